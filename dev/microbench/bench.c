@@ -0,0 +1,380 @@
+#include "bench.h"
+#include <util/nchan_rbtree.h>
+#include <util/nchan_reuse_queue.h>
+#include <util/nchan_bufchainpool.h>
+#include <util/nchan_slist.h>
+#include <util/nchan_list.h>
+#include <util/nchan_msg.h>
+#include <util/nchan_output.h>
+#include <store/redis/redis_nodeset.h>
+
+// Microbenchmarks for nchan's utility data structures. Each benchmark prints one line of JSON:
+//   {"benchmark": name, "size": n, "ops": n, "ns_per_op": n, "ops_per_sec": n, "allocs_per_op": n, "bytes_per_op": n}
+// "size" is the number of elements, or bytes, the benchmark works with.
+//
+// usage: nchan-bench [-n total_ops] [name filter]
+
+#define BENCH_DEFAULT_OPS 2000000
+#define BENCH_CHANNEL_ID_FMT "/bench/channel/%ui"
+
+static uint64_t          total_ops = BENCH_DEFAULT_OPS;
+static const char       *filter = NULL;
+static volatile uint64_t sink; //so results don't get optimized away
+
+static uint64_t now_nsec(void) {
+  struct timespec   ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t )ts.tv_sec * 1000000000 + (uint64_t )ts.tv_nsec;
+}
+
+int bench_wanted(const char *name) {
+  //either way around, so "rbtree" runs all the rbtree benchmarks, and "rbtree_find" runs the group that has it
+  return filter == NULL || ngx_strstr(name, filter) != NULL || ngx_strstr(filter, name) != NULL;
+}
+
+uint64_t bench_ops(void) {
+  return total_ops;
+}
+
+void bench_start(bench_t *b, const char *name, ngx_uint_t size) {
+  b->name = name;
+  b->size = size;
+  b->start_allocs = bench_allocs;
+  b->start_nsec = now_nsec();
+}
+
+void bench_finish(bench_t *b, uint64_t ops) {
+  uint64_t   nsec = now_nsec() - b->start_nsec;
+  uint64_t   allocs = bench_allocs.count - b->start_allocs.count;
+  uint64_t   bytes = bench_allocs.bytes - b->start_allocs.bytes;
+  if(ops == 0) {
+    ops = 1;
+  }
+  printf("{\"benchmark\": \"%s\", \"size\": %lu, \"ops\": %lu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, \"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f}\n",
+         b->name, (unsigned long )b->size, (unsigned long )ops, (double )nsec / ops, nsec > 0 ? ops * 1e9 / nsec : 0,
+         (double )allocs / ops, (double )bytes / ops);
+  fflush(stdout);
+}
+
+static uint64_t rounds_for(ngx_uint_t ops_per_round) {
+  uint64_t rounds = total_ops / (ops_per_round ? ops_per_round : 1);
+  return rounds > 0 ? rounds : 1;
+}
+
+//////// rbtree ////////
+
+typedef struct {
+  ngx_str_t        id;
+  u_char           idbuf[32];
+} bench_rbtree_data_t;
+
+static void *bench_rbtree_id(void *data) {
+  return &((bench_rbtree_data_t *)data)->id;
+}
+
+static void bench_rbtree(ngx_uint_t n) {
+  rbtree_seed_t         seed;
+  ngx_rbtree_node_t   **nodes;
+  bench_rbtree_data_t  *data;
+  ngx_str_t            *ids;
+  u_char              (*idbufs)[32];
+  ngx_uint_t            i;
+  uint64_t              r, rounds = rounds_for(n);
+  bench_t               b;
+
+  if(!bench_wanted("rbtree")) {
+    return;
+  }
+  nodes = malloc(sizeof(*nodes) * n);
+  ids = malloc(sizeof(*ids) * n);
+  idbufs = malloc(sizeof(*idbufs) * n);
+  for(i = 0; i < n; i++) {
+    ids[i].data = idbufs[i];
+    ids[i].len = ngx_sprintf(idbufs[i], BENCH_CHANNEL_ID_FMT, i) - idbufs[i];
+  }
+  rbtree_init(&seed, "bench", bench_rbtree_id, NULL, NULL);
+
+  bench_start(&b, "rbtree_insert", n);
+  for(r = 0; r < rounds; r++) {
+    for(i = 0; i < n; i++) {
+      nodes[i] = rbtree_create_node(&seed, sizeof(*data));
+      data = rbtree_data_from_node(nodes[i]);
+      ngx_memcpy(data->idbuf, ids[i].data, ids[i].len);
+      data->id.data = data->idbuf;
+      data->id.len = ids[i].len;
+      rbtree_insert_node(&seed, nodes[i]);
+    }
+    if(r + 1 < rounds) {
+      for(i = 0; i < n; i++) {
+        rbtree_remove_node(&seed, nodes[i]);
+        rbtree_destroy_node(&seed, nodes[i]);
+      }
+    }
+  }
+  bench_finish(&b, rounds * n);
+
+  bench_start(&b, "rbtree_find", n);
+  for(r = 0; r < rounds; r++) {
+    for(i = 0; i < n; i++) {
+      sink += (uintptr_t )rbtree_find_node(&seed, &ids[(i * 7919) % n]);
+    }
+  }
+  bench_finish(&b, rounds * n);
+
+  bench_start(&b, "rbtree_remove", n);
+  for(i = 0; i < n; i++) {
+    rbtree_remove_node(&seed, nodes[i]);
+    rbtree_destroy_node(&seed, nodes[i]);
+  }
+  bench_finish(&b, n);
+
+  free(nodes);
+  free(ids);
+  free(idbufs);
+}
+
+//////// reuse queue ////////
+
+typedef struct bench_queued_s bench_queued_t;
+struct bench_queued_s {
+  bench_queued_t   *prev;
+  bench_queued_t   *next;
+  u_char            data[48];
+};
+
+static void *bench_queued_alloc(void *pd) {
+  return ngx_alloc(sizeof(bench_queued_t), ngx_cycle->log);
+}
+
+static ngx_int_t bench_queued_free(void *pd, void *thing) {
+  ngx_free(thing);
+  return NGX_OK;
+}
+
+static void bench_reuse_queue(ngx_uint_t depth) {
+  nchan_reuse_queue_t   rq;
+  bench_queued_t       *q;
+  ngx_uint_t            i;
+  uint64_t              r, rounds = rounds_for(depth);
+  bench_t               b;
+
+  if(!bench_wanted("reuse_queue")) {
+    return;
+  }
+  nchan_reuse_queue_init(&rq, offsetof(bench_queued_t, prev), offsetof(bench_queued_t, next), bench_queued_alloc, bench_queued_free, NULL);
+  bench_start(&b, "reuse_queue_push_pop", depth);
+  for(r = 0; r < rounds; r++) {
+    for(i = 0; i < depth; i++) {
+      q = nchan_reuse_queue_push(&rq);
+      q->data[0] = (u_char )i;
+    }
+    for(i = 0; i < depth; i++) {
+      nchan_reuse_queue_pop(&rq);
+    }
+  }
+  bench_finish(&b, rounds * depth);
+  nchan_reuse_queue_shutdown(&rq);
+}
+
+//////// bufchain pool ////////
+
+static void bench_bufchainpool(ngx_uint_t bufs) {
+  nchan_bufchain_pool_t   bcp;
+  nchan_buf_and_chain_t  *bc;
+  ngx_pool_t             *pool;
+  ngx_uint_t              i;
+  uint64_t                r, rounds = rounds_for(bufs);
+  bench_t                 b;
+
+  if(!bench_wanted("bufchainpool")) {
+    return;
+  }
+  //a pool per response, like a request pool
+  bench_start(&b, "bufchainpool_reserve", bufs);
+  for(r = 0; r < rounds; r++) {
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    nchan_bufchain_pool_init(&bcp, pool);
+    for(i = 0; i < bufs; i++) {
+      bc = nchan_bufchain_pool_reserve(&bcp, 2);
+      sink += (uintptr_t )bc;
+      if(i % 8 == 7) {
+        nchan_bufchain_pool_flush(&bcp);
+      }
+    }
+    nchan_bufchain_pool_flush(&bcp);
+    ngx_destroy_pool(pool);
+  }
+  bench_finish(&b, rounds * bufs);
+}
+
+//////// slist and list ////////
+
+typedef struct bench_slist_el_s bench_slist_el_t;
+struct bench_slist_el_s {
+  bench_slist_el_t  *prev;
+  bench_slist_el_t  *next;
+  ngx_uint_t         n;
+};
+
+static void bench_slist(ngx_uint_t n) {
+  nchan_slist_t       list;
+  bench_slist_el_t   *els, *el;
+  ngx_uint_t          i;
+  uint64_t            r, rounds = rounds_for(n);
+  bench_t             b;
+
+  if(!bench_wanted("slist")) {
+    return;
+  }
+  els = malloc(sizeof(*els) * n);
+  nchan_slist_init(&list, bench_slist_el_t, prev, next);
+  bench_start(&b, "slist_append_shift", n);
+  for(r = 0; r < rounds; r++) {
+    for(i = 0; i < n; i++) {
+      els[i].n = i;
+      nchan_slist_append(&list, &els[i]);
+    }
+    while((el = nchan_slist_shift(&list)) != NULL) {
+      sink += el->n;
+    }
+  }
+  bench_finish(&b, rounds * n);
+
+  bench_start(&b, "slist_remove_middle", n);
+  for(r = 0; r < rounds; r++) {
+    for(i = 0; i < n; i++) {
+      nchan_slist_append(&list, &els[i]);
+    }
+    for(i = 0; i < n; i++) {
+      nchan_slist_remove(&list, &els[(i * 7919) % n]);
+    }
+  }
+  bench_finish(&b, rounds * n);
+  free(els);
+}
+
+static void bench_list_run(const char *name, ngx_uint_t n, size_t pool_sz) {
+  nchan_list_t        list;
+  ngx_uint_t          i, *data;
+  uint64_t            r, rounds = rounds_for(n);
+  bench_t             b;
+
+  bench_start(&b, name, n);
+  for(r = 0; r < rounds; r++) {
+    nchan_list_pool_init(&list, sizeof(ngx_uint_t) * 4, pool_sz, "bench");
+    for(i = 0; i < n; i++) {
+      data = nchan_list_append(&list);
+      *data = i;
+    }
+    while((data = nchan_list_first(&list)) != NULL) {
+      sink += *data;
+      nchan_list_remove(&list, data);
+    }
+    nchan_list_empty(&list);
+  }
+  bench_finish(&b, rounds * n);
+}
+
+static void bench_list(ngx_uint_t n) {
+  if(!bench_wanted("list_")) {
+    return;
+  }
+  bench_list_run("list_append_remove", n, 0);
+  bench_list_run("list_append_remove_pooled", n, 4096);
+}
+
+//////// message ids ////////
+
+static void bench_msgid(void) {
+  nchan_msg_id_t      id;
+  ngx_str_t           single = ngx_string("1507925523:12");
+  ngx_str_t           multi = ngx_string("1507925523:[0],3,-,12");
+  char                buf[NCHAN_MULTITAG_MAX * 8];
+  uint64_t            i, ops = total_ops;
+  bench_t             b;
+
+  if(!bench_wanted("msgid")) {
+    return;
+  }
+  bench_start(&b, "msgid_parse_single", single.len);
+  for(i = 0; i < ops; i++) {
+    sink += nchan_parse_compound_msgid(&id, &single, 1);
+  }
+  bench_finish(&b, ops);
+
+  bench_start(&b, "msgid_parse_multi", multi.len);
+  for(i = 0; i < ops; i++) {
+    sink += nchan_parse_compound_msgid(&id, &multi, 4);
+  }
+  bench_finish(&b, ops);
+
+  nchan_parse_compound_msgid(&id, &single, 1);
+  bench_start(&b, "msgtag_to_str_single", 1);
+  for(i = 0; i < ops; i++) {
+    sink += msgtag_to_strptr(&id, buf);
+  }
+  bench_finish(&b, ops);
+
+  nchan_parse_compound_msgid(&id, &multi, 4);
+  bench_start(&b, "msgtag_to_str_multi", 4);
+  for(i = 0; i < ops; i++) {
+    sink += msgtag_to_strptr(&id, buf);
+  }
+  bench_finish(&b, ops);
+}
+
+//////// redis cluster hash slots ////////
+
+static void bench_redis_crc16(ngx_uint_t n) {
+  u_char             (*idbufs)[32];
+  size_t              *lens;
+  ngx_uint_t           i;
+  uint64_t             r, rounds = rounds_for(n);
+  bench_t              b;
+
+  if(!bench_wanted("redis_crc16")) {
+    return;
+  }
+  idbufs = malloc(sizeof(*idbufs) * n);
+  lens = malloc(sizeof(*lens) * n);
+  for(i = 0; i < n; i++) {
+    lens[i] = ngx_sprintf(idbufs[i], BENCH_CHANNEL_ID_FMT, i) - idbufs[i];
+  }
+  bench_start(&b, "redis_crc16_channel_id", sizeof(*idbufs));
+  for(r = 0; r < rounds; r++) {
+    for(i = 0; i < n; i++) {
+      sink += redis_crc16(0, (const char *)idbufs[i], lens[i]);
+    }
+  }
+  bench_finish(&b, rounds * n);
+  free(idbufs);
+  free(lens);
+}
+
+int main(int argc, char **argv) {
+  int     i;
+
+  for(i = 1; i < argc; i++) {
+    if(ngx_strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      total_ops = strtoull(argv[++i], NULL, 10);
+    }
+    else {
+      filter = argv[i];
+    }
+  }
+
+  bench_stub_init();
+
+  bench_rbtree(1000);
+  bench_rbtree(100000);
+  bench_reuse_queue(64);
+  bench_reuse_queue(4096);
+  bench_bufchainpool(32);
+  bench_slist(1000);
+  bench_list(100);
+  bench_msgid();
+  bench_redis_crc16(1000);
+  bench_websocket();
+
+  return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef NCHAN_MICROBENCH_H
+#define NCHAN_MICROBENCH_H
+
+#include <nchan_module.h>
+
+typedef struct {
+  uint64_t              count;
+  uint64_t              bytes;
+} bench_allocs_t;
+
+//counted by the stubbed ngx_alloc, ngx_calloc and ngx_memalign
+extern bench_allocs_t   bench_allocs;
+
+typedef struct {
+  const char           *name;
+  ngx_uint_t            size;
+  uint64_t              start_nsec;
+  bench_allocs_t        start_allocs;
+} bench_t;
+
+void bench_stub_init(void);
+
+//skip benchmarks not matching the filter given on the command line
+int bench_wanted(const char *name);
+
+//total operations each benchmark should run for, at least
+uint64_t bench_ops(void);
+
+void bench_start(bench_t *b, const char *name, ngx_uint_t size);
+void bench_finish(bench_t *b, uint64_t ops);
+
+//defined in bench_websocket.c, where websocket.c's static functions are visible
+void bench_websocket(void);
+
+#endif //NCHAN_MICROBENCH_H
@@ -0,0 +1,71 @@
+#include "bench.h"
+
+// websocket_unmask_frame() and is_utf8() are static, so websocket.c is compiled right in here.
+// Whatever else it references is never called, and gets dropped by the linker.
+#include <subscribers/websocket.c>
+
+static void bench_unmask(ngx_uint_t size) {
+  ws_frame_t    frame;
+  u_char       *payload;
+  uint64_t      i, ops = bench_ops() / (size / 64 + 1) + 1;
+  bench_t       b;
+
+  ngx_memzero(&frame, sizeof(frame));
+  payload = malloc(size);
+  ngx_memset(payload, 'x', size);
+  frame.mask_key[0] = 0x12;
+  frame.mask_key[1] = 0x34;
+  frame.mask_key[2] = 0x56;
+  frame.mask_key[3] = 0x78;
+  frame.payload_len = size;
+
+  bench_start(&b, "websocket_unmask", size);
+  for(i = 0; i < ops; i++) {
+    //unaligned half the time, like a payload after a variable-length frame header
+    frame.payload = payload + (i & 1);
+    frame.payload_len = size - (i & 1);
+    websocket_unmask_frame(&frame);
+  }
+  bench_finish(&b, ops);
+  free(payload);
+}
+
+static void bench_utf8(const char *name, const char *fill, ngx_uint_t size) {
+  ngx_buf_t     buf;
+  u_char       *data, *cur;
+  size_t        fill_len = ngx_strlen(fill);
+  uint64_t      i, ops = bench_ops() / (size / 64 + 1) + 1;
+  ngx_flag_t    valid = 1;
+  bench_t       b;
+
+  data = malloc(size);
+  for(cur = data; cur + fill_len <= data + size; cur += fill_len) {
+    ngx_memcpy(cur, fill, fill_len);
+  }
+  ngx_memzero(&buf, sizeof(buf));
+  buf.start = buf.pos = data;
+  buf.end = buf.last = cur;
+  buf.memory = 1;
+
+  bench_start(&b, name, cur - data);
+  for(i = 0; i < ops; i++) {
+    valid &= is_utf8(&buf);
+  }
+  bench_finish(&b, ops);
+  if(!valid) {
+    fprintf(stderr, "%s: buffer wasn't valid UTF-8\n", name);
+  }
+  free(data);
+}
+
+void bench_websocket(void) {
+  if(bench_wanted("websocket_unmask")) {
+    bench_unmask(125);
+    bench_unmask(4096);
+    bench_unmask(65536);
+  }
+  if(bench_wanted("websocket_utf8")) {
+    bench_utf8("websocket_utf8_ascii", "hello world, ", 4096);
+    bench_utf8("websocket_utf8_multibyte", "h\xc3\xa9llo w\xc3\xb6rld \xe2\x82\xac\xf0\x9f\x98\x80 ", 4096);
+  }
+}
@@ -0,0 +1,73 @@
+#include "bench.h"
+#include <util/nchan_thingcache.h>
+
+// Just enough of the nginx runtime for nchan's utility code, with ngx_alloc and friends counting allocations.
+// These stand in for objs/src/os/unix/ngx_alloc.o, ngx_log.o and ngx_cycle.o, which aren't linked.
+
+ngx_uint_t              ngx_pagesize;
+ngx_uint_t              ngx_pagesize_shift;
+ngx_uint_t              ngx_cacheline_size;
+
+static ngx_log_t        bench_log;
+static ngx_cycle_t      bench_cycle;
+volatile ngx_cycle_t   *ngx_cycle = &bench_cycle;
+
+bench_allocs_t          bench_allocs;
+
+void *ngx_alloc(size_t size, ngx_log_t *log) {
+  bench_allocs.count++;
+  bench_allocs.bytes += size;
+  return malloc(size);
+}
+
+void *ngx_calloc(size_t size, ngx_log_t *log) {
+  bench_allocs.count++;
+  bench_allocs.bytes += size;
+  return calloc(1, size);
+}
+
+#if (NGX_HAVE_POSIX_MEMALIGN)
+void *ngx_memalign(size_t alignment, size_t size, ngx_log_t *log) {
+  void  *p;
+  bench_allocs.count++;
+  bench_allocs.bytes += size;
+  return posix_memalign(&p, alignment, size) == 0 ? p : NULL;
+}
+#elif (NGX_HAVE_MEMALIGN)
+void *ngx_memalign(size_t alignment, size_t size, ngx_log_t *log) {
+  bench_allocs.count++;
+  bench_allocs.bytes += size;
+  return memalign(alignment, size);
+}
+#endif
+
+//the benchmarks shouldn't be logging anything, and timing it if they did would be pointless
+#if (NGX_HAVE_VARIADIC_MACROS)
+void ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err, const char *fmt, ...) {
+}
+#else
+void ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err, const char *fmt, va_list args) {
+}
+
+void ngx_cdecl ngx_log_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err, const char *fmt, ...) {
+}
+
+void ngx_cdecl ngx_log_debug_core(ngx_log_t *log, ngx_err_t err, const char *fmt, ...) {
+}
+#endif
+
+//is_utf8() reaches this through nchan_fdcache_get() for file-backed buffers, which the benchmarks don't use
+void *nchan_thingcache_get(void *tcv, ngx_str_t *id) {
+  return (void *)(uintptr_t )NGX_INVALID_FILE;
+}
+
+void bench_stub_init(void) {
+  ngx_uint_t  n;
+
+  ngx_pagesize = getpagesize();
+  for(n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+  ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+  bench_log.log_level = NGX_LOG_EMERG;
+  bench_cycle.log = &bench_log;
+}
@@ -47,6 +47,7 @@ popd > /dev/null
 _dynamic_module="$_pkgdir/etc/nginx/modules/ngx_nchan_module.so"
 
 _cacheconf="  proxy_cache_path _CACHEDIR_ levels=1:2 keys_zone=cache:1m; \\n  server {\\n       listen 8007;\\n       location / { \\n          proxy_cache cache; \\n      }\\n  }\\n"
+_simulationconf="    location /simulation {\\n      nchan_simulation simulation/fanout.sim;\\n    }\\n"
 
 NGINX_CONF_FILE="nginx.conf"
 
@@ -92,6 +93,8 @@ for opt in $*; do
       alleyoop=1;;
     cache)
       CACHE=1;;
+    simulation)
+      SIMULATION=1;;
     access)
       ACCESS_LOG="/dev/stdout";;
     worker|one|single) 
@@ -192,6 +195,9 @@ if [[ ! -z $CACHE ]]; then
   mkdir $tmpdir 2>/dev/null
   _sed_i_conf "s|_CACHEDIR_|\"$tmpdir\"|g"
 fi
+if [[ ! -z $SIMULATION ]]; then
+  _sed_i_conf "s|^ *#simulationtag.*|${_simulationconf}|g"
+fi
 
 if (_semver_gteq $NGINX_VER 1.9.5); then
   #do nothing, http2 is on by default
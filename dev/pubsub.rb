@@ -640,11 +640,11 @@ class Subscriber
       end
     end
     
-    def on_ping
-      @on_ping = Proc.new if block_given?
+    def on_ping(&block)
+      @on_ping = block if block_given?
     end
-    def on_pong
-      @on_pong = Proc.new if block_given?
+    def on_pong(&block)
+      @on_pong = block if block_given?
     end
     
     def listen(bundle)
@@ -57,6 +57,8 @@ for opt in $*; do
       export NO_MAKE=1;;
     nodebug)
       export NO_DEBUG=1;;
+    fakeshard)
+      export FAKESHARD=1;;
     echo_module)
       export WITH_NGX_ECHO_MODULE=1;;
     O0)
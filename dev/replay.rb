@@ -0,0 +1,159 @@
+#!/usr/bin/env ruby
+require 'rubygems'
+require "optparse"
+
+# reads nchan_trace files (src/util/nchan_trace.h) to summarize them, or to replay the traffic against a server
+
+HEADER_FORMAT = "a8 L< L< Q< Q< Q< l< L<"
+HEADER_SIZE = 64
+RECORD_FORMAT = "Q< L< L< q< s< C C S< S< a32"
+RECORD_SIZE = 64
+
+EVENTS = {1 => :publish, 2 => :subscribe, 3 => :reconnect, 4 => :unsubscribe}
+SUBSCRIBER_TYPES = [:longpoll, :chunked, :multipart, :rawstream, :intervalpoll, :eventsource, :websocket, :internal]
+#the pubsub.rb client for each subscriber type. there's none for http-raw-stream
+CLIENTS = {longpoll: :longpoll, chunked: :chunked, multipart: :multipart, intervalpoll: :intervalpoll, eventsource: :eventsource, websocket: :websocket}
+
+server = "localhost:8082"
+pub_prefix = "/pub/"
+sub_prefix = "/sub/"
+scale = 1.0
+summary = false
+top = 10
+verbose = false
+
+opt_parser=OptionParser.new do |opts|
+  opts.on("-s", "--server SERVER (#{server})", "server and port."){|v| server=v}
+  opts.on("--pub PREFIX (#{pub_prefix})", "publisher path, followed by the channel id"){|v| pub_prefix=v}
+  opts.on("--sub PREFIX (#{sub_prefix})", "subscriber path, followed by the channel id"){|v| sub_prefix=v}
+  opts.on("--scale NUM (#{scale})", "replay this many times faster"){|v| scale = Float(v)}
+  opts.on("--summary", "print a summary of the traces instead of replaying them"){summary = true}
+  opts.on("--top NUM (#{top})", "channels to list in the summary"){|v| top = v.to_i}
+  opts.on("-v", "--verbose", "print every replayed event"){verbose = true}
+end
+opt_parser.banner="Usage: replay.rb [options] tracefile..."
+opt_parser.parse!
+
+if ARGV.empty?
+  puts opt_parser
+  exit 1
+end
+
+def read_trace(path)
+  data = File.binread path
+  magic, version, record_size, capacity, written, start_usec, pid, worker = data[0, HEADER_SIZE].unpack HEADER_FORMAT
+  raise "#{path} is not an nchan trace" unless magic == "NCHANTRC"
+  raise "#{path} is trace version #{version}, expected 1" unless version == 1 && record_size == RECORD_SIZE
+
+  #the file is a ring. once it wraps around, the oldest record is the one after the newest
+  if written > capacity
+    slots = (0...capacity).map { |i| (written + i) % capacity }
+  else
+    slots = (0...written).to_a
+  end
+  events = slots.map do |slot|
+    time, hash, size, msgid_time, msgid_tag, event, subtype, id_len, _, content_type = data[HEADER_SIZE + slot * RECORD_SIZE, RECORD_SIZE].unpack RECORD_FORMAT
+    {
+      time: time,
+      event: EVENTS[event],
+      channel: "trace-%08x" % hash,
+      channel_id_length: id_len,
+      size: size,
+      content_type: content_type.delete("\0"),
+      subscriber_type: SUBSCRIBER_TYPES[subtype],
+      msgid: msgid_time > 0 ? "#{msgid_time}:#{msgid_tag}" : nil,
+      worker: worker
+    }
+  end
+  lost = written > capacity ? written - capacity : 0
+  STDERR.puts "#{path}: worker #{worker} (pid #{pid}), #{events.count} events#{lost > 0 ? ", #{lost} oldest overwritten" : ""}"
+  events
+end
+
+events = ARGV.map { |path| read_trace path }.flatten.sort_by { |e| e[:time] }
+if events.empty?
+  puts "no events"
+  exit
+end
+
+if summary
+  duration = (events.last[:time] - events.first[:time]) / 1000000.0
+  puts "#{events.count} events over #{duration.round(3)} sec"
+  EVENTS.values.each do |ev|
+    n = events.count { |e| e[:event] == ev }
+    rate = duration > 0 ? " (#{(n / duration).round(2)}/sec)" : ""
+    puts "  #{ev}: #{n}#{rate}"
+  end
+
+  subs = events.select { |e| e[:event] == :subscribe || e[:event] == :reconnect }
+  unless subs.empty?
+    puts "subscriber types:"
+    subs.group_by { |e| e[:subscriber_type] }.sort_by { |_, v| -v.count }.each { |t, v| puts "  #{t}: #{v.count}" }
+  end
+
+  pubs = events.select { |e| e[:event] == :publish }
+  unless pubs.empty?
+    sizes = pubs.map { |e| e[:size] }.sort
+    puts "message size: min #{sizes.first}, avg #{sizes.sum / sizes.count}, p50 #{sizes[sizes.count / 2]}, p99 #{sizes[(sizes.count * 0.99).floor]}, max #{sizes.last}"
+    puts "content types:"
+    pubs.group_by { |e| e[:content_type] }.sort_by { |_, v| -v.count }.each { |t, v| puts "  #{t.empty? ? "(none)" : t}: #{v.count}" }
+  end
+
+  puts "channels: #{events.map { |e| e[:channel] }.uniq.count}"
+  puts "busiest channels:"
+  events.group_by { |e| e[:channel] }.sort_by { |_, v| -v.count }.first(top).each do |ch, v|
+    puts "  #{ch}: #{v.count { |e| e[:event] == :publish }} published, #{v.count { |e| e[:event] == :subscribe || e[:event] == :reconnect }} subscribed"
+  end
+  exit
+end
+
+require 'bundler/setup'
+require_relative 'pubsub.rb'
+
+publishers = {}
+subscribers = Hash.new { |h, k| h[k] = [] }
+skipped = 0
+late = 0
+first = events.first[:time]
+started = Time.now
+
+puts "Replaying #{events.count} events to #{server} at #{scale}x."
+
+begin
+  events.each do |e|
+    wait = started + (e[:time] - first) / 1000000.0 / scale - Time.now
+    if wait > 0
+      sleep wait
+    elsif wait < -0.1
+      late += 1
+    end
+    puts "#{e[:event]} #{e[:channel]} #{e[:subscriber_type] || e[:size]}" if verbose
+
+    case e[:event]
+    when :publish
+      pub = publishers[e[:channel]] ||= Publisher.new("http://#{server}#{pub_prefix}#{e[:channel]}", nostore: true, timeout: 10)
+      pub.nofail = true
+      pub.post "x" * e[:size], e[:content_type].empty? ? nil : e[:content_type]
+    when :subscribe, :reconnect
+      #message ids from the traced server mean nothing to this one, so reconnects start at the newest message too
+      client = CLIENTS[e[:subscriber_type]]
+      if client.nil?
+        skipped += 1
+        next
+      end
+      sub = Subscriber.new "http://#{server}#{sub_prefix}#{e[:channel]}", 1, client: client, timeout: 100000, nostore: true
+      sub.on_failure { false }
+      sub.run
+      subscribers[e[:channel]] << sub
+    when :unsubscribe
+      sub = subscribers[e[:channel]].shift
+      sub.terminate if sub
+    end
+  end
+rescue Interrupt => e
+  #stop replaying
+end
+
+subscribers.each_value { |subs| subs.each(&:terminate) }
+puts "Replayed #{events.count - skipped} events in #{(Time.now - started).round(3)} sec#{skipped > 0 ? ", skipped #{skipped} with no client to replay them" : ""}."
+puts "#{late} events were replayed more than 100ms late." if late > 0
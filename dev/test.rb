@@ -17,6 +17,8 @@ $default_client=:longpoll
 $omit_longmsg=false
 $verbose=false
 $ordered_tests = false
+$redis_port = 8537
+$redis_replica = nil
 
 extra_opts = []
 orig_args = ARGV.dup
@@ -34,6 +36,8 @@ opt=OptionParser.new do |opts|
     raise OptionParser::InvalidOption , "--help"
   end
   opts.on("--ordered", "order tests alphabetically"){$ordered_tests = true}
+  opts.on("--redis PORT (#{$redis_port})", "port of the Redis server the redis tests use"){|v| $redis_port = v.to_i}
+  opts.on("--redis-replica PORT", "port of a local replica of the Redis server, for replication lag tests"){|v| $redis_replica = v.to_i}
 end
 
 begin
@@ -882,6 +886,266 @@ class PubSubTest <  Minitest::Test
     end
   end
   
+  def test_redis_location_relay
+    # with nchan_use_redis and nchan_redis_connection_workers uncommented in nginx.conf, the workers not connected 
+    # to Redis relay publishing, channel info and subscriber counts to the channel owner over IPC.
+    subs=30
+    pub, sub = pubsub(subs, pub: "pubredis/", sub: "subredis/", client: :eventsource, timeout: 10)
+    sub.run
+    sub.wait :ready
+    sleep 0.5
+    
+    pub.get "text/json"
+    assert_equal 200, pub.response_code
+    assert_channel_info_ok pub.channel_info, subscribers: subs
+    
+    10.times { |i| pub.post "relayed #{i}" }
+    pub.post "FIN"
+    sub.wait
+    verify pub, sub
+    
+    pub.get "text/json"
+    assert_channel_info_ok pub.channel_info, messages_min: 1
+    sub.terminate
+  end
+  
+  def redis_catch_up(pub, chan, n=4)
+    sub = Subscriber.new(url("subredis/#{chan}"), n, quit_message: pub.messages.messages.last, timeout: 10)
+    sub.run
+    sub.wait
+    verify pub, sub
+    sub.terminate
+  end
+  
+  def test_redis_message_cache
+    # with nchan_use_redis and nchan_redis_message_cache_size uncommented in nginx.conf, messages fetched from Redis
+    # are cached in shared memory. Cached or not, subscribers catching up must get the same messages.
+    chan = short_id
+    pub = Publisher.new url("pubredis/#{chan}")
+    5.times { |i| pub.post "cache me #{i}" }
+    pub.post "FIN"
+    
+    redis_catch_up pub, chan
+    first = stub_status_json["redis_message_cache"]
+    redis_catch_up pub, chan
+    second = stub_status_json["redis_message_cache"]
+    if first
+      assert second["entries"] > 0, "catching up should have cached the messages"
+      assert second["hits"] > first["hits"], "catching up again should be answered from the cache"
+    end
+    
+    #deleting the channel forgets its messages
+    pub.delete
+    assert_equal 200, pub.response_code
+    pub = Publisher.new url("pubredis/#{chan}")
+    pub.post ["after delete", "FIN"]
+    redis_catch_up pub, chan
+    deleted = stub_status_json["redis_message_cache"]
+    if first
+      #at least 5 of the old messages were cached, and at most 2 new ones can be
+      assert deleted["entries"] <= second["entries"] - 3, "the deleted channel's messages should be gone from the cache"
+    end
+    
+    #reloaded workers have a new generation, and don't use what the old ones cached
+    Process.kill "HUP", File.read("/tmp/nchan-test-nginx.pid").to_i
+    sleep 1.5
+    before_reload = stub_status_json["redis_message_cache"]
+    redis_catch_up pub, chan
+    after_reload = stub_status_json["redis_message_cache"]
+    if first
+      assert after_reload["misses"] > before_reload["misses"], "messages cached before the reload should not be used"
+    end
+  end
+  
+  def redis_cli(port, *args)
+    out = IO.popen(["redis-cli", "-p", port.to_s, *args], err: File::NULL, &:read)
+    $?.success? ? out : nil
+  rescue Errno::ENOENT
+    nil
+  end
+  
+  def test_redis_sharded_pubsub
+    # with nchan_redis_pass redis_server and nchan_redis_sharded_pubsub uncommented in nginx.conf, channels are
+    # subscribed to with SSUBSCRIBE on the node that owns their keyslot, and messages are sent with SPUBLISH.
+    chans = 5.times.map { short_id }
+    pubs = chans.map { |chan| Publisher.new url("pubredis/#{chan}") }
+    subs = chans.map { |chan| Subscriber.new url("subredis/#{chan}"), 3, quit_message: "FIN", client: :eventsource, timeout: 10 }
+    subs.each &:run
+    subs.each { |sub| sub.wait :ready }
+    sleep 0.5
+    
+    shard_channels = redis_cli $redis_port, "PUBSUB", "SHARDCHANNELS", "*#{chans.first}*"
+    if shard_channels && !shard_channels.strip.empty?
+      assert_match(/\{channel:[^}]*#{chans.first}\}:pubsub/, shard_channels)
+      assert_equal "", redis_cli($redis_port, "PUBSUB", "CHANNELS", "*#{chans.first}*").to_s.strip, "a sharded channel shouldn't also have a classic subscription"
+    end
+    
+    pubs.each { |pub| pub.post ["sharded 1", "sharded 2", "FIN"] }
+    subs.each &:wait
+    pubs.zip(subs).each do |pub, sub|
+      verify pub, sub
+      sub.terminate
+    end
+  end
+  
+  def test_redis_stream_storage
+    # with nchan_redis_pass redis_server and nchan_redis_stream_storage uncommented in nginx.conf, a channel's messages
+    # are kept in one stream, trimmed to the message buffer length, and caught up on with XRANGE.
+    chan = short_id
+    pub = Publisher.new url("pubredis/#{chan}")
+    14.times { |i| pub.post "streamed #{i}" }
+    pub.post "FIN"
+    
+    stream = redis_cli($redis_port, "--scan", "--pattern", "*{channel:*#{chan}}:stream").to_s.lines.first
+    if stream
+      stream.strip!
+      assert_equal "stream", redis_cli($redis_port, "TYPE", stream).strip
+      assert_equal 10, redis_cli($redis_port, "XLEN", stream).to_i, "the stream should be trimmed to the default nchan_message_buffer_length"
+    end
+    
+    #only the newest 10 messages are left to catch up on, in order
+    pub.messages.remove_old 5
+    sub = Subscriber.new url("subredis/#{chan}"), 2, quit_message: "FIN", timeout: 10
+    sub.run
+    sub.wait
+    verify pub, sub
+    sub.terminate
+    
+    #and catching up from the middle of the stream
+    mid = pub.messages[4].id
+    pub.messages.remove_old 5
+    sub = Subscriber.new url("subredis/#{chan}?last_event_id=#{mid}"), 2, quit_message: "FIN", timeout: 10
+    sub.run
+    sub.wait
+    verify pub, sub
+    sub.terminate
+  end
+  
+  def test_redis_large_pubsub_messages
+    # PUBSUB messages of at least 1K are decoded from Redis straight into shared memory. Messages on both sides of
+    # that size, and much bigger ones, must reach subscribers in every worker whole and with their content types.
+    chan = short_id
+    pub = Publisher.new url("pubredis/#{chan}")
+    sub = Subscriber.new url("subredis/#{chan}"), 20, quit_message: "FIN", client: :longpoll, timeout: 20
+    sub.run
+    sub.wait :ready
+    sleep 0.5
+    [1000, 1023, 1024, 1025, 65536, 1024 * 1024].each do |size|
+      pub.post "#{"q" * (size - 3)}end", "application/x-size-#{size}"
+    end
+    pub.post "FIN"
+    sub.wait
+    verify pub, sub, content_type: true
+    sub.terminate
+    
+    #the stored copies are still whole once the PUBSUB replies are gone
+    sub = Subscriber.new url("subredis/#{chan}"), 2, quit_message: "FIN", timeout: 20
+    sub.run
+    sub.wait
+    verify pub, sub
+    sub.terminate
+  end
+  
+  def test_redis_batched_subscriber_counts
+    # memstore+redis channels send their subscriber count changes and keepalives to Redis in batches per node.
+    # Each channel's count must still add up, and come back down when its subscribers leave.
+    chans = 6.times.map { short_id }
+    pubs = chans.map { |chan| Publisher.new url("pubredis/#{chan}") }
+    subs = chans.each_with_index.map { |chan, i| Subscriber.new url("subredis/#{chan}"), i + 1, client: :eventsource, timeout: 20 }
+    pubs.each { |pub| pub.post "hello" }
+    subs.each &:run
+    subs.each { |sub| sub.wait :ready }
+    sleep 1
+    
+    pubs.each_with_index do |pub, i|
+      pub.get "text/json"
+      assert_equal 200, pub.response_code
+      assert_channel_info_ok pub.channel_info, subscribers: i + 1
+      key = redis_cli($redis_port, "--scan", "--pattern", "*{channel:*#{chans[i]}}").to_s.lines.first
+      if key
+        assert redis_cli($redis_port, "TTL", key.strip).to_i > 0, "a channel with subscribers should expire in Redis only after a while"
+      end
+    end
+    
+    subs.each &:terminate
+    sleep 1
+    pubs.each do |pub|
+      pub.get "text/json"
+      assert_channel_info_ok pub.channel_info, subscribers: 0
+    end
+  end
+  
+  def test_redis_reconnect_catch_up
+    # after a Redis node reconnects, its channels are resubscribed in bulk and catch up on what they missed.
+    # Subscribers must not lose or repeat messages.
+    return unless redis_cli $redis_port, "PING"
+    chans = 10.times.map { short_id }
+    pubs = chans.map { |chan| Publisher.new url("pubredis/#{chan}") }
+    subs = chans.map { |chan| Subscriber.new url("subredis/#{chan}"), 2, quit_message: "FIN", client: :eventsource, timeout: 30 }
+    subs.each &:run
+    subs.each { |sub| sub.wait :ready }
+    sleep 0.5
+    pubs.each { |pub| pub.post "before the reconnect" }
+    
+    assert redis_cli($redis_port, "CLIENT", "KILL", "TYPE", "pubsub"), "couldn't disconnect the PUBSUB connections"
+    
+    #publishing fails until Redis is reconnected
+    pubs.each do |pub|
+      pub.nofail = true
+      ["after the reconnect", "FIN"].each do |msg|
+        20.times do
+          pub.post msg
+          break if pub.response_code == 201 || pub.response_code == 202
+          sleep 0.25
+        end
+      end
+    end
+    
+    subs.each &:wait
+    pubs.zip(subs).each do |pub, sub|
+      verify pub, sub
+      sub.terminate
+    end
+  end
+  
+  def test_redis_lagging_replica
+    # with Redis enabled as for the other redis tests, and --redis-replica given, subscribers catching up on messages
+    # the replica doesn't have yet must get them from the master rather than wait for the replica.
+    return unless $redis_replica
+    chan = short_id
+    pub = Publisher.new url("pubredis/#{chan}")
+    pub.post "before the replica falls behind"
+    sleep 0.5
+    #pausing writes on the replica holds back the replication stream, but it still answers reads
+    assert redis_cli($redis_replica, "CLIENT", "PAUSE", "4000", "WRITE"), "couldn't pause the replica"
+    begin
+      4.times { |i| pub.post "replica is behind #{i}" }
+      pub.post "FIN"
+      start = Time.now
+      redis_catch_up pub, chan
+      assert Time.now - start < 3, "catching up shouldn't have waited for the replica"
+    ensure
+      redis_cli $redis_replica, "CLIENT", "UNPAUSE"
+    end
+  end
+  
+  def test_publish_multi_then_subscribe
+    #a multi-channel message is stored once, and each channel gets a header pointing to it. each copy must come back whole.
+    chans= [short_id, short_id, short_id]
+    pub = Publisher.new url("pub_multi/#{chans.join '/'}")
+    pub.post ["hey", "#{"q"*2000}end", "and a third", "FIN"]
+    
+    chans.each do |id|
+      [:longpoll, :eventsource, :websocket].each do |client|
+        sub = Subscriber.new url("sub/broadcast/#{id}"), 1, client: client, quit_message: 'FIN', timeout: 5
+        sub.run
+        sub.wait
+        verify pub, sub
+        sub.terminate
+      end
+    end
+  end
+  
     def test_delete_multi
     chans= [short_id, short_id, short_id]
     keeper = short_id
@@ -921,6 +1185,27 @@ class PubSubTest <  Minitest::Test
     sub_keep.terminate
   end
   
+  def test_channel_events_summary
+    chan = short_id
+    sub = Subscriber.new(url("sub/events/summary/#{chan}"), 1, client: :eventsource, timeout: 10)
+    sub.on_failure { false }
+    sub.run
+    sleep 0.5
+    pub = Publisher.new url("pub/events_summary/#{chan}")
+    5.times { |i| pub.post "message #{i}" }
+    sleep 2.5 #at least one full aggregation interval
+    
+    published = 0
+    sub.messages.each do |msg|
+      assert_match(/^channel_summary \S+ subscriber_enqueue=\d+ subscriber_dequeue=\d+ channel_publish=\d+ channel_delete=\d+$/, msg.message)
+      published += msg.message[/channel_publish=(\d+)/, 1].to_i
+    end
+    #each worker publishes its own summary, but every publish is counted once
+    assert sub.messages.count >= 1, "expected at least one channel_summary"
+    assert_equal 5, published
+    sub.terminate
+  end
+  
   def test_subscriber_timeout
     chan=SecureRandom.hex
     sub=Subscriber.new(url("sub/timeout/#{chan}"), 5, timeout: 10)
@@ -935,6 +1220,39 @@ class PubSubTest <  Minitest::Test
     sub.terminate
   end
   
+  def test_subscriber_timeout_timing
+    chan = short_id
+    sub = Subscriber.new(url("sub/timeout/#{chan}"), 3, client: :longpoll, timeout: 10)
+    timed_out = []
+    sub.on_failure { timed_out << Time.now; false }
+    start = Time.now
+    sub.run
+    sub.wait
+    assert sub.match_errors(/code 408/)
+    assert timed_out.length > 0
+    timed_out.each do |t|
+      #nchan_subscriber_timeout is 2s here, and timeouts are kept on a timer wheel that may fire up to a second late
+      assert (1.9..3.5).cover?(t - start), "subscriber timed out after #{t - start}s, expected 2-3s"
+    end
+    sub.terminate
+  end
+  
+  def test_websocket_ping_interval
+    chan = short_id
+    sub = Subscriber.new(url("sub/websocket_only/#{chan}"), 1, client: :websocket, timeout: 20)
+    pings = []
+    sub.client.on_ping { pings << Time.now }
+    start = Time.now
+    sub.run
+    sleep 11.5
+    sub.terminate
+    
+    #nchan_websocket_ping_interval is 5s here, and pings are on a timer wheel that may fire up to a second late
+    assert pings.length >= 2, "expected at least 2 pings in 11.5s, got #{pings.length}"
+    assert (4.5..6.5).cover?(pings[0] - start), "first ping after #{pings[0] - start}s, expected 5-6s"
+    assert (4..6.5).cover?(pings[1] - pings[0]), "pings #{pings[1] - pings[0]}s apart, expected about 5s"
+  end
+  
   def assert_header_includes(description, response, header, str)
     assert response.headers[header].include?(str), "#{description} response header '#{header}: #{response.headers[header]}' must contain \"#{str}\", but does not."
   end
@@ -991,6 +1309,283 @@ class PubSubTest <  Minitest::Test
     assert_header_absent "publisher GET", resp, "Access-Control-Allow-Credentials"
   end
   
+  def test_stub_status_formats
+    pub = Publisher.new url("pub/#{short_id}")
+    pub.post "hello"
+    
+    resp = Typhoeus::Request.new(url("nchan_stub_status/json")).run
+    assert_equal 200, resp.code
+    status = JSON.parse resp.body
+    assert status["published_messages"] >= 1
+    %w( workers groups shared_memory_pages hot_channels stalls ).each {|k| assert status.has_key?(k), "json stub_status must have \"#{k}\""}
+    
+    resp = Typhoeus::Request.new(url("metrics")).run
+    assert_equal 200, resp.code
+    assert resp.headers["Content-Type"].start_with?("application/openmetrics-text")
+    assert resp.body.end_with?("# EOF\n"), "OpenMetrics exposition must end with '# EOF'"
+    assert_equal 1, resp.body.scan(/^# EOF$/).length
+    assert_match(/^# TYPE nchan_build info$/, resp.body)
+    assert_match(/^nchan_build_info\{version="[^"]+"\} 1$/, resp.body)
+    
+    resp = Typhoeus::Request.new(url("metrics"), method: :HEAD).run
+    assert_equal 200, resp.code
+    assert resp.body.empty?
+  end
+  
+  def stub_status_json
+    resp = Typhoeus::Request.new(url("nchan_stub_status/json")).run
+    assert_equal 200, resp.code
+    JSON.parse resp.body
+  end
+  
+  def test_latency_histograms
+    #nchan_latency_sampling is 1 by default, so every message gets measured
+    before = stub_status_json["latency"]
+    pub, sub = pubsub 5, timeout: 10
+    sub.run
+    sub.wait :ready
+    10.times { |i| pub.post "how long did this take #{i}" }
+    pub.post "FIN"
+    sub.wait
+    verify pub, sub
+    sub.terminate
+    
+    after = stub_status_json["latency"]
+    %w( publish_stored delivery_first delivery_last ).each do |stage|
+      assert after[stage]["samples"] >= before[stage]["samples"] + 11, "every message should have been measured at #{stage}"
+      assert after[stage]["p50"] <= after[stage]["p90"], "#{stage} p50 must not be above p90"
+      assert after[stage]["p90"] <= after[stage]["p99"], "#{stage} p90 must not be above p99"
+      assert after[stage]["p99"] <= after[stage]["max"], "#{stage} p99 must not be above max"
+    end
+    assert after.has_key?("publish_ipc")
+    
+    resp = Typhoeus::Request.new(url("nchan_stub_status")).run
+    assert_equal 200, resp.code
+    %w( publish_stored publish_ipc delivery_first delivery_last ).each do |stage|
+      assert_match(/^latency #{stage} usec: avg \d+ p50 \d+ p90 \d+ p99 \d+ max \d+ samples \d+$/, resp.body)
+    end
+  end
+  
+  def run_simulation
+    resp = Typhoeus::Request.new(url("simulation"), timeout: 60).run
+    return nil if resp.code == 404
+    assert_equal 200, resp.code
+    JSON.parse resp.body
+  end
+  
+  def test_simulation
+    # needs a FAKESHARD build (./rebuild.sh fakeshard), started with ./nginx.sh simulation to run dev/simulation/fanout.sim
+    run = run_simulation
+    return unless run
+    assert_equal 6000, run["simulated_msec"], "the script ends at 6s"
+    assert_equal 1, run["seed"]
+    assert_equal 0, run["publish_failures"]
+    assert_equal 20 * 50 + 500, run["published"], "50 messages to each of 20 channels, and 500 to the busy one"
+    assert run["received"] > 0
+    assert run["received"] <= run["published"] * 50, "no channel has more than 50 subscribers"
+    
+    assert_equal run["workers"], run["per_worker"].length
+    assert_equal run["published"], run["per_worker"].map { |w| w["published"] }.sum
+    assert_equal run["received"], run["per_worker"].map { |w| w["received"] }.sum
+    assert_equal 20 * 50, run["per_worker"].map { |w| w["subscribed"] }.sum
+    %w( subscribe publish ).each do |op|
+      assert run["operations"][op]["count"] > 0, "should have counted #{op} operations"
+    end
+    assert run["high_water"]["channels"] >= 20
+    assert run["high_water"]["subscribers"] >= 20 * 50
+    
+    #same script and seed, same run. timings aside
+    again = run_simulation
+    %w( simulated_msec published publish_failures received ).each do |k|
+      assert_equal run[k], again[k], "a second run should have the same \"#{k}\""
+    end
+    run["per_worker"].zip(again["per_worker"]).each_with_index do |(first, second), i|
+      %w( published subscribed received ).each do |k|
+        assert_equal first[k], second[k], "a second run should have the same \"#{k}\" for worker #{i}"
+      end
+    end
+  end
+  
+  def test_benchmark
+    resp = Typhoeus::Request.new(url("benchmark"), timeout: 30).run
+    assert_equal 200, resp.code
+    lines = resp.body.lines.map { |line| JSON.parse line }
+    start, results, progress = lines.first, lines.last, lines[1..-2]
+    assert_equal "start", start["type"]
+    assert_equal "results", results["type"]
+    assert_equal 20, start["channels"]
+    assert_equal 20 * 10, start["subscribers"]
+    assert_equal start["subscribers"], start["subscribers_ready"], "all the subscribers should be ready before publishing starts"
+    
+    assert_equal 3, progress.length, "one progress line per second"
+    progress.each { |p| assert_equal "progress", p["type"] }
+    
+    assert results["published"] > 0
+    assert_equal 0, results["publish_failures"]
+    assert_equal results["published"], progress.map { |p| p["published"] }.sum
+    assert_equal results["published"] * 10, results["expected"]
+    assert_equal results["expected"], results["received"], "every subscriber should get every message"
+    
+    lat = results["latency_usec"]
+    %w( min p50 p90 p99 p999 max ).each_cons(2) do |lo, hi|
+      assert lat[lo] <= lat[hi], "latency #{lo} should be no more than #{hi}"
+    end
+  end
+  
+  def trace_summary
+    files = Dir.glob("/tmp/nchan-test.trace.*").grep(/\.\d+\z/)
+    return nil if files.empty?
+    out = IO.popen(["ruby", File.join(__dir__, "replay.rb"), "--summary", *files], err: File::NULL, &:read)
+    counts = Hash.new(0)
+    out.scan(/^  (\w+): (\d+)/) { |name, n| counts[name] = n.to_i }
+    counts
+  end
+  
+  def test_trace
+    # with nchan_trace uncommented in nginx.conf, client traffic is recorded, and dev/replay.rb can read it back.
+    before = trace_summary
+    return unless before
+    chan = short_id
+    pub, sub = pubsub 2, channel: chan, client: :websocket, timeout: 10
+    sub.run
+    sub.wait :ready
+    5.times { |i| pub.post "traced #{i}" }
+    pub.post "FIN"
+    sub.wait
+    verify pub, sub
+    sub.terminate
+    sleep 0.5
+    
+    after = trace_summary
+    assert after["publish"] >= before["publish"] + 6, "every publish should be traced"
+    assert after["subscribe"] >= before["subscribe"] + 2, "every subscribe should be traced"
+    assert after["unsubscribe"] >= before["unsubscribe"] + 2, "every unsubscribe should be traced"
+    assert after["websocket"] >= before["websocket"] + 2, "subscriber types should be traced"
+  end
+  
+  def test_hot_channels
+    hot, cold = short_id, short_id
+    pub = Publisher.new url("pub/#{hot}")
+    30.times { |i| pub.post "hot #{i}" }
+    Publisher.new(url("pub/#{cold}")).post "cold"
+    
+    status = stub_status_json
+    assert status["hot_channels"]["window"] > 0
+    %w( publishes bytes subscribes fanout ).each {|k| assert_kind_of Array, status["hot_channels"][k], "hot_channels must have \"#{k}\""}
+    
+    publishes = status["hot_channels"]["publishes"]
+    found = publishes.find { |c| c["channel"].end_with? hot }
+    assert found, "channel #{hot} should be among the busiest channels"
+    assert found["per_second"] > 0
+    assert_equal false, found["truncated"]
+    cold_entry = publishes.find { |c| c["channel"].end_with? cold }
+    assert cold_entry.nil? || cold_entry["per_second"] < found["per_second"], "channel #{cold} shouldn't look busier than #{hot}"
+    
+    resp = Typhoeus::Request.new(url("metrics")).run
+    assert_match(/^nchan_hot_channel_publishes_per_second\{channel="[^"]*#{hot}"\} [0-9.]+$/, resp.body)
+  end
+  
+  def test_stall_stats
+    before = stub_status_json["stalls"]
+    assert_equal 100, before["threshold_msec"]
+    
+    pub, sub = pubsub 5
+    sub.run
+    pub.post ["hello", "FIN"]
+    sub.wait
+    verify pub, sub
+    sub.terminate
+    
+    after = stub_status_json["stalls"]
+    %w( spool_respond messages_gc reaper deflate redis_reply ipc ).each do |site|
+      %w( avg p50 p90 p99 max samples over_threshold ).each {|k| assert after[site].has_key?(k), "stalls.#{site} must have \"#{k}\""}
+      assert after[site]["over_threshold"] <= after[site]["samples"]
+    end
+    assert after["spool_respond"]["samples"] > before["spool_respond"]["samples"], "responding to subscribers should have been timed"
+    assert after["spool_respond"]["max"] >= after["spool_respond"]["p50"]
+    
+    resp = Typhoeus::Request.new(url("metrics")).run
+    assert_match(/^nchan_stall_microseconds_count\{site="spool_respond"\} [1-9]\d*$/, resp.body)
+    assert_match(/^nchan_stalls_total\{site="spool_respond"\} \d+$/, resp.body)
+  end
+  
+  def test_subscriber_footprint
+    before = stub_status_json["subscriber_footprint_bytes"]
+    assert_nil before["internal"], "internal subscribers have no connection to measure"
+    
+    [:longpoll, :websocket].each do |client|
+      pub, sub = pubsub 3, client: client
+      sub.run
+      pub.post ["hello", "FIN"]
+      sub.wait
+      verify pub, sub
+      sub.terminate
+    end
+    sleep 0.5 #for the websocket connections to be closed on the server side
+    
+    after = stub_status_json["subscriber_footprint_bytes"]
+    %w( longpoll websocket ).each do |type|
+      assert after[type]["samples"] >= before[type]["samples"] + 3, "#{type} subscribers' footprints should have been recorded when they left"
+      assert after[type]["max"] > 0
+      assert after[type]["max"] >= after[type]["p50"]
+    end
+    
+    resp = Typhoeus::Request.new(url("metrics")).run
+    assert_match(/^nchan_subscriber_footprint_bytes_count\{type="websocket"\} [1-9]\d*$/, resp.body)
+  end
+  
+  def test_shared_memory_pages
+    Publisher.new(url("pub/#{short_id}")).post "hello"
+    status = stub_status_json
+    
+    pages = status["shared_memory_pages"]
+    assert pages["size"] > 0
+    assert pages["total"] > 0
+    assert pages["free"] <= pages["total"]
+    assert pages["largest_free_run"] <= pages["free"]
+    assert pages["whole_page_allocations"] <= pages["total"] - pages["free"]
+    
+    slabs = status["shared_memory_slabs"]
+    assert slabs.length > 0
+    slabs.each do |slab|
+      assert slab["used"] <= slab["slots"], "slab size #{slab["size"]} has more slots used than it has"
+      assert slab["partial_pages"] <= slab["pages"], "slab size #{slab["size"]} has more partly used pages than pages"
+    end
+    assert slabs.map { |slab| slab["pages"] }.sum <= pages["total"] - pages["free"]
+    
+    resp = Typhoeus::Request.new(url("metrics")).run
+    assert_match(/^nchan_shm_slab_pages\{size="\d+"\} \d+$/, resp.body)
+    assert_match(/^nchan_shm_slab_partial_pages\{size="\d+"\} \d+$/, resp.body)
+    assert_match(/^nchan_shm_largest_free_run_pages \d+$/, resp.body)
+  end
+  
+  def test_shared_memory_compaction
+    chan = short_id
+    pub = Publisher.new url("pub/#{chan}")
+    #a spread of sizes, so they land in different slabs
+    pub.post (1..20).map { |i| "compact me #{i} " * (i * 5) }
+    before = stub_status_json["shared_memory_compaction"]
+    sleep 1.2 #nchan_shared_memory_compaction is 1s in nginx.conf, and messages only move once they're older than that
+    
+    #keep reading the messages from every worker while the sweeps run. moved or not, they must come out the same
+    6.times do
+      sub = Subscriber.new(url("sub/broadcast/#{chan}"), 8, quit_message: pub.messages.messages.last)
+      sub.run
+      sub.wait
+      verify pub, sub
+      sub.terminate
+      sleep 0.25
+    end
+    
+    after = stub_status_json["shared_memory_compaction"]
+    assert after["sweeps"] > before["sweeps"], "compaction should have swept"
+    assert after["messages_moved"] >= before["messages_moved"]
+    assert after["bytes_moved"] >= before["bytes_moved"]
+    
+    resp = Typhoeus::Request.new(url("metrics")).run
+    assert_match(/^nchan_shm_compaction_sweeps_total [1-9]\d*$/, resp.body)
+  end
+  
   def generic_test_access_control(opt)
     pub, sub = pubsub 1, extra_headers: { Origin: opt[:origin] }, pub: opt[:pub_url], sub: opt[:sub_url], sub_param: opt[:param], pub_param: opt[:param]
     
@@ -1383,6 +1978,105 @@ class PubSubTest <  Minitest::Test
   end
   
   
+  def test_batched_subscribe_callbacks
+    events = {"subscribe" => [], "unsubscribe" => []}
+    requests = 0
+    auth = start_authserver quiet: true do |env|
+      if env["PATH_INFO"] == "/sub_batched" || env["PATH_INFO"] == "/unsub_batched"
+        assert_equal "POST", env["REQUEST_METHOD"]
+        env["rack.input"].rewind
+        JSON.parse(env["rack.input"].read).each do |ev|
+          events[ev["type"]] << ev
+        end
+        requests += 1
+      end
+    end
+    begin
+      chans = 5.times.map { short_id }
+      subs = chans.map do |chan|
+        sub = Subscriber.new(url("/sub/withcb_batched/#{chan}"), 1, client: :websocket, quit_message: 'FIN')
+        sub.on_failure { false }
+        sub.run
+        sub
+      end
+      sleep 1
+      subs.each &:terminate
+      sleep 1
+      
+      ["subscribe", "unsubscribe"].each do |type|
+        assert_equal chans.sort, events[type].map{|ev| ev["channel"]}.sort
+        events[type].each do |ev|
+          assert_equal "websocket", ev["subscriber_type"]
+          assert_equal "chid=#{ev["channel"]}", ev["args"]
+        end
+      end
+      assert requests < 10, "expected events to be batched"
+    ensure
+      auth.stop
+    end
+  end
+  
+  def test_auth_cache
+    chan = short_id
+    pub = Publisher.new url("pub/#{chan}")
+    pub.post [ "wut", "waht", "FIN" ]
+    
+    auth = start_authserver quiet: true
+    begin
+      sub = Subscriber.new(url("sub/auth_cached/#{chan}"), 1, client: :longpoll, quit_message: 'FIN')
+      sub.on_failure { false }
+      sub.run
+      sub.wait
+      verify pub, sub
+      sub.terminate
+    ensure
+      auth.stop
+    end
+    
+    #auth server's gone, but the authorization should still be cached
+    [:longpoll, :eventsource, :websocket].each do |t|
+      sub = Subscriber.new(url("sub/auth_cached/#{chan}"), 1, client: t, quit_message: 'FIN')
+      sub.on_failure { false }
+      sub.run
+      sub.wait
+      verify pub, sub
+      sub.terminate
+    end
+  end
+  
+  def test_auth_cache_per_authorizer
+    chan = short_id
+    pub = Publisher.new url("pub/#{chan}")
+    pub.post [ "hi", "FIN" ]
+    
+    auth = start_authserver quiet: true
+    begin
+      sub = Subscriber.new(url("sub/auth_cached/#{chan}"), 1, client: :longpoll, quit_message: 'FIN')
+      sub.on_failure { false }
+      sub.run
+      sub.wait
+      verify pub, sub
+      sub.terminate
+      
+      #same cache key, different authorization URL: the cached allow must not apply.
+      #and denials aren't cached, so every one of these gets the authorizer's whole response
+      2.times do
+        sub = Subscriber.new(url("sub/auth_fail_weird_cached/#{chan}"), 1, client: :longpoll)
+        sub.on_failure do |err, bundle|
+          assert_match "too-ripe", bundle.headers["X-Banana"]
+          assert_match "f38697175091d1667f5187c016cba46d092baf6a", Digest::SHA1.hexdigest(bundle.body_buf)
+          false
+        end
+        sub.run
+        sub.wait
+        assert sub.match_errors(/406/)
+        sub.terminate
+      end
+    ensure
+      auth.stop
+    end
+  end
+  
   def test_x_accel_redirect
     
     auth = start_authserver quiet: true
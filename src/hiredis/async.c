@@ -136,6 +136,7 @@ static redisAsyncContext *redisAsyncInitialize(redisContext *c) {
     ac->sub.invalid.tail = NULL;
     ac->sub.channels = dictCreate(&callbackDict,NULL);
     ac->sub.patterns = dictCreate(&callbackDict,NULL);
+    ac->sub.shard_channels = dictCreate(&callbackDict,NULL);
     return ac;
 }
 
@@ -299,6 +300,12 @@ static void __redisAsyncFree(redisAsyncContext *ac) {
     dictReleaseIterator(it);
     dictRelease(ac->sub.patterns);
 
+    it = dictGetIterator(ac->sub.shard_channels);
+    while ((de = dictNext(it)) != NULL)
+        __redisRunCallback(ac,dictGetEntryVal(de),NULL);
+    dictReleaseIterator(it);
+    dictRelease(ac->sub.shard_channels);
+
     /* Signal event lib to clean up */
     _EL_CLEANUP(ac);
 
@@ -365,7 +372,7 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
     redisContext *c = &(ac->c);
     dict *callbacks;
     dictEntry *de;
-    int pvariant;
+    int pvariant, svariant;
     char *stype;
     sds sname;
 
@@ -376,9 +383,16 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
         assert(reply->element[0]->type == REDIS_REPLY_STRING);
         stype = reply->element[0]->str;
         pvariant = (tolower(stype[0]) == 'p') ? 1 : 0;
+        /* Sharded pub/sub (Redis 7): smessage, ssubscribe, sunsubscribe */
+        svariant = (tolower(stype[0]) == 's' &&
+                    (strcasecmp(stype+1,"message") == 0 ||
+                     strcasecmp(stype+1,"subscribe") == 0 ||
+                     strcasecmp(stype+1,"unsubscribe") == 0)) ? 1 : 0;
 
         if (pvariant)
             callbacks = ac->sub.patterns;
+        else if (svariant)
+            callbacks = ac->sub.shard_channels;
         else
             callbacks = ac->sub.channels;
 
@@ -390,13 +404,17 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
             memcpy(dstcb,dictGetEntryVal(de),sizeof(*dstcb));
 
             /* If this is an unsubscribe message, remove it. */
-            if (strcasecmp(stype+pvariant,"unsubscribe") == 0) {
+            if (strcasecmp(stype+pvariant+svariant,"unsubscribe") == 0) {
                 dictDelete(callbacks,sname);
 
                 /* If this was the last unsubscribe message, revert to
-                 * non-subscribe mode. */
+                 * non-subscribe mode. The server counts shard channels
+                 * separately from channels and patterns, so check both. */
                 assert(reply->element[2]->type == REDIS_REPLY_INTEGER);
-                if (reply->element[2]->integer == 0)
+                if (reply->element[2]->integer == 0 &&
+                    dictSize(ac->sub.channels) == 0 &&
+                    dictSize(ac->sub.patterns) == 0 &&
+                    dictSize(ac->sub.shard_channels) == 0)
                     c->flags &= ~REDIS_SUBSCRIBED;
             }
         }
@@ -583,7 +601,7 @@ static const char *nextArgument(const char *start, const char **str, size_t *len
 static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
     redisContext *c = &(ac->c);
     redisCallback cb;
-    int pvariant, hasnext;
+    int pvariant, svariant, hasnext;
     const char *cstr, *astr;
     size_t clen, alen;
     const char *p;
@@ -602,8 +620,11 @@ static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void
     assert(p != NULL);
     hasnext = (p[0] == '$');
     pvariant = (tolower(cstr[0]) == 'p') ? 1 : 0;
-    cstr += pvariant;
-    clen -= pvariant;
+    svariant = (tolower(cstr[0]) == 's' &&
+                (strncasecmp(cstr+1,"subscribe\r\n",11) == 0 ||
+                 strncasecmp(cstr+1,"unsubscribe\r\n",13) == 0)) ? 1 : 0;
+    cstr += pvariant + svariant;
+    clen -= pvariant + svariant;
 
     if (hasnext && strncasecmp(cstr,"subscribe\r\n",11) == 0) {
         c->flags |= REDIS_SUBSCRIBED;
@@ -613,6 +634,8 @@ static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void
             sname = sdsnewlen(astr,alen);
             if (pvariant)
                 ret = dictReplace(ac->sub.patterns,sname,&cb);
+            else if (svariant)
+                ret = dictReplace(ac->sub.shard_channels,sname,&cb);
             else
                 ret = dictReplace(ac->sub.channels,sname,&cb);
 
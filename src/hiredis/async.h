@@ -97,6 +97,7 @@ typedef struct redisAsyncContext {
         redisCallbackList invalid;
         struct dict *channels;
         struct dict *patterns;
+        struct dict *shard_channels;
     } sub;
 } redisAsyncContext;
 
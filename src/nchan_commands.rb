@@ -248,6 +248,26 @@ CfCmd.new do
       info: "Send GET request to internal location (which may proxy to an upstream server) for authorization of a publisher or subscriber request. A 200 response authorizes the request, a 403 response forbids it.",
       uri: "#request-authorization"
   
+  nchan_authorize_request_cache_key [:srv, :loc, :if], 
+      :ngx_http_set_complex_value_slot,
+      [:loc_conf, :"authorize_cache.key"],
+      
+      group: "security",
+      tags: ['publisher', 'subscriber', 'hook'],
+      value: "<string>",
+      info: "Cache `nchan_authorize_request` responses in shared memory, keyed on this value (for example `$cookie_session$nchan_channel_id`) and the authorization request URL. Only successful responses are cached. Identical authorization requests made at the same time are collapsed into a single request. The `Cache-Control` header of the authorization response is respected.",
+      uri: "#request-authorization"
+  
+  nchan_authorize_request_cache_ttl [:srv, :loc, :if], 
+      :ngx_conf_set_sec_slot,
+      [:loc_conf, :"authorize_cache.ttl"],
+      
+      group: "security",
+      tags: ['publisher', 'subscriber', 'hook'],
+      value: "<time>",
+      default: "10s",
+      info: "How long to cache a successful (2xx) authorization response when `nchan_authorize_request_cache_key` is set. A `max-age` in the response's `Cache-Control` header takes precedence."
+  
   nchan_subscribe_request [:srv, :loc, :if], 
       :ngx_http_set_complex_value_slot,
       [:loc_conf, :subscribe_request_url],
@@ -268,6 +288,28 @@ CfCmd.new do
       info: "Send GET request to internal location (which may proxy to an upstream server) after unsubscribing. Disabled for longpoll and interval-polling subscribers.",
       uri: "#subscriber-presence"
   
+  nchan_subscriber_presence_batch_interval [:srv, :loc, :if],
+      :ngx_conf_set_msec_slot,
+      [:loc_conf, :"subscriber_presence_batch.interval"],
+      
+      group: "pubsub",
+      tags: ['subscriber', 'hook'],
+      value: "<time>",
+      default: "0 (off)",
+      info: "Collect `nchan_subscribe_request` and `nchan_unsubscribe_request` callbacks for up to this long, and send them together as a single POST request with a JSON array body. Each array element has the event `type` (`subscribe` or `unsubscribe`), the `channel`, the `subscriber_type`, and the callback url's query string as `args`. Callbacks are batched per worker and per callback url path.",
+      uri: "#subscriber-presence"
+  
+  nchan_subscriber_presence_batch_size [:srv, :loc, :if],
+      :ngx_conf_set_num_slot,
+      [:loc_conf, :"subscriber_presence_batch.size"],
+      
+      group: "pubsub",
+      tags: ['subscriber', 'hook'],
+      value: "<number>",
+      default: "100",
+      info: "Send a batch of subscriber presence callbacks as soon as it has this many events, without waiting for `nchan_subscriber_presence_batch_interval` to elapse.",
+      uri: "#subscriber-presence"
+  
   nchan_message_temp_path [:main],
       :ngx_conf_set_path_slot,
       [:main_conf, :message_temp_path],
@@ -302,6 +344,17 @@ CfCmd.new do
       info: "Shared memory slab pre-allocated for Nchan. Used for channel statistics, message storage, and interprocess communication.",
       uri: "#memory-storage"
   
+  nchan_shared_memory_compaction [:main],
+      :ngx_conf_set_msec_slot,
+      [:main_conf, :shm_compaction_interval],
+      
+      group: "storage",
+      tags: ['memstore'],
+      value: "<time>",
+      default: "0 (off)",
+      info: "How often each worker moves its channels' long-lived messages out of mostly-empty shared memory pages and into fuller ones, so that the emptied pages can be freed for larger allocations. Only messages older than this interval, stored in memory, and not being sent to anyone are moved.",
+      uri: "#memory-storage"
+  
   nchan_permessage_deflate_compression_level [:main],
       :nchan_conf_deflate_compression_level_directive,
       :main_conf,
@@ -374,6 +427,26 @@ CfCmd.new do
       undocumented: true,
       group: "storage"
   
+  nchan_redis_message_cache_size [:main],
+      :ngx_conf_set_size_slot,
+      [:main_conf, :redis_message_cache_size],
+      
+      group: "storage",
+      tags: ['redis'],
+      value: "<size>",
+      default: "0",
+      info: "Keep messages received from Redis in shared memory, up to this much, so that subscribers in different workers catching up on the same message don't each fetch it from Redis. Identical fetches made at the same time by one worker are also combined. Set to 0 to disable."
+  
+  nchan_redis_connection_workers [:main],
+      :ngx_conf_set_num_slot,
+      [:main_conf, :redis_connection_workers],
+      
+      group: "storage",
+      tags: ['redis'],
+      value: "<number>",
+      default: "0",
+      info: "Only this many Nginx workers connect to Redis. Channels stored in Redis are owned by these workers, and the other workers pass their Redis publishing, channel lookups, deletes and subscriber counts to the channel owner over IPC. With 32 workers and a setting of 2, there are 16 times fewer Redis connections. Set to 0 to have every worker connect to Redis."
+  
   nchan_redis_server [:upstream],
       :ngx_conf_upstream_redis_server,
       :loc_conf,
@@ -444,6 +517,46 @@ CfCmd.new do
       default: "master=1 slave=1",
       info: "Determines how subscriptions to Redis PUBSUB channels are distributed between master and slave nodes. The higher the number, the more likely that each node of that type will be chosen for each new channel. The weights for slave nodes are cumulative, so an equal 1:1 master:slave weight ratio with two slaves would have a 1/3 chance of picking a master, and 2/3 chance of picking one of the slaves. The weight must be a non-negative integer."
   
+  nchan_redis_latency_routing [:upstream],
+      :ngx_conf_set_flag_slot,
+      [:srv_conf, :"redis.latency_routing"],
+      
+      group: "storage",
+      tags: ['redis', 'subscriber'],
+      value: ["on", "off"],
+      default: "off",
+      info: "Measure each Redis server's round-trip time and each slave's replication lag, and use them to pick where reads go. Messages are fetched from the fastest slave that's no more than `nchan_redis_replica_max_lag` behind its master, or from the master itself. New PUBSUB subscriptions are spread out in proportion to the `nchan_redis_subscribe_weights` divided by each node's round-trip time, skipping slaves that have fallen behind."
+  
+  nchan_redis_replica_max_lag [:upstream],
+      :ngx_conf_set_size_slot,
+      [:srv_conf, :"redis.replica_max_lag"],
+      
+      group: "storage",
+      tags: ['redis', 'subscriber'],
+      value: "<size>",
+      default: "1m",
+      info: "With `nchan_redis_latency_routing` enabled, the most replication data (in bytes) a slave may be behind its master and still be used for reads and new subscriptions."
+  
+  nchan_redis_stream_storage [:upstream],
+      :ngx_conf_set_flag_slot,
+      [:srv_conf, :"redis.stream_storage"],
+      
+      group: "storage",
+      tags: ['redis', 'publisher', 'subscriber'],
+      value: ["on", "off"],
+      default: "off",
+      info: "Keep each channel's messages in a single [Redis stream](https://redis.io/docs/data-types/streams/) rather than a hash per message and a list of message ids. Uses less Redis memory per message and makes catching up on long message buffers cheaper. Requires Redis 5 or newer. Messages already stored the other way are not converted, so switch this setting on an empty Redis server or namespace. `nchan_redis_publish_batch` is ignored when this is enabled."
+  
+  nchan_redis_reconnect_catch_up_concurrency [:upstream],
+      :ngx_conf_set_redis_catch_up_concurrency,
+      :srv_conf,
+      
+      group: "storage",
+      tags: ['redis', 'subscriber'],
+      value: "<number>",
+      default: "4",
+      info: "After a Redis server reconnects, its channels check for messages they missed in batches, and only the channels that have new messages fetch them. This is how many of those batches may be waiting on Redis at once for each Redis server set. Lower values go easier on Redis, higher values catch up faster."
+  
   nchan_redis_optimize_target [:upstream],
       :ngx_conf_set_redis_optimize_target,
       :srv_conf,
@@ -454,6 +567,37 @@ CfCmd.new do
       default: "cpu",
       info: "This tweaks whether [effect replication](https://redis.io/commands/eval#replicating-commands-instead-of-scripts) is enabled. Optimizing for CPU usage enables effect replication, costing additional bandwidth (between 1.2 and 2 times more) between all master->slave links. Optimizing for bandwidth increases CPU load on slaves, but keeps outgoing bandwidth used for replication the same as the incoming bandwidth on Master."
   
+  nchan_redis_publish_batch [:upstream],
+      :ngx_conf_set_redis_publish_batch,
+      :srv_conf,
+      
+      group: "storage",
+      tags: ['redis', 'publisher'],
+      value: ["on", "off", "<time>"],
+      default: "off",
+      info: "Publish messages bound for the same Redis server together, with a single script call, rather than one call per message. When `on`, messages published during the same event loop iteration are sent together. When set to a time interval, messages are collected for up to that long before being sent. This reduces Redis CPU load at high publishing rates, at the cost of some added publishing latency. Has no effect in Redis Cluster mode."
+  
+  nchan_redis_command_connections [:upstream],
+      :ngx_conf_set_redis_command_connections,
+      :srv_conf,
+      args: 1..3,
+      
+      group: "storage",
+      tags: ['redis'],
+      value: "<number> [max_pending=<number>] [max_queued=<number>]",
+      default: "1 max_pending=0 max_queued=10000",
+      info: "Number of connections each worker opens to each Redis server for commands and scripts (up to 16). Commands are sent on the connection with the fewest replies outstanding, so that large replies don't hold up small commands behind them. With `max_pending` set, each connection will have at most that many commands awaiting a reply, and further commands wait in a queue. Once `max_queued` commands are waiting, new commands fail right away. A `max_pending` of 0 means no limit."
+  
+  nchan_redis_sharded_pubsub [:upstream],
+      :ngx_conf_set_flag_slot,
+      [:srv_conf, :"redis.sharded_pubsub"],
+      
+      group: "storage",
+      tags: ['redis', 'subscriber', 'publisher'],
+      value: ["on", "off"],
+      default: "off",
+      info: "Use Redis 7 sharded PUBSUB (`SSUBSCRIBE` and `SPUBLISH`) for channel messages. In a Redis Cluster, classic PUBSUB messages are broadcast to every node in the cluster; sharded PUBSUB messages stay on the master and slaves that own the channel's keyslot. All Redis servers in the upstream must be version 7 or newer, and all Nchan servers using the same Redis servers must have the same setting."
+  
   nchan_redis_namespace [:main, :srv, :upstream], 
       :ngx_conf_set_redis_namespace_slot,
       [:loc_conf, :"redis.namespace"],
@@ -632,13 +776,144 @@ CfCmd.new do
   nchan_stub_status [:loc],
       :nchan_stub_status_directive,
       :loc_conf,
-      args: 0,
+      args: 0..1,
+      
+      group: "meta",
+      tags: ['introspection'],
+      value: ["text", "json", "prometheus"],
+      default: "text",
+      info: "Similar to Nginx's stub_status directive, requests to an `nchan_stub_status` location get a response with some vital Nchan statistics. This data does not account for information from other Nchan instances, and monitors only local connections, published messages, etc. The `json` and `prometheus` (OpenMetrics) formats add per-worker, per-channel-group, shared memory and Redis server details.",
+      uri: "#nchan_stub_status"
+  
+  nchan_latency_sampling [:main],
+      :ngx_conf_set_num_slot,
+      [:main_conf, :latency_sampling],
+      
+      group: "meta",
+      tags: ['introspection'],
+      value: "<number>",
+      default: "1",
+      info: "Measure the publish-to-delivery latency of 1 in every this many published messages for the latency histograms shown by `nchan_stub_status`. Set to 0 to stop measuring latency.",
+      uri: "#nchan_stub_status"
+  
+  nchan_hot_channels_window [:main],
+      :ngx_conf_set_sec_slot,
+      [:main_conf, :hot_channels_window],
+      
+      group: "meta",
+      tags: ['introspection'],
+      value: "<time>",
+      default: "60s",
+      info: "The sliding window over which the busiest channels' publishing, subscribing and fan-out rates are measured for `nchan_stub_status`. Set to 0 to stop tracking the busiest channels.",
+      uri: "#nchan_stub_status"
+  
+  nchan_stall_threshold [:main],
+      :ngx_conf_set_msec_slot,
+      [:main_conf, :stall_threshold],
       
       group: "meta",
       tags: ['introspection'],
-      info: "Similar to Nginx's stub_status directive, requests to an `nchan_stub_status` location get a response with some vital Nchan statistics. This data does not account for information from other Nchan instances, and monitors only local connections, published messages, etc.",
+      value: "<time>",
+      default: "100ms",
+      info: "Log a warning whenever responding to subscribers, garbage-collecting messages or channels, compressing a message, or handling a Redis or interprocess message holds up an Nginx worker for at least this long. These timings are also shown by `nchan_stub_status`. Set to 0 to stop timing them.",
       uri: "#nchan_stub_status"
   
+  nchan_trace [:main],
+      :ngx_conf_set_str_slot,
+      [:main_conf, :trace_path],
+      
+      group: "meta",
+      tags: ['introspection'],
+      value: "<path>",
+      info: "Record every publish, subscribe, subscriber reconnect and unsubscribe to a binary trace file per worker, named `<path>.<worker number>`. Channel ids are recorded only as hashes, and message contents aren't recorded at all. The traces can be summarized or replayed against another server with `dev/replay.rb`.",
+      uri: "#traffic-tracing"
+  
+  nchan_trace_size [:main],
+      :ngx_conf_set_size_slot,
+      [:main_conf, :trace_size],
+      
+      group: "meta",
+      tags: ['introspection'],
+      value: "<size>",
+      default: "16M",
+      info: "The size of each worker's trace file. Each event takes 64 bytes, and once the file is full the oldest events are overwritten.",
+      uri: "#traffic-tracing"
+  
+  nchan_benchmark [:loc],
+      :nchan_benchmark_directive,
+      :loc_conf,
+      args: 0,
+      
+      group: "meta",
+      tags: ['introspection', 'benchmark'],
+      info: "Run a benchmark from inside Nginx on every GET request to this location, with internal subscribers and publishers, using the location's storage settings. The response is a stream of JSON objects, one per line, with the publishing and receiving rates and the publish-to-delivery latency percentiles in microseconds.",
+      uri: "#benchmarking"
+  
+  nchan_benchmark_time [:srv, :loc],
+      :ngx_conf_set_sec_slot,
+      [:loc_conf, :"benchmark.time"],
+      
+      group: "meta",
+      tags: ['benchmark'],
+      value: "<time>",
+      default: "10s",
+      info: "How long an `nchan_benchmark` run publishes messages for.",
+      uri: "#benchmarking"
+  
+  nchan_benchmark_channels [:srv, :loc],
+      :ngx_conf_set_num_slot,
+      [:loc_conf, :"benchmark.channels"],
+      
+      group: "meta",
+      tags: ['benchmark'],
+      value: "<number>",
+      default: "1000",
+      info: "Number of channels used by an `nchan_benchmark` run.",
+      uri: "#benchmarking"
+  
+  nchan_benchmark_subscribers_per_channel [:srv, :loc],
+      :ngx_conf_set_num_slot,
+      [:loc_conf, :"benchmark.subscribers_per_channel"],
+      
+      group: "meta",
+      tags: ['benchmark'],
+      value: "<number>",
+      default: "100",
+      info: "Number of internal subscribers on each `nchan_benchmark` channel.",
+      uri: "#benchmarking"
+  
+  nchan_benchmark_messages_per_channel_per_minute [:srv, :loc],
+      :ngx_conf_set_num_slot,
+      [:loc_conf, :"benchmark.messages_per_channel_per_minute"],
+      
+      group: "meta",
+      tags: ['benchmark'],
+      value: "<number>",
+      default: "10",
+      info: "Publishing rate for each `nchan_benchmark` channel.",
+      uri: "#benchmarking"
+  
+  nchan_benchmark_message_size [:srv, :loc],
+      :ngx_conf_set_size_slot,
+      [:loc_conf, :"benchmark.message_size"],
+      
+      group: "meta",
+      tags: ['benchmark'],
+      value: "<size>",
+      default: "1000",
+      info: "Size of the messages published by `nchan_benchmark`. Each message starts with a 20-digit timestamp, so messages are never smaller than that.",
+      uri: "#benchmarking"
+  
+  nchan_simulation [:loc],
+      :nchan_simulation_directive,
+      :loc_conf,
+      args: 1,
+      
+      undocumented: true,
+      group: "debug",
+      value: "<script>",
+      info: "Run a scripted load simulation across fake workers on every GET request to this location. Needs Nchan built with FAKESHARD."
+  
   nchan_channel_event_string [:srv, :loc, :if], 
       :ngx_http_set_complex_value_slot,
       [:loc_conf, :channel_event_string],
@@ -649,6 +924,17 @@ CfCmd.new do
       default: "\"$nchan_channel_event $nchan_channel_id\"",
       info: "Contents of channel event message"
   
+  nchan_channel_events_aggregate_interval [:srv, :loc, :if],
+      :ngx_conf_set_msec_slot,
+      [:loc_conf, :channel_events_aggregate_interval],
+      
+      group: "meta",
+      tags: ['publisher', 'subscriber', 'channel-events', 'introspection'],
+      value: "<time>",
+      default: "0 (off)",
+      info: "Instead of publishing a channel event message for every event, count each channel's events and publish one `channel_summary` message per channel at most once per this interval. `nchan_channel_event_string` is not used for summaries.",
+      uri: "#channel-events"
+  
   nchan_max_channel_id_length [:main, :srv, :loc],
       :ngx_conf_set_num_slot,
       [:loc_conf, :max_channel_id_length],
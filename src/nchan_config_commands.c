@@ -194,6 +194,20 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_loc_conf_t, authorize_request_url),
     NULL } ,
 
+  { ngx_string("nchan_authorize_request_cache_key"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
+    ngx_http_set_complex_value_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, authorize_cache.key),
+    NULL } ,
+
+  { ngx_string("nchan_authorize_request_cache_ttl"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_sec_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, authorize_cache.ttl),
+    NULL } ,
+
   { ngx_string("nchan_subscribe_request"),
     NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
     ngx_http_set_complex_value_slot,
@@ -208,6 +222,20 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_loc_conf_t, unsubscribe_request_url),
     NULL } ,
 
+  { ngx_string("nchan_subscriber_presence_batch_interval"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_msec_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, subscriber_presence_batch.interval),
+    NULL } ,
+
+  { ngx_string("nchan_subscriber_presence_batch_size"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_num_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, subscriber_presence_batch.size),
+    NULL } ,
+
   { ngx_string("nchan_message_temp_path"),
     NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
     ngx_conf_set_path_slot,
@@ -247,6 +275,13 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_main_conf_t, shm_size),
     NULL } ,
 
+  { ngx_string("nchan_shared_memory_compaction"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_msec_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, shm_compaction_interval),
+    NULL } ,
+
   { ngx_string("nchan_permessage_deflate_compression_level"),
     NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
     nchan_conf_deflate_compression_level_directive,
@@ -303,6 +338,20 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_main_conf_t, redis_publish_message_msgkey_size),
     NULL } ,
 
+  { ngx_string("nchan_redis_message_cache_size"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_size_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, redis_message_cache_size),
+    NULL } ,
+
+  { ngx_string("nchan_redis_connection_workers"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_num_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, redis_connection_workers),
+    NULL } ,
+
   { ngx_string("nchan_redis_server"),
     NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
     ngx_conf_upstream_redis_server,
@@ -352,6 +401,34 @@ static ngx_command_t  nchan_commands[] = {
     0,
     NULL } ,
 
+  { ngx_string("nchan_redis_latency_routing"),
+    NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_flag_slot,
+    NGX_HTTP_SRV_CONF_OFFSET,
+    offsetof(nchan_srv_conf_t, redis.latency_routing),
+    NULL } ,
+
+  { ngx_string("nchan_redis_replica_max_lag"),
+    NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_size_slot,
+    NGX_HTTP_SRV_CONF_OFFSET,
+    offsetof(nchan_srv_conf_t, redis.replica_max_lag),
+    NULL } ,
+
+  { ngx_string("nchan_redis_stream_storage"),
+    NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_flag_slot,
+    NGX_HTTP_SRV_CONF_OFFSET,
+    offsetof(nchan_srv_conf_t, redis.stream_storage),
+    NULL } ,
+
+  { ngx_string("nchan_redis_reconnect_catch_up_concurrency"),
+    NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_redis_catch_up_concurrency,
+    NGX_HTTP_SRV_CONF_OFFSET,
+    0,
+    NULL } ,
+
   { ngx_string("nchan_redis_optimize_target"),
     NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
     ngx_conf_set_redis_optimize_target,
@@ -359,6 +436,27 @@ static ngx_command_t  nchan_commands[] = {
     0,
     NULL } ,
 
+  { ngx_string("nchan_redis_publish_batch"),
+    NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_redis_publish_batch,
+    NGX_HTTP_SRV_CONF_OFFSET,
+    0,
+    NULL } ,
+
+  { ngx_string("nchan_redis_command_connections"),
+    NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1|NGX_CONF_TAKE2|NGX_CONF_TAKE3,
+    ngx_conf_set_redis_command_connections,
+    NGX_HTTP_SRV_CONF_OFFSET,
+    0,
+    NULL } ,
+
+  { ngx_string("nchan_redis_sharded_pubsub"),
+    NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_flag_slot,
+    NGX_HTTP_SRV_CONF_OFFSET,
+    offsetof(nchan_srv_conf_t, redis.sharded_pubsub),
+    NULL } ,
+
   { ngx_string("nchan_redis_namespace"),
     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
     ngx_conf_set_redis_namespace_slot,
@@ -515,12 +613,96 @@ static ngx_command_t  nchan_commands[] = {
     NULL } ,
 
   { ngx_string("nchan_stub_status"),
-    NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+    NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
     nchan_stub_status_directive,
     NGX_HTTP_LOC_CONF_OFFSET,
     0,
     NULL } ,
 
+  { ngx_string("nchan_latency_sampling"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_num_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, latency_sampling),
+    NULL } ,
+
+  { ngx_string("nchan_hot_channels_window"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_sec_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, hot_channels_window),
+    NULL } ,
+
+  { ngx_string("nchan_stall_threshold"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_msec_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, stall_threshold),
+    NULL } ,
+
+  { ngx_string("nchan_trace"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_str_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, trace_path),
+    NULL } ,
+
+  { ngx_string("nchan_trace_size"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_size_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, trace_size),
+    NULL } ,
+
+  { ngx_string("nchan_benchmark"),
+    NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+    nchan_benchmark_directive,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    0,
+    NULL } ,
+
+  { ngx_string("nchan_benchmark_time"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_sec_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, benchmark.time),
+    NULL } ,
+
+  { ngx_string("nchan_benchmark_channels"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_num_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, benchmark.channels),
+    NULL } ,
+
+  { ngx_string("nchan_benchmark_subscribers_per_channel"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_num_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, benchmark.subscribers_per_channel),
+    NULL } ,
+
+  { ngx_string("nchan_benchmark_messages_per_channel_per_minute"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_num_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, benchmark.messages_per_channel_per_minute),
+    NULL } ,
+
+  { ngx_string("nchan_benchmark_message_size"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_size_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, benchmark.message_size),
+    NULL } ,
+
+  { ngx_string("nchan_simulation"),
+    NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+    nchan_simulation_directive,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    0,
+    NULL } ,
+
   { ngx_string("nchan_channel_event_string"),
     NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
     ngx_http_set_complex_value_slot,
@@ -528,6 +710,13 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_loc_conf_t, channel_event_string),
     NULL } ,
 
+  { ngx_string("nchan_channel_events_aggregate_interval"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_msec_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, channel_events_aggregate_interval),
+    NULL } ,
+
   { ngx_string("nchan_max_channel_id_length"),
     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
     ngx_conf_set_num_slot,
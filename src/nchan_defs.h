@@ -2,15 +2,35 @@
 #define NCHAN_DEFS_H
 
 #define NCHAN_DEFAULT_SHM_SIZE 134217728 //128 megs
+#define NCHAN_DEFAULT_SHM_COMPACTION_INTERVAL 0 //off
+#define NCHAN_SHM_COMPACTION_MAX_FILL 25 //percent. messages in slab pages fuller than this stay where they are
+#define NCHAN_SHM_COMPACTION_MAX_MOVES 1000 //per sweep, to keep each one short
 #define NCHAN_DEFAULT_MESSAGE_TIMEOUT 3600
 #define NCHAN_DEFAULT_REDIS_IDLE_CHANNEL_CACHE_TIMEOUT 30
 #define NCHAN_DEFAULT_SUBSCRIBER_TIMEOUT 0  //default: never timeout
 #define NCHAN_DEFAULT_REDIS_NODE_CONNECT_TIMEOUT_MSEC 600
+#define NCHAN_DEFAULT_REDIS_COMMAND_MAX_QUEUED 10000
+#define NCHAN_REDIS_MAX_COMMAND_CONNECTIONS 16
+#define NCHAN_DEFAULT_REDIS_REPLICA_MAX_LAG 1048576
+#define NCHAN_DEFAULT_REDIS_CATCH_UP_CONCURRENCY 4
+#define NCHAN_REDIS_LATENCY_PROBE_INTERVAL_MSEC 1000
 //(liucougar: this is a bit confusing, but it is what's the default behavior before this option is introducecd)
 #define NCHAN_DEFAULT_WEBSOCKET_PING_INTERVAL 0
 
 #define NCHAN_DEFAULT_CHANNEL_TIMEOUT 5 //default: timeout in 5 seconds
 
+#define NCHAN_DEFAULT_AUTHORIZE_CACHE_TTL 10
+#define NCHAN_DEFAULT_SUBSCRIBER_PRESENCE_BATCH_SIZE 100
+#define NCHAN_DEFAULT_BENCHMARK_TIME 10
+#define NCHAN_DEFAULT_BENCHMARK_CHANNELS 1000
+#define NCHAN_DEFAULT_BENCHMARK_SUBSCRIBERS_PER_CHANNEL 100
+#define NCHAN_DEFAULT_BENCHMARK_MESSAGES_PER_CHANNEL_PER_MINUTE 10
+#define NCHAN_DEFAULT_BENCHMARK_MESSAGE_SIZE 1000
+#define NCHAN_DEFAULT_LATENCY_SAMPLING 1
+#define NCHAN_DEFAULT_HOT_CHANNELS_WINDOW 60
+#define NCHAN_DEFAULT_STALL_THRESHOLD 100 //msec
+#define NCHAN_DEFAULT_TRACE_SIZE 16777216
+
 #define NCHAN_DEFAULT_MIN_MESSAGES 1
 #define NCHAN_DEFAULT_MAX_MESSAGES 10
 
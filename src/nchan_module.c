@@ -4,6 +4,11 @@
 
 #include <nchan_module.h>
 #include <util/nchan_subrequest.h>
+#include <util/nchan_auth_cache.h>
+#include <util/nchan_presence_batch.h>
+#include <util/nchan_rbtree.h>
+#include <util/nchan_latency.h>
+#include <util/nchan_trace.h>
 #include <assert.h>
 
 #include <subscribers/longpoll.h>
@@ -50,19 +55,184 @@ typedef struct {
 static safe_request_ptr_t *nchan_set_safe_request_ptr(ngx_http_request_t *r);
 static ngx_http_request_t *nchan_get_safe_request_ptr(safe_request_ptr_t *pd);
 
-ngx_int_t nchan_maybe_send_channel_event_message(ngx_http_request_t *r, channel_event_type_t event_type) {
+static ngx_str_t evt_sub_enqueue = ngx_string("subscriber_enqueue");
+static ngx_str_t evt_sub_dequeue = ngx_string("subscriber_dequeue");
+static ngx_str_t evt_sub_recvmsg = ngx_string("subscriber_receive_message");
+static ngx_str_t evt_sub_recvsts = ngx_string("subscriber_receive_status");
+static ngx_str_t evt_chan_publish= ngx_string("channel_publish");
+static ngx_str_t evt_chan_delete = ngx_string("channel_delete");
+
+static ngx_str_t *channel_event_names[] = {
+  [SUB_ENQUEUE] =         &evt_sub_enqueue,
+  [SUB_DEQUEUE] =         &evt_sub_dequeue,
+  [SUB_RECEIVE_MESSAGE] = &evt_sub_recvmsg,
+  [SUB_RECEIVE_STATUS] =  &evt_sub_recvsts,
+  [CHAN_PUBLISH] =        &evt_chan_publish,
+  [CHAN_DELETE] =         &evt_chan_delete
+};
+
+static ngx_int_t nchan_publish_channel_event_message(ngx_str_t *id, ngx_str_t *evstr, nchan_loc_conf_t *cf) {
   static nchan_loc_conf_t            evcf_data;
   static nchan_loc_conf_t           *evcf = NULL;
+  nchan_msg_t                        msg;
   
-  static ngx_str_t group =           ngx_string("meta");
+  ngx_memzero(&msg, sizeof(msg));
+  
+  msg.buf.temporary = 1;
+  msg.buf.memory = 1;
+  msg.buf.last_buf = 1;
+  msg.buf.pos = evstr->data;
+  msg.buf.last = evstr->data + evstr->len;
+  msg.buf.start = msg.buf.pos;
+  msg.buf.end = msg.buf.last;
+  
+  msg.id.time = 0;
+  msg.id.tag.fixed[0] = 0;
+  msg.id.tagactive = 0;
+  msg.id.tagcount = 1;
+  
+  if(evcf == NULL) {
+    evcf = &evcf_data;
+    ngx_memzero(evcf, sizeof(*evcf));
+
+    evcf->message_timeout = NCHAN_META_CHANNEL_MESSAGE_TTL;
+    evcf->max_messages = NCHAN_META_CHANNEL_MAX_MESSAGES;
+    evcf->complex_max_messages = NULL;
+    evcf->complex_message_timeout = NULL;
+    evcf->subscriber_first_message = 0;
+    evcf->channel_timeout = NCHAN_META_CHANNEL_TIMEOUT;
+  }
+  evcf->storage_engine = cf->storage_engine;
+  evcf->redis = cf->redis;
+  
+  return evcf->storage_engine->publish(id, &msg, evcf, NULL, NULL);
+}
+
+// aggregated channel events: per-channel event counts, published as one summary per interval
+typedef struct {
+  ngx_str_t            key; //meta channel id length, meta channel id, channel id
+  ngx_str_t            meta_id;
+  ngx_str_t            channel_id;
+  nchan_loc_conf_t    *cf;
+  ngx_uint_t           count[CHAN_DELETE + 1];
+  ngx_event_t          timer;
+} channel_event_summary_t;
+
+static rbtree_seed_t   channel_event_summaries;
+static int             channel_event_summaries_initialized = 0;
+
+static void *channel_event_summary_id(void *d) {
+  return &((channel_event_summary_t *)d)->key;
+}
+
+static void channel_event_summary_publish(channel_event_summary_t *summary) {
+  static ngx_str_t           evt_summary = ngx_string("channel_summary");
+  u_char                    *buf, *cur;
+  size_t                     sz;
+  ngx_str_t                  evstr;
+  int                        i;
+  
+  sz = evt_summary.len + 1 + summary->channel_id.len;
+  for(i = SUB_ENQUEUE; i <= CHAN_DELETE; i++) {
+    sz += 1 + channel_event_names[i]->len + 1 + NGX_INT_T_LEN;
+  }
   
-  static ngx_str_t evt_sub_enqueue = ngx_string("subscriber_enqueue");
-  static ngx_str_t evt_sub_dequeue = ngx_string("subscriber_dequeue");
-  static ngx_str_t evt_sub_recvmsg = ngx_string("subscriber_receive_message");
-  static ngx_str_t evt_sub_recvsts = ngx_string("subscriber_receive_status");
-  static ngx_str_t evt_chan_publish= ngx_string("channel_publish");
-  static ngx_str_t evt_chan_delete = ngx_string("channel_delete");
+  if((buf = ngx_alloc(sz, ngx_cycle->log)) == NULL) {
+    nchan_log_error("can't allocate channel event summary for %V", &summary->channel_id);
+  }
+  else {
+    cur = ngx_sprintf(buf, "%V %V", &evt_summary, &summary->channel_id);
+    for(i = SUB_ENQUEUE; i <= CHAN_DELETE; i++) {
+      if(i == SUB_RECEIVE_MESSAGE || i == SUB_RECEIVE_STATUS) {
+        //never emitted
+        continue;
+      }
+      cur = ngx_sprintf(cur, " %V=%ui", channel_event_names[i], summary->count[i]);
+    }
+    evstr.data = buf;
+    evstr.len = cur - buf;
+    nchan_publish_channel_event_message(&summary->meta_id, &evstr, summary->cf);
+    ngx_free(buf);
+  }
+}
+
+static void channel_event_summary_timer_handler(ngx_event_t *ev) {
+  channel_event_summary_t   *summary = ev->data;
+  
+  channel_event_summary_publish(summary);
+  
+  //start over with the next event
+  rbtree_remove_node(&channel_event_summaries, rbtree_node_from_data(summary));
+  rbtree_destroy_node(&channel_event_summaries, rbtree_node_from_data(summary));
+}
 
+static ngx_int_t nchan_aggregate_channel_event(ngx_str_t *meta_id, ngx_str_t *channel_id, channel_event_type_t event_type, nchan_loc_conf_t *cf) {
+  u_char                     keybuf[NGX_SIZE_T_LEN + 1 + NCHAN_MAX_CHANNEL_ID_LENGTH * 2];
+  ngx_str_t                  key;
+  ngx_rbtree_node_t         *node;
+  channel_event_summary_t   *summary;
+  
+  if(meta_id->len + channel_id->len > NCHAN_MAX_CHANNEL_ID_LENGTH * 2) {
+    nchan_log_error("channel id too long for aggregated channel events");
+    return NGX_ERROR;
+  }
+  key.data = keybuf;
+  key.len = ngx_sprintf(keybuf, "%uz:%V%V", meta_id->len, meta_id, channel_id) - keybuf;
+  
+  if(!channel_event_summaries_initialized) {
+    rbtree_init(&channel_event_summaries, "aggregated channel events", channel_event_summary_id, NULL, NULL);
+    channel_event_summaries_initialized = 1;
+  }
+  
+  if((node = rbtree_find_node(&channel_event_summaries, &key)) != NULL) {
+    summary = rbtree_data_from_node(node);
+  }
+  else {
+    if((node = rbtree_create_node(&channel_event_summaries, sizeof(*summary) + key.len)) == NULL) {
+      nchan_log_error("can't allocate aggregated channel events for %V", channel_id);
+      return NGX_ERROR;
+    }
+    summary = rbtree_data_from_node(node);
+    ngx_memzero(summary, sizeof(*summary));
+    summary->key.data = (u_char *)&summary[1];
+    summary->key.len = key.len;
+    ngx_memcpy(summary->key.data, key.data, key.len);
+    summary->channel_id.len = channel_id->len;
+    summary->channel_id.data = summary->key.data + key.len - channel_id->len;
+    summary->meta_id.len = meta_id->len;
+    summary->meta_id.data = summary->channel_id.data - meta_id->len;
+    summary->cf = cf;
+    nchan_init_timer(&summary->timer, channel_event_summary_timer_handler, summary);
+    rbtree_insert_node(&channel_event_summaries, node);
+    ngx_add_timer(&summary->timer, cf->channel_events_aggregate_interval);
+  }
+  
+  summary->count[event_type]++;
+  
+  return NGX_OK;
+}
+
+static ngx_int_t channel_event_summary_shutdown_walker(rbtree_seed_t *seed, void *node_data, void *privdata) {
+  channel_event_summary_t   *summary = node_data;
+  if(summary->timer.timer_set) {
+    ngx_del_timer(&summary->timer);
+  }
+  //publish whatever was counted so far rather than lose it
+  channel_event_summary_publish(summary);
+  return NGX_OK;
+}
+
+ngx_int_t nchan_channel_event_summaries_shutdown(void) {
+  if(channel_event_summaries_initialized) {
+    rbtree_empty(&channel_event_summaries, channel_event_summary_shutdown_walker, NULL);
+    channel_event_summaries_initialized = 0;
+  }
+  return NGX_OK;
+}
+
+ngx_int_t nchan_maybe_send_channel_event_message(ngx_http_request_t *r, channel_event_type_t event_type) {
+  static ngx_str_t group =           ngx_string("meta");
+  
   nchan_loc_conf_t          *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
   ngx_http_complex_value_t  *cv = cf->channel_events_channel_id;
   if(cv==NULL) {
@@ -76,28 +246,8 @@ ngx_int_t nchan_maybe_send_channel_event_message(ngx_http_request_t *r, channel_
   ngx_str_t                 *id;
   u_char                    *cur;
   ngx_str_t                  evstr;
-  nchan_msg_t                msg;
   
-  switch(event_type) {
-    case SUB_ENQUEUE:
-      ctx->channel_event_name = &evt_sub_enqueue;
-      break;
-    case SUB_DEQUEUE:
-      ctx->channel_event_name = &evt_sub_dequeue;
-      break;
-    case SUB_RECEIVE_MESSAGE:
-      ctx->channel_event_name = &evt_sub_recvmsg;
-      break;
-    case SUB_RECEIVE_STATUS:
-      ctx->channel_event_name = &evt_sub_recvsts;
-      break;
-    case CHAN_PUBLISH:
-      ctx->channel_event_name = &evt_chan_publish;
-      break;
-    case CHAN_DELETE:
-      ctx->channel_event_name = &evt_chan_delete;
-      break;
-  }
+  ctx->channel_event_name = channel_event_names[event_type];
   
   //the id
   ngx_http_complex_value(r, cv, &tmpid); 
@@ -115,40 +265,14 @@ ngx_int_t nchan_maybe_send_channel_event_message(ngx_http_request_t *r, channel_
   cur++;
   ngx_memcpy(cur, tmpid.data, tmpid.len);
   
+  if(cf->channel_events_aggregate_interval > 0) {
+    return nchan_aggregate_channel_event(id, &ctx->channel_id[0], event_type, cf);
+  }
   
   //the event message
   ngx_http_complex_value(r, cf->channel_event_string, &evstr);
   
-  ngx_memzero(&msg, sizeof(msg));
-  
-  msg.buf.temporary = 1;
-  msg.buf.memory = 1;
-  msg.buf.last_buf = 1;
-  msg.buf.pos = evstr.data;
-  msg.buf.last = evstr.data + evstr.len;
-  msg.buf.start = msg.buf.pos;
-  msg.buf.end = msg.buf.last;
-  
-  msg.id.time = 0;
-  msg.id.tag.fixed[0] = 0;
-  msg.id.tagactive = 0;
-  msg.id.tagcount = 1;
-  
-  if(evcf == NULL) {
-    evcf = &evcf_data;
-    ngx_memzero(evcf, sizeof(*evcf));
-
-    evcf->message_timeout = NCHAN_META_CHANNEL_MESSAGE_TTL;
-    evcf->max_messages = NCHAN_META_CHANNEL_MAX_MESSAGES;
-    evcf->complex_max_messages = NULL;
-    evcf->complex_message_timeout = NULL;
-    evcf->subscriber_first_message = 0;
-    evcf->channel_timeout = NCHAN_META_CHANNEL_TIMEOUT;
-  }
-  evcf->storage_engine = cf->storage_engine;
-  evcf->redis = cf->redis;
-  
-  evcf->storage_engine->publish(id, &msg, evcf, NULL, NULL);
+  nchan_publish_channel_event_message(id, &evstr, cf);
   
   return NGX_OK;
 }
@@ -239,6 +363,7 @@ ngx_int_t nchan_stub_status_handler(ngx_http_request_t *r) {
   nchan_main_conf_t   *mcf = ngx_http_get_module_main_conf(r, ngx_nchan_module);
   
   float                shmem_used, shmem_max;
+  size_t               sz;
   
   char     *buf_fmt = "total published messages: %ui\n"
                       "stored messages: %ui\n"
@@ -255,7 +380,8 @@ ngx_int_t nchan_stub_status_handler(ngx_http_request_t *r) {
                       "total interprocess receive delay: %ui\n"
                       "nchan version: %s\n";
   
-  if ((b = ngx_pcalloc(r->pool, sizeof(*b) + 800)) == NULL) {
+  sz = 800 + redis_store_node_stats_size() + nchan_latency_stub_status_size() + nchan_footprint_stub_status_size();
+  if ((b = ngx_pcalloc(r->pool, sizeof(*b) + sz)) == NULL) {
     nchan_log_request_error(r, "Failed to allocate response buffer for nchan_stub_status.");
     return NGX_HTTP_INTERNAL_SERVER_ERROR;
   }
@@ -269,6 +395,9 @@ ngx_int_t nchan_stub_status_handler(ngx_http_request_t *r) {
   b->pos = b->start;
   
   b->end = ngx_snprintf(b->start, 800, buf_fmt, stats->total_published_messages, stats->messages, shmem_used, shmem_max, stats->channels, stats->subscribers, stats->redis_pending_commands, stats->redis_connected_servers, stats->ipc_total_alerts_received, stats->ipc_total_alerts_sent - stats->ipc_total_alerts_received, stats->ipc_queue_size, stats->ipc_total_send_delay, stats->ipc_total_receive_delay, NCHAN_VERSION);
+  b->end = redis_store_node_stats_write(b->end, b->start + sz);
+  b->end = nchan_latency_stub_status_write(b->end, b->start + sz);
+  b->end = nchan_footprint_stub_status_write(b->end, b->start + sz);
   b->last = b->end;
 
   b->memory = 1;
@@ -480,11 +609,6 @@ ngx_int_t nchan_pubsub_handler(ngx_http_request_t *r) {
   nchan_request_ctx_t    *ctx;
   nchan_group_limits_t    group_limits;
   
-#if NCHAN_BENCHMARK
-  struct timeval          tv;
-  ngx_gettimeofday(&tv);
-#endif
-  
   if(r->connection && (r->connection->read->eof || r->connection->read->pending_eof)) {
     ngx_http_finalize_request(r, NGX_HTTP_CLIENT_CLOSED_REQUEST);
     return NGX_ERROR;
@@ -495,10 +619,6 @@ ngx_int_t nchan_pubsub_handler(ngx_http_request_t *r) {
   }
   ngx_http_set_ctx(r, ctx, ngx_nchan_module);
 
-#if NCHAN_BENCHMARK
-  ctx->start_tv = tv;
-#endif
-  
   //X-Accel-Redirected requests get their method mangled to GET. De-mangle it if necessary
   if(r->upstream && r->upstream->headers_in.x_accel_redirect) {
     //yep, we got x-accel-redirected. what was the original method?...
@@ -749,12 +869,13 @@ static ngx_int_t publish_callback(ngx_int_t status, void *data, safe_request_ptr
   }
   ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
   
-  //DBG("publish_callback %V owner %i status %i", ch_id, memstore_channel_owner(ch_id), status);
+  //DBG("publish_callback %V owner %i status %i", ch_id, memstore_channel_owner(ch_id, NULL), status);
   switch(status) {
     case NCHAN_MESSAGE_QUEUED:
       //message was queued successfully, but there were no subscribers to receive it.
       ctx->prev_msg_id = ctx->msg_id;
       ctx->msg_id = ch != NULL ? ch->last_published_msg_id : empty_msgid;
+      nchan_latency_record(NCHAN_LATENCY_PUBLISH_STORED, ctx->latency_start);
       
       nchan_maybe_send_channel_event_message(r, CHAN_PUBLISH);
       nchan_http_finalize_request(r, nchan_response_channel_ptr_info(ch, r, NGX_HTTP_ACCEPTED));
@@ -764,6 +885,7 @@ static ngx_int_t publish_callback(ngx_int_t status, void *data, safe_request_ptr
       //message was queued successfully, and it was already sent to at least one subscriber
       ctx->prev_msg_id = ctx->msg_id;
       ctx->msg_id = ch != NULL ? ch->last_published_msg_id : empty_msgid;
+      nchan_latency_record(NCHAN_LATENCY_PUBLISH_STORED, ctx->latency_start);
       
       nchan_maybe_send_channel_event_message(r, CHAN_PUBLISH);
       nchan_http_finalize_request(r, nchan_response_channel_ptr_info(ch, r, NGX_HTTP_CREATED));
@@ -807,6 +929,7 @@ static void nchan_publisher_post_request(ngx_http_request_t *r, ngx_str_t *conte
   ngx_buf_t                      *buf;
   nchan_msg_t                    *msg;
   ngx_str_t                      *eventsource_event;
+  nchan_request_ctx_t            *ctx;
   
   safe_request_ptr_t             *pd;
 
@@ -854,15 +977,16 @@ static void nchan_publisher_post_request(ngx_http_request_t *r, ngx_str_t *conte
 #if NCHAN_MSG_LEAK_DEBUG
   msg->lbl = r->uri;
 #endif
-#if NCHAN_BENCHMARK
-  nchan_request_ctx_t            *ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
-  msg->start_tv = ctx->start_tv;
-#endif
+  msg->latency_start = nchan_latency_sample_start();
+  if((ctx = ngx_http_get_module_ctx(r, ngx_nchan_module)) != NULL) {
+    ctx->latency_start = msg->latency_start;
+  }
   nchan_deflate_message_if_needed(msg, cf, r, r->pool);
   if((pd = nchan_set_safe_request_ptr(r)) == NULL) {
     return;
   }
   
+  nchan_trace_publish(channel_id, msg);
   cf->storage_engine->publish(channel_id, msg, cf, (callback_pt) &publish_callback, pd);
   nchan_update_stub_status(total_published_messages, 1);
 #if FAKESHARD
@@ -1001,8 +1125,16 @@ static void nchan_publisher_body_handler_continued(ngx_http_request_t *r, ngx_st
 
 typedef struct {
   ngx_str_t       *ch_id;
+  ngx_str_t        cache_key;
+  ngx_uint_t       cache_flight;
 } nchan_pub_subrequest_data_t;
 
+typedef struct {
+  ngx_http_request_t   *r;
+  ngx_str_t            *ch_id;
+  ngx_http_cleanup_t   *cln;
+} nchan_pub_auth_wait_data_t;
+
 typedef struct {
   ngx_http_post_subrequest_t    psr;
   nchan_pub_subrequest_data_t   psr_data;
@@ -1012,6 +1144,15 @@ typedef struct {
 static ngx_int_t nchan_publisher_body_authorize_handler(ngx_http_request_t *r, void *data, ngx_int_t rc) {
   nchan_pub_subrequest_data_t  *d = data;
   
+  if(d->cache_key.len > 0) {
+    if(rc == NGX_OK) {
+      nchan_auth_cache_set(ngx_http_get_module_loc_conf(r->parent, ngx_nchan_module), &d->cache_key, d->cache_flight, r->headers_out.status, r);
+    }
+    else {
+      nchan_auth_cache_resolve(&d->cache_key, d->cache_flight, (rc >= 500 && rc < 600) ? rc : NGX_HTTP_INTERNAL_SERVER_ERROR);
+    }
+  }
+  
   if(rc == NGX_OK) {
     nchan_loc_conf_t    *cf = ngx_http_get_module_loc_conf(r->parent, ngx_nchan_module);
     ngx_int_t            code = r->headers_out.status;
@@ -1029,6 +1170,64 @@ static ngx_int_t nchan_publisher_body_authorize_handler(ngx_http_request_t *r, v
   return NGX_OK;
 }
 
+static void nchan_publisher_body_authorize_cached(ngx_http_request_t *r, ngx_str_t *ch_id, ngx_int_t code) {
+  nchan_loc_conf_t    *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  if(code >= 200 && code <299) {
+    nchan_publisher_body_handler_continued(r, ch_id, cf);
+  }
+  else if(code >= 500 && code < 600) {
+    nchan_http_finalize_request(r, code);
+  }
+  else {
+    nchan_http_finalize_request(r, NGX_HTTP_FORBIDDEN);
+  }
+}
+
+static void nchan_publisher_body_authorize_wait_cleanup(void *data) {
+  nchan_pub_auth_wait_data_t   *wd = data;
+  wd->r = NULL; //request's gone, don't bother with it when the authorization comes in
+}
+
+static ngx_int_t nchan_publisher_body_authorize_wait_callback(ngx_int_t code, void *unused, void *data) {
+  nchan_pub_auth_wait_data_t   *wd = data;
+  ngx_http_request_t           *r = wd->r;
+  ngx_str_t                    *ch_id = wd->ch_id;
+  
+  if(r) {
+    wd->cln->handler = NULL;
+  }
+  ngx_free(wd);
+  if(r) {
+    nchan_publisher_body_authorize_cached(r, ch_id, code);
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t nchan_publisher_body_authorize_wait(ngx_http_request_t *r, ngx_str_t *ch_id, ngx_str_t *cache_key, ngx_uint_t *cache_flight) {
+  nchan_pub_auth_wait_data_t   *wd;
+  ngx_http_cleanup_t           *cln;
+  
+  if((wd = ngx_alloc(sizeof(*wd), ngx_cycle->log)) == NULL) {
+    return NGX_DECLINED;
+  }
+  if((cln = ngx_http_cleanup_add(r, 0)) == NULL) {
+    ngx_free(wd);
+    return NGX_DECLINED;
+  }
+  wd->r = r;
+  wd->ch_id = ch_id;
+  wd->cln = cln;
+  cln->data = wd;
+  cln->handler = NULL;
+  
+  if(nchan_auth_cache_wait(cache_key, (callback_pt )nchan_publisher_body_authorize_wait_callback, wd, cache_flight) == NGX_OK) {
+    cln->handler = nchan_publisher_body_authorize_wait_cleanup;
+    return NGX_OK;
+  }
+  ngx_free(wd);
+  return NGX_DECLINED;
+}
+
 static void nchan_publisher_unavailable_body_handler(ngx_http_request_t *r) {
   nchan_http_finalize_request(r, NGX_HTTP_SERVICE_UNAVAILABLE);
   return;
@@ -1050,9 +1249,26 @@ static void nchan_publisher_body_handler(ngx_http_request_t *r) {
   }
   else {
     nchan_pub_subrequest_stuff_t   *psr_stuff;
+    ngx_str_t                       cache_key = {0, NULL};
+    ngx_uint_t                      cache_flight = 0;
+    ngx_int_t                       cached;
+    
+    if(cf->authorize_cache.key && nchan_auth_cache_key(r, cf, PUB, r->pool, &cache_key) == NGX_OK) {
+      if((cached = nchan_auth_cache_get(&cache_key)) != NGX_DECLINED) {
+        nchan_publisher_body_authorize_cached(r, channel_id, cached);
+        return;
+      }
+      if(nchan_publisher_body_authorize_wait(r, channel_id, &cache_key, &cache_flight) == NGX_OK) {
+        //an identical request is already underway
+        return;
+      }
+    }
     
     if((psr_stuff = ngx_palloc(r->pool, sizeof(*psr_stuff))) == NULL) {
       nchan_log_request_error(r, "can't allocate memory for publisher auth subrequest");
+      if(cache_key.len > 0) {
+        nchan_auth_cache_resolve(&cache_key, cache_flight, NGX_HTTP_INTERNAL_SERVER_ERROR);
+      }
       nchan_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
       return;
     }
@@ -1068,6 +1284,8 @@ static void nchan_publisher_body_handler(ngx_http_request_t *r) {
     psr->data = psrd;
     
     psrd->ch_id = channel_id;
+    psrd->cache_key = cache_key; //zero-length when there's no key, or it's not being cached
+    psrd->cache_flight = cache_flight;
     
     ngx_http_subrequest(r, &auth_request_url, NULL, &sr, psr, 0);
     
@@ -1094,27 +1312,3 @@ static void nchan_publisher_body_handler(ngx_http_request_t *r) {
     sr->header_only = 1;
   }
 }
-
-#if NCHAN_BENCHMARK
-int nchan_timeval_subtract(struct timeval *result, struct timeval *x, struct timeval *y) {
-  /* Perform the carry for the later subtraction by updating y. */
-  if (x->tv_usec < y->tv_usec) {
-    int nsec = (y->tv_usec - x->tv_usec) / 1000000 + 1;
-    y->tv_usec -= 1000000 * nsec;
-    y->tv_sec += nsec;
-  }
-  if (x->tv_usec - y->tv_usec > 1000000) {
-    int nsec = (x->tv_usec - y->tv_usec) / 1000000;
-    y->tv_usec += 1000000 * nsec;
-    y->tv_sec -= nsec;
-  }
-
-  /* Compute the time remaining to wait.
-     tv_usec is certainly positive. */
-  result->tv_sec = x->tv_sec - y->tv_sec;
-  result->tv_usec = x->tv_usec - y->tv_usec;
-
-  /* Return 1 if result is negative. */
-  return x->tv_sec < y->tv_sec;
-}
-#endif
@@ -3,7 +3,6 @@
 //#define NCHAN_SUBSCRIBER_LEAK_DEBUG 1
 //#define NCHAN_MSG_RESERVE_DEBUG 1
 //#define NCHAN_MSG_LEAK_DEBUG 1
-//#define NCHAN_BENCHMARK 1
 
 //debugging config
 //#define FAKESHARD 1
@@ -35,6 +34,7 @@
 #include <util/nchan_msg.h>
 #include <util/nchan_output.h>
 #include <util/nchan_debug.h>
+#include <util/nchan_timer_wheel.h>
 
 extern ngx_pool_t *nchan_pool;
 extern ngx_int_t nchan_worker_processes;
@@ -51,16 +51,13 @@ time_t nchan_loc_conf_message_timeout(nchan_loc_conf_t *cf);
 ngx_int_t nchan_loc_conf_max_messages(nchan_loc_conf_t *cf);
 
 ngx_int_t nchan_maybe_send_channel_event_message(ngx_http_request_t *, channel_event_type_t);
+ngx_int_t nchan_channel_event_summaries_shutdown(void);
 
 #define nchan_update_stub_status(counter_name, count) __memstore_update_stub_status(offsetof(nchan_stub_status_t, counter_name), count)
 void __memstore_update_stub_status(off_t offset, int count);
 nchan_stub_status_t *nchan_get_stub_status_stats(void);
 size_t nchan_get_used_shmem(void);
 
-#if NCHAN_BENCHMARK
-int nchan_timeval_subtract(struct timeval *result, struct timeval *x, struct timeval *y);
-#endif
-
 #define nchan_log(level, log, errno, fmt, args...) ngx_log_error(level, log, errno, "nchan: " fmt, ##args)
 #define nchan_log_notice(fmt, args...) nchan_log(NGX_LOG_NOTICE, ngx_cycle->log, 0, fmt, ##args)
 #define nchan_log_warning(fmt, args...) nchan_log(NGX_LOG_WARN, ngx_cycle->log, 0, fmt, ##args)
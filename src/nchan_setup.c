@@ -4,6 +4,10 @@
 #include <nchan_variables.h>
 #include <store/memory/store.h>
 #include <store/redis/store.h>
+#include <util/nchan_benchmark.h>
+#include <util/nchan_simulation.h>
+#include <util/nchan_metrics.h>
+#include <util/nchan_trace.h>
 #if (NGX_ZLIB)
 #include <zlib.h>
 #endif
@@ -50,10 +54,44 @@ static ngx_int_t nchan_init_worker(ngx_cycle_t *cycle) {
   nchan_websocket_publisher_llist_init();
   nchan_output_init();
   
+  //a trace file that can't be opened is logged, and just leaves tracing off
+  nchan_trace_init_worker(cycle);
+  
   return NGX_OK;
 }
 
 static ngx_int_t nchan_postconfig(ngx_conf_t *cf) {
+  nchan_main_conf_t  *mcf = ngx_http_conf_get_module_main_conf(cf, ngx_nchan_module);
+  
+  if(mcf->latency_sampling == NGX_CONF_UNSET) {
+    mcf->latency_sampling = NCHAN_DEFAULT_LATENCY_SAMPLING;
+  }
+  nchan_latency_set_sampling(mcf->latency_sampling);
+  
+  if(mcf->hot_channels_window == NGX_CONF_UNSET) {
+    mcf->hot_channels_window = NCHAN_DEFAULT_HOT_CHANNELS_WINDOW;
+  }
+  nchan_hot_channels_set_window(mcf->hot_channels_window);
+  
+  if(mcf->stall_threshold == NGX_CONF_UNSET_MSEC) {
+    mcf->stall_threshold = NCHAN_DEFAULT_STALL_THRESHOLD;
+  }
+  nchan_stall_set_threshold(mcf->stall_threshold);
+  
+  if(mcf->trace_size == NGX_CONF_UNSET_SIZE) {
+    mcf->trace_size = NCHAN_DEFAULT_TRACE_SIZE;
+  }
+  if(mcf->trace_path.len > 0) {
+    if(mcf->trace_size < sizeof(nchan_trace_header_t) + sizeof(nchan_trace_record_t)) {
+      ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "nchan_trace_size is too small");
+      return NGX_ERROR;
+    }
+    if(ngx_conf_full_name(cf->cycle, &mcf->trace_path, 0) != NGX_OK) {
+      return NGX_ERROR;
+    }
+  }
+  nchan_trace_set_file(&mcf->trace_path, mcf->trace_size);
+  
   if(nchan_store_memory.init_postconfig(cf)!=NGX_OK) {
     return NGX_ERROR;
   }
@@ -63,7 +101,6 @@ static ngx_int_t nchan_postconfig(ngx_conf_t *cf) {
   
 #if (NGX_ZLIB)
   if(global_zstream_needed) {
-    nchan_main_conf_t  *mcf = ngx_http_conf_get_module_main_conf(cf, ngx_nchan_module);
     nchan_common_deflate_init(mcf);
   }
 #endif
@@ -81,6 +118,11 @@ static void * nchan_create_main_conf(ngx_conf_t *cf) {
   static ngx_path_init_t nchan_temp_path = { ngx_string(NGX_HTTP_CLIENT_TEMP_PATH), { 0, 0, 0 } };
   ngx_conf_merge_path_value(cf, &mcf->message_temp_path, NULL, &nchan_temp_path);
   
+  mcf->latency_sampling = NGX_CONF_UNSET;
+  mcf->hot_channels_window = NGX_CONF_UNSET;
+  mcf->stall_threshold = NGX_CONF_UNSET_MSEC;
+  mcf->trace_size = NGX_CONF_UNSET_SIZE;
+  
   nchan_store_memory.create_main_conf(cf, mcf);
   nchan_store_redis.create_main_conf(cf, mcf);
   
@@ -103,6 +145,16 @@ static void *nchan_create_srv_conf(ngx_conf_t *cf) {
   scf->redis.optimize_target = NCHAN_REDIS_OPTIMIZE_UNSET;
   scf->redis.master_weight = NGX_CONF_UNSET;
   scf->redis.slave_weight = NGX_CONF_UNSET;
+  scf->redis.publish_batch = NGX_CONF_UNSET;
+  scf->redis.publish_batch_window = NGX_CONF_UNSET_MSEC;
+  scf->redis.sharded_pubsub = NGX_CONF_UNSET;
+  scf->redis.command_connections = NGX_CONF_UNSET;
+  scf->redis.command_max_pending = NGX_CONF_UNSET;
+  scf->redis.command_max_queued = NGX_CONF_UNSET;
+  scf->redis.latency_routing = NGX_CONF_UNSET;
+  scf->redis.replica_max_lag = NGX_CONF_UNSET_SIZE;
+  scf->redis.stream_storage = NGX_CONF_UNSET;
+  scf->redis.catch_up_concurrency = NGX_CONF_UNSET;
   return scf;
 }
 
@@ -112,6 +164,16 @@ static char *nchan_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child) {
   MERGE_UNSET_CONF(conf->redis.optimize_target, prev->redis.optimize_target, NCHAN_REDIS_OPTIMIZE_UNSET, NCHAN_REDIS_OPTIMIZE_CPU);
   ngx_conf_merge_value(conf->redis.master_weight, prev->redis.master_weight, 1);
   ngx_conf_merge_value(conf->redis.slave_weight, prev->redis.slave_weight, 1);
+  ngx_conf_merge_value(conf->redis.publish_batch, prev->redis.publish_batch, 0);
+  ngx_conf_merge_msec_value(conf->redis.publish_batch_window, prev->redis.publish_batch_window, 0);
+  ngx_conf_merge_value(conf->redis.sharded_pubsub, prev->redis.sharded_pubsub, 0);
+  ngx_conf_merge_value(conf->redis.command_connections, prev->redis.command_connections, 1);
+  ngx_conf_merge_value(conf->redis.command_max_pending, prev->redis.command_max_pending, 0);
+  ngx_conf_merge_value(conf->redis.command_max_queued, prev->redis.command_max_queued, NCHAN_DEFAULT_REDIS_COMMAND_MAX_QUEUED);
+  ngx_conf_merge_value(conf->redis.latency_routing, prev->redis.latency_routing, 0);
+  ngx_conf_merge_size_value(conf->redis.replica_max_lag, prev->redis.replica_max_lag, NCHAN_DEFAULT_REDIS_REPLICA_MAX_LAG);
+  ngx_conf_merge_value(conf->redis.stream_storage, prev->redis.stream_storage, 0);
+  ngx_conf_merge_value(conf->redis.catch_up_concurrency, prev->redis.catch_up_concurrency, NCHAN_DEFAULT_REDIS_CATCH_UP_CONCURRENCY);
   return NGX_CONF_OK;
 }
 
@@ -137,9 +199,20 @@ static void *nchan_create_loc_conf(ngx_conf_t *cf) {
   lcf->shared_data_index=NGX_CONF_UNSET;
   
   lcf->authorize_request_url = NULL;
+  lcf->authorize_cache.key = NULL;
+  lcf->authorize_cache.ttl = NGX_CONF_UNSET;
   lcf->publisher_upstream_request_url = NULL;
   lcf->unsubscribe_request_url = NULL;
   lcf->subscribe_request_url = NULL;
+  lcf->subscriber_presence_batch.interval = NGX_CONF_UNSET_MSEC;
+  lcf->subscriber_presence_batch.size = NGX_CONF_UNSET;
+  lcf->benchmark.time = NGX_CONF_UNSET;
+  lcf->benchmark.channels = NGX_CONF_UNSET;
+  lcf->benchmark.subscribers_per_channel = NGX_CONF_UNSET;
+  lcf->benchmark.messages_per_channel_per_minute = NGX_CONF_UNSET;
+  lcf->benchmark.message_size = NGX_CONF_UNSET_SIZE;
+  lcf->simulation_script.len = 0;
+  lcf->simulation_script.data = NULL;
   lcf->channel_group = NULL;
   
   lcf->message_timeout=NGX_CONF_UNSET;
@@ -167,6 +240,7 @@ static void *nchan_create_loc_conf(ngx_conf_t *cf) {
   
   lcf->channel_events_channel_id = NULL;
   lcf->channel_event_string = NULL;
+  lcf->channel_events_aggregate_interval = NGX_CONF_UNSET_MSEC;
   
   lcf->websocket_heartbeat.enabled=NGX_CONF_UNSET;
   
@@ -342,6 +416,7 @@ static char * nchan_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
   
   MERGE_CONF(conf, prev, channel_events_channel_id);
   MERGE_CONF(conf, prev, channel_event_string);
+  ngx_conf_merge_msec_value(conf->channel_events_aggregate_interval, prev->channel_events_aggregate_interval, 0);
   
   if(conf->channel_event_string == NULL) { //still null? use the default string
     if(create_complex_value_from_ngx_str(cf, &conf->channel_event_string, &DEFAULT_CHANNEL_EVENT_STRING) == NGX_CONF_ERROR) {
@@ -354,9 +429,23 @@ static char * nchan_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
   }
 
   MERGE_CONF(conf, prev, authorize_request_url);
+  MERGE_CONF(conf, prev, authorize_cache.key);
+  ngx_conf_merge_sec_value(conf->authorize_cache.ttl, prev->authorize_cache.ttl, NCHAN_DEFAULT_AUTHORIZE_CACHE_TTL);
   MERGE_CONF(conf, prev, publisher_upstream_request_url);
   MERGE_CONF(conf, prev, unsubscribe_request_url);
   MERGE_CONF(conf, prev, subscribe_request_url);
+  ngx_conf_merge_msec_value(conf->subscriber_presence_batch.interval, prev->subscriber_presence_batch.interval, 0);
+  ngx_conf_merge_value(conf->subscriber_presence_batch.size, prev->subscriber_presence_batch.size, NCHAN_DEFAULT_SUBSCRIBER_PRESENCE_BATCH_SIZE);
+  ngx_conf_merge_sec_value(conf->benchmark.time, prev->benchmark.time, NCHAN_DEFAULT_BENCHMARK_TIME);
+  ngx_conf_merge_value(conf->benchmark.channels, prev->benchmark.channels, NCHAN_DEFAULT_BENCHMARK_CHANNELS);
+  ngx_conf_merge_value(conf->benchmark.subscribers_per_channel, prev->benchmark.subscribers_per_channel, NCHAN_DEFAULT_BENCHMARK_SUBSCRIBERS_PER_CHANNEL);
+  ngx_conf_merge_value(conf->benchmark.messages_per_channel_per_minute, prev->benchmark.messages_per_channel_per_minute, NCHAN_DEFAULT_BENCHMARK_MESSAGES_PER_CHANNEL_PER_MINUTE);
+  ngx_conf_merge_size_value(conf->benchmark.message_size, prev->benchmark.message_size, NCHAN_DEFAULT_BENCHMARK_MESSAGE_SIZE);
+  if(conf->benchmark.channels < 1 || conf->benchmark.subscribers_per_channel < 0 || conf->benchmark.messages_per_channel_per_minute < 1) {
+    ngx_conf_log_error(NGX_LOG_ERR, cf, 0, "nchan_benchmark needs at least 1 channel and 1 message per channel per minute");
+    return NGX_CONF_ERROR;
+  }
+  ngx_conf_merge_str_value(conf->simulation_script, prev->simulation_script, "");
   MERGE_CONF(conf, prev, channel_group);
   
   MERGE_CONF(conf, prev, group.max_channels);
@@ -771,6 +860,8 @@ static char *nchan_conf_deflate_compression_memlevel_directive(ngx_conf_t *cf, n
 
 
 static void nchan_exit_worker(ngx_cycle_t *cycle) {
+  //before the stores go away, so the final summaries can still be published
+  nchan_channel_event_summaries_shutdown();
   if(global_redis_enabled) {
     redis_store_prepare_to_exit_worker();
   }
@@ -779,6 +870,9 @@ static void nchan_exit_worker(ngx_cycle_t *cycle) {
     nchan_store_redis.exit_worker(cycle);
   }
   nchan_output_shutdown();
+  nchan_trace_exit_worker();
+  nchan_auth_cache_shutdown();
+  nchan_presence_batch_shutdown();
 #if (NGX_ZLIB)
   if(global_zstream_needed) {
     nchan_common_deflate_shutdown();
@@ -1037,6 +1131,49 @@ static char *ngx_conf_set_redis_subscribe_weights(ngx_conf_t *cf, ngx_command_t
   return NGX_CONF_OK;
 }
 
+static char *ngx_conf_set_redis_command_connections(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+  ngx_int_t  connections;
+  ngx_int_t  max_pending = NGX_CONF_UNSET;
+  ngx_int_t  max_queued = NGX_CONF_UNSET;
+  ngx_str_t *val = cf->args->elts;
+  ngx_str_t *cur;
+  unsigned   i;
+  nchan_srv_conf_t *scf = conf;
+  
+  connections = ngx_atoi(val[1].data, val[1].len);
+  if(connections == NGX_ERROR || connections < 1 || connections > NCHAN_REDIS_MAX_COMMAND_CONNECTIONS) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid number of connections for %V: %V. Must be between 1 and %i", &cmd->name, &val[1], (ngx_int_t )NCHAN_REDIS_MAX_COMMAND_CONNECTIONS);
+    return NGX_CONF_ERROR;
+  }
+  
+  for(i=2; i < cf->args->nelts; i++) {
+    cur = &val[i];
+    if(nchan_str_after(&cur, "max_pending=")) {
+      if((max_pending = ngx_atoi(cur->data, cur->len)) == NGX_ERROR) {
+        return "has invalid max_pending value";
+      }
+    }
+    else if(nchan_str_after(&cur, "max_queued=")) {
+      if((max_queued = ngx_atoi(cur->data, cur->len)) == NGX_ERROR) {
+        return "has invalid max_queued value";
+      }
+    }
+    else {
+      return "has unexpected parameter";
+    }
+  }
+  
+  scf->redis.command_connections = connections;
+  if(max_pending != NGX_CONF_UNSET) {
+    scf->redis.command_max_pending = max_pending;
+  }
+  if(max_queued != NGX_CONF_UNSET) {
+    scf->redis.command_max_queued = max_queued;
+  }
+  
+  return NGX_CONF_OK;
+}
+
 static char *ngx_conf_set_redis_optimize_target(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
   ngx_str_t          *val = &((ngx_str_t *) cf->args->elts)[1];
   nchan_srv_conf_t   *scf = conf;
@@ -1052,6 +1189,44 @@ static char *ngx_conf_set_redis_optimize_target(ngx_conf_t *cf, ngx_command_t *c
   return NGX_CONF_OK;
 }
 
+static char *ngx_conf_set_redis_catch_up_concurrency(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+  ngx_str_t          *val = &((ngx_str_t *) cf->args->elts)[1];
+  nchan_srv_conf_t   *scf = conf;
+  ngx_int_t           n;
+  if(scf->redis.catch_up_concurrency != NGX_CONF_UNSET) {
+    return "is duplicate";
+  }
+  n = ngx_atoi(val->data, val->len);
+  if(n == NGX_ERROR || n < 1) {
+    return "invalid value, must be a number greater than 0";
+  }
+  scf->redis.catch_up_concurrency = n;
+  return NGX_CONF_OK;
+}
+
+static char *ngx_conf_set_redis_publish_batch(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+  ngx_str_t          *val = &((ngx_str_t *) cf->args->elts)[1];
+  nchan_srv_conf_t   *scf = conf;
+  ngx_msec_t          window;
+  if(nchan_strmatch(val, 1, "off")) {
+    scf->redis.publish_batch = 0;
+    scf->redis.publish_batch_window = 0;
+  }
+  else if(nchan_strmatch(val, 1, "on")) {
+    scf->redis.publish_batch = 1;
+    scf->redis.publish_batch_window = 0;
+  }
+  else {
+    window = ngx_parse_time(val, 0);
+    if(window == (ngx_msec_t) NGX_ERROR) {
+      return "invalid value, must be \"on\", \"off\", or a time interval";
+    }
+    scf->redis.publish_batch = 1;
+    scf->redis.publish_batch_window = window;
+  }
+  return NGX_CONF_OK;
+}
+
 static char *ngx_conf_enable_redis(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
   char                *rc;
   ngx_flag_t          *fp;
@@ -1080,11 +1255,52 @@ static char *ngx_conf_enable_redis(ngx_conf_t *cf, ngx_command_t *cmd, void *con
 
 static char *nchan_stub_status_directive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
   nchan_loc_conf_t    *lcf = conf;
+  ngx_str_t           *val;
   nchan_stub_status_enabled = 1;
   lcf->request_handler = &nchan_stub_status_handler;
+  lcf->stub_status_format = NCHAN_STUB_STATUS_TEXT;
+  
+  if(cf->args->nelts > 1) {
+    val = &((ngx_str_t *) cf->args->elts)[1];
+    if(nchan_strmatch(val, 1, "json")) {
+      lcf->stub_status_format = NCHAN_STUB_STATUS_JSON;
+      lcf->request_handler = &nchan_metrics_handler;
+    }
+    else if(nchan_strmatch(val, 2, "prometheus", "openmetrics")) {
+      lcf->stub_status_format = NCHAN_STUB_STATUS_PROMETHEUS;
+      lcf->request_handler = &nchan_metrics_handler;
+    }
+    else if(!nchan_strmatch(val, 1, "text")) {
+      ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid %V value: %V", &cmd->name, val);
+      return NGX_CONF_ERROR;
+    }
+  }
+  return NGX_CONF_OK;
+}
+
+static char *nchan_benchmark_directive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+  nchan_loc_conf_t    *lcf = conf;
+  lcf->request_handler = &nchan_benchmark_handler;
   return NGX_CONF_OK;
 }
 
+static char *nchan_simulation_directive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+#if FAKESHARD
+  nchan_loc_conf_t    *lcf = conf;
+  ngx_str_t           *value = cf->args->elts;
+  
+  lcf->simulation_script = value[1];
+  if(ngx_conf_full_name(cf->cycle, &lcf->simulation_script, 1) != NGX_OK) {
+    return NGX_CONF_ERROR;
+  }
+  lcf->request_handler = &nchan_simulation_handler;
+  return NGX_CONF_OK;
+#else
+  ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "%V needs Nchan built with FAKESHARD", &cmd->name);
+  return NGX_CONF_ERROR;
+#endif
+}
+
 
 static ngx_int_t nchan_upstream_dummy_roundrobin_init(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us) {
   return NGX_OK;
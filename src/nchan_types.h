@@ -12,6 +12,8 @@ typedef enum {INACTIVE, NOTREADY, WAITING, STUBBED, READY, DELETED} chanhead_pub
 
 typedef enum {NCHAN_CONTENT_TYPE_PLAIN, NCHAN_CONTENT_TYPE_JSON, NCHAN_CONTENT_TYPE_XML, NCHAN_CONTENT_TYPE_YAML, NCHAN_CONTENT_TYPE_HTML} nchan_content_type_t;
 
+typedef enum {NCHAN_STUB_STATUS_TEXT = 0, NCHAN_STUB_STATUS_JSON, NCHAN_STUB_STATUS_PROMETHEUS} nchan_stub_status_format_t;
+
 typedef enum {REDIS_MODE_CONF_UNSET = NGX_CONF_UNSET, REDIS_MODE_BACKUP = 1, REDIS_MODE_DISTRIBUTED = 2} nchan_redis_storage_mode_t;
 
 typedef enum {
@@ -21,8 +23,16 @@ typedef enum {
 //on with the declarations
 typedef struct {
   size_t                          shm_size;
+  ngx_msec_t                      shm_compaction_interval;
   ngx_msec_t                      redis_fakesub_timer_interval;
   size_t                          redis_publish_message_msgkey_size;
+  size_t                          redis_message_cache_size;
+  ngx_int_t                       redis_connection_workers;
+  ngx_int_t                       latency_sampling;
+  time_t                          hot_channels_window;
+  ngx_msec_t                      stall_threshold;
+  ngx_str_t                       trace_path;
+  size_t                          trace_size;
 #if (NGX_ZLIB)
   struct {
                                     int level;
@@ -122,6 +132,7 @@ struct nchan_msg_s {
   
   ngx_atomic_int_t                refcount;
   nchan_msg_t                    *parent;
+  nchan_msg_t                    *shared_body; //shm message whose contents this one borrows (multi-channel publishing, Redis PUBSUB messages)
   nchan_compressed_msg_t         *compressed;
   //struct nchan_msg_s             *reload_next;
   
@@ -135,9 +146,7 @@ struct nchan_msg_s {
   struct nchan_msg_s             *dbg_prev;
   struct nchan_msg_s             *dbg_next;
 #endif
-#if NCHAN_BENCHMARK
-  struct timeval                  start_tv;
-#endif
+  uint64_t                        latency_start; //when it was accepted (usec), if sampled for the latency histograms. 0 otherwise
 }; // nchan_msg_t
 
 typedef struct {
@@ -187,7 +196,8 @@ typedef struct {
   ngx_atomic_int_t                messages_file_bytes;
 } nchan_group_limits_t;
 
-typedef struct {
+typedef struct nchan_group_s nchan_group_t;
+struct nchan_group_s {
   ngx_atomic_int_t               channels;
   ngx_atomic_int_t               multiplexed_channels;
   ngx_atomic_int_t               subscribers;
@@ -196,7 +206,9 @@ typedef struct {
   ngx_atomic_int_t               messages_file_bytes;
   nchan_group_limits_t           limit;
   ngx_str_t                      name;
-} nchan_group_t;
+  nchan_group_t                 *prev; //memstore's list of all groups in shm
+  nchan_group_t                 *next;
+};
 
 typedef struct{
   //init
@@ -279,6 +291,16 @@ typedef struct {
       nchan_redis_optimize_t        optimize_target;
       ngx_int_t                     master_weight;
       ngx_int_t                     slave_weight;
+      ngx_flag_t                    publish_batch;
+      ngx_msec_t                    publish_batch_window;
+      ngx_flag_t                    sharded_pubsub;
+      ngx_int_t                     command_connections;
+      ngx_int_t                     command_max_pending;
+      ngx_int_t                     command_max_queued;
+      ngx_flag_t                    latency_routing;
+      size_t                        replica_max_lag;
+      ngx_flag_t                    stream_storage;
+      ngx_int_t                     catch_up_concurrency;
   }                               redis;
 } nchan_srv_conf_t;
 
@@ -293,10 +315,28 @@ struct nchan_loc_conf_s { //nchan_loc_conf_t
   ngx_http_complex_value_t       *complex_max_messages;
   
   ngx_http_complex_value_t       *authorize_request_url;
+  struct {
+    ngx_http_complex_value_t     *key;
+    time_t                        ttl;
+  }                               authorize_cache;
   ngx_http_complex_value_t       *publisher_upstream_request_url;
   
   ngx_http_complex_value_t       *unsubscribe_request_url;
   ngx_http_complex_value_t       *subscribe_request_url;
+  struct {
+    ngx_msec_t                    interval;
+    ngx_int_t                     size;
+  }                               subscriber_presence_batch;
+  
+  struct {
+    time_t                        time;
+    ngx_int_t                     channels;
+    ngx_int_t                     subscribers_per_channel;
+    ngx_int_t                     messages_per_channel_per_minute;
+    size_t                        message_size;
+  }                               benchmark;
+  
+  ngx_str_t                       simulation_script;
   
   nchan_complex_value_arr_t       pub_chid;
   nchan_complex_value_arr_t       sub_chid;
@@ -338,6 +378,7 @@ struct nchan_loc_conf_s { //nchan_loc_conf_t
   
   ngx_http_complex_value_t       *channel_events_channel_id;
   ngx_http_complex_value_t       *channel_event_string;
+  ngx_msec_t                      channel_events_aggregate_interval;
   
   ngx_int_t                       subscribe_only_existing_channel;
   
@@ -350,6 +391,7 @@ struct nchan_loc_conf_s { //nchan_loc_conf_t
   nchan_store_t                  *storage_engine;
   
   ngx_int_t                     (*request_handler)(ngx_http_request_t *r);
+  nchan_stub_status_format_t      stub_status_format;
 };// nchan_loc_conf_t;
 
 typedef struct nchan_llist_timed_s {
@@ -426,9 +468,9 @@ typedef struct {
   
   unsigned                       sent_unsubscribe_request:1;
   unsigned                       request_ran_content_handler:1;
-#if NCHAN_BENCHMARK
-  struct timeval                 start_tv;
-#endif
+  uint64_t                       latency_start;
+  uint32_t                       trace_channel_hash; //for nchan_trace
+  uint16_t                       trace_channel_id_len;
   
 } nchan_request_ctx_t;
 
@@ -1,5 +1,6 @@
 #include <nchan_module.h>
 #include <util/nchan_output.h>
+#include <util/nchan_latency.h>
 
 //#define DEBUG_LEVEL NGX_LOG_WARN
 #define DEBUG_LEVEL NGX_LOG_DEBUG
@@ -171,6 +172,18 @@ static ngx_int_t nchan_stub_status_shared_memory_used(ngx_http_request_t *r, ngx
   return NGX_OK;
 }
 
+#define LATENCY_VARIABLE_DATA(stage, stat) ((stage) * (NCHAN_LATENCY_SAMPLES + 1) + (stat))
+
+static ngx_int_t nchan_stub_status_latency_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data) {
+  static u_char           buf[NCHAN_LATENCY_STAGES * (NCHAN_LATENCY_SAMPLES + 1)][NGX_INT64_LEN + 1];
+  nchan_latency_stage_t   stage = data / (NCHAN_LATENCY_SAMPLES + 1);
+  nchan_latency_stat_t    stat = data % (NCHAN_LATENCY_SAMPLES + 1);
+  nchan_latency_stats_t  *stats = nchan_latency_stats_merged();
+  
+  set_varval(v, buf[data], ngx_sprintf(buf[data], "%uL", nchan_latency_stat(&stats->stage[stage], stat)) - buf[data]);
+  return NGX_OK;
+}
+
 static ngx_int_t nchan_version_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t d) {
   set_varval(v, (u_char *)NCHAN_VERSION, strlen(NCHAN_VERSION));
   return NGX_OK;
@@ -184,6 +197,14 @@ static ngx_int_t nchan_version_variable(ngx_http_request_t *r, ngx_http_variable
 #define STUB_STATUS_NAMED_VARIABLE(var_name, counter) \
   {  ngx_string("nchan_stub_status_" var_name), nchan_stub_status_variable, offsetof(nchan_stub_status_t, counter) }
 
+#define STUB_STATUS_LATENCY_VARIABLES(stage_name, stage) \
+  {  ngx_string("nchan_stub_status_latency_" stage_name "_avg"), nchan_stub_status_latency_variable, LATENCY_VARIABLE_DATA(stage, NCHAN_LATENCY_AVG) }, \
+  {  ngx_string("nchan_stub_status_latency_" stage_name "_p50"), nchan_stub_status_latency_variable, LATENCY_VARIABLE_DATA(stage, NCHAN_LATENCY_P50) }, \
+  {  ngx_string("nchan_stub_status_latency_" stage_name "_p90"), nchan_stub_status_latency_variable, LATENCY_VARIABLE_DATA(stage, NCHAN_LATENCY_P90) }, \
+  {  ngx_string("nchan_stub_status_latency_" stage_name "_p99"), nchan_stub_status_latency_variable, LATENCY_VARIABLE_DATA(stage, NCHAN_LATENCY_P99) }, \
+  {  ngx_string("nchan_stub_status_latency_" stage_name "_max"), nchan_stub_status_latency_variable, LATENCY_VARIABLE_DATA(stage, NCHAN_LATENCY_MAX) }, \
+  {  ngx_string("nchan_stub_status_latency_" stage_name "_samples"), nchan_stub_status_latency_variable, LATENCY_VARIABLE_DATA(stage, NCHAN_LATENCY_SAMPLES) }
+
 
 nchan_variable_t nchan_vars[] = {
   { ngx_string("nchan_channel_id"),         nchan_channel_id_variable, 0},
@@ -210,6 +231,10 @@ nchan_variable_t nchan_vars[] = {
   STUB_STATUS_NAMED_VARIABLE("ipc_queued_alerts", ipc_queue_size),
   STUB_STATUS_NAMED_VARIABLE("total_ipc_send_delay", ipc_total_send_delay),
   STUB_STATUS_NAMED_VARIABLE("total_ipc_receive_delay", ipc_total_receive_delay),
+  STUB_STATUS_LATENCY_VARIABLES("publish_stored", NCHAN_LATENCY_PUBLISH_STORED),
+  STUB_STATUS_LATENCY_VARIABLES("publish_ipc", NCHAN_LATENCY_PUBLISH_IPC),
+  STUB_STATUS_LATENCY_VARIABLES("delivery_first", NCHAN_LATENCY_DELIVERY_FIRST),
+  STUB_STATUS_LATENCY_VARIABLES("delivery_last", NCHAN_LATENCY_DELIVERY_LAST),
   { ngx_string("nchan_version"), nchan_version_variable, 0},
   
 //  { ngx_string("nchan_message_alert_type"), nchan_message_alert_type_variable, 0},
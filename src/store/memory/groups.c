@@ -46,6 +46,7 @@ ngx_int_t shutdown_walker(rbtree_seed_t *seed, void *node_data, void *privdata)
   ngx_int_t          myslot = memstore_slot();
   DBG("shutdown_walker %V group %p", &gtn->name, gtn->group);
   if(memstore_str_owner(&gtn->name) == myslot) {
+    memstore_groups_list_remove(gtn->group);
     shm_free(shm, gtn->group);
   }
   return NGX_OK;
@@ -105,6 +106,7 @@ static group_tree_node_t *group_owner_create_node(memstore_groups_t *gp, ngx_str
     shm_free(nchan_store_memory_shmem, group);
     return NULL;
   }
+  memstore_groups_list_add(group);
   
   memstore_ipc_broadcast_group(group);
   
@@ -36,6 +36,8 @@
   L(get_group) \
   L(group) \
   L(group_delete) \
+  L(redis_relay) \
+  L(redis_relay_reply) \
   L(flood_test)
 
 
@@ -57,6 +59,19 @@ static ipc_command_codes_t ipc_cmd = {
 
 #define IPC_CMDS (sizeof(ipc_handlers_t)/sizeof(ipc_handler_pt))
 
+#define MAKE_ipc_cmd_name(val) #val,
+static const char *ipc_cmd_name[] = {
+  LIST_IPC_COMMANDS(MAKE_ipc_cmd_name)
+};
+
+const char *memstore_ipc_command_name(ngx_uint_t code) {
+  return code < IPC_CMDS ? ipc_cmd_name[code] : "unknown";
+}
+
+ngx_uint_t memstore_ipc_command_count(void) {
+  return IPC_CMDS < MEMSTORE_WORKER_STATS_IPC_CODES ? IPC_CMDS : MEMSTORE_WORKER_STATS_IPC_CODES;
+}
+
 #define ipc_cmd(cmd, dst, data) ipc_alert(nchan_memstore_get_ipc(), dst, ipc_cmd.cmd, data, sizeof(*(data)))
 #define ipc_broadcast_cmd(cmd, data) ipc_broadcast_alert(nchan_memstore_get_ipc(), ipc_cmd.cmd, data, sizeof(*(data)))
 
@@ -119,7 +134,7 @@ ngx_int_t memstore_ipc_send_subscribe(ngx_int_t dst, ngx_str_t *chid, memstore_c
   data.owner_chanhead = NULL;
   data.cf = cf;
   
-  assert(memstore_str_owner(data.shm_chid) == dst);
+  assert(memstore_channel_owner(data.shm_chid, cf) == dst);
   
   return ipc_cmd(subscribe, dst, &data);
 }
@@ -262,16 +277,16 @@ ngx_int_t memstore_ipc_send_unsubscribed(ngx_int_t dst, ngx_str_t *chid, void* p
   return ipc_cmd(unsubscribed, dst, &data);
 }
 static void receive_unsubscribed(ngx_int_t sender, unsubscribed_data_t *d) {
+  memstore_channel_head_t    *head;
   DBG("received unsubscribed request for channel %V privdata %p", d->shm_chid, d->privdata);
-  if(memstore_channel_owner(d->shm_chid) != memstore_slot()) {
-    memstore_channel_head_t    *head;
-    //find channel
-    head = nchan_memstore_find_chanhead(d->shm_chid);
-    if(head == NULL) {
-      //already deleted maybe?
-      DBG("already unsubscribed...");
-      return;
-    }
+  //find channel
+  head = nchan_memstore_find_chanhead(d->shm_chid);
+  if(head == NULL) {
+    //already deleted maybe?
+    DBG("already unsubscribed...");
+    return;
+  }
+  if(head->owner != memstore_slot()) {
     //gc if no subscribers
     if(head->total_sub_count == 0) {
       DBG("add %p to GC", head);
@@ -412,8 +427,9 @@ static void receive_publish_message(ngx_int_t sender, publish_data_t *d) {
   assert(d->shm_chid->data != NULL);
   
   DBG("IPC: received publish request for channel %V  msg %p", d->shm_chid, d->shm_msg);
+  nchan_latency_record(NCHAN_LATENCY_PUBLISH_IPC, d->shm_msg->latency_start);
   
-  if(memstore_channel_owner(d->shm_chid) == memstore_slot()) {
+  if(memstore_channel_owner(d->shm_chid, d->cf) == memstore_slot()) {
     if(d->cf->redis.enabled) {
       cd = ngx_alloc(sizeof(*cd) + sizeof(*d), ngx_cycle->log);
       cd->allocd=1;
@@ -428,6 +444,8 @@ static void receive_publish_message(ngx_int_t sender, publish_data_t *d) {
     
     cd->sender = sender;
     
+    //the message is handed over to the publish, which discards it if it can't be published
+    msg_release(d->shm_msg, "publish_message");
     nchan_store_publish_message_generic(d->shm_chid, d->shm_msg, 1, d->cf, publish_message_generic_callback, cd);
     //string will be freed on publish response
   }
@@ -440,9 +458,9 @@ static void receive_publish_message(ngx_int_t sender, publish_data_t *d) {
     }
     
     //don't deallocate shm_msg
+    msg_release(d->shm_msg, "publish_message");
   }
   
-  msg_release(d->shm_msg, "publish_message");
   str_shm_free(d->shm_chid);
   d->shm_chid=NULL;
 }
@@ -723,7 +741,7 @@ typedef struct {
 } channel_info_find_chanhead_backup_data_t;
 
 static void receive_get_channel_info_continued(ngx_int_t sender, channel_info_data_t *d, memstore_channel_head_t *head) {
-  assert(memstore_slot() == memstore_channel_owner(d->shm_chid));
+  assert(memstore_slot() == memstore_channel_owner(d->shm_chid, d->cf));
   if(head == NULL) {
     //already deleted maybe?
     DBG("channel not for for get_channel_info");
@@ -841,7 +859,7 @@ static void receive_channel_auth_check(ngx_int_t sender, channel_authcheck_data_
   
   DBG("received channel_auth_check request for channel %V privdata %p", d->shm_chid, d->privdata);
   
-  assert(memstore_slot() == memstore_channel_owner(d->shm_chid));
+  assert(memstore_slot() == memstore_channel_owner(d->shm_chid, d->cf));
   if(!d->cf->redis.enabled) {
     head = nchan_memstore_find_chanhead(d->shm_chid);
     if(head == NULL) {
@@ -1050,15 +1068,132 @@ static void receive_flood_test(ngx_int_t sender, flood_data_t *d) {
   nanosleep(&tv, NULL);
 }
 
+////////// REDIS RELAY ////////////////
+// for workers that don't connect to Redis (see nchan_redis_connection_workers).
+// the channel owner runs the Redis command, and replies with the result.
+typedef struct {
+  ngx_str_t                  *shm_chid;
+  nchan_loc_conf_t           *cf;
+  nchan_channel_t            *shm_channel_info;
+  callback_pt                 callback;
+  void                       *privdata;
+  ngx_int_t                   code; //fakesub count in the request, status code in the reply
+  memstore_redis_relay_op_t   op;
+} redis_relay_data_t;
+
+ngx_int_t memstore_ipc_send_redis_relay(ngx_int_t dst, memstore_redis_relay_op_t op, ngx_str_t *chid, nchan_loc_conf_t *cf, ngx_int_t count, callback_pt callback, void *privdata) {
+  redis_relay_data_t   data;
+  DEBUG_MEMZERO(&data);
+  
+  if((data.shm_chid = str_shm_copy(chid)) == NULL) {
+    nchan_log_ooshm_error("sending IPC redis-relay alert for channel %V", chid);
+    return NGX_DECLINED;
+  }
+  data.cf = cf;
+  data.shm_channel_info = NULL;
+  data.callback = callback;
+  data.privdata = privdata;
+  data.code = count;
+  data.op = op;
+  
+  DBG("IPC: send redis relay %i to %i ch %V", op, dst, chid);
+  return ipc_cmd(redis_relay, dst, &data);
+}
+
+typedef struct {
+  ngx_int_t              sender;
+  redis_relay_data_t     d;
+} redis_relay_callback_data_t;
+
+static ngx_int_t redis_relay_callback_handler(ngx_int_t code, void *ch, void *pd) {
+  redis_relay_callback_data_t  *dd = pd;
+  nchan_channel_t              *chan = ch;
+  nchan_channel_t              *chan_info;
+  
+  dd->d.code = code;
+  dd->d.shm_channel_info = NULL;
+  if(chan) {
+    if((chan_info = shm_alloc(nchan_store_memory_shmem, sizeof(*chan_info), "channel info for redis relay IPC response")) == NULL) {
+      dd->d.code = NGX_HTTP_INSUFFICIENT_STORAGE;
+      nchan_log_ooshm_error("sending IPC redis-relay reply for channel %V", dd->d.shm_chid);
+    }
+    else {
+      ngx_memzero(chan_info, sizeof(*chan_info));
+      chan_info->messages = chan->messages;
+      chan_info->subscribers = chan->subscribers;
+      chan_info->last_seen = chan->last_seen;
+      if(chan->last_published_msg_id.tagcount <= NCHAN_FIXED_MULTITAG_MAX) {
+        chan_info->last_published_msg_id = chan->last_published_msg_id;
+      }
+      dd->d.shm_channel_info = chan_info;
+    }
+  }
+  ipc_cmd(redis_relay_reply, dd->sender, &dd->d);
+  ngx_free(dd);
+  return NGX_OK;
+}
+
+static void receive_redis_relay(ngx_int_t sender, redis_relay_data_t *d) {
+  redis_relay_callback_data_t  *dd;
+  
+  DBG("IPC: received redis relay %i for channel %V", d->op, d->shm_chid);
+  
+  if(d->op == MEMSTORE_REDIS_RELAY_FAKESUB_ADD) {
+    nchan_store_redis_fakesub_add(d->shm_chid, d->cf, d->code, ngx_exiting || ngx_quit);
+    str_shm_free(d->shm_chid);
+    return;
+  }
+  
+  if((dd = ngx_alloc(sizeof(*dd), ngx_cycle->log)) == NULL) {
+    ERR("can't allocate redis relay callback data");
+    d->code = NGX_HTTP_INTERNAL_SERVER_ERROR;
+    d->shm_channel_info = NULL;
+    ipc_cmd(redis_relay_reply, sender, d);
+    return;
+  }
+  dd->sender = sender;
+  dd->d = *d;
+  
+  switch(d->op) {
+    case MEMSTORE_REDIS_RELAY_FIND_CHANNEL:
+      nchan_store_redis.find_channel(dd->d.shm_chid, dd->d.cf, redis_relay_callback_handler, dd);
+      break;
+    case MEMSTORE_REDIS_RELAY_DELETE_CHANNEL:
+      nchan_store_redis.delete_channel(dd->d.shm_chid, dd->d.cf, redis_relay_callback_handler, dd);
+      break;
+    default:
+      ERR("unknown redis relay op %i", d->op);
+      redis_relay_callback_handler(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, dd);
+      break;
+  }
+}
+
+static void receive_redis_relay_reply(ngx_int_t sender, redis_relay_data_t *d) {
+  DBG("IPC: received redis relay reply for channel %V", d->shm_chid);
+  if(d->callback) {
+    d->callback(d->code, d->shm_channel_info, d->privdata);
+  }
+  if(d->shm_channel_info) {
+    shm_free(nchan_store_memory_shmem, d->shm_channel_info);
+  }
+  str_shm_free(d->shm_chid);
+}
+
 #define MAKE_ipc_cmd_handler(val) [offsetof(ipc_handlers_t, val)/sizeof(ipc_handler_pt)] = (ipc_handler_pt )receive_ ## val,
 static ipc_handler_pt ipc_cmd_handler[] = {
   LIST_IPC_COMMANDS(MAKE_ipc_cmd_handler)
 };
 
 void memstore_ipc_alert_handler(ngx_int_t sender, ngx_uint_t code, void *data) {
+  uint64_t      stall_start;
   if(code >= IPC_CMDS) {
     ERR("received invalid code %ui from sender %i", code, sender);
     return;
   }
+  if(code < MEMSTORE_WORKER_STATS_IPC_CODES) {
+    memstore_update_worker_stats(ipc_alerts_received[code], 1);
+  }
+  stall_start = nchan_stall_start();
   ipc_cmd_handler[code](sender, data);
+  nchan_stall_end(NCHAN_STALL_IPC, stall_start, ipc_cmd_name[code], NULL, -1);
 }
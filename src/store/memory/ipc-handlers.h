@@ -1,5 +1,11 @@
 #include "store-private.h"
 
+typedef enum {
+  MEMSTORE_REDIS_RELAY_FIND_CHANNEL,
+  MEMSTORE_REDIS_RELAY_DELETE_CHANNEL,
+  MEMSTORE_REDIS_RELAY_FAKESUB_ADD
+} memstore_redis_relay_op_t;
+
 typedef void (*ipc_handler_pt)(ngx_int_t, void *);
 
 ngx_int_t memstore_ipc_send_subscribe(ngx_int_t owner, ngx_str_t *shm_chid, memstore_channel_head_t *, nchan_loc_conf_t *);
@@ -18,3 +24,4 @@ ngx_int_t memstore_ipc_broadcast_group(nchan_group_t *shared_group);
 ngx_int_t memstore_ipc_send_get_group(ngx_int_t dst, ngx_str_t *group_id);
 ngx_int_t memstore_ipc_broadcast_group_delete(nchan_group_t *shared_group);
 ngx_int_t memstore_ipc_send_flood_test(ngx_int_t dst);
+ngx_int_t memstore_ipc_send_redis_relay(ngx_int_t dst, memstore_redis_relay_op_t op, ngx_str_t *chid, nchan_loc_conf_t *cf, ngx_int_t count, callback_pt callback, void *privdata);
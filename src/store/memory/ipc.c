@@ -485,6 +485,9 @@ ngx_int_t ipc_alert(ipc_t *ipc, ngx_int_t slot, ngx_uint_t code, void *data, siz
     assert(0);
   }
   nchan_update_stub_status(ipc_total_alerts_sent, 1);
+  if(code < MEMSTORE_WORKER_STATS_IPC_CODES) {
+    memstore_update_worker_stats(ipc_alerts_sent[code], 1);
+  }
 #if (FAKESHARD)
   
   ipc_alert_t         alert = {0};
@@ -12,6 +12,7 @@
 #include <store/spool.h>
 
 #include <util/nchan_reaper.h>
+#include <util/nchan_slist.h>
 #include <util/nchan_debug.h>
 
 #include <store/redis/store.h>
@@ -23,6 +24,10 @@
 #define NCHAN_CHANHEAD_EXPIRE_SEC 5
 
 static ngx_int_t redis_fakesub_timer_interval;
+static ngx_msec_t shm_compaction_interval;
+static ngx_int_t redis_connection_workers = 0; //0 means all the workers
+static ngx_int_t memstore_worker_index = 0;
+memstore_worker_stats_t          *memstore_my_worker_stats = NULL;
 #define REDIS_DEFAULT_FAKESUB_TIMER_INTERVAL 100;
 
 //#define DEBUG_LEVEL NGX_LOG_WARN
@@ -51,6 +56,9 @@ typedef struct {
   
   nchan_reaper_t                  chanhead_churner;
   
+  nchan_slist_t                   fakesub_queue; //chanheads with fake subscriber count changes for Redis
+  ngx_event_t                     fakesub_timer;
+  
   ngx_int_t                       workers;
   
 #if FAKESHARD
@@ -233,6 +241,8 @@ static void memstore_reap_churned_chanhead(memstore_channel_head_t *ch) { //diff
   memstore_reap_chanhead(ch);
 }
 
+static void fakesub_timer_handler(ngx_event_t *ev);
+
 static void init_mpt(memstore_data_t *m) {
   
   nchan_reaper_start(&m->msg_reaper, 
@@ -275,6 +285,8 @@ static void init_mpt(memstore_data_t *m) {
   m->chanhead_churner.strategy = KEEP_PLACE;
   m->chanhead_churner.max_notready_ratio = 0.10;
   
+  nchan_slist_init(&m->fakesub_queue, memstore_channel_head_t, fakesub_prev, fakesub_next);
+  nchan_init_timer(&m->fakesub_timer, fakesub_timer_handler, m);
 }
 
 static shmem_t         *shm = NULL;
@@ -392,11 +404,9 @@ void memstore_fakeprocess_push_random(void) {
 
 #endif
 
-ngx_int_t memstore_str_owner(ngx_str_t *str) {
+static ngx_int_t memstore_str_owner_among(ngx_str_t *str, ngx_int_t workers) {
   uint32_t        h;
-  ngx_int_t       workers;
   
-  workers = shdata->max_workers;
   h = ngx_crc32_short(str->data, str->len);
 #if FAKESHARD
   #ifdef ONE_FAKE_CHANNEL_OWNER
@@ -420,8 +430,34 @@ ngx_int_t memstore_str_owner(ngx_str_t *str) {
 #endif
 }
 
-ngx_int_t memstore_channel_owner(ngx_str_t *id) {
-  return nchan_channel_id_is_multi(id) ? memstore_slot() : memstore_str_owner(id);
+ngx_int_t memstore_str_owner(ngx_str_t *str) {
+  return memstore_str_owner_among(str, shdata->max_workers);
+}
+
+ngx_int_t memstore_channel_owner(ngx_str_t *id, nchan_loc_conf_t *cf) {
+  ngx_int_t       workers = shdata->max_workers;
+  
+  if(nchan_channel_id_is_multi(id)) {
+    return memstore_slot();
+  }
+  //Redis-backed channels are owned by the workers connected to Redis.
+  //check the nodeset rather than redis.enabled: memstore works on these channels with copies of the cf that have it cleared.
+  if(cf && cf->redis.nodeset && redis_connection_workers > 0 && redis_connection_workers < workers) {
+    workers = redis_connection_workers;
+  }
+  return memstore_str_owner_among(id, workers);
+}
+
+void memstore_set_redis_connection_workers(ngx_int_t n) {
+  redis_connection_workers = n;
+}
+
+int memstore_worker_connects_to_redis(void) {
+#if FAKESHARD
+  return 1;
+#else
+  return redis_connection_workers == 0 || memstore_worker_index < redis_connection_workers;
+#endif
 }
 
 #if NCHAN_MSG_LEAK_DEBUG
@@ -590,6 +626,127 @@ nchan_stub_status_t *nchan_get_stub_status_stats(void) {
   return &shdata->stats;
 }
 
+//this worker's own per-worker stats. Only this worker writes to them.
+static nchan_latency_stats_t       *memstore_my_latency_stats = NULL;
+static nchan_hot_channels_t        *memstore_my_hot_channels = NULL;
+static nchan_stall_stats_t         *memstore_my_stall_stats = NULL;
+static nchan_footprint_stats_t     *memstore_my_footprint_stats = NULL;
+
+nchan_latency_stats_t *memstore_worker_latency_stats(ngx_int_t worker) {
+  if(shdata == NULL) {
+    return NULL;
+  }
+  if(worker == -1) {
+    return memstore_my_latency_stats;
+  }
+  return worker >= 0 && worker < NGX_MAX_PROCESSES ? shdata->latency[worker] : NULL;
+}
+
+nchan_hot_channels_t *memstore_worker_hot_channels(ngx_int_t worker) {
+  if(shdata == NULL) {
+    return NULL;
+  }
+  if(worker == -1) {
+    return memstore_my_hot_channels;
+  }
+  return worker >= 0 && worker < NGX_MAX_PROCESSES ? shdata->hot_channels[worker] : NULL;
+}
+
+nchan_stall_stats_t *memstore_worker_stall_stats(ngx_int_t worker) {
+  if(shdata == NULL) {
+    return NULL;
+  }
+  if(worker == -1) {
+    return memstore_my_stall_stats;
+  }
+  return worker >= 0 && worker < NGX_MAX_PROCESSES ? shdata->stalls[worker] : NULL;
+}
+
+nchan_footprint_stats_t *memstore_worker_footprint_stats(ngx_int_t worker) {
+  if(shdata == NULL) {
+    return NULL;
+  }
+  if(worker == -1) {
+    return memstore_my_footprint_stats;
+  }
+  return worker >= 0 && worker < NGX_MAX_PROCESSES ? shdata->footprint[worker] : NULL;
+}
+
+ngx_int_t memstore_worker_count(void) {
+  return shdata ? shdata->max_workers : 0;
+}
+
+memstore_worker_stats_t *memstore_worker_stats(ngx_int_t worker) {
+  if(shdata == NULL) {
+    return NULL;
+  }
+  if(worker == -1) {
+    worker = memstore_worker_index;
+  }
+  return worker >= 0 && worker < NGX_MAX_PROCESSES ? shdata->worker_stats[worker] : NULL;
+}
+
+static int memstore_compaction_timer_handler(void *pd);
+
+static int memstore_worker_stats_timer_handler(void *pd) {
+  memstore_worker_stats_t  *stats = memstore_my_worker_stats;
+  if(stats == NULL) {
+    return 0;
+  }
+  stats->spools = spooler_total_spools();
+  stats->reaper.msg = mpt->msg_reaper.count;
+  stats->reaper.nobuffer_msg = mpt->nobuffer_msg_reaper.count;
+  stats->reaper.chanhead = mpt->chanhead_reaper.count;
+  stats->reaper.chanhead_churner = mpt->chanhead_churner.count;
+  return 1;
+}
+
+void memstore_groups_each(void (*cb)(nchan_group_t *, void *), void *pd) {
+  nchan_group_t  *cur;
+  if(shdata == NULL) {
+    return;
+  }
+  shmtx_lock(shm);
+  for(cur = shdata->groups; cur != NULL; cur = cur->next) {
+    cb(cur, pd);
+  }
+  shmtx_unlock(shm);
+}
+
+void memstore_groups_list_add(nchan_group_t *group) {
+  shmtx_lock(shm);
+  group->prev = NULL;
+  group->next = shdata->groups;
+  if(shdata->groups) {
+    shdata->groups->prev = group;
+  }
+  shdata->groups = group;
+  shmtx_unlock(shm);
+}
+
+void memstore_groups_list_remove(nchan_group_t *group) {
+  shmtx_lock(shm);
+  if(group->prev) {
+    group->prev->next = group->next;
+  }
+  else if(shdata->groups == group) {
+    shdata->groups = group->next;
+  }
+  if(group->next) {
+    group->next->prev = group->prev;
+  }
+  group->prev = group->next = NULL;
+  shmtx_unlock(shm);
+}
+
+nchan_auth_cache_shm_t *nchan_memstore_get_auth_cache(void) {
+  return shdata ? &shdata->auth_cache : NULL;
+}
+
+redis_msg_cache_shm_t *nchan_memstore_get_redis_msg_cache(void) {
+  return shdata ? &shdata->redis_msg_cache : NULL;
+}
+
 size_t nchan_get_used_shmem(void) {
 #if nginx_version <= 1011006
   return shdata->shmem_pages_used * ngx_pagesize;
@@ -598,9 +755,18 @@ size_t nchan_get_used_shmem(void) {
 #endif
 }
 
+static void redis_fakesub_add(memstore_channel_head_t *head, ngx_int_t n) {
+  if(memstore_worker_connects_to_redis()) {
+    nchan_store_redis_fakesub_add(&head->id, head->cf, n, head->shutting_down);
+  }
+  else {
+    memstore_ipc_send_redis_relay(head->owner, MEMSTORE_REDIS_RELAY_FAKESUB_ADD, &head->id, head->cf, n, NULL, NULL);
+  }
+}
+
 static int send_redis_fakesub_delta(memstore_channel_head_t *head) {
   if(head->delta_fakesubs != 0) {
-    nchan_store_redis_fakesub_add(&head->id, head->cf, head->delta_fakesubs, head->shutting_down);
+    redis_fakesub_add(head, head->delta_fakesubs);
     head->delta_fakesubs = 0;
     return 1;
   }
@@ -618,12 +784,14 @@ static void memstore_reap_chanhead(memstore_channel_head_t *ch) {
   stop_spooler(&ch->spooler, 0);
   if(ch->cf && ch->cf->redis.enabled && ch->cf->redis.storage_mode == REDIS_MODE_DISTRIBUTED && !ch->multi) {
     send_redis_fakesub_delta(ch);
-    if(ch->delta_fakesubs_timer_ev.timer_set) {
-      ngx_del_timer(&ch->delta_fakesubs_timer_ev);
+    if(ch->in_fakesub_queue) {
+      nchan_slist_remove(&mpt->fakesub_queue, ch);
+      ch->in_fakesub_queue = 0;
     }
   }
   if(ch->owner == memstore_slot()) {
     nchan_update_stub_status(channels, -1);
+    memstore_update_worker_stats(channels, -1);
     if(ch->shared)
       shm_free(shm, ch->shared);
   }
@@ -663,6 +831,67 @@ static void memstore_reap_chanhead(memstore_channel_head_t *ch) {
   ngx_free(ch);
 }
 
+//On a reload, the worker this one replaces may keep writing to the stats at this index until it exits,
+//and the hot channels' seqlock needs a single writer. So each generation gets its own, and the cumulative
+//ones pick up where the previous generation left off. Called with the shm lock held.
+static void *worker_shm_stats_replace(void **slot, size_t size, unsigned enabled, unsigned carry_over, const char *label) {
+  ngx_int_t   idx = memstore_worker_index;
+  void       *prev = *slot, *cur = NULL;
+  
+  if(prev != NULL && shdata->worker_shm_stats_generation[idx] == memstore_worker_generation) {
+    //the worker before us crashed, so nobody else is writing to these
+    return prev;
+  }
+  if(enabled && (cur = shm_locked_calloc(shm, size, label)) != NULL && prev != NULL && carry_over) {
+    ngx_memcpy(cur, prev, size);
+  }
+  if(prev != NULL && shdata->worker_shm_stats_pid[idx] == 0) {
+    //the previous generation's worker is already gone. Otherwise, it frees them itself on exit
+    shm_locked_free(shm, prev);
+  }
+  *slot = cur;
+  return cur;
+}
+
+static void worker_shm_stats_init(void) {
+  ngx_int_t   idx = memstore_worker_index;
+  
+  memstore_my_latency_stats = worker_shm_stats_replace((void **)&shdata->latency[idx], sizeof(nchan_latency_stats_t), 1, 1, "latency histograms");
+  memstore_my_hot_channels = worker_shm_stats_replace((void **)&shdata->hot_channels[idx], sizeof(nchan_hot_channels_t), nchan_hot_channels_window() > 0, 0, "hot channels");
+  memstore_my_stall_stats = worker_shm_stats_replace((void **)&shdata->stalls[idx], sizeof(nchan_stall_stats_t), nchan_stall_threshold() > 0, 1, "stall timings");
+  memstore_my_footprint_stats = worker_shm_stats_replace((void **)&shdata->footprint[idx], sizeof(nchan_footprint_stats_t), nchan_stub_status_enabled, 1, "subscriber footprints");
+  
+  shdata->worker_shm_stats_generation[idx] = memstore_worker_generation;
+  shdata->worker_shm_stats_pid[idx] = ngx_pid;
+}
+
+static void worker_shm_stats_release(void) {
+  ngx_int_t   idx = memstore_worker_index;
+  
+  if(shdata->worker_shm_stats_pid[idx] == ngx_pid) {
+    //still ours. Whoever gets this worker index next takes them over.
+    shdata->worker_shm_stats_pid[idx] = 0;
+    return;
+  }
+  //a newer worker has its own by now
+  if(memstore_my_latency_stats) {
+    shm_locked_free(shm, memstore_my_latency_stats);
+  }
+  if(memstore_my_hot_channels) {
+    shm_locked_free(shm, memstore_my_hot_channels);
+  }
+  if(memstore_my_stall_stats) {
+    shm_locked_free(shm, memstore_my_stall_stats);
+  }
+  if(memstore_my_footprint_stats) {
+    shm_locked_free(shm, memstore_my_footprint_stats);
+  }
+  memstore_my_latency_stats = NULL;
+  memstore_my_hot_channels = NULL;
+  memstore_my_stall_stats = NULL;
+  memstore_my_footprint_stats = NULL;
+}
+
 static store_message_t *create_shared_message(nchan_msg_t *m, ngx_int_t msg_already_in_shm);
 static ngx_int_t chanhead_push_message(memstore_channel_head_t *ch, store_message_t *msg);
 
@@ -711,6 +940,7 @@ static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
   assert(procslot_found == 1);
   
   mpt->workers = workers;
+  memstore_worker_index = i - memstore_procslot_offset;
   
   if(i >= workers) {
     //we're probably reloading or something
@@ -719,9 +949,27 @@ static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
   
   //reload_msgs();
   
+  worker_shm_stats_init();
+  
   DBG("shm: %p, shdata: %p", shm, shdata);
   shmtx_unlock(shm);
   
+  if(nchan_stub_status_enabled) {
+    //these are this process' counters, so they start over
+    if(shdata->worker_stats[memstore_worker_index] == NULL) {
+      shdata->worker_stats[memstore_worker_index] = shm_calloc(shm, sizeof(memstore_worker_stats_t), "worker stats");
+    }
+    if((memstore_my_worker_stats = shdata->worker_stats[memstore_worker_index]) != NULL) {
+      ngx_memzero(memstore_my_worker_stats, sizeof(*memstore_my_worker_stats));
+      memstore_my_worker_stats->pid = ngx_pid;
+      nchan_add_interval_timer(memstore_worker_stats_timer_handler, NULL, 1000);
+    }
+  }
+  
+  if(shm_compaction_interval > 0) {
+    nchan_add_interval_timer(memstore_compaction_timer_handler, NULL, shm_compaction_interval);
+  }
+  
   return NGX_OK;
 }
 
@@ -730,13 +978,17 @@ static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
 void memstore_fakesub_add(memstore_channel_head_t *head, ngx_int_t n) {
   assert(head->cf->redis.storage_mode == REDIS_MODE_DISTRIBUTED);
   if(redis_fakesub_timer_interval == 0) {
-    nchan_store_redis_fakesub_add(&head->id, head->cf, n, head->shutting_down);
+    redis_fakesub_add(head, n);
   }
   else {
     head->delta_fakesubs += n;
-    if(!head->delta_fakesubs_timer_ev.timer_set && !head->shutting_down && !ngx_exiting && !ngx_quit) {
-      //ERR("%V start fakesub timer", &head->id);
-      ngx_add_timer(&head->delta_fakesubs_timer_ev, redis_fakesub_timer_interval);
+    if(!head->in_fakesub_queue && !head->shutting_down && !ngx_exiting && !ngx_quit) {
+      //one timer for all the channels in this worker, rather than one per channel
+      nchan_slist_append(&mpt->fakesub_queue, head);
+      head->in_fakesub_queue = 1;
+      if(!mpt->fakesub_timer.timer_set) {
+        ngx_add_timer(&mpt->fakesub_timer, redis_fakesub_timer_interval);
+      }
     }
   }
 }
@@ -755,6 +1007,7 @@ static void memstore_spooler_use_handler(channel_spooler_t *spl, void *d) {
 static void memstore_spooler_add_handler(channel_spooler_t *spl, subscriber_t *sub, void *privdata) {
   memstore_channel_head_t   *head = (memstore_channel_head_t *)privdata;
   head->total_sub_count++;
+  memstore_update_worker_stats(subscribers[sub->type], 1);
   if(sub->type == INTERNAL) {
     head->internal_sub_count++;
     if(head->shared) {
@@ -791,6 +1044,7 @@ static void memstore_spooler_add_handler(channel_spooler_t *spl, subscriber_t *s
 
 static void memstore_spooler_bulk_dequeue_handler(channel_spooler_t *spl, subscriber_type_t type, ngx_int_t count, void *privdata) {
   memstore_channel_head_t   *head = (memstore_channel_head_t *)privdata;
+  memstore_update_worker_stats(subscribers[type], -count);
   if (type == INTERNAL) {
     //internal subscribers are *special* and don't really count
     head->internal_sub_count -= count;
@@ -981,17 +1235,20 @@ static int count_channel_id(ngx_str_t *id) {
   }
 }
 
-static void delta_fakesubs_timer_handler(ngx_event_t *ev) {
-  memstore_channel_head_t *head = (memstore_channel_head_t *)ev->data;
-  if(send_redis_fakesub_delta(head) && !ngx_exiting && !ngx_quit && ev->timedout) {
-    ev->timedout = 0;
-    ngx_add_timer(ev, redis_fakesub_timer_interval);
+static void fakesub_timer_handler(ngx_event_t *ev) {
+  memstore_data_t          *m = ev->data;
+  memstore_channel_head_t  *head;
+  
+  //the Redis store batches these deltas into one script call per node
+  while((head = nchan_slist_shift(&m->fakesub_queue)) != NULL) {
+    head->in_fakesub_queue = 0;
+    send_redis_fakesub_delta(head);
   }
 }
 
 static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id, nchan_loc_conf_t *cf) {
   memstore_channel_head_t      *head;
-  ngx_int_t                     owner = memstore_channel_owner(channel_id);
+  ngx_int_t                     owner = memstore_channel_owner(channel_id, cf);
   ngx_str_t                     ids[NCHAN_MULTITAG_MAX];
   ngx_int_t                     i, n = 0;
   ngx_str_t                     group_name;
@@ -1038,6 +1295,7 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
     head->shared->last_seen = ngx_time();
     head->shared->gc.outside_refcount=0;
     nchan_update_stub_status(channels, 1);
+    memstore_update_worker_stats(channels, 1);
   }
   else {
     head->shared = NULL;
@@ -1138,8 +1396,10 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
   }
   
   if(head->cf && head->cf->redis.enabled && !head->multi) { // both DISTRIBUTED and BACKUP redis storage modes
-    nchan_init_timer(&head->delta_fakesubs_timer_ev, delta_fakesubs_timer_handler, head);
     head->delta_fakesubs = 0;
+    head->fakesub_prev = NULL;
+    head->fakesub_next = NULL;
+    head->in_fakesub_queue = 0;
     head->redis_idle_cache_ttl = cf->redis_idle_channel_cache_timeout;
     
     
@@ -1396,18 +1656,9 @@ ngx_int_t nchan_memstore_publish_generic(memstore_channel_head_t *head, nchan_ms
   if(msg) {
     //DBG("tried publishing %V to chanhead %p (subs: %i)", msgid_to_str(&msg->id), head, head->total_sub_count);
     head->spooler.fn->respond_message(&head->spooler, msg);
-
-#if NCHAN_BENCHMARK
-    struct timeval          tv, diff;
-    ngx_gettimeofday(&tv);
-    nchan_timeval_subtract(&diff, &tv, &msg->start_tv);
-    
-    ngx_str_t              *msgid_str = msgid_to_str(&msg->id);
-    
-    assert(diff.tv_sec < 10);
-    
-    ERR("::BENCH:: channel %V msg %p <%V> len %i responded to %i in %l.%06l sec", &head->id, msg, msgid_str, ngx_buf_size((&msg->buf)), head->spooler.last_responded_subscriber_count, (long int)(diff.tv_sec), (long int)(diff.tv_usec));
-#endif
+    if(head->total_sub_count > 0) {
+      nchan_hot_channels_record(&head->id, NCHAN_HOT_FANOUT, head->total_sub_count);
+    }
     
     //wait what?...
     //if(msg->temp_allocd) {
@@ -1472,9 +1723,21 @@ static ngx_int_t nchan_store_delete_single_channel_id(ngx_str_t *channel_id, nch
   ngx_int_t                rc;
   
   assert(!nchan_channel_id_is_multi(channel_id));
-  owner = memstore_channel_owner(channel_id);
+  owner = memstore_channel_owner(channel_id, cf);
   
-  if(cf->redis.enabled) {
+  if(cf->redis.enabled && !memstore_worker_connects_to_redis()) {
+    if(cf->redis.storage_mode == REDIS_MODE_DISTRIBUTED) {
+      if(memstore_ipc_send_redis_relay(owner, MEMSTORE_REDIS_RELAY_DELETE_CHANNEL, channel_id, cf, 0, callback, privdata) == NGX_DECLINED) {
+        callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, privdata);
+        return NGX_ERROR;
+      }
+      return NGX_OK;
+    }
+    else {
+      memstore_ipc_send_redis_relay(owner, MEMSTORE_REDIS_RELAY_DELETE_CHANNEL, channel_id, cf, 0, NULL, NULL);
+    }
+  }
+  else if(cf->redis.enabled) {
     if(cf->redis.storage_mode == REDIS_MODE_DISTRIBUTED) {
       return nchan_store_redis.delete_channel(channel_id, cf, callback, privdata);
     }
@@ -1556,12 +1819,11 @@ static ngx_int_t nchan_memstore_force_delete_chanhead(memstore_channel_head_t *c
 ngx_int_t nchan_memstore_force_delete_channel(ngx_str_t *channel_id, callback_pt callback, void *privdata) {
   memstore_channel_head_t       *ch;
 
-  assert(memstore_channel_owner(channel_id) == memstore_slot());
-  
   if(callback == NULL) {
     callback = empty_callback;
   }
   if((ch = nchan_memstore_find_chanhead(channel_id))) {
+    assert(ch->owner == memstore_slot());
     nchan_memstore_force_delete_chanhead(ch, callback, privdata);
   }
   else {
@@ -1571,13 +1833,19 @@ ngx_int_t nchan_memstore_force_delete_channel(ngx_str_t *channel_id, callback_pt
 }
 
 static ngx_int_t nchan_store_find_channel(ngx_str_t *channel_id, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
-  ngx_int_t                    owner = memstore_channel_owner(channel_id);
+  ngx_int_t                    owner = memstore_channel_owner(channel_id, cf);
   memstore_channel_head_t     *ch;
   nchan_channel_t              chaninfo;
   
   //TODO: WORK IN PROGRESS
   
   if(cf->redis.enabled && cf->redis.storage_mode == REDIS_MODE_DISTRIBUTED) {
+    if(!memstore_worker_connects_to_redis()) {
+      if(memstore_ipc_send_redis_relay(owner, MEMSTORE_REDIS_RELAY_FIND_CHANNEL, channel_id, cf, 0, callback, privdata) == NGX_DECLINED) {
+        callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, privdata);
+      }
+      return NGX_OK;
+    }
     return nchan_store_redis.find_channel(channel_id, cf, callback, privdata);
   }
   else if(memstore_slot() == owner) {
@@ -1708,6 +1976,10 @@ static ngx_int_t nchan_store_init_postconfig(ngx_conf_t *cf) {
     conf->redis_fakesub_timer_interval = REDIS_DEFAULT_FAKESUB_TIMER_INTERVAL;
   }
   redis_fakesub_timer_interval = conf->redis_fakesub_timer_interval;
+  if(conf->shm_compaction_interval == NGX_CONF_UNSET_MSEC) {
+    conf->shm_compaction_interval = NCHAN_DEFAULT_SHM_COMPACTION_INTERVAL;
+  }
+  shm_compaction_interval = conf->shm_compaction_interval;
   
   shm = shm_create(&name, cf, conf->shm_size, initialize_shm, &ngx_nchan_module);
   nchan_store_memory_shmem = shm;
@@ -1717,6 +1989,7 @@ static ngx_int_t nchan_store_init_postconfig(ngx_conf_t *cf) {
 static void nchan_store_create_main_conf(ngx_conf_t *cf, nchan_main_conf_t *mcf) {
   mcf->shm_size=NGX_CONF_UNSET_SIZE;
   mcf->redis_fakesub_timer_interval=NGX_CONF_UNSET_MSEC;
+  mcf->shm_compaction_interval=NGX_CONF_UNSET_MSEC;
 }
 
 static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
@@ -1747,6 +2020,10 @@ static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
   
   nchan_reaper_stop(&mpt->nobuffer_msg_reaper);
   nchan_reaper_stop(&mpt->msg_reaper);
+  
+  if(mpt->fakesub_timer.timer_set) {
+    ngx_del_timer(&mpt->fakesub_timer);
+  }
 #if FAKESHARD
   memstore_fakeprocess_pop();
   }
@@ -1762,6 +2039,8 @@ static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
   
   shdata->reloading--;
   
+  worker_shm_stats_release();
+  
   //don't care if this is 'inefficient', it only happens once per worker per load
   for(i = memstore_procslot_offset; i < memstore_procslot_offset + shdata->old_max_workers; i++) {
     if(ngx_process_slot == shdata->procslot[i]) {
@@ -1815,7 +2094,7 @@ static ngx_int_t validate_chanhead_messages(memstore_channel_head_t *ch) {
   /*
   ngx_int_t              count = ch->channel.messages;
   ngx_int_t              rev_count = count;
-  ngx_int_t              owner = memstore_channel_owner(&ch->id);
+  ngx_int_t              owner = memstore_channel_owner(&ch->id, ch->cf);
   store_message_t        *cur;
   
   if(memstore_slot() == owner) {
@@ -1835,12 +2114,10 @@ static ngx_int_t validate_chanhead_messages(memstore_channel_head_t *ch) {
   return NGX_OK;
 }
 
-static void memstore_reap_message( nchan_msg_t *msg ) {
+static void memstore_free_shm_msg( nchan_msg_t *msg ) {
   ngx_buf_t         *buf = &msg->buf;
   ngx_file_t        *f = buf->file;
   
-  assert(!msg_refcount_valid(msg));
-  
   if(f != NULL) {
     if(f->fd != NGX_INVALID_FILE) {
       DBG("close fd %u ", f->fd);
@@ -1869,9 +2146,49 @@ static void memstore_reap_message( nchan_msg_t *msg ) {
   nchan_free_msg_id(&msg->prev_id);
   ngx_memset(msg, 0xFA, sizeof(*msg)); //debug stuff
   shm_free(shm, msg);
+}
+
+static void memstore_shared_body_release( nchan_msg_t *body ) {
+  ngx_atomic_fetch_add((ngx_atomic_uint_t *)&body->refcount, -1);
+  if(msg_refcount_invalidate_if_zero(body)) {
+    //last header's gone. the body's files and memory can go too.
+    memstore_free_shm_msg(body);
+  }
+}
+
+static void memstore_free_shm_msg_or_header( nchan_msg_t *msg ) {
+  nchan_msg_t       *body = msg->shared_body;
+  
+  if(body) {
+    //just a header. the contents (and files) belong to the shared body
+#if NCHAN_MSG_LEAK_DEBUG  
+    msg_debug_remove(msg);
+#endif
+    nchan_free_msg_id(&msg->id);
+    nchan_free_msg_id(&msg->prev_id);
+    ngx_memset(msg, 0xFA, sizeof(*msg)); //debug stuff
+    shm_free(shm, msg);
+    memstore_shared_body_release(body);
+  }
+  else {
+    memstore_free_shm_msg(msg);
+  }
+}
+
+static void memstore_reap_message( nchan_msg_t *msg ) {
+  assert(!msg_refcount_valid(msg));
+  memstore_free_shm_msg_or_header(msg);
   nchan_update_stub_status(messages, -1);
 }
 
+void memstore_discard_unpublished_shm_msg(nchan_msg_t *msg) {
+  //put in shm to be published, but never made it into a channel.
+  //something else may still have a hold on it though, like a worker relaying a publish through Redis
+  if(msg_refcount_invalidate_if_zero(msg)) {
+    memstore_free_shm_msg_or_header(msg);
+  }
+}
+
 static void memstore_reap_store_message( store_message_t *smsg ) {
   
   memstore_reap_message(smsg->msg);
@@ -1955,8 +2272,12 @@ static ngx_int_t chanhead_messages_gc_custom(memstore_channel_head_t *ch, ngx_in
 }
 
 ngx_int_t memstore_chanhead_messages_gc(memstore_channel_head_t *ch) {
+  uint64_t    stall_start = nchan_stall_start();
+  ngx_int_t   rc;
   //DBG("messages gc for ch %p %V", ch, &ch->id);
-  return chanhead_messages_gc_custom(ch, ch->max_messages);
+  rc = chanhead_messages_gc_custom(ch, ch->max_messages);
+  nchan_stall_end(NCHAN_STALL_MESSAGES_GC, stall_start, NULL, &ch->id, ch->total_sub_count);
+  return rc;
 }
 
 static ngx_int_t chanhead_messages_delete(memstore_channel_head_t *ch) {
@@ -2101,7 +2422,7 @@ static ngx_int_t nchan_store_subscribe_channel_existence_check_callback(ngx_int_
 static ngx_int_t nchan_store_subscribe_continued(ngx_int_t channel_status, void* _, subscribe_data_t *d);
 
 static ngx_int_t nchan_store_subscribe(ngx_str_t *channel_id, subscriber_t *sub) {
-  ngx_int_t                    owner = memstore_channel_owner(channel_id);
+  ngx_int_t                    owner = memstore_channel_owner(channel_id, sub->cf);
   subscribe_data_t            *d = subscribe_data_alloc(sub->cf->redis.enabled ? -1 : owner);
   
   assert(d != NULL);
@@ -2115,6 +2436,8 @@ static ngx_int_t nchan_store_subscribe(ngx_str_t *channel_id, subscriber_t *sub)
   d->group_channel_limit_pass = 0;
   d->msg_id = sub->last_msgid;
   
+  nchan_hot_channels_record(channel_id, NCHAN_HOT_SUBSCRIBES, 1);
+  
   if(sub->cf->subscribe_only_existing_channel || sub->cf->max_channel_subscribers > 0) {
     sub->fn->reserve(sub);
     d->reserved = 1;
@@ -2702,7 +3025,7 @@ static ngx_int_t getmsg_proxy_completebuffer_callback(ngx_int_t code, nchan_msg_
 
 static ngx_int_t nchan_store_async_get_message(ngx_str_t *channel_id, nchan_msg_id_t *msg_id, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
   store_message_t             *chmsg;
-  ngx_int_t                    owner = memstore_channel_owner(channel_id);
+  ngx_int_t                    owner = memstore_channel_owner(channel_id, cf);
   subscribe_data_t            *d; 
   nchan_msg_status_t           findmsg_status;
   memstore_channel_head_t     *chead;
@@ -2951,6 +3274,7 @@ static nchan_msg_t *create_shm_msg(nchan_msg_t *m) {
   
   msg->storage = NCHAN_MSG_SHARED;
   msg->parent = NULL;
+  msg->shared_body = NULL;
   
   if(m->compressed) {
     msg->compressed = (nchan_compressed_msg_t *)cur;
@@ -2977,6 +3301,51 @@ static nchan_msg_t *create_shm_msg(nchan_msg_t *m) {
   return msg;
 }
 
+static nchan_msg_t *create_shm_msg_header(nchan_msg_t *body) {
+  //a thin per-channel message with its own id and prev_id, borrowing the contents of a shared body.
+  //the body stays alive as long as any header points to it.
+  nchan_msg_t             *msg;
+  
+  assert(body->storage == NCHAN_MSG_SHARED);
+  assert(body->shared_body == NULL);
+  
+  if((msg = shm_alloc(shm, sizeof(*msg), "message header")) == NULL) {
+    nchan_log_ooshm_error("allocating message header");
+    return NULL;
+  }
+  
+  *msg = *body;
+  msg->refcount = 0;
+  msg->shared_body = body;
+  ngx_atomic_fetch_add((ngx_atomic_uint_t *)&body->refcount, 1);
+  
+#if NCHAN_MSG_RESERVE_DEBUG
+  msg->rsv = NULL;
+#endif
+#if NCHAN_MSG_LEAK_DEBUG
+  msg_debug_add(msg);
+#endif
+  return msg;
+}
+
+nchan_msg_t *memstore_shared_msg_body_create(nchan_msg_t *m) {
+  //the caller holds the body's first reference, and lets go of it with memstore_shared_msg_body_release()
+  nchan_msg_t             *body;
+  if((body = create_shm_msg(m)) == NULL) {
+    return NULL;
+  }
+  body->refcount = 1;
+  return body;
+}
+
+nchan_msg_t *memstore_shared_msg_header_create(nchan_msg_t *body) {
+  return create_shm_msg_header(body);
+}
+
+void memstore_shared_msg_body_release(nchan_msg_t *body) {
+  memstore_shared_body_release(body);
+}
+
 static store_message_t *create_shared_message(nchan_msg_t *m, ngx_int_t msg_already_in_shm) {
   store_message_t          *chmsg;
   nchan_msg_t              *msg;
@@ -2989,14 +3358,116 @@ static store_message_t *create_shared_message(nchan_msg_t *m, ngx_int_t msg_alre
       return NULL;
     }
   }
-  if((chmsg = ngx_alloc(sizeof(*chmsg), ngx_cycle->log)) != NULL) {
-    chmsg->prev = NULL;
-    chmsg->next = NULL;
-    chmsg->msg  = msg;
+  if((chmsg = ngx_alloc(sizeof(*chmsg), ngx_cycle->log)) == NULL) {
+    if(!msg_already_in_shm) {
+      memstore_discard_unpublished_shm_msg(msg);
+    }
+    return NULL;
   }
+  chmsg->prev = NULL;
+  chmsg->next = NULL;
+  chmsg->msg  = msg;
   return chmsg;
 }
 
+#if nginx_version > 1011006
+// Moving a message frees the original, so it's only safe if nobody else can be holding a pointer to it.
+// A channel's messages live in its owner's worker-local chanhead, and every pointer that leaves this worker
+// is reserved before it does: IPC publish_message and get_message_reply (ipc-handlers.c), multi-channel gets,
+// and output queues all go through msg_reserve, and the refcount swap below fails while any of those are out.
+// On top of that, channels that are still loading or fetching messages, and each channel's newest message
+// (the one a new subscriber or a get_message is most likely to be after), are left alone.
+static ngx_int_t compaction_channel_movable(memstore_channel_head_t *head) {
+  return head->status == READY && head->owner == head->slot && head->msg_buffer_complete && !head->stub && !head->multi;
+}
+
+static ngx_int_t compaction_movable(nchan_msg_t *msg, time_t cutoff) {
+  if(msg->shared_body || msg->refcount != 0) {
+    //shared bodies and their headers point at each other, and anything with a refcount is in use
+    return 0;
+  }
+  if(msg->buf.file || (msg->compressed && msg->compressed->buf.file)) {
+    return 0;
+  }
+  if(msg->id.tagcount != 1 || msg->prev_id.tagcount > NCHAN_FIXED_MULTITAG_MAX) {
+    return 0;
+  }
+  return msg->id.time <= cutoff;
+}
+
+static int memstore_compaction_timer_handler(void *pd) {
+  // move long-lived messages out of mostly-empty slab pages, and into fuller ones, so the emptied pages can be freed.
+  // the slab allocator hands out the first free slot it finds, so a fresh copy lands in a fuller page whenever there is one.
+  memstore_channel_head_t  *cur, *tmp;
+  store_message_t          *smsg;
+  nchan_msg_t              *msg, *moved;
+  shm_page_fill_t           fill, newfill;
+  size_t                    stuck[16]; //slot sizes with no fuller page to move to this time around
+  ngx_uint_t                nstuck = 0, i, nmoved = 0;
+  size_t                    bytes = 0;
+  time_t                    cutoff = ngx_time() - shm_compaction_interval / 1000;
+  
+  HASH_ITER(hh, mpt->hash, cur, tmp) {
+    if(!compaction_channel_movable(cur)) {
+      continue;
+    }
+    for(smsg = cur->msg_first; smsg != NULL && smsg != cur->msg_last && nmoved < NCHAN_SHM_COMPACTION_MAX_MOVES; smsg = smsg->next) {
+      msg = smsg->msg;
+      if(!compaction_movable(msg, cutoff)) {
+        continue;
+      }
+      if(shm_page_fill(shm, msg, &fill) != NGX_OK || fill.used * 100 > fill.total * NCHAN_SHM_COMPACTION_MAX_FILL) {
+        continue;
+      }
+      for(i = 0; i < nstuck && stuck[i] != fill.size; i++) { /*void*/ }
+      if(i < nstuck) {
+        continue;
+      }
+      if(!msg_refcount_invalidate_if_zero(msg)) {
+        continue;
+      }
+      if((moved = create_shm_msg(msg)) == NULL) {
+        msg->refcount = 0;
+        goto done;
+      }
+      moved->refcount = 0;
+      if(shm_page_fill(shm, moved, &newfill) != NGX_OK || newfill.page == fill.page || newfill.used <= fill.used) {
+        //nowhere better for it to go
+        memstore_free_shm_msg(moved);
+        msg->refcount = 0;
+        if(nstuck < sizeof(stuck)/sizeof(*stuck)) {
+          stuck[nstuck++] = fill.size;
+        }
+        continue;
+      }
+      smsg->msg = moved;
+      bytes += memstore_msg_memsize(moved);
+      memstore_free_shm_msg(msg);
+      nmoved++;
+    }
+    if(nmoved >= NCHAN_SHM_COMPACTION_MAX_MOVES) {
+      break;
+    }
+  }
+  
+done:
+  if(nmoved > 0) {
+    DBG("compaction moved %ui messages, %uz bytes", nmoved, bytes);
+  }
+  if(memstore_my_worker_stats) {
+    ngx_atomic_fetch_add(&memstore_my_worker_stats->compaction.sweeps, 1);
+    ngx_atomic_fetch_add(&memstore_my_worker_stats->compaction.messages, nmoved);
+    ngx_atomic_fetch_add(&memstore_my_worker_stats->compaction.bytes, bytes);
+  }
+  return 1;
+}
+#else
+static int memstore_compaction_timer_handler(void *pd) {
+  //the slab internals this needs are only known for newer nginx versions
+  return 0;
+}
+#endif
+
 typedef struct {
   uint16_t              n;
   ngx_int_t             rc;
@@ -3014,16 +3485,18 @@ static ngx_int_t publish_multi_callback(ngx_int_t status, void *rptr, void *priv
     pd->rc = status;
   }
   
-  if(pd->ch.last_seen < ch->last_seen) {
-    pd->ch.last_seen = ch->last_seen;
-  }
-  
-  if(pd->ch.messages < ch->messages) {
-    pd->ch.messages = ch->messages;
+  if(ch) {
+    if(pd->ch.last_seen < ch->last_seen) {
+      pd->ch.last_seen = ch->last_seen;
+    }
+    
+    if(pd->ch.messages < ch->messages) {
+      pd->ch.messages = ch->messages;
+    }
+    
+    pd->ch.subscribers += ch->subscribers;
   }
   
-  pd->ch.subscribers += ch->subscribers;
-  
   pd->n--;
   
   if(pd->n == 0) {
@@ -3125,6 +3598,8 @@ static ngx_int_t group_publish_accounting_check(ngx_int_t rc, nchan_group_t *shm
 }
 
 static ngx_int_t nchan_store_publish_message(ngx_str_t *channel_id, nchan_msg_t *msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  nchan_hot_channels_record_publish(channel_id, ngx_buf_size(&msg->buf));
+  
   if(cf->group.enable_accounting) {
     // it might be better to do this later when a chanhead is available,
     // so we can avoid the group lookup in the group-tree and use chanhead->groupnode.
@@ -3164,6 +3639,46 @@ static void fill_message_timedata(nchan_msg_t *msg, time_t timeout) {
   }
 }
 
+typedef struct {
+  callback_pt       callback;
+  void             *privdata;
+  nchan_msg_t      *body;
+} redis_relay_publish_data_t;
+
+static ngx_int_t redis_relay_publish_callback(ngx_int_t status, void *ch, void *pd) {
+  redis_relay_publish_data_t *d = pd;
+  d->callback(status, ch, d->privdata);
+  memstore_shared_body_release(d->body);
+  ngx_free(d);
+  return NGX_OK;
+}
+
+static ngx_int_t redis_relay_publish(ngx_str_t *channel_id, nchan_msg_t *msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  //the channel owner publishes to Redis for us. We hang on to the message until it's done.
+  redis_relay_publish_data_t *d;
+  
+  if((d = ngx_alloc(sizeof(*d), ngx_cycle->log)) == NULL) {
+    ERR("can't allocate redis relay publish data");
+    callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, privdata);
+    return NGX_ERROR;
+  }
+  if((d->body = memstore_shared_msg_body_create(msg)) == NULL) {
+    ngx_free(d);
+    callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, privdata);
+    return NGX_ERROR;
+  }
+  d->callback = callback;
+  d->privdata = privdata;
+  
+  if(memstore_ipc_send_publish_message(memstore_channel_owner(channel_id, cf), channel_id, d->body, cf, redis_relay_publish_callback, d) == NGX_DECLINED) {
+    memstore_shared_body_release(d->body);
+    ngx_free(d);
+    callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, privdata);
+    return NGX_ERROR;
+  }
+  return NGX_OK;
+}
+
 static ngx_int_t nchan_store_publish_message_to_single_channel_id(ngx_str_t *channel_id, nchan_msg_t *msg, ngx_int_t msg_in_shm, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
   memstore_channel_head_t  *chead;
   
@@ -3175,7 +3690,11 @@ static ngx_int_t nchan_store_publish_message_to_single_channel_id(ngx_str_t *cha
     fill_message_timedata(msg, nchan_loc_conf_message_timeout(cf));
     
     if(cf->redis.storage_mode == REDIS_MODE_DISTRIBUTED) {
-      assert(!msg_in_shm);
+      if(!memstore_worker_connects_to_redis()) {
+        assert(!msg_in_shm);
+        return redis_relay_publish(channel_id, msg, cf, callback, privdata);
+      }
+      //messages in shm come from workers relaying through this one
       return nchan_store_redis.publish(channel_id, msg, cf, callback, privdata);
     }
     //BACKUP mode gets published later
@@ -3184,6 +3703,9 @@ static ngx_int_t nchan_store_publish_message_to_single_channel_id(ngx_str_t *cha
   if((chead = nchan_memstore_get_chanhead(channel_id, cf)) == NULL) {
     //ERR("can't get chanhead for id %V", channel_id);
     //we probably just ran out of shared memory
+    if(msg_in_shm) {
+      memstore_discard_unpublished_shm_msg(msg);
+    }
     callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, privdata);
     return NGX_ERROR;
   }
@@ -3198,6 +3720,10 @@ ngx_int_t nchan_store_publish_message_generic(ngx_str_t *channel_id, nchan_msg_t
     ngx_str_t             ids[NCHAN_MULTITAG_MAX];
     ngx_int_t             trc=NGX_OK;
     publish_multi_data_t *pd;
+    nchan_msg_t          *body = NULL, *hdr;
+    if(callback == NULL) {
+      callback = empty_callback;
+    }
     if((pd = ngx_alloc(sizeof(*pd), ngx_cycle->log)) == NULL) {
       ERR("can't allocate publish multi chanhead data");
       return NGX_ERROR;
@@ -3211,12 +3737,37 @@ ngx_int_t nchan_store_publish_message_generic(ngx_str_t *channel_id, nchan_msg_t
     pd->rc = NCHAN_MESSAGE_QUEUED;
     ngx_memzero(&pd->ch, sizeof(pd->ch));
     
+    if(!msg_in_shm && !(cf->redis.enabled && cf->redis.storage_mode == REDIS_MODE_DISTRIBUTED)) {
+      //copy the message contents into shm just once, and give each channel a thin header.
+      if((body = create_shm_msg(msg)) == NULL) {
+        ngx_free(pd);
+        callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, privdata);
+        return NGX_ERROR;
+      }
+      //hold on to the body until all the headers are out
+      ngx_atomic_fetch_add((ngx_atomic_uint_t *)&body->refcount, 1);
+    }
+    
     for(i=0; i<n; i++) {
-      rc = nchan_store_publish_message_to_single_channel_id(&ids[i], msg, msg_in_shm, cf, publish_multi_callback, pd);
+      if(body) {
+        if((hdr = create_shm_msg_header(body)) == NULL) {
+          publish_multi_callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, pd);
+          trc = NGX_ERROR;
+          continue;
+        }
+        rc = nchan_store_publish_message_to_single_channel_id(&ids[i], hdr, 1, cf, publish_multi_callback, pd);
+      }
+      else {
+        rc = nchan_store_publish_message_to_single_channel_id(&ids[i], msg, msg_in_shm, cf, publish_multi_callback, pd);
+      }
       if(rc != NGX_OK) {
         trc = rc;
       }
     }
+    
+    if(body) {
+      memstore_shared_body_release(body);
+    }
     return trc;
   }
   else {
@@ -3243,11 +3794,19 @@ ngx_int_t nchan_store_chanhead_publish_message_generic(memstore_channel_head_t *
   assert(!cf->redis.enabled || cf->redis.storage_mode == REDIS_MODE_BACKUP);
   
   if(memstore_slot() != owner) {
-    if((publish_msg = create_shm_msg(msg)) == NULL) {
+    if(msg_in_shm) {
+      publish_msg = msg;
+    }
+    else if((publish_msg = create_shm_msg(msg)) == NULL) {
+      callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, privdata);
+      return NGX_ERROR;
+    }
+    if((rc = memstore_ipc_send_publish_message(owner, &chead->id, publish_msg, cf, callback, privdata)) == NGX_DECLINED) {
+      memstore_discard_unpublished_shm_msg(publish_msg);
       callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, privdata);
       return NGX_ERROR;
     }
-    return memstore_ipc_send_publish_message(owner, &chead->id, publish_msg, cf, callback, privdata);
+    return rc;
   }
   
   if(cf->redis.enabled && cf->redis.storage_mode == REDIS_MODE_BACKUP) {
@@ -3281,6 +3840,9 @@ ngx_int_t nchan_store_chanhead_publish_message_generic(memstore_channel_head_t *
     channel_copy=&chead->channel;
     
     if((shmsg_link = create_shared_message(msg, msg_in_shm)) == NULL) {
+      if(msg_in_shm) {
+        memstore_discard_unpublished_shm_msg(msg);
+      }
       callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, privdata);
       ERR("can't create unbuffered message for channel %V", &chead->id);
       return NGX_ERROR;
@@ -3301,12 +3863,16 @@ ngx_int_t nchan_store_chanhead_publish_message_generic(memstore_channel_head_t *
   else {
     
     if((shmsg_link = create_shared_message(msg, msg_in_shm)) == NULL) {
+      if(msg_in_shm) {
+        memstore_discard_unpublished_shm_msg(msg);
+      }
       callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, privdata);
       ERR("can't create shared message for channel %V", &chead->id);
       return NGX_ERROR;
     }
     
     if(chanhead_push_message(chead, shmsg_link) != NGX_OK) {
+      //it's in the channel's message list (or already reaped from it), so it's not ours to discard
       callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, privdata);
       ERR("can't enqueue shared message for channel %V", &chead->id);
       return NGX_ERROR;
@@ -1,6 +1,10 @@
  #ifndef MEMSTORE_PRIVATE_HEADER
 #define MEMSTORE_PRIVATE_HEADER
 #include <util/shmem.h>
+#include <util/nchan_auth_cache.h>
+#include <store/redis/redis_msg_cache.h>
+#include <util/nchan_latency.h>
+#include "store.h"
 #include "ipc.h"
 //#define MEMSTORE_CHANHEAD_RESERVE_DEBUG 1
 
@@ -85,7 +89,9 @@ struct memstore_channel_head_s {
 
   subscriber_t                   *redis_sub;
   ngx_int_t                       delta_fakesubs;
-  ngx_event_t                     delta_fakesubs_timer_ev;
+  memstore_channel_head_t        *fakesub_prev;
+  memstore_channel_head_t        *fakesub_next;
+  unsigned                        in_fakesub_queue:1;
   
   memstore_channel_head_t        *gc_prev;
   memstore_channel_head_t        *gc_next;
@@ -126,6 +132,16 @@ typedef struct {
   nchan_loc_conf_shared_data_t      *conf_data;
   
   nchan_stub_status_t                stats;
+  nchan_latency_stats_t             *latency[NGX_MAX_PROCESSES]; //by worker index
+  memstore_worker_stats_t           *worker_stats[NGX_MAX_PROCESSES]; //by worker index
+  nchan_hot_channels_t              *hot_channels[NGX_MAX_PROCESSES]; //by worker index
+  nchan_stall_stats_t               *stalls[NGX_MAX_PROCESSES]; //by worker index
+  nchan_footprint_stats_t           *footprint[NGX_MAX_PROCESSES]; //by worker index
+  uint16_t                           worker_shm_stats_generation[NGX_MAX_PROCESSES]; //that the stats above were allocated for
+  ngx_pid_t                          worker_shm_stats_pid[NGX_MAX_PROCESSES]; //writing to them, or 0 once it has exited
+  nchan_group_t                     *groups; //every group in shm, linked by group->next
+  nchan_auth_cache_shm_t             auth_cache;
+  redis_msg_cache_shm_t              redis_msg_cache;
 #if nginx_version <= 1011006
   ngx_atomic_uint_t                  shmem_pages_used;
 #endif
@@ -144,9 +160,11 @@ ipc_t *nchan_memstore_get_ipc(void);
 memstore_groups_t *nchan_memstore_get_groups(void);
 ngx_int_t nchan_memstore_handle_get_message_reply(nchan_msg_t *msg, nchan_msg_status_t findmsg_status, void *d);
 
+//with msg_in_shm, the message is handed over: if it can't be published, it's discarded unless something else is holding on to it
 ngx_int_t nchan_store_publish_message_generic(ngx_str_t *channel_id, nchan_msg_t *msg, ngx_int_t msg_in_shm, nchan_loc_conf_t *cf, callback_pt callback, void *privdata);
 ngx_int_t nchan_memstore_publish_generic(memstore_channel_head_t *head, nchan_msg_t *msg, ngx_int_t status_code, const ngx_str_t *status_line);
 ngx_int_t nchan_store_chanhead_publish_message_generic(memstore_channel_head_t *chead, nchan_msg_t *msg, ngx_int_t msg_in_shm, nchan_loc_conf_t *cf, callback_pt callback, void *privdata);
+void memstore_discard_unpublished_shm_msg(nchan_msg_t *msg);
 ngx_int_t nchan_memstore_publish_notice(memstore_channel_head_t *head, ngx_int_t notice_code, const void *notice_data);
 ngx_int_t nchan_memstore_force_delete_channel(ngx_str_t *channel_id, callback_pt callback, void *privdata);
 ngx_int_t memstore_ensure_chanhead_is_ready(memstore_channel_head_t *head, uint8_t ipc_subscribe_if_needed);
@@ -162,6 +180,8 @@ ngx_int_t memstore_fakeprocess_pop(void);
 #endif
 
 ngx_int_t memstore_slot(void);
+void memstore_groups_list_add(nchan_group_t *group);
+void memstore_groups_list_remove(nchan_group_t *group);
 ngx_int_t memstore_str_owner(ngx_str_t *str);
 
 int memstore_ready(void);
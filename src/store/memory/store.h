@@ -1,12 +1,81 @@
 #ifndef NCHAN_MEMSTORE_H
 #define NCHAN_MEMSTORE_H
+#include <util/nchan_auth_cache.h>
+#include <store/redis/redis_msg_cache.h>
+#include <util/nchan_latency.h>
+#include <util/nchan_hot_channels.h>
+#include <util/nchan_stall.h>
+#include <util/nchan_footprint.h>
 
 extern nchan_store_t  nchan_store_memory;
 
-ngx_int_t memstore_channel_owner(ngx_str_t *id);
+ngx_int_t memstore_channel_owner(ngx_str_t *id, nchan_loc_conf_t *cf);
 
 extern void  *nchan_store_memory_shmem;
 
+nchan_auth_cache_shm_t *nchan_memstore_get_auth_cache(void);
+redis_msg_cache_shm_t *nchan_memstore_get_redis_msg_cache(void);
+
 nchan_loc_conf_shared_data_t *memstore_get_conf_shared_data(nchan_loc_conf_t *cf);
 ngx_int_t memstore_reserve_conf_shared_data(nchan_loc_conf_t *cf);
+
+//message contents copied into shm once, and borrowed by thin per-channel message headers
+nchan_msg_t *memstore_shared_msg_body_create(nchan_msg_t *m);
+nchan_msg_t *memstore_shared_msg_header_create(nchan_msg_t *body);
+void memstore_shared_msg_body_release(nchan_msg_t *body);
+
+//only the first n workers connect to Redis, and own all the channels. 0 means all workers.
+void memstore_set_redis_connection_workers(ngx_int_t n);
+int memstore_worker_connects_to_redis(void);
+
+//per-worker latency histograms. worker -1 for this one. NULL if there aren't any
+nchan_latency_stats_t *memstore_worker_latency_stats(ngx_int_t worker);
+ngx_int_t memstore_worker_count(void);
+
+//per-worker hot channel counts. worker -1 for this one. NULL if there aren't any
+nchan_hot_channels_t *memstore_worker_hot_channels(ngx_int_t worker);
+
+//per-worker event loop stall timings. worker -1 for this one. NULL if there aren't any
+nchan_stall_stats_t *memstore_worker_stall_stats(ngx_int_t worker);
+
+//per-worker subscriber memory footprints, kept only when there's an nchan_stub_status location. worker -1 for this one
+nchan_footprint_stats_t *memstore_worker_footprint_stats(ngx_int_t worker);
+
+#define MEMSTORE_WORKER_STATS_IPC_CODES 32
+
+//per-worker counters, kept in shm only when there's an nchan_stub_status location.
+//each worker only writes its own
+typedef struct {
+  ngx_pid_t                       pid;
+  ngx_atomic_uint_t               channels; //owned by this worker
+  ngx_atomic_uint_t               subscribers[SUBSCRIBER_TYPES];
+  ngx_atomic_uint_t               ipc_alerts_sent[MEMSTORE_WORKER_STATS_IPC_CODES];
+  ngx_atomic_uint_t               ipc_alerts_received[MEMSTORE_WORKER_STATS_IPC_CODES];
+  //these are updated once a second
+  ngx_atomic_uint_t               spools;
+  struct {
+    ngx_atomic_uint_t               msg;
+    ngx_atomic_uint_t               nobuffer_msg;
+    ngx_atomic_uint_t               chanhead;
+    ngx_atomic_uint_t               chanhead_churner;
+  }                               reaper;
+  struct {
+    ngx_atomic_uint_t               sweeps;
+    ngx_atomic_uint_t               messages;
+    ngx_atomic_uint_t               bytes;
+  }                               compaction;
+} memstore_worker_stats_t;
+
+extern memstore_worker_stats_t *memstore_my_worker_stats;
+#define memstore_update_worker_stats(counter, count) \
+  do { if(memstore_my_worker_stats) memstore_my_worker_stats->counter += (count); } while(0)
+
+//worker -1 for this one. NULL if there aren't any
+memstore_worker_stats_t *memstore_worker_stats(ngx_int_t worker);
+
+//walk all the groups in shm while holding the shm lock. cb must not allocate shared memory
+void memstore_groups_each(void (*cb)(nchan_group_t *, void *), void *pd);
+
+const char *memstore_ipc_command_name(ngx_uint_t code);
+ngx_uint_t memstore_ipc_command_count(void);
 #endif //NCHAN_MEMSTORE_H
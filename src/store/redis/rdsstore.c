@@ -15,6 +15,7 @@
 
 #include "redis_nodeset.h"
 #include "redis_lua_commands.h"
+#include "redis_msg_cache.h"
 
 #define REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_STEP 600 //10min
 #define REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_MAX 2628000 //whole month
@@ -37,6 +38,12 @@ size_t            redis_subscriber_id_len;
 static rdstore_channel_head_t    *chanhead_hash = NULL;
 static size_t                     redis_publish_message_msgkey_size;
 
+static ngx_int_t redis_publish_batch_flush(redis_nodeset_t *ns);
+static ngx_int_t redis_fakesub_batch_flush(redis_nodeset_t *ns);
+static void redis_keepalive_schedule(rdstore_channel_head_t *head, time_t delay);
+static void redis_keepalive_withdraw(rdstore_channel_head_t *head);
+static void redis_catch_up_withdraw(rdstore_channel_head_t *head);
+
 
 #define CHANNEL_HASH_FIND(id_buf, p)    HASH_FIND( hh, chanhead_hash, (id_buf)->data, (id_buf)->len, p)
 #define CHANNEL_HASH_ADD(chanhead)      HASH_ADD_KEYPTR( hh, chanhead_hash, (chanhead->id).data, (chanhead->id).len, chanhead)
@@ -82,7 +89,7 @@ static size_t                     redis_publish_message_msgkey_size;
     if(node->state >= REDIS_NODE_READY) {                            \
       node->pending_commands++;                                      \
       nchan_update_stub_status(redis_pending_commands, 1);           \
-      redisAsyncCommand((node)->ctx.cmd, cb, pd, fmt, ##args);       \
+      nodeset_node_command((node), cb, pd, fmt, ##args);             \
     } else {                                                         \
       node_log_error(node, "Can't run redis command: no connection to redis server.");\
     }                                                                \
@@ -94,6 +101,12 @@ static size_t                     redis_publish_message_msgkey_size;
 #define nchan_redis_script(script_name, node, cb, pd, channel_id, fmt, args...)       \
   redis_script(script_name, node, cb, pd, "0 %b %b " fmt, STR((node)->nodeset->settings.namespace), STR(channel_id), ##args)
 
+//for scripts with a script_name_stream counterpart used with nchan_redis_stream_storage
+#define nchan_redis_layout_script(script_name, node, cb, pd, channel_id, fmt, args...) \
+  redis_command(node, cb, pd, "EVALSHA %s 0 %b %b " fmt,                             \
+    (node)->nodeset->settings.stream_storage ? redis_lua_scripts.script_name ## _stream.hash : redis_lua_scripts.script_name.hash, \
+    STR((node)->nodeset->settings.namespace), STR(channel_id), ##args)
+
   
 #define CHECK_REPLY_STR(reply) ((reply)->type == REDIS_REPLY_STRING)
 #define CHECK_REPLY_STRVAL(reply, v) ( CHECK_REPLY_STR(reply) && ngx_strcmp((reply)->str, v) == 0 )
@@ -245,9 +258,12 @@ static void redis_store_reap_chanhead(rdstore_channel_head_t *ch) {
     assert(ch->redis.nodeset->settings.storage_mode == REDIS_MODE_DISTRIBUTED);
     assert(ch->redis.node.pubsub);
     ch->pubsub_status = REDIS_PUBSUB_UNSUBSCRIBED;
-    redis_subscriber_command(ch->redis.node.pubsub, NULL, NULL, "UNSUBSCRIBE %b{channel:%b}:pubsub", STR(ch->redis.nodeset->settings.namespace), STR(&ch->id));
+    redis_subscriber_command(ch->redis.node.pubsub, NULL, NULL, "%s %b{channel:%b}:pubsub", ch->redis.nodeset->settings.sharded_pubsub ? "SUNSUBSCRIBE" : "UNSUBSCRIBE", STR(ch->redis.nodeset->settings.namespace), STR(&ch->id));
   }
   
+  redis_keepalive_withdraw(ch);
+  redis_catch_up_withdraw(ch);
+  
   redis_nodeset_t *ns = ch->redis.nodeset;
   redis_node_t *cmd = ch->redis.node.cmd;
   redis_node_t *pubsub = ch->redis.node.pubsub;
@@ -284,9 +300,6 @@ static void redis_store_reap_chanhead(rdstore_channel_head_t *ch) {
   
   
   DBG("chanhead %p (%V) is empty and expired. delete.", ch, &ch->id);
-  if(ch->keepalive_timer.timer_set) {
-    ngx_del_timer(&ch->keepalive_timer);
-  }
   stop_spooler(&ch->spooler, 1);
   CHANNEL_HASH_DEL(ch);
   
@@ -333,6 +346,8 @@ static ngx_int_t nchan_redis_chanhead_ready_to_reap(rdstore_channel_head_t *ch,
 }
 
 static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privdata);
+static void redis_subscriber_reply_handler(redisAsyncContext *c, void *r, void *privdata);
+static redisReplyObjectFunctions *redis_pubsub_reply_functions_init(void);
 
 static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
   ngx_int_t rc = NGX_OK;
@@ -344,8 +359,14 @@ static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
   
   redis_nginx_init();
   
-  nodeset_initialize((char *)redis_subscriber_id, redis_subscriber_callback);
-  nodeset_connect_all();
+  nodeset_initialize((char *)redis_subscriber_id, redis_subscriber_callback, redis_pubsub_reply_functions_init());
+  if(memstore_worker_connects_to_redis()) {
+    nodeset_connect_all();
+  }
+  else {
+    //this worker relays its Redis commands through the channel owners, which are connected
+    DBG("worker won't connect to Redis");
+  }
   
   //OLD
   //rbtree_walk(&redis_data_tree, (rbtree_walk_callback_pt )redis_data_tree_connector, &rc);
@@ -471,8 +492,9 @@ typedef struct {
   ngx_msec_t                    t;
   char                         *name;
   ngx_str_t                     channel_id;
-  nchan_msg_id_t               *msg_id;
+  nchan_msg_tiny_id_t           msg_id;
   ngx_str_t                     msg_key;
+  unsigned                      master_only:1;
 } redis_get_message_from_key_data_t;
 
 static void get_msg_from_msgkey_callback(redisAsyncContext *ac, void *r, void *privdata);
@@ -480,8 +502,8 @@ static void get_msg_from_msgkey_callback(redisAsyncContext *ac, void *r, void *p
 static ngx_int_t get_msg_from_msgkey_send(redis_nodeset_t *ns, void *pd) {
   redis_get_message_from_key_data_t *d = pd;
   if(nodeset_ready(ns)) {
-    redis_node_t  *node = nodeset_node_find_by_key(ns, &d->msg_key);
-    redis_script(get_message_from_key, node, &get_msg_from_msgkey_callback, d, "1 %b", STR(&d->msg_key));
+    redis_node_t  *node = d->master_only ? nodeset_node_find_by_key(ns, &d->msg_key) : nodeset_node_read_find_by_key(ns, &d->msg_key);
+    redis_script(get_message_from_key, node, &get_msg_from_msgkey_callback, d, "1 %b %i %i", STR(&d->msg_key), d->msg_id.time, d->msg_id.tag);
   }
   else {
     ngx_free(d);
@@ -517,9 +539,16 @@ static void get_msg_from_msgkey_callback(redisAsyncContext *ac, void *r, void *p
       return;
     }
     if(msg_from_redis_get_message_reply(&msg, &cmsg, &content_type, &eventsource_event, reply, 0) != NGX_OK) {
+      if(node->role == REDIS_NODE_ROLE_SLAVE && !d->master_only) {
+        //not replicated to this slave yet
+        d->master_only = 1;
+        get_msg_from_msgkey_send(node->nodeset, d);
+        return;
+      }
       ERR("invalid message or message absent after get_msg_from_key");
       return;
     }
+    redis_msg_cache_put(node->nodeset, chid, &msg);
     nchan_store_publish_generic(chid, node->nodeset, &msg, 0, NULL);
   }
   else {
@@ -651,6 +680,9 @@ static ngx_int_t get_msg_from_msgkey(ngx_str_t *channel_id, redis_nodeset_t *nod
   nchan_strcpy(&d->msg_key, msg_redis_hash_key, 0);
   
   d->t = ngx_current_msec;
+  d->msg_id.time = msgid->time;
+  d->msg_id.tag = msgid->tag.fixed[0];
+  d->master_only = 0;
   
   d->name = "get_message_from_key";
   
@@ -693,7 +725,116 @@ static rdstore_channel_head_t *find_chanhead_for_pubsub_callback(ngx_str_t *chid
   return head;
 }
 
+// PUBSUB replies are built with these, so that large messages can be decoded right out of hiredis'
+// read buffer into a shared memory message body, without first being copied into a redisReply string.
+static redisReplyObjectFunctions   redis_pubsub_reply_functions;
+static redisReplyObjectFunctions  *redis_default_reply_functions = NULL;
+
+static nchan_msg_t *redis_pubsub_msg_to_shm(redis_node_t *node, redisReply *pubsub_channel_reply, char *str, size_t len, nchan_msg_compression_type_t *compression) {
+  ngx_str_t               pubsub_channel;
+  ngx_str_t               chid_str;
+  ngx_str_t               msg_type;
+  ngx_str_t               content_type;
+  ngx_str_t               eventsource_event;
+  nchan_msg_t             msg;
+  nchan_compressed_msg_t  cmsg;
+  ngx_buf_t               mpbuf;
+  cmp_ctx_t               cmp;
+  uint32_t                array_sz, sz;
+  rdstore_channel_head_t *chanhead;
+  
+  pubsub_channel.data = (u_char *)pubsub_channel_reply->str;
+  pubsub_channel.len = pubsub_channel_reply->len;
+  if(get_channel_id_from_pubsub_channel(&pubsub_channel, node->nodeset->settings.namespace, &chid_str) == NULL) {
+    return NULL;
+  }
+  if((chanhead = find_chanhead_for_pubsub_callback(&chid_str)) == NULL || chanhead->sub_count == 0) {
+    //nobody to give it to
+    return NULL;
+  }
+  
+  set_buf(&mpbuf, (u_char *)str, len);
+  cmp_init(&cmp, &mpbuf, ngx_buf_reader, NULL, ngx_buf_writer);
+  //just plain "msg"s. the rest are small or rare, and go the usual way.
+  if(!cmp_read_array(&cmp, &array_sz) || array_sz < 10 || !cmp_read_str_size(&cmp, &sz)) {
+    return NULL;
+  }
+  fwd_buf_to_str(&mpbuf, sz, &msg_type);
+  if(!ngx_strmatch(&msg_type, "msg")) {
+    return NULL;
+  }
+  
+  ngx_memzero(&msg, sizeof(msg));
+  msg.storage = NCHAN_MSG_STACK;
+  if(!cmp_to_msg(&cmp, &msg, &cmsg, &content_type, &eventsource_event)) {
+    return NULL;
+  }
+  //the compressed version is made later, per worker, in a pool. the body only has the original.
+  *compression = msg.compressed ? msg.compressed->compression : NCHAN_MSG_NO_COMPRESSION;
+  msg.compressed = NULL;
+  
+  return memstore_shared_msg_body_create(&msg);
+}
+
+static void *redis_pubsub_create_string(const redisReadTask *task, char *str, size_t len) {
+  redisReply                   *r, *parent;
+  nchan_msg_t                  *body;
+  nchan_msg_compression_type_t  compression;
+  
+  if(task->type == REDIS_REPLY_STRING && len >= NCHAN_REDIS_PUBSUB_SHM_DECODE_MIN_SIZE && task->parent && task->idx == 2) {
+    //the message payload. element[0] and element[1] have been read by now.
+    parent = task->parent->obj;
+    if(parent->elements == 3
+     && (CHECK_REPLY_STRVAL(parent->element[0], "message") || CHECK_REPLY_STRVAL(parent->element[0], "smessage"))
+     && CHECK_REPLY_STR(parent->element[1])
+     && (body = redis_pubsub_msg_to_shm(task->privdata, parent->element[1], str, len, &compression)) != NULL) {
+      if((r = calloc(1, sizeof(*r))) == NULL) {
+        memstore_shared_msg_body_release(body);
+        return NULL;
+      }
+      r->type = REDIS_REPLY_NCHAN_SHM_MSG;
+      r->str = (char *)body;
+      r->len = len;
+      r->integer = compression;
+      parent->element[task->idx] = r;
+      return r;
+    }
+  }
+  return redis_default_reply_functions->createString(task, str, len);
+}
+
+static void redis_pubsub_free_reply(void *reply) {
+  redisReply   *r = reply, *el;
+  if(r && r->type == REDIS_REPLY_ARRAY && r->elements == 3
+   && (el = r->element[2]) != NULL && el->type == REDIS_REPLY_NCHAN_SHM_MSG) {
+    memstore_shared_msg_body_release((nchan_msg_t *)el->str);
+    el->str = NULL;
+  }
+  redis_default_reply_functions->freeObject(reply);
+}
+
+static redisReplyObjectFunctions *redis_pubsub_reply_functions_init(void) {
+  redisReader  *reader;
+  if((reader = redisReaderCreate()) == NULL) {
+    return NULL;
+  }
+  redis_default_reply_functions = reader->fn; //hiredis' own, statically allocated
+  redisReaderFree(reader);
+  
+  redis_pubsub_reply_functions = *redis_default_reply_functions;
+  redis_pubsub_reply_functions.createString = redis_pubsub_create_string;
+  redis_pubsub_reply_functions.freeObject = redis_pubsub_free_reply;
+  return &redis_pubsub_reply_functions;
+}
+
 static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privdata) {
+  uint64_t      stall_start = nchan_stall_start();
+  redis_subscriber_reply_handler(c, r, privdata);
+  //c may be gone by now
+  nchan_stall_end(NCHAN_STALL_REDIS_REPLY, stall_start, NULL, NULL, -1);
+}
+
+static void redis_subscriber_reply_handler(redisAsyncContext *c, void *r, void *privdata) {
   redisReply             *reply = r;
   redisReply             *el = NULL;
   nchan_msg_t             msg;
@@ -717,7 +858,9 @@ static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privd
   msg.expires = 0;
   msg.refcount = 0;
   msg.parent = NULL;
+  msg.shared_body = NULL;
   msg.storage = NCHAN_MSG_STACK;
+  msg.latency_start = 0; //publish time on another server isn't comparable to ours
 
   if(reply == NULL) return;
   
@@ -734,7 +877,28 @@ static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privd
     return;
   }
   
-  if(CHECK_REPLY_STRVAL(reply->element[0], "message") && CHECK_REPLY_STR(reply->element[2])) {
+  if(reply->element[2]->type == REDIS_REPLY_NCHAN_SHM_MSG) {
+    //a "msg" already decoded into shm by redis_pubsub_create_string
+    nchan_msg_t  *body = (nchan_msg_t *)reply->element[2]->str;
+    
+    msg = *body;
+    msg.refcount = 0;
+    msg.parent = NULL;
+    msg.shared_body = body;
+    msg.storage = NCHAN_MSG_STACK;
+    if(reply->element[2]->integer > 0) {
+      msg.compressed = &cmsg;
+      ngx_memzero(&cmsg.buf, sizeof(cmsg.buf));
+      cmsg.compression = reply->element[2]->integer;
+    }
+    
+    if(chid && (chanhead = find_chanhead_for_pubsub_callback(chid)) != NULL) {
+      redis_msg_cache_put(chanhead->redis.nodeset, chid, &msg);
+      nchan_store_publish_generic(chid, chanhead->redis.nodeset, &msg, 0, NULL);
+    }
+    //the body is released along with the reply
+  }
+  else if((CHECK_REPLY_STRVAL(reply->element[0], "message") || CHECK_REPLY_STRVAL(reply->element[0], "smessage")) && CHECK_REPLY_STR(reply->element[2])) {
     
     //reply->element[1] is the pubsub channel name
     el = reply->element[2];
@@ -779,6 +943,10 @@ static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privd
           //  chid already set from the pubsub channel name
           //}
           
+          if(msgbuf_size_changed) {
+            //cached messages may have been pushed out of the buffer
+            redis_msg_cache_invalidate_channel(nodeset, chid);
+          }
           if(msgbuf_size_changed && (chanhead = nchan_store_get_chanhead(chid, nodeset)) != NULL) {
             chanhead->spooler.fn->broadcast_notice(&chanhead->spooler, NCHAN_NOTICE_REDIS_CHANNEL_MESSAGE_BUFFER_SIZE_CHANGE, (void *)(intptr_t )msgbuf_size);
           }
@@ -791,6 +959,7 @@ static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privd
             assert(array_sz >= 9 + msgbuf_size_changed + chid_present);
             if(chanhead && cmp_to_msg(&cmp, &msg, &cmsg, &content_type, &eventsource_event)) {
               //ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0, "got msg %V", msgid_to_str(&msg));
+              redis_msg_cache_put(chanhead->redis.nodeset, chid, &msg);
               nchan_store_publish_generic(chid, chanhead ? chanhead->redis.nodeset : nodeset, &msg, 0, NULL);
             }
             else {
@@ -836,6 +1005,7 @@ static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privd
             if(ngx_strmatch(&alerttype, "delete channel") && array_sz > 2) {
               if(cmp_to_str(&cmp, &extracted_channel_id)) {
                 rdstore_channel_head_t *doomed_channel;
+                redis_msg_cache_invalidate_channel(nodeset, &extracted_channel_id);
                 nchan_store_publish_generic(&extracted_channel_id, nodeset, NULL, NGX_HTTP_GONE, &NCHAN_HTTP_STATUS_410);
                 doomed_channel = nchan_store_get_chanhead(&extracted_channel_id, nodeset);
                 redis_chanhead_gc_add(doomed_channel, 0, "channel deleted");
@@ -891,7 +1061,7 @@ static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privd
     }
   }
 
-  else if(CHECK_REPLY_STRVAL(reply->element[0], "subscribe") && CHECK_REPLY_INT(reply->element[2])) {
+  else if((CHECK_REPLY_STRVAL(reply->element[0], "subscribe") || CHECK_REPLY_STRVAL(reply->element[0], "ssubscribe")) && CHECK_REPLY_INT(reply->element[2])) {
     
     if(chid) {
       chanhead = find_chanhead_for_pubsub_callback(chid);
@@ -930,7 +1100,17 @@ static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privd
     
     DBG("REDIS: PUB/SUB subscribed to %s (%i total)", reply->element[1]->str, reply->element[2]->integer);
   }
-  else if(CHECK_REPLY_STRVAL(reply->element[0], "unsubscribe") && CHECK_REPLY_INT(reply->element[2])) {
+  else if(CHECK_REPLY_STRVAL(reply->element[0], "sunsubscribe") && CHECK_REPLY_INT(reply->element[2])
+   && chid && (chanhead = find_chanhead_for_pubsub_callback(chid)) != NULL
+   && chanhead->pubsub_status == REDIS_PUBSUB_SUBSCRIBED) {
+    // we didn't ask for this. Redis drops sharded subscriptions when their keyslot migrates to
+    // another node, so the cluster keyspace must be refreshed. The node's channels will
+    // then resubscribe (and catch up) on the new keyslot owner.
+    node_log_notice(node, "sharded PUBSUB channel %V was unsubscribed by Redis, keyslot has probably moved", chid);
+    chanhead->pubsub_status = REDIS_PUBSUB_UNSUBSCRIBED;
+    nodeset_node_keyslot_changed(node);
+  }
+  else if((CHECK_REPLY_STRVAL(reply->element[0], "unsubscribe") || CHECK_REPLY_STRVAL(reply->element[0], "sunsubscribe")) && CHECK_REPLY_INT(reply->element[2])) {
     
     if(chid) {
       DBG("received UNSUBSCRIBE acknowledgement for channel %V", chid);
@@ -1102,8 +1282,8 @@ static void redis_subscriber_register_cb(redisAsyncContext *c, void *vr, void *p
   }
   keepalive_ttl = reply->element[2]->integer;
   if(keepalive_ttl > 0) {
-    if(!sdata->chanhead->keepalive_timer.timer_set) {
-      ngx_add_timer(&sdata->chanhead->keepalive_timer, keepalive_ttl * 1000);
+    if(!sdata->chanhead->redis.slist.in_keepalive_wheel) {
+      redis_keepalive_schedule(sdata->chanhead, keepalive_ttl);
     }
   }
   ngx_free(sdata);
@@ -1200,73 +1380,271 @@ static ngx_int_t redis_subscriber_unregister(rdstore_channel_head_t *chanhead, s
 }
 
 
-static void redisChannelKeepaliveCallback(redisAsyncContext *c, void *vr, void *privdata);
+// Channel keepalives. Rather than a timer per channel, each nodeset keeps a timing wheel of
+// REDIS_NODESET_KEEPALIVE_WHEEL_SIZE buckets, REDIS_NODESET_KEEPALIVE_WHEEL_TICK_SEC apart. On every tick,
+// the channels that are due get their keepalives sent together, one channel_keepalive_batch script
+// call per Redis node. A keepalive may go out up to a tick late, which is fine -- they're minutes apart.
 
-static ngx_int_t redisChannelKeepaliveCallback_send(redis_nodeset_t *ns, void *pd) {
-  rdstore_channel_head_t   *head = pd;
-  time_t                    ttl;
-  //TODO: optimize this
-  redis_node_t *node = nodeset_node_find_by_channel_id(head->redis.nodeset, &head->id);
-  if(nodeset_ready(ns)) {
-    head->reserved++;
-    ttl = REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_STEP * (1+head->keepalive_times_sent);
-    if(ttl > REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_MAX) { //1 week at most
-      ttl = REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_MAX;
+#define REDIS_KEEPALIVE_BATCH_MAX 512
+#define REDIS_KEEPALIVE_RETRY_SEC (REDIS_RECONNECT_TIME / 1000)
+
+typedef struct {
+  ngx_uint_t                n;
+  rdstore_channel_head_t   *head[1]; //actually n
+} redis_keepalive_batch_t;
+
+static void redis_keepalive_wheel_tick(ngx_event_t *ev);
+
+static nchan_slist_t *keepalive_wheel_bucket(redis_nodeset_t *ns, time_t t) {
+  return &ns->keepalive.bucket[(t / REDIS_NODESET_KEEPALIVE_WHEEL_TICK_SEC) % REDIS_NODESET_KEEPALIVE_WHEEL_SIZE];
+}
+
+static void redis_keepalive_withdraw(rdstore_channel_head_t *head) {
+  redis_nodeset_t   *ns = head->redis.nodeset;
+  if(head->redis.slist.in_keepalive_wheel) {
+    nchan_slist_remove(keepalive_wheel_bucket(ns, head->keepalive_time), head);
+    head->redis.slist.in_keepalive_wheel = 0;
+    ns->keepalive.n--;
+  }
+}
+
+static void redis_keepalive_schedule(rdstore_channel_head_t *head, time_t delay) {
+  redis_nodeset_t   *ns = head->redis.nodeset;
+  time_t             now = ngx_time();
+  time_t             next_tick_start;
+  
+  redis_keepalive_withdraw(head);
+  
+  if(ns->keepalive.n == 0 && !ns->keepalive.ev.timer_set) {
+    //the wheel's been idle. start it up again from here.
+    ns->keepalive.last_tick = now / REDIS_NODESET_KEEPALIVE_WHEEL_TICK_SEC - 1;
+  }
+  //don't land in a bucket whose tick has already passed
+  next_tick_start = (ns->keepalive.last_tick + 1) * REDIS_NODESET_KEEPALIVE_WHEEL_TICK_SEC;
+  head->keepalive_time = now + delay > next_tick_start ? now + delay : next_tick_start;
+  
+  nchan_slist_append(keepalive_wheel_bucket(ns, head->keepalive_time), head);
+  head->redis.slist.in_keepalive_wheel = 1;
+  ns->keepalive.n++;
+  
+  if(!ns->keepalive.ev.timer_set) {
+    if(!ns->keepalive.ev.handler) {
+      nchan_init_timer(&ns->keepalive.ev, redis_keepalive_wheel_tick, ns);
     }
-    nchan_redis_script(channel_keepalive, node, &redisChannelKeepaliveCallback, head, &head->id, "%i", ttl);
+    ngx_add_timer(&ns->keepalive.ev, REDIS_NODESET_KEEPALIVE_WHEEL_TICK_SEC * 1000);
+  }
+}
+
+//arguments for a batched EVALSHA, in one allocation.
+typedef struct {
+  const char   **argv;
+  size_t        *argvlen;
+  u_char        *numbuf;
+  ngx_uint_t     argc;
+} redis_batch_argv_t;
+
+//room for argc arguments, ints of them integers. starts off with the script and namespace.
+static ngx_int_t redis_batch_argv_init(redis_batch_argv_t *a, size_t argc, size_t ints, redis_lua_script_t *script, ngx_str_t *namespace) {
+  u_char  *buf;
+  if((buf = ngx_alloc((sizeof(*a->argv) + sizeof(*a->argvlen)) * argc + (NGX_INT_T_LEN + 1) * ints, ngx_cycle->log)) == NULL) {
+    return NGX_ERROR;
   }
+  a->argv = (const char **)buf;
+  a->argvlen = (size_t *)&a->argv[argc];
+  a->numbuf = (u_char *)&a->argvlen[argc];
+  a->argc = 0;
+  
+  a->argv[a->argc] = "EVALSHA";
+  a->argvlen[a->argc++] = 7;
+  a->argv[a->argc] = script->hash;
+  a->argvlen[a->argc++] = strlen(script->hash);
+  a->argv[a->argc] = "0";
+  a->argvlen[a->argc++] = 1;
+  a->argv[a->argc] = (const char *)namespace->data;
+  a->argvlen[a->argc++] = namespace->len;
   return NGX_OK;
 }
 
-static ngx_int_t redisChannelKeepaliveCallback_retry_wrapper(redis_nodeset_t *ns, void *pd) {
-  rdstore_channel_head_t   *head = pd;
-  head->reserved--;
-  return redisChannelKeepaliveCallback_send(ns, pd);
+static void redis_batch_argv_str(redis_batch_argv_t *a, ngx_str_t *str) {
+  a->argv[a->argc] = (const char *)str->data;
+  a->argvlen[a->argc++] = str->len;
 }
 
-static void redisChannelKeepaliveCallback(redisAsyncContext *c, void *vr, void *privdata) {
-  rdstore_channel_head_t   *head = (rdstore_channel_head_t *)privdata;
-  redisReply               *reply = (redisReply *)vr;
-  redis_node_t             *node = c->data;
+static void redis_batch_argv_int(redis_batch_argv_t *a, ngx_int_t num) {
+  u_char  *start = a->numbuf;
+  a->numbuf = ngx_sprintf(start, "%i", num);
+  a->argv[a->argc] = (const char *)start;
+  a->argvlen[a->argc++] = a->numbuf - start;
+}
+
+static void redis_batch_argv_send(redis_node_t *node, redisCallbackFn *cb, void *privdata, redis_batch_argv_t *a) {
+  node->pending_commands++;
+  nchan_update_stub_status(redis_pending_commands, 1);
+  nodeset_node_command_argv(node, cb, privdata, a->argc, a->argv, a->argvlen);
+  ngx_free(a->argv);
+}
+
+static void redisChannelKeepaliveBatchCallback(redisAsyncContext *c, void *vr, void *privdata);
+
+static void redis_keepalive_batch_send(redis_node_t *node, rdstore_channel_head_t **heads, ngx_uint_t n) {
+  redis_nodeset_t          *ns = node->nodeset;
+  redis_keepalive_batch_t  *batch;
+  redis_batch_argv_t        args;
+  ngx_uint_t                j;
+  time_t                    ttl;
+  rdstore_channel_head_t   *head;
   
-  head->reserved--;
-  node->pending_commands--;
-  nchan_update_stub_status(redis_pending_commands, -1);
+  //input:  keys: [], values: [namespace, (channel_id, ttl)...]
+  batch = ngx_alloc(sizeof(*batch) + sizeof(batch->head[0]) * (n - 1), ngx_cycle->log);
+  if(!batch || redis_batch_argv_init(&args, 4 + n * 2, n, &redis_lua_scripts.channel_keepalive_batch, ns->settings.namespace) != NGX_OK) {
+    ERR("can't allocate batched channel keepalive command");
+    for(j = 0; j < n; j++) {
+      redis_keepalive_schedule(heads[j], REDIS_KEEPALIVE_RETRY_SEC);
+    }
+    if(batch) ngx_free(batch);
+    return;
+  }
   
-  if(!nodeset_node_reply_keyslot_ok(node, reply)) {
+  batch->n = n;
+  for(j = 0; j < n; j++) {
+    head = heads[j];
     head->reserved++;
-    nodeset_callback_on_ready(node->nodeset, 1000, redisChannelKeepaliveCallback_retry_wrapper, head);
-    return;
+    batch->head[j] = head;
+    ttl = REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_STEP * (1+head->keepalive_times_sent);
+    if(ttl > REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_MAX) {
+      ttl = REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_MAX;
+    }
+    redis_batch_argv_str(&args, &head->id);
+    redis_batch_argv_int(&args, ttl);
   }
-  else {
-    head->keepalive_times_sent++;
+  
+  redis_batch_argv_send(node, redisChannelKeepaliveBatchCallback, batch, &args);
+}
+
+static void redis_keepalive_send_due(redis_nodeset_t *ns, nchan_slist_t *due) {
+  rdstore_channel_head_t   *cur, *next;
+  rdstore_channel_head_t   *group[REDIS_KEEPALIVE_BATCH_MAX];
+  redis_node_t             *node;
+  ngx_uint_t                i, n;
+  
+  for(cur = nchan_slist_first(due); cur != NULL; cur = next) {
+    next = nchan_slist_next(due, cur);
+    if(!nodeset_ready(ns) || cur->pubsub_status != REDIS_PUBSUB_SUBSCRIBED || cur->status == NOTREADY) {
+      //no use trying to keepalive a not-ready (possibly disconnected) chanhead
+      DBG("Tried sending channel keepalive when channel is not ready");
+      nchan_slist_remove(due, cur);
+      redis_keepalive_schedule(cur, REDIS_KEEPALIVE_RETRY_SEC); //retry after reconnect timeout
+    }
   }
   
-  if(redisReplyOk(c, vr)) {
-    assert(CHECK_REPLY_INT(reply));
-    
-    //reply->integer == -1 means "let it disappear" (see channel_keepalive.lua)
+  //pick off all the channels for one node at a time
+  while((cur = nchan_slist_first(due)) != NULL) {
+    node = nodeset_node_find_by_channel_id(ns, &cur->id);
+    n = 0;
+    for(; cur != NULL; cur = next) {
+      next = nchan_slist_next(due, cur);
+      if(n < REDIS_KEEPALIVE_BATCH_MAX && nodeset_node_find_by_channel_id(ns, &cur->id) == node) {
+        nchan_slist_remove(due, cur);
+        group[n++] = cur;
+      }
+    }
     
-    if(reply->integer != -1 && !head->keepalive_timer.timer_set) {
-      ngx_add_timer(&head->keepalive_timer, reply->integer * 1000);
+    if(node && node->state >= REDIS_NODE_READY) {
+      redis_keepalive_batch_send(node, group, n);
+    }
+    else {
+      for(i = 0; i < n; i++) {
+        redis_keepalive_schedule(group[i], REDIS_KEEPALIVE_RETRY_SEC);
+      }
+    }
+  }
+}
+
+static void redis_keepalive_wheel_tick(ngx_event_t *ev) {
+  redis_nodeset_t          *ns = ev->data;
+  nchan_slist_t             due;
+  nchan_slist_t            *bucket;
+  rdstore_channel_head_t   *cur, *next;
+  time_t                    tick, now_tick = ngx_time() / REDIS_NODESET_KEEPALIVE_WHEEL_TICK_SEC;
+  ngx_uint_t                i;
+  
+  nchan_slist_init(&due, rdstore_channel_head_t, redis.slist.keepalive.prev, redis.slist.keepalive.next);
+  
+  //every tick since the last one, but no more than once around the wheel
+  for(i = 0, tick = ns->keepalive.last_tick + 1; tick <= now_tick && i < REDIS_NODESET_KEEPALIVE_WHEEL_SIZE; tick++, i++) {
+    bucket = &ns->keepalive.bucket[tick % REDIS_NODESET_KEEPALIVE_WHEEL_SIZE];
+    for(cur = nchan_slist_first(bucket); cur != NULL; cur = next) {
+      next = nchan_slist_next(bucket, cur);
+      if(cur->keepalive_time < (tick + 1) * REDIS_NODESET_KEEPALIVE_WHEEL_TICK_SEC) {
+        //due. the rest are for a later time around the wheel
+        nchan_slist_remove(bucket, cur);
+        cur->redis.slist.in_keepalive_wheel = 0;
+        ns->keepalive.n--;
+        nchan_slist_append(&due, cur);
+      }
     }
   }
+  ns->keepalive.last_tick = now_tick;
+  
+  redis_keepalive_send_due(ns, &due);
   
+  if(ns->keepalive.n > 0 && !ev->timer_set) {
+    ngx_add_timer(ev, REDIS_NODESET_KEEPALIVE_WHEEL_TICK_SEC * 1000);
+  }
 }
 
-static void redis_channel_keepalive_timer_handler(ngx_event_t *ev) {
-  rdstore_channel_head_t   *head = ev->data;
-  if(ev->timedout) {
-    ev->timedout=0;
-    if(head->pubsub_status != REDIS_PUBSUB_SUBSCRIBED || head->status == NOTREADY) {
-      //no use trying to keepalive a not-ready (possibly disconnected) chanhead
-      DBG("Tried sending channel keepalive when channel is not ready");
-      ngx_add_timer(ev, REDIS_RECONNECT_TIME); //retry after reconnect timeout
+static void redisChannelKeepaliveBatchCallback(redisAsyncContext *c, void *vr, void *privdata) {
+  redis_keepalive_batch_t  *batch = privdata;
+  redisReply               *reply = (redisReply *)vr;
+  redisReply               *el;
+  redis_node_t             *node = c->data;
+  rdstore_channel_head_t   *head;
+  ngx_uint_t                i;
+  int                       ok, keyslot_changed = 0;
+  
+  node->pending_commands--;
+  nchan_update_stub_status(redis_pending_commands, -1);
+  
+  ok = nodeset_node_reply_keyslot_ok(node, reply) && redisReplyOk(c, reply);
+  if(ok && (reply->type != REDIS_REPLY_ARRAY || reply->elements != batch->n)) {
+    ERR("unexpected reply to batched channel keepalive");
+    ok = 0;
+  }
+  
+  for(i = 0; i < batch->n; i++) {
+    head = batch->head[i];
+    head->reserved--;
+    if(head->shutting_down) {
+      continue;
+    }
+    if(!ok) {
+      redis_keepalive_schedule(head, REDIS_KEEPALIVE_RETRY_SEC);
+      continue;
+    }
+    
+    el = reply->element[i];
+    if(CHECK_REPLY_INT(el)) {
+      head->keepalive_times_sent++;
+      //-1 means "let it disappear" (see channel_keepalive_batch.lua)
+      if(el->integer != -1 && !head->redis.slist.in_keepalive_wheel) {
+        redis_keepalive_schedule(head, el->integer);
+      }
     }
     else {
-      redisChannelKeepaliveCallback_send(head->redis.nodeset, head);
+      if(CHECK_REPLY_STRNVAL(el, "CLUSTER KEYSLOT ERROR. ", 23)) {
+        if(!keyslot_changed) {
+          nodeset_node_keyslot_changed(node);
+          keyslot_changed = 1;
+        }
+      }
+      else {
+        ERR("channel keepalive for %V failed: %s", &head->id, CHECK_REPLY_STR(el) ? el->str : "(not a string)");
+      }
+      redis_keepalive_schedule(head, REDIS_KEEPALIVE_RETRY_SEC);
     }
   }
+  
+  ngx_free(batch);
 }
 
 ngx_int_t ensure_chanhead_pubsub_subscribed_if_needed(rdstore_channel_head_t *ch) {
@@ -1280,7 +1658,10 @@ ngx_int_t ensure_chanhead_pubsub_subscribed_if_needed(rdstore_channel_head_t *ch
     namespace = ch->redis.nodeset->settings.namespace;
     DBG("SUBSCRIBING to %V{channel:%V}:pubsub", namespace, &ch->id);
     ch->pubsub_status = REDIS_PUBSUB_SUBSCRIBING;
-    redis_subscriber_command(pubsub_node, redis_subscriber_callback, NULL, "SUBSCRIBE %b{channel:%b}:pubsub", STR(namespace), STR(&ch->id));
+    //sharded subscriptions must go to the channel keyslot's master or one of its slaves, which is
+    //what nodeset_node_pubsub_find_by_chanhead picks anyway. The pubsub key is hash-tagged to the
+    //same keyslot as the rest of the channel's keys.
+    redis_subscriber_command(pubsub_node, redis_subscriber_callback, NULL, "%s %b{channel:%b}:pubsub", ch->redis.nodeset->settings.sharded_pubsub ? "SSUBSCRIBE" : "SUBSCRIBE", STR(namespace), STR(&ch->id));
   }
   return NGX_OK;
 }
@@ -1289,6 +1670,277 @@ ngx_int_t redis_chanhead_catch_up_after_reconnect(rdstore_channel_head_t *ch) {
   return spooler_catch_up(&ch->spooler);
 }
 
+// Bulk recovery after a reconnect: channels are resubscribed with multi-channel SUBSCRIBEs,
+// and checked for missed messages in batches. Only the channels whose latest message
+// in Redis isn't the last one they've seen catch up with get_message.
+
+#define REDIS_RESUBSCRIBE_BATCH_MAX 256
+#define REDIS_CATCH_UP_BATCH_MAX 256
+
+static int chanhead_needs_pubsub_subscribe(rdstore_channel_head_t *ch) {
+  return ch->pubsub_status != REDIS_PUBSUB_SUBSCRIBED && ch->pubsub_status != REDIS_PUBSUB_SUBSCRIBING
+   && ch->redis.nodeset->settings.storage_mode == REDIS_MODE_DISTRIBUTED
+   && nodeset_ready(ch->redis.nodeset);
+}
+
+static void redis_subscribe_batch_send(redis_node_t *node, rdstore_channel_head_t **heads, ngx_uint_t n) {
+  ngx_str_t                *namespace = node->nodeset->settings.namespace;
+  const char              **argv;
+  size_t                   *argvlen;
+  u_char                   *buf, *cur;
+  size_t                    bufsize = 0;
+  ngx_uint_t                i;
+  
+  for(i = 0; i < n; i++) {
+    bufsize += namespace->len + heads[i]->id.len + sizeof("{channel:}:pubsub") - 1;
+  }
+  argv = ngx_alloc(sizeof(*argv) * (n + 1), ngx_cycle->log);
+  argvlen = ngx_alloc(sizeof(*argvlen) * (n + 1), ngx_cycle->log);
+  buf = ngx_alloc(bufsize, ngx_cycle->log);
+  
+  if(!argv || !argvlen || !buf) {
+    ERR("can't allocate multi-channel SUBSCRIBE command. subscribing one at a time.");
+    for(i = 0; i < n; i++) {
+      ensure_chanhead_pubsub_subscribed_if_needed(heads[i]);
+    }
+    if(argv) ngx_free(argv);
+    if(argvlen) ngx_free(argvlen);
+    if(buf) ngx_free(buf);
+    return;
+  }
+  
+  argv[0] = "SUBSCRIBE";
+  argvlen[0] = sizeof("SUBSCRIBE") - 1;
+  cur = buf;
+  for(i = 0; i < n; i++) {
+    argv[i+1] = (const char *)cur;
+    cur = ngx_sprintf(cur, "%V{channel:%V}:pubsub", namespace, &heads[i]->id);
+    argvlen[i+1] = cur - (u_char *)argv[i+1];
+    heads[i]->pubsub_status = REDIS_PUBSUB_SUBSCRIBING;
+  }
+  
+  //each channel gets its own "subscribe" reply, handled as usual by redis_subscriber_callback
+  redisAsyncCommandArgv(node->ctx.pubsub, redis_subscriber_callback, NULL, n + 1, argv, argvlen);
+  
+  ngx_free(argv);
+  ngx_free(argvlen);
+  ngx_free(buf);
+}
+
+ngx_int_t redis_chanheads_resubscribe(redis_nodeset_t *ns, rdstore_channel_head_t **heads, ngx_uint_t n) {
+  rdstore_channel_head_t  **pending, *group[REDIS_RESUBSCRIBE_BATCH_MAX];
+  redis_node_t             *node;
+  ngx_uint_t                i, j, remaining = 0, count;
+  
+  if(ns->settings.sharded_pubsub) {
+    //an SSUBSCRIBE's channels must all be in the same keyslot, so these go one at a time.
+    for(i = 0; i < n; i++) {
+      ensure_chanhead_pubsub_subscribed_if_needed(heads[i]);
+    }
+    return NGX_OK;
+  }
+  
+  if((pending = ngx_alloc(sizeof(*pending) * n, ngx_cycle->log)) == NULL) {
+    ERR("can't allocate channel list for resubscribing");
+    for(i = 0; i < n; i++) {
+      ensure_chanhead_pubsub_subscribed_if_needed(heads[i]);
+    }
+    return NGX_ERROR;
+  }
+  for(i = 0; i < n; i++) {
+    if(chanhead_needs_pubsub_subscribe(heads[i])) {
+      pending[remaining++] = heads[i];
+    }
+  }
+  
+  //pick off all the channels for one node at a time
+  while(remaining > 0) {
+    node = nodeset_node_pubsub_find_by_chanhead(pending[0]);
+    count = 0;
+    for(i = 0, j = 0; i < remaining; i++) {
+      if(count < REDIS_RESUBSCRIBE_BATCH_MAX && nodeset_node_pubsub_find_by_chanhead(pending[i]) == node) {
+        group[count++] = pending[i];
+      }
+      else {
+        pending[j++] = pending[i];
+      }
+    }
+    remaining = j;
+    
+    if(node && node->state >= REDIS_NODE_READY) {
+      redis_subscribe_batch_send(node, group, count);
+    }
+    else {
+      for(i = 0; i < count; i++) {
+        ensure_chanhead_pubsub_subscribed_if_needed(group[i]);
+      }
+    }
+  }
+  
+  ngx_free(pending);
+  return NGX_OK;
+}
+
+typedef struct {
+  ngx_uint_t                n;
+  rdstore_channel_head_t   *head[1]; //actually n
+} redis_catch_up_batch_t;
+
+static void redis_catch_up_withdraw(rdstore_channel_head_t *head) {
+  if(head->redis.slist.in_catch_up_queue) {
+    nchan_slist_remove(&head->redis.nodeset->catch_up.queue, head);
+    head->redis.slist.in_catch_up_queue = 0;
+  }
+}
+
+static void redis_catch_up_enqueue(rdstore_channel_head_t *head) {
+  if(!head->redis.slist.in_catch_up_queue) {
+    nchan_slist_append(&head->redis.nodeset->catch_up.queue, head);
+    head->redis.slist.in_catch_up_queue = 1;
+  }
+}
+
+static void redisCatchUpBatchCallback(redisAsyncContext *c, void *r, void *privdata);
+static void redis_catch_up_send_more(redis_nodeset_t *ns);
+
+static void redis_catch_up_batch_send(redis_node_t *node, rdstore_channel_head_t **heads, ngx_uint_t n) {
+  redis_nodeset_t          *ns = node->nodeset;
+  redis_catch_up_batch_t   *batch;
+  redis_batch_argv_t        args;
+  ngx_uint_t                j;
+  
+  //input:  keys: [], values: [namespace, channel_id...]
+  batch = ngx_alloc(sizeof(*batch) + sizeof(batch->head[0]) * (n - 1), ngx_cycle->log);
+  if(!batch || redis_batch_argv_init(&args, 4 + n, 0, &redis_lua_scripts.get_last_message_id_batch, ns->settings.namespace) != NGX_OK) {
+    ERR("can't allocate batched catch-up command. catching up one at a time.");
+    for(j = 0; j < n; j++) {
+      redis_chanhead_catch_up_after_reconnect(heads[j]);
+    }
+    if(batch) ngx_free(batch);
+    return;
+  }
+  
+  batch->n = n;
+  for(j = 0; j < n; j++) {
+    heads[j]->reserved++;
+    batch->head[j] = heads[j];
+    redis_batch_argv_str(&args, &heads[j]->id);
+  }
+  
+  ns->catch_up.in_flight++;
+  redis_batch_argv_send(node, redisCatchUpBatchCallback, batch, &args);
+}
+
+static void redis_catch_up_send_more(redis_nodeset_t *ns) {
+  rdstore_channel_head_t   *cur, *next;
+  rdstore_channel_head_t   *taken[REDIS_CATCH_UP_BATCH_MAX], *group[REDIS_CATCH_UP_BATCH_MAX];
+  redis_node_t             *node;
+  ngx_uint_t                i, j, n, remaining;
+  
+  while(ns->catch_up.in_flight < ns->settings.catch_up_concurrency && nodeset_ready(ns)) {
+    remaining = 0;
+    for(cur = nchan_slist_first(&ns->catch_up.queue); cur != NULL && remaining < REDIS_CATCH_UP_BATCH_MAX; cur = next) {
+      next = nchan_slist_next(&ns->catch_up.queue, cur);
+      redis_catch_up_withdraw(cur);
+      taken[remaining++] = cur;
+    }
+    if(remaining == 0) {
+      break;
+    }
+    
+    //one batch per node
+    while(remaining > 0) {
+      node = nodeset_node_find_by_channel_id(ns, &taken[0]->id);
+      n = 0;
+      for(i = 0, j = 0; i < remaining; i++) {
+        if(nodeset_node_find_by_channel_id(ns, &taken[i]->id) == node) {
+          group[n++] = taken[i];
+        }
+        else {
+          taken[j++] = taken[i];
+        }
+      }
+      remaining = j;
+      
+      if(node && node->state >= REDIS_NODE_READY) {
+        redis_catch_up_batch_send(node, group, n);
+      }
+      else {
+        for(i = 0; i < n; i++) {
+          redis_chanhead_catch_up_after_reconnect(group[i]);
+        }
+      }
+    }
+  }
+}
+
+ngx_int_t redis_chanheads_catch_up_after_reconnect(redis_nodeset_t *ns, rdstore_channel_head_t **heads, ngx_uint_t n) {
+  ngx_uint_t      i;
+  for(i = 0; i < n; i++) {
+    redis_catch_up_enqueue(heads[i]);
+  }
+  redis_catch_up_send_more(ns);
+  return NGX_OK;
+}
+
+static int chanhead_last_msgid_matches(rdstore_channel_head_t *head, redisReply *el) {
+  u_char     buf[NGX_INT_T_LEN * 2 + 2];
+  u_char    *end;
+  if(head->last_msgid.time == 0) {
+    return 0;
+  }
+  end = ngx_sprintf(buf, "%T:%i", head->last_msgid.time, (ngx_int_t )head->last_msgid.tag.fixed[0]);
+  return (size_t )(end - buf) == el->len && ngx_strncmp(buf, el->str, el->len) == 0;
+}
+
+static void redisCatchUpBatchCallback(redisAsyncContext *c, void *r, void *privdata) {
+  redis_catch_up_batch_t   *batch = privdata;
+  redisReply               *reply = r;
+  redisReply               *el;
+  redis_node_t             *node = c->data;
+  redis_nodeset_t          *ns = node->nodeset;
+  rdstore_channel_head_t   *head;
+  ngx_uint_t                i;
+  int                       ok, keyslot_changed = 0;
+  
+  node->pending_commands--;
+  nchan_update_stub_status(redis_pending_commands, -1);
+  ns->catch_up.in_flight--;
+  
+  ok = nodeset_node_reply_keyslot_ok(node, reply) && redisReplyOk(c, reply);
+  if(ok && (reply->type != REDIS_REPLY_ARRAY || reply->elements != batch->n)) {
+    ERR("unexpected reply to batched catch-up");
+    ok = 0;
+  }
+  
+  for(i = 0; i < batch->n; i++) {
+    head = batch->head[i];
+    head->reserved--;
+    if(!ok) {
+      //couldn't tell. catch up the old-fashioned way.
+      redis_chanhead_catch_up_after_reconnect(head);
+      continue;
+    }
+    el = reply->element[i];
+    if(CHECK_REPLY_STRNVAL(el, "CLUSTER KEYSLOT ERROR. ", 23)) {
+      if(!keyslot_changed) {
+        nodeset_node_keyslot_changed(node);
+        keyslot_changed = 1;
+      }
+      redis_catch_up_enqueue(head);
+    }
+    else if(!CHECK_REPLY_STR(el) || el->len == 0) {
+      //no messages, nothing to catch up on
+    }
+    else if(!chanhead_last_msgid_matches(head, el)) {
+      redis_chanhead_catch_up_after_reconnect(head);
+    }
+  }
+  ngx_free(batch);
+  
+  redis_catch_up_send_more(ns);
+}
+
 static rdstore_channel_head_t *create_chanhead(ngx_str_t *channel_id, redis_nodeset_t *ns) {
   rdstore_channel_head_t   *head;
   
@@ -1326,8 +1978,7 @@ static rdstore_channel_head_t *create_chanhead(ngx_str_t *channel_id, redis_node
     head->meta = 0;
   }
 
-  ngx_memzero(&head->keepalive_timer, sizeof(head->keepalive_timer));
-  nchan_init_timer(&head->keepalive_timer, redis_channel_keepalive_timer_handler, head);
+  head->keepalive_time = 0;
   
   if(channel_id->len > 2) { // absolutely no multiplexed channels allowed
     assert(ngx_strncmp(head->id.data, "m/", 2) != 0);
@@ -1566,7 +2217,7 @@ static ngx_int_t nchan_store_delete_channel_send(redis_nodeset_t *ns, void *pd)
   redis_channel_callback_data_t *d = pd;
   if(nodeset_ready(ns)) {
     redis_node_t *node = nodeset_node_find_by_channel_id(ns, d->channel_id);
-    nchan_redis_script(delete, node, &redisChannelDeleteCallback, d, d->channel_id, "");
+    nchan_redis_script(delete, node, &redisChannelDeleteCallback, d, d->channel_id, "%i", (int )ns->settings.sharded_pubsub);
     return NGX_OK;
   }
   else {
@@ -1746,6 +2397,9 @@ typedef struct {
   nchan_msg_tiny_id_t     msg_id;
   callback_pt             callback;
   void                   *privdata;
+  redis_nodeset_t        *nodeset;
+  ngx_uint_t              cache_flight; //0 unless this is the fetch others are waiting on
+  unsigned                master_only:1;
 } redis_get_message_data_t;
 
 static void redis_get_message_callback(redisAsyncContext *c, void *r, void *privdata);
@@ -1755,19 +2409,33 @@ static ngx_int_t nchan_store_async_get_message_send(redis_nodeset_t *ns, void *p
   //input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl]
   //output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, channel_subscriber_count
   if(nodeset_ready(ns)) {
-    redis_node_t *node = nodeset_node_find_by_channel_id(ns, d->channel_id);
-    nchan_redis_script(get_message, node, &redis_get_message_callback, d, d->channel_id, "%i %i FILO 0", 
+    redis_node_t *node = d->master_only ? nodeset_node_find_by_channel_id(ns, d->channel_id) : nodeset_node_read_find_by_channel_id(ns, d->channel_id);
+    nchan_redis_layout_script(get_message, node, &redis_get_message_callback, d, d->channel_id, "%i %i FILO 0 %i", 
                        d->msg_id.time, 
-                       d->msg_id.tag
+                       d->msg_id.tag,
+                       node->role == REDIS_NODE_ROLE_SLAVE ? 1 : 0
                       );
   }
   else {
     //TODO: pass on a get_msg error status maybe?
+    redis_msg_cache_resolve(d->nodeset, d->channel_id, &d->msg_id, d->cache_flight, MSG_ERROR, NULL);
     ngx_free(d);
   }
   return NGX_OK;
 }
 
+static ngx_int_t redis_get_message_cache_waiter(ngx_int_t status, void *msg, void *pd) {
+  redis_get_message_data_t  *d = pd;
+  if(status == MSG_ERROR) {
+    //the fetch we were waiting on didn't work out. try it ourselves
+    nchan_store_async_get_message_send(d->nodeset, d);
+    return NGX_OK;
+  }
+  d->callback(status, msg, d->privdata);
+  ngx_free(d);
+  return NGX_OK;
+}
+
 static void redis_get_message_callback(redisAsyncContext *ac, void *r, void *privdata) {
   redisReply                *reply= r;
   redis_get_message_data_t  *d= (redis_get_message_data_t *)privdata;
@@ -1800,6 +2468,7 @@ static void redis_get_message_callback(redisAsyncContext *ac, void *r, void *pri
   
     if (!redisReplyOk(ac, r) || !CHECK_REPLY_ARRAY_MIN_SIZE(reply, 1) || !CHECK_REPLY_INT(reply->element[0]) ) {
       //no good
+      redis_msg_cache_resolve(d->nodeset, d->channel_id, &d->msg_id, d->cache_flight, MSG_ERROR, NULL);
       ngx_free(d);
       return;
     }
@@ -1807,23 +2476,43 @@ static void redis_get_message_callback(redisAsyncContext *ac, void *r, void *pri
     switch(reply->element[0]->integer) {
       case 200: //ok
         if(msg_from_redis_get_message_reply(&msg, &cmsg, &content_type, &eventsource_event, reply, 1) == NGX_OK) {
+          redis_msg_cache_resolve(d->nodeset, d->channel_id, &d->msg_id, d->cache_flight, MSG_FOUND, &msg);
           d->callback(MSG_FOUND, &msg, d->privdata);
         }
+        else {
+          redis_msg_cache_resolve(d->nodeset, d->channel_id, &d->msg_id, d->cache_flight, MSG_ERROR, NULL);
+        }
         break;
       case 403: //channel not found
       case 404: //not found
+      case 418: //not yet available
+        if(node->role == REDIS_NODE_ROLE_SLAVE && !d->master_only) {
+          //the slave might just not have caught up yet. ask the master.
+          //a 418 from a lagging slave could be for a message the master already has and has already sent out on PUBSUB,
+          //so it's not safe to wait for it either.
+          d->master_only = 1;
+          nchan_store_async_get_message_send(node->nodeset, d);
+          return;
+        }
+        if(reply->element[0]->integer == 418) {
+          redis_msg_cache_resolve(d->nodeset, d->channel_id, &d->msg_id, d->cache_flight, MSG_EXPECTED, NULL);
+          d->callback(MSG_EXPECTED, NULL, d->privdata);
+          break;
+        }
+        redis_msg_cache_resolve(d->nodeset, d->channel_id, &d->msg_id, d->cache_flight, MSG_NOTFOUND, NULL);
         d->callback(MSG_NOTFOUND, NULL, d->privdata);
         break;
       case 410: //gone
+        redis_msg_cache_resolve(d->nodeset, d->channel_id, &d->msg_id, d->cache_flight, MSG_EXPIRED, NULL);
         d->callback(MSG_EXPIRED, NULL, d->privdata);
         break;
-      case 418: //not yet available
-        d->callback(MSG_EXPECTED, NULL, d->privdata);
-        break;
+      default:
+        redis_msg_cache_resolve(d->nodeset, d->channel_id, &d->msg_id, d->cache_flight, MSG_ERROR, NULL);
     }
   }
   else {
     ERR("redisAsyncContext NULL for redis_get_message_callback");
+    redis_msg_cache_resolve(d->nodeset, d->channel_id, &d->msg_id, d->cache_flight, MSG_ERROR, NULL);
   }
   
   ngx_free(d);
@@ -1832,6 +2521,7 @@ static void redis_get_message_callback(redisAsyncContext *ac, void *r, void *pri
 static ngx_int_t nchan_store_async_get_message(ngx_str_t *channel_id, nchan_msg_id_t *msg_id, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
   redis_get_message_data_t      *d;
   redis_nodeset_t               *ns = nodeset_find(&cf->redis);
+  nchan_msg_tiny_id_t            tiny_id;
   if(callback==NULL) {
     ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0, "no callback given for async get_message. someone's using the API wrong!");
     return NGX_ERROR;
@@ -1839,10 +2529,21 @@ static ngx_int_t nchan_store_async_get_message(ngx_str_t *channel_id, nchan_msg_
   
   assert(msg_id->tagcount == 1);
   
+  tiny_id.time = msg_id->time;
+  tiny_id.tag = msg_id->tag.fixed[0];
+  if(redis_msg_cache_get(ns, channel_id, &tiny_id, callback, privdata) == NGX_OK) {
+    return NGX_OK;
+  }
+  
   CREATE_CALLBACK_DATA(d, ns, cf, "get_message", channel_id, callback, privdata);
-  d->msg_id.time = msg_id->time;
-  d->msg_id.tag = msg_id->tag.fixed[0];
+  d->msg_id = tiny_id;
+  d->nodeset = ns;
+  d->master_only = 0;
   
+  if(redis_msg_cache_wait(ns, d->channel_id, &d->msg_id, redis_get_message_cache_waiter, d, &d->cache_flight) == NGX_OK) {
+    //someone in this worker is already fetching it
+    return NGX_OK;
+  }
   nchan_store_async_get_message_send(ns, d);
   return NGX_OK; //async only now!
 }
@@ -1916,6 +2617,16 @@ static ngx_int_t nchan_store_init_postconfig(ngx_conf_t *cf) {
   }
   redis_publish_message_msgkey_size = mcf->redis_publish_message_msgkey_size;
   
+  if(mcf->redis_message_cache_size == NGX_CONF_UNSET_SIZE) {
+    mcf->redis_message_cache_size = 0;
+  }
+  redis_msg_cache_set_size(mcf->redis_message_cache_size);
+  
+  if(mcf->redis_connection_workers == NGX_CONF_UNSET) {
+    mcf->redis_connection_workers = 0;
+  }
+  memstore_set_redis_connection_workers(mcf->redis_connection_workers);
+  
   for(cur = redis_conf_head; cur != NULL; cur = cur->next) {
     lcf = cur->lcf;
     rcf = &lcf->redis;
@@ -1945,11 +2656,25 @@ static ngx_int_t nchan_store_init_postconfig(ngx_conf_t *cf) {
 
 static void nchan_store_create_main_conf(ngx_conf_t *cf, nchan_main_conf_t *mcf) {
   mcf->redis_publish_message_msgkey_size=NGX_CONF_UNSET_SIZE;
+  mcf->redis_message_cache_size=NGX_CONF_UNSET_SIZE;
+  mcf->redis_connection_workers=NGX_CONF_UNSET;
   
   //reset redis_conf_head for reloads
   redis_conf_head = NULL;
 }
 
+size_t redis_store_node_stats_size(void) {
+  return nodeset_node_stats_size();
+}
+
+u_char *redis_store_node_stats_write(u_char *cur, u_char *end) {
+  return nodeset_node_stats_write(cur, end);
+}
+
+void redis_store_node_stats_each(void (*cb)(redis_node_stats_t *, void *), void *pd) {
+  nodeset_node_stats_each(cb, pd);
+}
+
 void redis_store_prepare_to_exit_worker() {
   rdstore_channel_head_t    *cur, *tmp;
   HASH_ITER(hh, chanhead_hash, cur, tmp) {
@@ -1958,6 +2683,11 @@ void redis_store_prepare_to_exit_worker() {
 }
 
 void nodeset_exiter_stage1(redis_nodeset_t *ns, void *pd) {
+  redis_publish_batch_flush(ns);
+  redis_fakesub_batch_flush(ns);
+  if(ns->keepalive.ev.timer_set) {
+    ngx_del_timer(&ns->keepalive.ev);
+  }
   nodeset_abort_on_ready_callbacks(ns);
 }
 void nodeset_exiter_stage2(redis_nodeset_t *ns, void *pd) {
@@ -1994,6 +2724,7 @@ static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
   //rbtree_walk(&redis_data_tree, (rbtree_walk_callback_pt )redis_data_tree_exiter_stage2, &chanheads);
   
   nodeset_destroy_all();
+  redis_msg_cache_shutdown();
   
   //OLD
   //rbtree_empty(&redis_data_tree, (rbtree_walk_callback_pt )redis_data_tree_exiter_stage3, NULL);
@@ -2108,10 +2839,33 @@ static ngx_int_t redis_publish_message_nodeset_maybe_retry(redis_nodeset_t *ns,
   return NGX_DECLINED;
 }
 
+//returns 1 if the message body had to be mmapped, and should be munmapped after use
+static int redis_publish_message_body(nchan_msg_t *msg, ngx_str_t *msgstr) {
+  ngx_buf_t                      *buf = &msg->buf;
+  if(ngx_buf_in_memory(buf)) {
+    msgstr->data = buf->pos;
+    msgstr->len = buf->last - msgstr->data;
+  }
+  else { //in a file
+    ngx_fd_t fd = buf->file->fd == NGX_INVALID_FILE ? nchan_fdcache_get(&buf->file->name) : buf->file->fd;
+    
+    msgstr->len = buf->file_last - buf->file_pos;
+    msgstr->data = mmap(NULL, msgstr->len, PROT_READ, MAP_SHARED, fd, 0);
+    if (msgstr->data != MAP_FAILED) {
+      return 1;
+    }
+    else {
+      msgstr->data = NULL;
+      msgstr->len = 0;
+      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "Redis store: Couldn't mmap file %V", &buf->file->name);
+    }
+  }
+  return 0;
+}
+
 static ngx_int_t redis_publish_message_send(redis_nodeset_t *nodeset, void *pd) {
   redis_publish_callback_data_t  *d = pd;
   ngx_int_t                       mmapped = 0;
-  ngx_buf_t                      *buf;
   ngx_str_t                       msgstr;
   nchan_msg_t                    *msg = d->msg;
   const ngx_str_t                 empty=ngx_string("");
@@ -2122,33 +2876,15 @@ static ngx_int_t redis_publish_message_send(redis_nodeset_t *nodeset, void *pd)
   
   redis_node_t *node = nodeset_node_find_by_channel_id(nodeset, d->channel_id);
   
-  buf = &msg->buf;
-  if(ngx_buf_in_memory(buf)) {
-    msgstr.data = buf->pos;
-    msgstr.len = buf->last - msgstr.data;
-  }
-  else { //in a file
-    ngx_fd_t fd = buf->file->fd == NGX_INVALID_FILE ? nchan_fdcache_get(&buf->file->name) : buf->file->fd;
-    
-    msgstr.len = buf->file_last - buf->file_pos;
-    msgstr.data = mmap(NULL, msgstr.len, PROT_READ, MAP_SHARED, fd, 0);
-    if (msgstr.data != MAP_FAILED) {
-      mmapped = 1;
-    }
-    else {
-      msgstr.data = NULL;
-      msgstr.len = 0;
-      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "Redis store: Couldn't mmap file %V", &buf->file->name);
-    }
-  }
+  mmapped = redis_publish_message_body(msg, &msgstr);
   d->msglen = msgstr.len;
   
   
   
-  //input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff]
+  //input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub]
   //output: message_time, message_tag, channel_hash {ttl, time_last_seen, subscribers, messages}
-  nchan_redis_script(publish, node, &redisPublishCallback, d, d->channel_id, 
-                     "%i %b %b %b %i %i %i %i %i", 
+  nchan_redis_layout_script(publish, node, &redisPublishCallback, d, d->channel_id, 
+                     "%i %b %b %b %i %i %i %i %i %i", 
                      msg->id.time, 
                      STR(&msgstr), 
                      STR((msg->content_type ? msg->content_type : &empty)), 
@@ -2157,7 +2893,8 @@ static ngx_int_t redis_publish_message_send(redis_nodeset_t *nodeset, void *pd)
                      d->message_timeout, 
                      d->max_messages, 
                      redis_publish_message_msgkey_size,
-                     nodeset->settings.optimize_target
+                     nodeset->settings.optimize_target,
+                     (int )nodeset->settings.sharded_pubsub
                     );
   if(mmapped && munmap(msgstr.data, msgstr.len) == -1) {
     ERR("munmap was a problem");
@@ -2166,6 +2903,286 @@ static ngx_int_t redis_publish_message_send(redis_nodeset_t *nodeset, void *pd)
   return NGX_OK;
 }
 
+
+// Batched publishing: messages are queued per nodeset, and sent at the end of the event loop
+// iteration (or publish_batch_window) as one publish_batch script call per Redis node.
+// The queued messages are copied, because the publisher's message may not outlive this call.
+// A message published to several channels at once is queued once per channel, and those entries
+// share one copy of the body, which is also sent to Redis just once per script call.
+// The script doesn't declare its keys, so in cluster mode there's no batching: a batch queued
+// before the cluster was discovered is sent one message per script call.
+
+#define REDIS_PUBLISH_BATCH_MAX 256
+#define REDIS_PUBLISH_BATCH_SCRIPT_ARGC 5
+#define REDIS_PUBLISH_BATCH_MSG_ARGC 8
+
+typedef struct {
+  ngx_uint_t                      refcount;
+  ngx_str_t                       data;
+} redis_publish_batch_body_t;
+
+typedef struct redis_publish_batch_entry_s redis_publish_batch_entry_t;
+struct redis_publish_batch_entry_s {
+  redis_publish_callback_data_t  *d;
+  redis_publish_batch_entry_t    *next;
+  redis_publish_batch_body_t     *body;
+  ngx_str_t                       channel_id;
+  ngx_str_t                       content_type;
+  ngx_str_t                       eventsource_event;
+};
+
+typedef struct {
+  ngx_uint_t                      n;
+  redis_publish_callback_data_t  *d[1]; //actually n
+} redis_publish_batch_t;
+
+static void redisPublishBatchCallback(redisAsyncContext *, void *, void *);
+
+static void redis_publish_batch_event_handler(ngx_event_t *ev) {
+  redis_publish_batch_flush((redis_nodeset_t *)ev->data);
+}
+
+static void redis_publish_batch_entry_free(redis_publish_batch_entry_t *entry) {
+  if(--entry->body->refcount == 0) {
+    ngx_free(entry->body);
+  }
+  ngx_free(entry);
+}
+
+static ngx_int_t redis_publish_batch_on_ready(redis_nodeset_t *ns, void *pd) {
+  redis_publish_batch_entry_t    *cur, *next;
+  ns->publish_batch.waiting_for_ready = 0;
+  if(nodeset_ready(ns)) {
+    return redis_publish_batch_flush(ns);
+  }
+  cur = ns->publish_batch.first;
+  ns->publish_batch.first = NULL;
+  ns->publish_batch.last = NULL;
+  ns->publish_batch.n = 0;
+  for(; cur != NULL; cur = next) {
+    next = cur->next;
+    if(cur->d->shared_msg) {
+      msg_release(cur->d->msg, "redis publish");
+    }
+    cur->d->callback(NGX_HTTP_SERVICE_UNAVAILABLE, NULL, cur->d->privdata);
+    ngx_free(cur->d);
+    redis_publish_batch_entry_free(cur);
+  }
+  return NGX_DECLINED;
+}
+
+static ngx_int_t redis_publish_batch_add(redis_nodeset_t *ns, redis_publish_callback_data_t *d) {
+  redis_publish_batch_entry_t    *entry, *last = ns->publish_batch.last;
+  redis_publish_batch_body_t     *body = NULL;
+  nchan_msg_t                    *msg = d->msg;
+  ngx_str_t                       msgstr;
+  int                             mmapped;
+  u_char                         *cur;
+  size_t                          ctlen = msg->content_type ? msg->content_type->len : 0;
+  size_t                          eselen = msg->eventsource_event ? msg->eventsource_event->len : 0;
+  
+  mmapped = redis_publish_message_body(msg, &msgstr);
+  d->msglen = msgstr.len;
+  
+  //the same message going to the next channel of a multi-channel publish.
+  //comparing the bytes too, because the previous message may be gone and its address reused
+  if(last && last->d->msg == msg && last->body->data.len == msgstr.len && ngx_memcmp(last->body->data.data, msgstr.data, msgstr.len) == 0) {
+    body = last->body;
+  }
+  else if((body = ngx_alloc(sizeof(*body) + msgstr.len, ngx_cycle->log)) != NULL) {
+    body->refcount = 0;
+    body->data.len = msgstr.len;
+    body->data.data = (u_char *)&body[1];
+    ngx_memcpy(body->data.data, msgstr.data, msgstr.len);
+  }
+  if(mmapped && munmap(msgstr.data, msgstr.len) == -1) {
+    ERR("munmap was a problem");
+  }
+  
+  if(body == NULL || (entry = ngx_alloc(sizeof(*entry) + d->channel_id->len + ctlen + eselen, ngx_cycle->log)) == NULL) {
+    ERR("can't allocate batched publish entry");
+    if(body && body->refcount == 0) {
+      ngx_free(body);
+    }
+    return NGX_ERROR;
+  }
+  entry->d = d;
+  entry->next = NULL;
+  entry->body = body;
+  body->refcount++;
+  cur = (u_char *)&entry[1];
+  
+  entry->channel_id.len = d->channel_id->len;
+  entry->channel_id.data = cur;
+  cur = ngx_cpymem(cur, d->channel_id->data, d->channel_id->len);
+  
+  entry->content_type.len = ctlen;
+  entry->content_type.data = cur;
+  if(ctlen) {
+    cur = ngx_cpymem(cur, msg->content_type->data, ctlen);
+  }
+  
+  entry->eventsource_event.len = eselen;
+  entry->eventsource_event.data = cur;
+  if(eselen) {
+    ngx_memcpy(cur, msg->eventsource_event->data, eselen);
+  }
+  
+  if(ns->publish_batch.last) {
+    ns->publish_batch.last->next = entry;
+  }
+  else {
+    ns->publish_batch.first = entry;
+  }
+  ns->publish_batch.last = entry;
+  ns->publish_batch.n++;
+  
+  if(ns->publish_batch.n >= REDIS_PUBLISH_BATCH_MAX) {
+    redis_publish_batch_flush(ns);
+    return NGX_OK;
+  }
+  
+  if(!ns->publish_batch.ev.handler) {
+    nchan_init_timer(&ns->publish_batch.ev, redis_publish_batch_event_handler, ns);
+  }
+  if(ns->settings.publish_batch_window > 0) {
+    if(!ns->publish_batch.ev.timer_set) {
+      ngx_add_timer(&ns->publish_batch.ev, ns->settings.publish_batch_window);
+    }
+  }
+  else {
+    ngx_post_event(&ns->publish_batch.ev, &ngx_posted_events);
+  }
+  return NGX_OK;
+}
+
+static void redis_publish_batch_send(redis_node_t *node, redis_publish_batch_entry_t **entries, ngx_uint_t n) {
+  redis_nodeset_t                *ns = node->nodeset;
+  redis_publish_batch_t          *batch;
+  redis_publish_batch_entry_t    *e;
+  redis_batch_argv_t              args;
+  ngx_uint_t                      i, j, bodies;
+  
+  //entries sharing a body are always next to each other
+  for(bodies = 1, j = 1; j < n; j++) {
+    if(entries[j]->body != entries[j-1]->body) {
+      bodies++;
+    }
+  }
+  
+  //input:  keys: [], values: [namespace, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub, bodies_count, (message_body)..., (channel_id, time, message_body_index, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size)...]
+  batch = ngx_alloc(sizeof(*batch) + sizeof(batch->d[0]) * (n - 1), ngx_cycle->log);
+  if(!batch || redis_batch_argv_init(&args, REDIS_PUBLISH_BATCH_SCRIPT_ARGC + 3 + bodies + n * REDIS_PUBLISH_BATCH_MSG_ARGC, 4 + 5 * n, &redis_lua_scripts.publish_batch, ns->settings.namespace) != NGX_OK) {
+    ERR("can't allocate batched publish command");
+    for(i = 0; i < n; i++) {
+      if(entries[i]->d->shared_msg) {
+        msg_release(entries[i]->d->msg, "redis publish");
+      }
+      entries[i]->d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, entries[i]->d->privdata);
+      ngx_free(entries[i]->d);
+    }
+    if(batch) ngx_free(batch);
+    return;
+  }
+  
+  redis_batch_argv_int(&args, redis_publish_message_msgkey_size);
+  redis_batch_argv_int(&args, ns->settings.optimize_target);
+  redis_batch_argv_int(&args, ns->settings.sharded_pubsub);
+  redis_batch_argv_int(&args, bodies);
+  for(j = 0; j < n; j++) {
+    if(j == 0 || entries[j]->body != entries[j-1]->body) {
+      redis_batch_argv_str(&args, &entries[j]->body->data);
+    }
+  }
+  
+  batch->n = n;
+  for(i = 0, j = 0; j < n; j++) {
+    e = entries[j];
+    if(j > 0 && e->body != entries[j-1]->body) {
+      i++;
+    }
+    batch->d[j] = e->d;
+    redis_batch_argv_str(&args, &e->channel_id);
+    redis_batch_argv_int(&args, e->d->msg_time);
+    redis_batch_argv_int(&args, i + 1);
+    redis_batch_argv_str(&args, &e->content_type);
+    redis_batch_argv_str(&args, &e->eventsource_event);
+    redis_batch_argv_int(&args, e->d->compression);
+    redis_batch_argv_int(&args, e->d->message_timeout);
+    redis_batch_argv_int(&args, e->d->max_messages);
+  }
+  
+  redis_batch_argv_send(node, redisPublishBatchCallback, batch, &args);
+}
+
+static ngx_int_t redis_publish_batch_flush(redis_nodeset_t *ns) {
+  redis_publish_batch_entry_t    *pending, *cur, *next, **prev;
+  redis_publish_batch_entry_t    *group[REDIS_PUBLISH_BATCH_MAX];
+  redis_node_t                   *node;
+  ngx_uint_t                      i, n, max;
+  
+  if(ns->publish_batch.ev.timer_set) {
+    ngx_del_timer(&ns->publish_batch.ev);
+  }
+  if(ns->publish_batch.ev.posted) {
+    ngx_delete_posted_event(&ns->publish_batch.ev);
+  }
+  if(ns->publish_batch.first == NULL) {
+    return NGX_OK;
+  }
+  
+  if(!nodeset_ready(ns)) {
+    if(!ns->publish_batch.waiting_for_ready) {
+      ns->publish_batch.waiting_for_ready = 1;
+      nodeset_callback_on_ready(ns, 1000 * REDIS_NODESET_NOT_READY_MAX_RETRIES, redis_publish_batch_on_ready, NULL);
+    }
+    return NGX_DECLINED;
+  }
+  
+  //publisher callbacks may publish again, so start a new batch for those
+  pending = ns->publish_batch.first;
+  ns->publish_batch.first = NULL;
+  ns->publish_batch.last = NULL;
+  ns->publish_batch.n = 0;
+  
+  max = ns->cluster.enabled ? 1 : REDIS_PUBLISH_BATCH_MAX;
+  
+  //pick off all the messages for one node at a time
+  while(pending) {
+    node = nodeset_node_find_by_channel_id(ns, &pending->channel_id);
+    n = 0;
+    for(prev = &pending, cur = *prev; cur != NULL; cur = next) {
+      next = cur->next;
+      if(n < max && nodeset_node_find_by_channel_id(ns, &cur->channel_id) == node) {
+        *prev = next;
+        group[n++] = cur;
+      }
+      else {
+        prev = &cur->next;
+      }
+    }
+    
+    if(node && node->state >= REDIS_NODE_READY) {
+      redis_publish_batch_send(node, group, n);
+    }
+    else {
+      for(i = 0; i < n; i++) {
+        cur = group[i];
+        if(cur->d->shared_msg) {
+          msg_release(cur->d->msg, "redis publish");
+        }
+        cur->d->callback(NGX_HTTP_SERVICE_UNAVAILABLE, NULL, cur->d->privdata);
+        ngx_free(cur->d);
+      }
+    }
+    while(n > 0) {
+      redis_publish_batch_entry_free(group[--n]);
+    }
+  }
+  
+  return NGX_OK;
+}
+
 static ngx_int_t nchan_store_publish_message(ngx_str_t *channel_id, nchan_msg_t *msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
   redis_publish_callback_data_t  *d=NULL;
   redis_nodeset_t                *ns = nodeset_find(&cf->redis);
@@ -2189,34 +3206,30 @@ static ngx_int_t nchan_store_publish_message(ngx_str_t *channel_id, nchan_msg_t
   if(d->shared_msg) {
     msg_reserve(d->msg, "redis publish");
   }
+  if(ns->settings.publish_batch && !ns->cluster.enabled && redis_publish_batch_add(ns, d) == NGX_OK) {
+    return NGX_OK;
+  }
   redis_publish_message_send(ns, d);
   
   return NGX_OK;
 }
 
-static void redisPublishCallback(redisAsyncContext *c, void *r, void *privdata) {
-  redis_publish_callback_data_t *d=(redis_publish_callback_data_t *)privdata;
-  redisReply                    *reply=r;
+static void redis_publish_keyslot_error(redis_nodeset_t *ns, redis_publish_callback_data_t *d) {
+  if(d->shared_msg) {
+    redis_publish_message_nodeset_maybe_retry(ns, d);
+  }
+  else {
+    //message probably isn't available anymore...
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "redis store received cluster MOVE/ASK error while publishing, and can't retry publishing after reconfiguring cluster.");
+    d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
+    ngx_free(d);
+  }
+}
+
+static void redis_publish_reply(redisAsyncContext *c, redisReply *reply, redis_publish_callback_data_t *d) {
   redisReply                    *cur;
   nchan_channel_t                ch;
   
-  redis_node_t                 *node = c->data;
-  node->pending_commands--;
-  nchan_update_stub_status(redis_pending_commands, -1);
-  
-  if(!nodeset_node_reply_keyslot_ok(node, reply)) {
-    if(d->shared_msg) {
-      redis_publish_message_nodeset_maybe_retry(node->nodeset, d);
-    }
-    else {
-      //message probably isn't available anymore...
-      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "redis store received cluster MOVE/ASK error while publishing, and can't retry publishing after reconfiguring cluster.");
-      d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
-      ngx_free(d);
-    }
-    return;
-  }
-  
   if(d->shared_msg) {
     msg_release(d->msg, "redis publish");
   }
@@ -2234,17 +3247,88 @@ static void redisPublishCallback(redisAsyncContext *c, void *r, void *privdata)
         break;
       case NGX_ERROR:
       default:
-        redisEchoCallback(c, r, privdata);
+        redisEchoCallback(c, reply, d);
         d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
     }
   }
   else {
-    redisEchoCallback(c, r, privdata);
+    redisEchoCallback(c, reply, d);
     d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
   }
   ngx_free(d);
 }
 
+static void redisPublishCallback(redisAsyncContext *c, void *r, void *privdata) {
+  redis_publish_callback_data_t *d=(redis_publish_callback_data_t *)privdata;
+  redisReply                    *reply=r;
+  
+  redis_node_t                 *node = c->data;
+  node->pending_commands--;
+  nchan_update_stub_status(redis_pending_commands, -1);
+  
+  if(!nodeset_node_reply_keyslot_ok(node, reply)) {
+    redis_publish_keyslot_error(node->nodeset, d);
+    return;
+  }
+  
+  redis_publish_reply(c, reply, d);
+}
+
+static void redisPublishBatchCallback(redisAsyncContext *c, void *r, void *privdata) {
+  redis_publish_batch_t         *batch = privdata;
+  redisReply                    *reply = r;
+  redisReply                    *cur;
+  redis_publish_callback_data_t *d;
+  ngx_uint_t                     i;
+  int                            keyslot_changed = 0;
+  
+  redis_node_t                 *node = c->data;
+  node->pending_commands--;
+  nchan_update_stub_status(redis_pending_commands, -1);
+  
+  if(!nodeset_node_reply_keyslot_ok(node, reply)) {
+    for(i = 0; i < batch->n; i++) {
+      redis_publish_keyslot_error(node->nodeset, batch->d[i]);
+    }
+  }
+  else if(reply && reply->type == REDIS_REPLY_ARRAY && reply->elements == batch->n) {
+    for(i = 0; i < batch->n; i++) {
+      d = batch->d[i];
+      cur = reply->element[i];
+      if(cur->type == REDIS_REPLY_STRING && nchan_cstr_startswith(cur->str, "CLUSTER KEYSLOT ERROR")) {
+        if(!keyslot_changed) {
+          nodeset_node_keyslot_changed(node);
+          keyslot_changed = 1;
+        }
+        redis_publish_keyslot_error(node->nodeset, d);
+      }
+      else if(cur->type == REDIS_REPLY_STRING) {
+        node_log_error(node, "error publishing to channel: %s", cur->str);
+        if(d->shared_msg) {
+          msg_release(d->msg, "redis publish");
+        }
+        d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
+        ngx_free(d);
+      }
+      else {
+        redis_publish_reply(c, cur, d);
+      }
+    }
+  }
+  else {
+    redisEchoCallback(c, r, privdata);
+    for(i = 0; i < batch->n; i++) {
+      d = batch->d[i];
+      if(d->shared_msg) {
+        msg_release(d->msg, "redis publish");
+      }
+      d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
+      ngx_free(d);
+    }
+  }
+  ngx_free(batch);
+}
+
 
 
 typedef struct {
@@ -2318,12 +3402,202 @@ static void nchan_store_redis_add_fakesub_callback(redisAsyncContext *c, void *r
   redisCheckErrorCallback(c, r, privdata);
 }
 
+// Batched fake subscriber counts: changes are queued per nodeset, and sent at the end of the event
+// loop iteration as one add_fakesub_batch script call per Redis node. The memstore already
+// collects each channel's changes over nchan_redis_fakesub_timer_interval.
+
+#define REDIS_FAKESUB_BATCH_MAX 512
+
+typedef struct redis_fakesub_batch_entry_s redis_fakesub_batch_entry_t;
+struct redis_fakesub_batch_entry_s {
+  redis_fakesub_batch_entry_t    *next;
+  ngx_int_t                       count;
+  ngx_str_t                       channel_id;
+};
+
+typedef struct {
+  ngx_uint_t                      n;
+  redis_fakesub_batch_entry_t    *entry[1]; //actually n
+} redis_fakesub_batch_t;
+
+static void redis_fakesub_batch_event_handler(ngx_event_t *ev) {
+  redis_fakesub_batch_flush((redis_nodeset_t *)ev->data);
+}
+
+static ngx_int_t redis_fakesub_batch_add(redis_nodeset_t *ns, ngx_str_t *channel_id, ngx_int_t count) {
+  redis_fakesub_batch_entry_t    *entry;
+  
+  if((entry = ngx_alloc(sizeof(*entry) + channel_id->len, ngx_cycle->log)) == NULL) {
+    ERR("can't allocate batched fakesub entry");
+    return NGX_ERROR;
+  }
+  entry->next = NULL;
+  entry->count = count;
+  entry->channel_id.data = (u_char *)&entry[1];
+  nchan_strcpy(&entry->channel_id, channel_id, 0);
+  
+  if(ns->fakesub_batch.last) {
+    ns->fakesub_batch.last->next = entry;
+  }
+  else {
+    ns->fakesub_batch.first = entry;
+  }
+  ns->fakesub_batch.last = entry;
+  ns->fakesub_batch.n++;
+  
+  if(ns->fakesub_batch.n >= REDIS_FAKESUB_BATCH_MAX) {
+    redis_fakesub_batch_flush(ns);
+    return NGX_OK;
+  }
+  
+  if(!ns->fakesub_batch.ev.handler) {
+    nchan_init_timer(&ns->fakesub_batch.ev, redis_fakesub_batch_event_handler, ns);
+  }
+  if(!ns->fakesub_batch.ev.posted) {
+    ngx_post_event(&ns->fakesub_batch.ev, &ngx_posted_events);
+  }
+  return NGX_OK;
+}
+
+static void redisFakesubBatchCallback(redisAsyncContext *c, void *r, void *privdata);
+
+static void redis_fakesub_batch_send(redis_node_t *node, redis_fakesub_batch_entry_t **entries, ngx_uint_t n) {
+  redis_nodeset_t                *ns = node->nodeset;
+  redis_fakesub_batch_t          *batch;
+  redis_batch_argv_t              args;
+  ngx_uint_t                      j;
+  
+  //input:  keys: [], values: [namespace, time, (channel_id, number)...]
+  batch = ngx_alloc(sizeof(*batch) + sizeof(batch->entry[0]) * (n - 1), ngx_cycle->log);
+  if(!batch || redis_batch_argv_init(&args, 5 + n * 2, 1 + n, &redis_lua_scripts.add_fakesub_batch, ns->settings.namespace) != NGX_OK) {
+    ERR("can't allocate batched fakesub command");
+    for(j = 0; j < n; j++) {
+      ngx_free(entries[j]);
+    }
+    if(batch) ngx_free(batch);
+    return;
+  }
+  
+  redis_batch_argv_int(&args, ngx_time());
+  
+  batch->n = n;
+  for(j = 0; j < n; j++) {
+    batch->entry[j] = entries[j];
+    redis_batch_argv_str(&args, &entries[j]->channel_id);
+    redis_batch_argv_int(&args, entries[j]->count);
+  }
+  
+  redis_batch_argv_send(node, redisFakesubBatchCallback, batch, &args);
+}
+
+static ngx_int_t redis_fakesub_batch_flush(redis_nodeset_t *ns) {
+  redis_fakesub_batch_entry_t    *pending, *cur, *next, **prev;
+  redis_fakesub_batch_entry_t    *group[REDIS_FAKESUB_BATCH_MAX];
+  redis_node_t                   *node;
+  ngx_uint_t                      n;
+  
+  if(ns->fakesub_batch.ev.posted) {
+    ngx_delete_posted_event(&ns->fakesub_batch.ev);
+  }
+  
+  pending = ns->fakesub_batch.first;
+  ns->fakesub_batch.first = NULL;
+  ns->fakesub_batch.last = NULL;
+  ns->fakesub_batch.n = 0;
+  
+  if(!nodeset_ready(ns)) {
+    //same as a single add_fakesub when Redis isn't there: the counts are lost
+    for(cur = pending; cur != NULL; cur = next) {
+      next = cur->next;
+      ngx_free(cur);
+    }
+    return pending ? NGX_DECLINED : NGX_OK;
+  }
+  
+  //pick off all the channels for one node at a time
+  while(pending) {
+    node = nodeset_node_find_by_channel_id(ns, &pending->channel_id);
+    n = 0;
+    for(prev = &pending, cur = *prev; cur != NULL; cur = next) {
+      next = cur->next;
+      if(n < REDIS_FAKESUB_BATCH_MAX && nodeset_node_find_by_channel_id(ns, &cur->channel_id) == node) {
+        *prev = next;
+        group[n++] = cur;
+      }
+      else {
+        prev = &cur->next;
+      }
+    }
+    
+    if(node && node->state >= REDIS_NODE_READY) {
+      redis_fakesub_batch_send(node, group, n);
+    }
+    else {
+      while(n > 0) {
+        ngx_free(group[--n]);
+      }
+    }
+  }
+  
+  return NGX_OK;
+}
+
+static void redisFakesubBatchCallback(redisAsyncContext *c, void *r, void *privdata) {
+  redis_fakesub_batch_t          *batch = privdata;
+  redis_fakesub_batch_entry_t    *entry;
+  redisReply                     *reply = r;
+  redisReply                     *el;
+  redis_node_t                   *node = c->data;
+  add_fakesub_data_t             *d;
+  ngx_uint_t                      i;
+  int                             keyslot_changed = 0;
+  
+  node->pending_commands--;
+  nchan_update_stub_status(redis_pending_commands, -1);
+  
+  if(nodeset_node_reply_keyslot_ok(node, reply) && redisReplyOk(c, reply)) {
+    if(reply->type != REDIS_REPLY_ARRAY || reply->elements != batch->n) {
+      ERR("unexpected reply to batched fakesub update");
+    }
+    else for(i = 0; i < batch->n; i++) {
+      el = reply->element[i];
+      entry = batch->entry[i];
+      if(CHECK_REPLY_STRNVAL(el, "CLUSTER KEYSLOT ERROR. ", 23)) {
+        if(!keyslot_changed) {
+          nodeset_node_keyslot_changed(node);
+          keyslot_changed = 1;
+        }
+        //retry this one on its own once the cluster's sorted out
+        if((d = ngx_alloc(sizeof(*d) + sizeof(ngx_str_t) + entry->channel_id.len, ngx_cycle->log)) == NULL) {
+          ERR("can't allocate add_fakesub_data for CLUSTER KEYSLOT ERROR retry");
+          continue;
+        }
+        d->count = entry->count;
+        d->channel_id = (ngx_str_t *)&d[1];
+        d->channel_id->data = (u_char *)&d->channel_id[1];
+        nchan_strcpy(d->channel_id, &entry->channel_id, 0);
+        nodeset_callback_on_ready(node->nodeset, 1000, nchan_store_redis_add_fakesub_send_retry_wrapper, d);
+      }
+      else if(!CHECK_REPLY_INT(el)) {
+        ERR("fakesub update for %V failed: %s", &entry->channel_id, CHECK_REPLY_STR(el) ? el->str : "(not a string)");
+      }
+    }
+  }
+  
+  for(i = 0; i < batch->n; i++) {
+    ngx_free(batch->entry[i]);
+  }
+  ngx_free(batch);
+}
+
 ngx_int_t nchan_store_redis_fakesub_add(ngx_str_t *channel_id, nchan_loc_conf_t *cf, ngx_int_t count, uint8_t shutting_down) {
   redis_nodeset_t  *nodeset = nodeset_find(&cf->redis);
   
   if(!shutting_down) {
-    add_fakesub_data_t   data = {channel_id, count};
-    nchan_store_redis_add_fakesub_send(nodeset, &data);
+    if(redis_fakesub_batch_add(nodeset, channel_id, count) != NGX_OK) {
+      add_fakesub_data_t   data = {channel_id, count};
+      nchan_store_redis_add_fakesub_send(nodeset, &data);
+    }
   }
   else {
     if(nodeset_ready(nodeset)) {
@@ -2336,6 +3610,10 @@ ngx_int_t nchan_store_redis_fakesub_add(ngx_str_t *channel_id, nchan_loc_conf_t
 
 int nchan_store_redis_ready(nchan_loc_conf_t *cf) {
   redis_nodeset_t   *nodeset = nodeset_find(&cf->redis);
+  if(!memstore_worker_connects_to_redis()) {
+    //the channel owner answers for Redis, and will respond with an error if it's not ready
+    return nodeset != NULL;
+  }
   return nodeset && nodeset_ready(nodeset);
 }
 
@@ -0,0 +1,42 @@
+--input:  keys: [], values: [namespace, time, (channel_id, number)...]
+--output: for each channel, current_fake_subscribers or a "CLUSTER KEYSLOT ERROR" string
+-- same as add_fakesub.lua, for many channels at once
+
+redis.call('echo', ' ####### FAKESUBS BATCH ####### ')
+local ns=ARGV[1]
+local time = tonumber(ARGV[2])
+local argc_per_channel = 2
+
+local add_fakesub = function(id, num)
+  if num==nil then
+    return "fakesub number not given"
+  end
+  
+  local chan_key = ('%s{channel:%s}'):format(ns, id)
+  
+  local res = redis.pcall('EXISTS', chan_key)
+  if type(res) == "table" and res["err"] then
+    return ("CLUSTER KEYSLOT ERROR. %i %s"):format(num, id)
+  end
+  
+  local exists = res == 1
+  local cur = 0
+  
+  if exists or (not exists and num > 0) then
+    cur = redis.call('HINCRBY', chan_key, 'fake_subscribers', num)
+    if time then
+      redis.call('HSET', chan_key, 'last_seen_fake_subscriber', time)
+    end
+    if not exists then
+      redis.call('EXPIRE', chan_key, 5) --something small
+    end
+  end
+  
+  return cur
+end
+
+local results = {}
+for i = 3, #ARGV, argc_per_channel do
+  table.insert(results, add_fakesub(ARGV[i], tonumber(ARGV[i+1])))
+end
+return results
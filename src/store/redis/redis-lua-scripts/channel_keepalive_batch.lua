@@ -0,0 +1,55 @@
+--input:  keys: [], values: [namespace, (channel_id, ttl)...]
+-- ttl is for when there are no messages but at least 1 subscriber.
+--output: for each channel, seconds until next keepalive is expected, -1 for "let it disappear", or a "CLUSTER KEYSLOT ERROR" string
+redis.call('ECHO', ' ####### CHANNEL KEEPALIVE BATCH ####### ')
+local ns=ARGV[1]
+local argc_per_channel = 2
+
+local random_safe_next_ttl = function(ttl)
+  return math.floor(ttl/2 + ttl/2.1 * math.random())
+end
+
+local keepalive = function(id, ttl)
+  if not ttl then
+    return "Invalid channel keepalive TTL"
+  end
+  local ch = ('%s{channel:%s}'):format(ns, id)
+  local key={
+    channel=   ch, --hash
+    messages=  ch..':messages', --list
+    stream=    ch..':stream', --stream, with nchan_redis_stream_storage
+  }
+  
+  -- the first key access for each channel is a pcall, so that a channel
+  -- that's not on this cluster node doesn't fail the whole batch
+  local subs_count = redis.pcall('HGET', key.channel, "subscribers")
+  if type(subs_count) == "table" and subs_count["err"] then
+    return ("CLUSTER KEYSLOT ERROR. %s"):format(id)
+  end
+  subs_count = tonumber(subs_count) or 0
+  
+  local msgs_count = tonumber(redis.call('LLEN', key.messages)) or 0
+  if redis.call('EXISTS', key.stream) == 1 then
+    msgs_count = msgs_count + tonumber(redis.call('XLEN', key.stream))
+  end
+  local actual_ttl = tonumber(redis.call('TTL',  key.channel))
+
+  if subs_count > 0 then
+    if msgs_count > 0 and actual_ttl > ttl then
+      return random_safe_next_ttl(actual_ttl)
+    end
+    --refresh ttl
+    redis.call('expire', key.channel, ttl);
+    redis.call('expire', key.messages, ttl);
+    redis.call('expire', key.stream, ttl);
+    return random_safe_next_ttl(ttl)
+  else
+    return -1
+  end
+end
+
+local results = {}
+for i = 2, #ARGV, argc_per_channel do
+  table.insert(results, keepalive(ARGV[i], tonumber(ARGV[i+1])))
+end
+return results
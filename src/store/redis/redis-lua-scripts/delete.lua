@@ -1,12 +1,14 @@
---input: keys: [],  values: [ namespace, channel_id ]
+--input: keys: [],  values: [ namespace, channel_id, sharded_pubsub ]
 --output: channel_hash {ttl, time_last_seen, subscribers, messages} or nil
 -- delete this channel and all its messages
 local ns = ARGV[1]
 local id = ARGV[2]
+local sharded_pubsub = tonumber(ARGV[3]) == 1
 local ch = ('%s{channel:%s}'):format(ns, id)
 local key_msg=    ch..':msg:%s' --not finished yet
 local key_channel=ch
 local messages=   ch..':messages'
+local stream=     ch..':stream'
 local subscribers=ch..':subscribers'
 local pubsub=     ch..':pubsub'
 
@@ -24,6 +26,10 @@ while true do
   end
 end
 
+if redis.call('EXISTS', stream) == 1 then
+  num_messages = num_messages + redis.call('XLEN', stream)
+end
+
 local del_msgpack =cmsgpack.pack({"alert", "delete channel", id})
 for k,channel_key in pairs(redis.call('SMEMBERS', subscribers)) do
   redis.call('PUBLISH', channel_key, del_msgpack)
@@ -52,9 +58,13 @@ if redis.call('EXISTS', key_channel) ~= 0 then
   redis.call('setex', ch..":deleted", 5, 1)  
 end
 
-redis.call('DEL', key_channel, messages, subscribers)
+redis.call('DEL', key_channel, messages, stream, subscribers)
 
-if redis.call('PUBSUB','NUMSUB', pubsub)[2] > 0 then
+if sharded_pubsub then
+  if redis.call('PUBSUB','SHARDNUMSUB', pubsub)[2] > 0 then
+    redis.call('SPUBLISH', pubsub, del_msgpack)
+  end
+elseif redis.call('PUBSUB','NUMSUB', pubsub)[2] > 0 then
   redis.call('PUBLISH', pubsub, del_msgpack)
 end
 
@@ -5,6 +5,7 @@ local ns = ARGV[1]
 local id = ARGV[2]
 local channel_key = ('%s{channel:%s}'):format(ns, id)
 local messages_key = channel_key..':messages'
+local stream_key = channel_key..':stream'
 
 redis.call('echo', ' #######  FIND_CHANNEL ######## ')
 
@@ -54,6 +55,8 @@ if redis.call('EXISTS', channel_key) ~= 0 then
   if redis.call("TYPE", messages_key)['ok'] == 'list' then
     oldestmsg(messages_key, channel_key ..':msg:%s')
     msgs_count = tonumber(redis.call('llen', messages_key))
+  elseif redis.call("TYPE", stream_key)['ok'] == 'stream' then
+    msgs_count = tonumber(redis.call('xlen', stream_key))
   else
     msgs_count = 0
   end
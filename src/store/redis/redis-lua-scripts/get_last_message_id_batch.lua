@@ -0,0 +1,17 @@
+--input:  keys: [], values: [namespace, channel_id...]
+--output: for each channel, its latest message id as "time:tag", "" if it has none, or a "CLUSTER KEYSLOT ERROR" string
+redis.call('ECHO', ' ####### GET LAST MESSAGE ID BATCH ####### ')
+local ns=ARGV[1]
+
+local results = {}
+for i = 2, #ARGV do
+  local id = ARGV[i]
+  -- a pcall, so that a channel that's not on this cluster node doesn't fail the whole batch
+  local msgid = redis.pcall('HGET', ('%s{channel:%s}'):format(ns, id), 'current_message')
+  if type(msgid) == "table" and msgid["err"] then
+    table.insert(results, ("CLUSTER KEYSLOT ERROR. %s"):format(id))
+  else
+    table.insert(results, msgid or "")
+  end
+end
+return results
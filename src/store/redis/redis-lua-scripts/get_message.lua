@@ -1,11 +1,16 @@
---input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl]
+--input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, read_only]
 --output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count
 -- no_msgid_order: 'FILO' for oldest message, 'FIFO' for most recent
 -- create_channel_ttl - make new channel if it's absent, with ttl set to this. 0 to disable.
+-- read_only - 1 when running on a slave: don't clean up expired message ids or create channels
 -- result_code can be: 200 - ok, 404 - not found, 410 - gone, 418 - not yet available
 local ns, id, time, tag, subscribe_if_current = ARGV[1], ARGV[2], tonumber(ARGV[3]), tonumber(ARGV[4])
 local no_msgid_order=ARGV[5]
 local create_channel_ttl=tonumber(ARGV[6]) or 0
+local read_only=tonumber(ARGV[7]) == 1
+if read_only then
+  create_channel_ttl = 0
+end
 local msg_id
 if time and time ~= 0 and tag then
   msg_id=("%s:%s"):format(time, tag)
@@ -39,13 +44,13 @@ local oldestmsg=function(list_key, old_fmt)
   local n, del=0,0
   while true do
     n=n+1
-    old=redis.call('lindex', list_key, -1)
+    old=redis.call('lindex', list_key, read_only and -n or -1)
     if old then
       oldkey=old_fmt:format(old)
       local ex=redis.call('exists', oldkey)
       if ex==1 then
         return oldkey
-      else
+      elseif not read_only then
         redis.call('rpop', list_key)
         del=del+1
       end 
@@ -1,7 +1,25 @@
---input:  keys: [message_key], values: []
+--input:  keys: [message_key], values: [msg_time, msg_tag]
 --output: msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression, channel_subscriber_count
+-- message_key is either the message's hash, or the channel's message stream (see publish_stream.lua)
 local key = KEYS[1]
 
+if redis.call('TYPE', key)['ok'] == 'stream' then
+  local sid = ('%s-%s'):format(ARGV[1], ARGV[2])
+  local entry = redis.call('XRANGE', key, sid, sid)[1]
+  if not entry then
+    return {}
+  end
+  local msg = {}
+  for i = 1, #entry[2], 2 do
+    msg[entry[2][i]] = entry[2][i+1]
+  end
+  local ttl = tonumber(msg.expires) - tonumber(redis.call('TIME')[1])
+  if ttl <= 0 then
+    return {}
+  end
+  return {ttl, tonumber(ARGV[1]), tonumber(ARGV[2]), msg.prev_time or 0, msg.prev_tag or 0, msg.data or "", msg.content_type or "", msg.eventsource_event or "", tonumber(msg.compression or 0)}
+end
+
 local ttl = redis.call('TTL', key)
 local time, tag, prev_time, prev_tag, data, content_type, es_event, compression = unpack(redis.call('HMGET', key, 'time', 'tag', 'prev_time', 'prev_tag', 'data', 'content_type', 'eventsource_event', 'compression'))
 
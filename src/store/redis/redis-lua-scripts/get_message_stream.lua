@@ -0,0 +1,139 @@
+--input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, read_only]
+--output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count
+-- same as get_message.lua, for channels whose messages are kept in a Redis stream by publish_stream.lua
+-- result_code can be: 200 - ok, 404 - not found, 410 - gone, 418 - not yet available
+local ns, id, time, tag = ARGV[1], ARGV[2], tonumber(ARGV[3]), tonumber(ARGV[4])
+local no_msgid_order=ARGV[5]
+local create_channel_ttl=tonumber(ARGV[6]) or 0
+local read_only=tonumber(ARGV[7]) == 1
+if read_only then
+  create_channel_ttl = 0
+end
+local msg_id
+if time and time ~= 0 and tag then
+  msg_id=("%s:%s"):format(time, tag)
+end
+
+if redis.replicate_commands then
+  redis.replicate_commands()
+end
+
+local ch=('%s{channel:%s}'):format(ns, id)
+local key={
+  channel=      ch, --hash
+  stream=       ch..':stream', --stream
+}
+
+redis.call('echo', ' #######  GET_MESSAGE STREAM ######## ')
+
+local tohash=function(arr)
+  if type(arr)~="table" then
+    return nil
+  end
+  local h = {}
+  local k=nil
+  for i, v in ipairs(arr) do
+    if k == nil then
+      k=v
+    else
+      h[k]=v; k=nil
+    end
+  end
+  return h
+end
+
+local now = tonumber(redis.call('TIME')[1])
+
+local expired = function(entry)
+  return tonumber(tohash(entry[2]).expires or 0) <= now
+end
+
+local stream_id = function(nchan_msg_id)
+  return (nchan_msg_id:gsub(":", "-"))
+end
+
+--oldest unexpired entry. expired ones are cleaned out on the way, unless this is a slave
+local oldest_entry=function()
+  local start = '-'
+  while true do
+    local entries = redis.call('XRANGE', key.stream, start, '+', 'COUNT', 16)
+    local found_any = false
+    for _, entry in ipairs(entries) do
+      if entry[1] ~= start then
+        found_any = true
+        if not expired(entry) then
+          return entry
+        elseif not read_only then
+          redis.call('XDEL', key.stream, entry[1])
+        end
+        start = entry[1]
+      end
+    end
+    if not found_any then
+      return nil
+    end
+  end
+end
+
+local entry_reply=function(entry, subs_count)
+  local msg = tohash(entry[2])
+  local etime, etag = entry[1]:match("^(%d+)-(%d+)$")
+  return {200, tonumber(msg.expires) - now, tonumber(etime), tonumber(etag), tonumber(msg.prev_time) or 0, tonumber(msg.prev_tag) or 0, msg.data or "", msg.content_type or "", msg.eventsource_event or "", tonumber(msg.compression) or 0, subs_count}
+end
+
+if no_msgid_order ~= 'FIFO' then
+  no_msgid_order = 'FILO'
+end
+
+local channel = tohash(redis.call('HGETALL', key.channel))
+local new_channel = false
+if next(channel) == nil then
+  if create_channel_ttl==0 then
+    return {404, nil}
+  end
+  redis.call('HSET', key.channel, 'time', time)
+  redis.call('EXPIRE', key.channel, create_channel_ttl)
+  channel = {time=time}
+  new_channel = true
+end
+
+local subs_count = tonumber(channel.subscribers)
+
+if msg_id==nil then
+  if new_channel then
+    return {418, "", "", "", "", subs_count}
+  end
+  local entry
+  if no_msgid_order == 'FIFO' then --most recent message
+    if channel.current_message then
+      local sid = stream_id(channel.current_message)
+      entry = redis.call('XRANGE', key.stream, sid, sid)[1]
+      if not entry or expired(entry) then
+        return {404, "", "", "", "", subs_count}
+      end
+    end
+  else --oldest message
+    entry = oldest_entry()
+  end
+  if entry == nil then
+    --we await a message
+    return {418, "", "", "", "", subs_count}
+  end
+  return entry_reply(entry, subs_count)
+else
+  if channel.current_message == msg_id or not channel.current_message then
+    return {418, "", "", "", "", subs_count}
+  end
+
+  -- the message we're after, and the one after it
+  local sid = stream_id(msg_id)
+  local entries = redis.call('XRANGE', key.stream, sid, '+', 'COUNT', 2)
+  if not entries[1] or entries[1][1] ~= sid or expired(entries[1]) then
+    -- no such message. it might've expired, or maybe it was never there
+    return {404, nil}
+  end
+  if not entries[2] or expired(entries[2]) then
+    return {404, nil}
+  end
+  return entry_reply(entries[2], subs_count)
+end
@@ -1,4 +1,4 @@
---input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target]
+--input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub]
 --output: channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?
 
 local ns, id=ARGV[1], ARGV[2]
@@ -17,6 +17,9 @@ local msgpacked_pubsub_cutoff = tonumber(ARGV[10])
 
 local optimize_target = tonumber(ARGV[11]) == 2 and "bandwidth" or "cpu"
 
+--redis 7 sharded pubsub keeps the message on this keyslot's nodes instead of the whole cluster
+local publish_command = tonumber(ARGV[12]) == 1 and 'SPUBLISH' or 'PUBLISH'
+
 local time
 if optimize_target == "cpu" and redis.replicate_commands then
   -- we're on redis >= 3.2. We can use We can use 'script effects replication' to allow
@@ -271,7 +274,7 @@ local msgpacked
 --but now that we're subscribing to slaves this is not possible
 --so just PUBLISH always.
 msgpacked = cmsgpack.pack(unpacked)
-redis.call('PUBLISH', channel_pubsub, msgpacked)
+redis.call(publish_command, channel_pubsub, msgpacked)
 
 local num_messages = redis.call('llen', key.messages)
 
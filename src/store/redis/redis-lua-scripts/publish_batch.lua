@@ -0,0 +1,270 @@
+--input:  keys: [], values: [namespace, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub, bodies_count, (message_body)..., (channel_id, time, message_body_index, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size)...]
+--output: for each message, either {channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?} or an error string
+-- same as publish.lua, for many messages at once. A message published to several channels has its body sent just once.
+-- A message whose channel isn't on this cluster node gets a "CLUSTER KEYSLOT ERROR" string. Nchan only batches
+-- messages like this outside of cluster mode, so that's just for batches queued before the cluster was discovered,
+-- which hold one message each.
+
+local ns = ARGV[1]
+local msgpacked_pubsub_cutoff = tonumber(ARGV[2])
+local optimize_target = tonumber(ARGV[3]) == 2 and "bandwidth" or "cpu"
+local publish_command = tonumber(ARGV[4]) == 1 and 'SPUBLISH' or 'PUBLISH'
+local bodies_count = tonumber(ARGV[5])
+local first_msg_arg = 6 + bodies_count
+local argc_per_msg = 8
+
+local effects_replication = false
+if optimize_target == "cpu" and redis.replicate_commands then
+  -- redis >= 3.2, so use Redis' TIME rather than the given time from Nginx. see publish.lua
+  redis.replicate_commands()
+  effects_replication = true
+end
+
+redis.call('echo', ' #######  PUBLISH BATCH  ######## ')
+
+-- sets all fields for a hash from a dictionary
+local hmset = function (key, dict)
+  if next(dict) == nil then return nil end
+  local bulk = {}
+  for k, v in pairs(dict) do
+    table.insert(bulk, k)
+    table.insert(bulk, v)
+  end
+  return redis.call('HMSET', key, unpack(bulk))
+end
+
+local tohash=function(arr)
+  if type(arr)~="table" then
+    return nil
+  end
+  local h = {}
+  local k=nil
+  for i, v in ipairs(arr) do
+    if k == nil then
+      k=v
+    else
+      h[k]=v; k=nil
+    end
+  end
+  return h
+end
+
+--check old entries
+local oldestmsg=function(list_key, old_fmt)
+  local old, oldkey
+  while true do
+    old=redis.call('lindex', list_key, -1)
+    if old then
+      oldkey=old_fmt:format(old)
+      if redis.call('exists', oldkey)==1 then
+        return oldkey
+      else
+        redis.call('rpop', list_key)
+      end
+    else
+      break
+    end
+  end
+end
+
+local publish = function(id, msg, store_at_most_n_messages)
+  local time = msg.time
+
+  if store_at_most_n_messages == nil then
+    return "max_msg_buf_size can't be empty"
+  end
+  if store_at_most_n_messages == 0 then
+    msg.unbuffered = 1
+  end
+  if msg.ttl == 0 then
+    msg.ttl = 126144000 --4 years
+  end
+  if type(msg.content_type)=='string' and msg.content_type:find(':') then
+    return 'Message content-type cannot contain ":" character.'
+  end
+
+  local ch = ('%s{channel:%s}'):format(ns, id)
+  local msg_fmt = ch..':msg:%s'
+  local key={
+    last_message= msg_fmt, --not finished yet
+    message=      msg_fmt, --not finished yet
+    channel=      ch,
+    messages=     ch..':messages',
+    subscribers=  ch..':subscribers'
+  }
+  local channel_pubsub = ch..':pubsub'
+
+  -- the first key access for each message is a pcall, so that a channel
+  -- that's not on this cluster node doesn't fail the whole batch
+  local exists = redis.pcall('EXISTS', key.channel)
+  if type(exists) == "table" and exists["err"] then
+    if tostring(exists["err"]):find("non local key", 1, true) then
+      return ("CLUSTER KEYSLOT ERROR. %s"):format(id)
+    end
+    return exists["err"]
+  end
+
+  local new_channel
+  local channel
+  if exists ~= 0 then
+    channel=tohash(redis.call('HGETALL', key.channel))
+    channel.max_stored_messages = tonumber(channel.max_stored_messages)
+  end
+
+  if channel~=nil then
+    if channel.current_message ~= nil then
+      key.last_message=key.last_message:format(channel.current_message, id)
+    else
+      key.last_message=nil
+    end
+    new_channel=false
+  else
+    channel={}
+    new_channel=true
+    key.last_message=nil
+  end
+
+  --set new message id
+  local lastmsg, lasttime, lasttag
+  if key.last_message then
+    lastmsg = redis.call('HMGET', key.last_message, 'time', 'tag')
+    lasttime, lasttag = tonumber(lastmsg[1]), tonumber(lastmsg[2])
+    if lasttime and tonumber(lasttime) > tonumber(msg.time) then
+      redis.log(redis.LOG_WARNING, "Nchan: message for " .. id .. " arrived a little late and may be delivered out of order. Redis must be very busy, or the Nginx servers do not have their times synchronized.")
+      msg.time = lasttime
+      time = lasttime
+    end
+    if lasttime and lasttime==msg.time then
+      msg.tag=lasttag+1
+    end
+    msg.prev_time = lasttime
+    msg.prev_tag = lasttag
+  else
+    msg.prev_time = 0
+    msg.prev_tag = 0
+  end
+  msg.id=('%i:%i'):format(msg.time, msg.tag)
+
+  key.message=key.message:format(msg.id)
+  if redis.call('EXISTS', key.message) ~= 0 then
+    return ("Message %s for channel %s id %s already exists."):format(key.message, id, msg.id)
+  end
+
+  msg.prev=channel.current_message
+  if key.last_message and redis.call('exists', key.last_message) == 1 then
+    redis.call('HSET', key.last_message, 'next', msg.id)
+  end
+
+  --update channel
+  redis.call('HSET', key.channel, 'current_message', msg.id)
+  if msg.prev then
+    redis.call('HSET', key.channel, 'prev_message', msg.prev)
+  end
+  if time then
+    redis.call('HSET', key.channel, 'time', time)
+  end
+
+  local message_len_changed = false
+  if channel.max_stored_messages ~= store_at_most_n_messages then
+    channel.max_stored_messages = store_at_most_n_messages
+    message_len_changed = true
+    redis.call('HSET', key.channel, 'max_stored_messages', store_at_most_n_messages)
+  end
+
+  --write message
+  hmset(key.message, msg)
+
+  local max_stored_msgs = channel.max_stored_messages or -1
+
+  if max_stored_msgs < 0 then --no limit
+    oldestmsg(key.messages, msg_fmt)
+    redis.call('LPUSH', key.messages, msg.id)
+  elseif max_stored_msgs > 0 then
+    local stored_messages = tonumber(redis.call('LLEN', key.messages))
+    redis.call('LPUSH', key.messages, msg.id)
+    -- Reduce the message length if necessary
+    local dump_message_ids = redis.call('LRANGE', key.messages, max_stored_msgs, stored_messages);
+    if dump_message_ids then
+      for _, msgid in ipairs(dump_message_ids) do
+        redis.call('DEL', msg_fmt:format(msgid))
+      end
+    end
+    redis.call('LTRIM', key.messages, 0, max_stored_msgs - 1)
+    oldestmsg(key.messages, msg_fmt)
+  end
+
+  --set expiration times for all the things
+  local channel_ttl = tonumber(redis.call('TTL',  key.channel))
+  redis.call('EXPIRE', key.message, msg.ttl)
+  if msg.ttl + 1 > channel_ttl then -- a little extra time for failover weirdness for 1-second TTL messages
+    redis.call('EXPIRE', key.channel, msg.ttl + 1)
+    redis.call('EXPIRE', key.messages, msg.ttl + 1)
+    redis.call('EXPIRE', key.subscribers, msg.ttl + 1)
+  end
+
+  --publish message
+  local unpacked
+
+  if msg.unbuffered or #msg.data < msgpacked_pubsub_cutoff then
+    unpacked= {
+      "msg",
+      msg.ttl or 0,
+      msg.time,
+      tonumber(msg.tag) or 0,
+      (msg.unbuffered and 0 or msg.prev_time) or 0,
+      (msg.unbuffered and 0 or msg.prev_tag) or 0,
+      msg.data or "",
+      msg.content_type or "",
+      msg.eventsource_event or "",
+      msg.compression or 0
+    }
+  else
+    unpacked= {
+      "msgkey",
+      msg.time,
+      tonumber(msg.tag) or 0,
+      key.message
+    }
+  end
+
+  if message_len_changed then
+    unpacked[1] = "max_msgs+" .. unpacked[1]
+    table.insert(unpacked, 2, tonumber(channel.max_stored_messages))
+  end
+
+  redis.call(publish_command, channel_pubsub, cmsgpack.pack(unpacked))
+
+  local num_messages = redis.call('llen', key.messages)
+
+  local chan = {
+    tonumber(channel.ttl or msg.ttl),
+    tonumber(channel.last_seen_fake_subscriber) or 0,
+    tonumber(channel.fake_subscribers or channel.subscribers) or 0,
+    msg.time and msg.time and ("%i:%i"):format(msg.time, msg.tag) or "",
+    tonumber(num_messages)
+  }
+
+  return {chan, new_channel}
+end
+
+local redis_time
+if effects_replication then
+  redis_time = tonumber(redis.call('TIME')[1])
+end
+
+local results = {}
+for i = first_msg_arg, #ARGV, argc_per_msg do
+  local msg = {
+    id = nil,
+    data = ARGV[5 + tonumber(ARGV[i+2])],
+    content_type = ARGV[i+3],
+    eventsource_event = ARGV[i+4],
+    compression = tonumber(ARGV[i+5]),
+    ttl = tonumber(ARGV[i+6]),
+    time = redis_time or tonumber(ARGV[i+1]),
+    tag = 0
+  }
+  table.insert(results, publish(ARGV[i], msg, tonumber(ARGV[i+7])))
+end
+
+return results
@@ -0,0 +1,204 @@
+--input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub]
+--output: channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?
+-- same as publish.lua, but the channel's messages are entries in a Redis stream (redis >= 5) with ids of the form <time>-<tag>
+
+local ns, id=ARGV[1], ARGV[2]
+
+local msg = {}
+
+local store_at_most_n_messages = tonumber(ARGV[9])
+if store_at_most_n_messages == nil or store_at_most_n_messages == "" then
+  return {err="Argument 9, max_msg_buf_size, can't be empty"}
+end
+if store_at_most_n_messages == 0 then
+  msg.unbuffered = 1
+end
+
+local msgpacked_pubsub_cutoff = tonumber(ARGV[10])
+
+local optimize_target = tonumber(ARGV[11]) == 2 and "bandwidth" or "cpu"
+
+local publish_command = tonumber(ARGV[12]) == 1 and 'SPUBLISH' or 'PUBLISH'
+
+local time
+if optimize_target == "cpu" and redis.replicate_commands then
+  -- use Redis' TIME rather than the given time from Nginx. see publish.lua
+  redis.replicate_commands()
+  time = tonumber(redis.call('TIME')[1])
+else
+  time = tonumber(ARGV[3])
+end
+
+msg.data= ARGV[4]
+msg.content_type=ARGV[5]
+msg.eventsource_event=ARGV[6]
+msg.compression=tonumber(ARGV[7])
+msg.ttl= tonumber(ARGV[8])
+msg.time= time
+msg.tag= 0
+
+if msg.ttl == 0 then
+  msg.ttl = 126144000 --4 years
+end
+
+if type(msg.content_type)=='string' and msg.content_type:find(':') then
+  return {err='Message content-type cannot contain ":" character.'}
+end
+
+redis.call('echo', ' #######  PUBLISH STREAM  ######## ')
+
+local tohash=function(arr)
+  if type(arr)~="table" then
+    return nil
+  end
+  local h = {}
+  local k=nil
+  for i, v in ipairs(arr) do
+    if k == nil then
+      k=v
+    else
+      h[k]=v; k=nil
+    end
+  end
+  return h
+end
+
+local ch = ('%s{channel:%s}'):format(ns, id)
+local key={
+  channel=      ch,
+  stream=       ch..':stream',
+  subscribers=  ch..':subscribers'
+}
+local channel_pubsub = ch..':pubsub'
+
+local new_channel
+local channel
+if redis.call('EXISTS', key.channel) ~= 0 then
+  channel=tohash(redis.call('HGETALL', key.channel))
+  channel.max_stored_messages = tonumber(channel.max_stored_messages)
+  new_channel=false
+else
+  channel={}
+  new_channel=true
+end
+
+--set new message id. stream entry ids must keep going up, so the tag does too.
+local lasttime, lasttag
+if channel.current_message then
+  lasttime, lasttag = channel.current_message:match("^(%d+):(%d+)$")
+  lasttime, lasttag = tonumber(lasttime), tonumber(lasttag)
+end
+if lasttime then
+  if lasttime > msg.time then
+    redis.log(redis.LOG_WARNING, "Nchan: message for " .. id .. " arrived a little late and may be delivered out of order. Redis must be very busy, or the Nginx servers do not have their times synchronized.")
+    msg.time = lasttime
+    time = lasttime
+  end
+  if lasttime == msg.time then
+    msg.tag = lasttag + 1
+  end
+  msg.prev_time = lasttime
+  msg.prev_tag = lasttag
+else
+  msg.prev_time = 0
+  msg.prev_tag = 0
+end
+msg.id=('%i:%i'):format(msg.time, msg.tag)
+
+--update channel
+redis.call('HSET', key.channel, 'current_message', msg.id)
+if channel.current_message then
+  redis.call('HSET', key.channel, 'prev_message', channel.current_message)
+end
+if time then
+  redis.call('HSET', key.channel, 'time', time)
+end
+
+local message_len_changed = false
+if channel.max_stored_messages ~= store_at_most_n_messages then
+  channel.max_stored_messages = store_at_most_n_messages
+  message_len_changed = true
+  redis.call('HSET', key.channel, 'max_stored_messages', store_at_most_n_messages)
+end
+
+--drop expired entries from the front of the stream
+local now = msg.time
+while true do
+  local oldest = redis.call('XRANGE', key.stream, '-', '+', 'COUNT', 1)[1]
+  if not oldest or tonumber(tohash(oldest[2]).expires or 0) > now then
+    break
+  end
+  redis.call('XDEL', key.stream, oldest[1])
+end
+
+--write message
+local max_stored_msgs = channel.max_stored_messages or -1
+local stream_id = ('%i-%i'):format(msg.time, msg.tag)
+local entry = {
+  'prev_time', msg.prev_time,
+  'prev_tag', msg.prev_tag,
+  'expires', msg.time + msg.ttl,
+  'data', msg.data or "",
+  'content_type', msg.content_type or "",
+  'eventsource_event', msg.eventsource_event or "",
+  'compression', msg.compression or 0
+}
+if max_stored_msgs < 0 then --no limit
+  redis.call('XADD', key.stream, stream_id, unpack(entry))
+elseif max_stored_msgs > 0 then
+  -- an exact MAXLEN. '~' only trims whole stream nodes, and wouldn't cap short buffers at all
+  redis.call('XADD', key.stream, 'MAXLEN', max_stored_msgs, stream_id, unpack(entry))
+end
+
+--set expiration times for all the things
+local channel_ttl = tonumber(redis.call('TTL',  key.channel))
+if msg.ttl + 1 > channel_ttl then -- a little extra time for failover weirdness for 1-second TTL messages
+  redis.call('EXPIRE', key.channel, msg.ttl + 1)
+  redis.call('EXPIRE', key.stream, msg.ttl + 1)
+  redis.call('EXPIRE', key.subscribers, msg.ttl + 1)
+end
+
+--publish message
+local unpacked
+
+if msg.unbuffered or #msg.data < msgpacked_pubsub_cutoff then
+  unpacked= {
+    "msg",
+    msg.ttl or 0,
+    msg.time,
+    tonumber(msg.tag) or 0,
+    (msg.unbuffered and 0 or msg.prev_time) or 0,
+    (msg.unbuffered and 0 or msg.prev_tag) or 0,
+    msg.data or "",
+    msg.content_type or "",
+    msg.eventsource_event or "",
+    msg.compression or 0
+  }
+else
+  -- get_message_from_key picks the entry out of the stream by the message id
+  unpacked= {
+    "msgkey",
+    msg.time,
+    tonumber(msg.tag) or 0,
+    key.stream
+  }
+end
+
+if message_len_changed then
+  unpacked[1] = "max_msgs+" .. unpacked[1]
+  table.insert(unpacked, 2, tonumber(channel.max_stored_messages))
+end
+
+redis.call(publish_command, channel_pubsub, cmsgpack.pack(unpacked))
+
+local num_messages = redis.call('EXISTS', key.stream) == 1 and redis.call('XLEN', key.stream) or 0
+
+local chan = {
+  tonumber(channel.ttl or msg.ttl),
+  tonumber(channel.last_seen_fake_subscriber) or 0,
+  tonumber(channel.fake_subscribers or channel.subscribers) or 0,
+  msg.time and msg.time and ("%i:%i"):format(msg.time, msg.tag) or "",
+  tonumber(num_messages)
+}
+
+return {chan, new_channel}
@@ -14,6 +14,7 @@ local ch=("%s{channel:%s}"):format(ns, id)
 local keys = {
   channel =     ch,
   messages =    ch..':messages:',
+  stream =      ch..':stream',
   subscribers = ch..':subscribers'
 }
 
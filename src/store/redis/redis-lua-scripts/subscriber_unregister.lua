@@ -12,6 +12,7 @@ local ch=('%s{channel:%s}'):format(ns, id)
 local keys = {
   channel =     ch,
   messages =    ch..':messages',
+  stream =      ch..':stream',
   subscribers = ch..':subscribers',
 }
 
@@ -37,7 +38,8 @@ end
 if res ~= 0 then
    sub_count = redis.call('hincrby', keys.channel, 'subscribers', -1)
 
-  if sub_count == 0 and tonumber(redis.call('LLEN', keys.messages)) == 0 then
+  if sub_count == 0 and tonumber(redis.call('LLEN', keys.messages)) == 0
+   and (redis.call('EXISTS', keys.stream) == 0 or tonumber(redis.call('XLEN', keys.stream)) == 0) then
     setkeyttl(empty_ttl)
   elseif sub_count < 0 then
     return {err="Subscriber count for channel " .. id .. " less than zero: " .. sub_count}
@@ -37,53 +37,119 @@ redis_lua_scripts_t redis_lua_scripts = {
    "\n"
    "return cur\n"},
 
-  {"channel_keepalive", "7e213d514486887425875dc9835564edfe14e677",
-   "--input:  keys: [], values: [namespace, channel_id, ttl]\n"
-   "-- ttl is for when there are no messages but at least 1 subscriber.\n"
-   "--output: seconds until next keepalive is expected, or -1 for \"let it disappear\"\n"
-   "redis.call('ECHO', ' ####### CHANNEL KEEPALIVE ####### ')\n"
+  {"add_fakesub_batch", "26676e6b3ab2a7097e31f7bc1564028eec54a875",
+   "--input:  keys: [], values: [namespace, time, (channel_id, number)...]\n"
+   "--output: for each channel, current_fake_subscribers or a \"CLUSTER KEYSLOT ERROR\" string\n"
+   "-- same as add_fakesub.lua, for many channels at once\n"
+   "\n"
+   "redis.call('echo', ' ####### FAKESUBS BATCH ####### ')\n"
    "local ns=ARGV[1]\n"
-   "local id=ARGV[2]\n"
-   "local ttl=tonumber(ARGV[3])\n"
-   "if not ttl then\n"
-   "  return {err=\"Invalid channel keepalive TTL (2nd arg)\"}\n"
+   "local time = tonumber(ARGV[2])\n"
+   "local argc_per_channel = 2\n"
+   "\n"
+   "local add_fakesub = function(id, num)\n"
+   "  if num==nil then\n"
+   "    return \"fakesub number not given\"\n"
+   "  end\n"
+   "  \n"
+   "  local chan_key = ('%s{channel:%s}'):format(ns, id)\n"
+   "  \n"
+   "  local res = redis.pcall('EXISTS', chan_key)\n"
+   "  if type(res) == \"table\" and res[\"err\"] then\n"
+   "    return (\"CLUSTER KEYSLOT ERROR. %i %s\"):format(num, id)\n"
+   "  end\n"
+   "  \n"
+   "  local exists = res == 1\n"
+   "  local cur = 0\n"
+   "  \n"
+   "  if exists or (not exists and num > 0) then\n"
+   "    cur = redis.call('HINCRBY', chan_key, 'fake_subscribers', num)\n"
+   "    if time then\n"
+   "      redis.call('HSET', chan_key, 'last_seen_fake_subscriber', time)\n"
+   "    end\n"
+   "    if not exists then\n"
+   "      redis.call('EXPIRE', chan_key, 5) --something small\n"
+   "    end\n"
+   "  end\n"
+   "  \n"
+   "  return cur\n"
    "end\n"
    "\n"
+   "local results = {}\n"
+   "for i = 3, #ARGV, argc_per_channel do\n"
+   "  table.insert(results, add_fakesub(ARGV[i], tonumber(ARGV[i+1])))\n"
+   "end\n"
+   "return results\n"},
+
+  {"channel_keepalive_batch", "578a3bce4b4d048e8c57a4c1e60a03b25cddca86",
+   "--input:  keys: [], values: [namespace, (channel_id, ttl)...]\n"
+   "-- ttl is for when there are no messages but at least 1 subscriber.\n"
+   "--output: for each channel, seconds until next keepalive is expected, -1 for \"let it disappear\", or a \"CLUSTER KEYSLOT ERROR\" string\n"
+   "redis.call('ECHO', ' ####### CHANNEL KEEPALIVE BATCH ####### ')\n"
+   "local ns=ARGV[1]\n"
+   "local argc_per_channel = 2\n"
+   "\n"
    "local random_safe_next_ttl = function(ttl)\n"
    "  return math.floor(ttl/2 + ttl/2.1 * math.random())\n"
    "end\n"
-   "local ch = ('%s{channel:%s}'):format(ns, id)\n"
-   "local key={\n"
-   "  channel=   ch, --hash\n"
-   "  messages=  ch..':messages', --list\n"
-   "}\n"
+   "\n"
+   "local keepalive = function(id, ttl)\n"
+   "  if not ttl then\n"
+   "    return \"Invalid channel keepalive TTL\"\n"
+   "  end\n"
+   "  local ch = ('%s{channel:%s}'):format(ns, id)\n"
+   "  local key={\n"
+   "    channel=   ch, --hash\n"
+   "    messages=  ch..':messages', --list\n"
+   "    stream=    ch..':stream', --stream, with nchan_redis_stream_storage\n"
+   "  }\n"
    "  \n"
-   "local subs_count = tonumber(redis.call('HGET', key.channel, \"subscribers\")) or 0\n"
-   "local msgs_count = tonumber(redis.call('LLEN', key.messages)) or 0\n"
-   "local actual_ttl = tonumber(redis.call('TTL',  key.channel))\n"
-   "\n"
-   "if subs_count > 0 then\n"
-   "  if msgs_count > 0 and actual_ttl > ttl then\n"
-   "    return random_safe_next_ttl(actual_ttl)\n"
-   "  end\n"
-   "  --refresh ttl\n"
-   "  redis.call('expire', key.channel, ttl);\n"
-   "  redis.call('expire', key.messages, ttl);\n"
-   "  return random_safe_next_ttl(ttl)\n"
-   "else\n"
-   "  return -1\n"
-   "end\n"},
+   "  -- the first key access for each channel is a pcall, so that a channel\n"
+   "  -- that's not on this cluster node doesn't fail the whole batch\n"
+   "  local subs_count = redis.pcall('HGET', key.channel, \"subscribers\")\n"
+   "  if type(subs_count) == \"table\" and subs_count[\"err\"] then\n"
+   "    return (\"CLUSTER KEYSLOT ERROR. %s\"):format(id)\n"
+   "  end\n"
+   "  subs_count = tonumber(subs_count) or 0\n"
+   "  \n"
+   "  local msgs_count = tonumber(redis.call('LLEN', key.messages)) or 0\n"
+   "  if redis.call('EXISTS', key.stream) == 1 then\n"
+   "    msgs_count = msgs_count + tonumber(redis.call('XLEN', key.stream))\n"
+   "  end\n"
+   "  local actual_ttl = tonumber(redis.call('TTL',  key.channel))\n"
+   "\n"
+   "  if subs_count > 0 then\n"
+   "    if msgs_count > 0 and actual_ttl > ttl then\n"
+   "      return random_safe_next_ttl(actual_ttl)\n"
+   "    end\n"
+   "    --refresh ttl\n"
+   "    redis.call('expire', key.channel, ttl);\n"
+   "    redis.call('expire', key.messages, ttl);\n"
+   "    redis.call('expire', key.stream, ttl);\n"
+   "    return random_safe_next_ttl(ttl)\n"
+   "  else\n"
+   "    return -1\n"
+   "  end\n"
+   "end\n"
+   "\n"
+   "local results = {}\n"
+   "for i = 2, #ARGV, argc_per_channel do\n"
+   "  table.insert(results, keepalive(ARGV[i], tonumber(ARGV[i+1])))\n"
+   "end\n"
+   "return results\n"},
 
-  {"delete", "181906aceef3012cc1f94c272bd00d9050f2916f",
-   "--input: keys: [],  values: [ namespace, channel_id ]\n"
+  {"delete", "2f37af74bd57ba908ea944d5d72ea26b18af71d8",
+   "--input: keys: [],  values: [ namespace, channel_id, sharded_pubsub ]\n"
    "--output: channel_hash {ttl, time_last_seen, subscribers, messages} or nil\n"
    "-- delete this channel and all its messages\n"
    "local ns = ARGV[1]\n"
    "local id = ARGV[2]\n"
+   "local sharded_pubsub = tonumber(ARGV[3]) == 1\n"
    "local ch = ('%s{channel:%s}'):format(ns, id)\n"
    "local key_msg=    ch..':msg:%s' --not finished yet\n"
    "local key_channel=ch\n"
    "local messages=   ch..':messages'\n"
+   "local stream=     ch..':stream'\n"
    "local subscribers=ch..':subscribers'\n"
    "local pubsub=     ch..':pubsub'\n"
    "\n"
@@ -101,6 +167,10 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  end\n"
    "end\n"
    "\n"
+   "if redis.call('EXISTS', stream) == 1 then\n"
+   "  num_messages = num_messages + redis.call('XLEN', stream)\n"
+   "end\n"
+   "\n"
    "local del_msgpack =cmsgpack.pack({\"alert\", \"delete channel\", id})\n"
    "for k,channel_key in pairs(redis.call('SMEMBERS', subscribers)) do\n"
    "  redis.call('PUBLISH', channel_key, del_msgpack)\n"
@@ -129,9 +199,13 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  redis.call('setex', ch..\":deleted\", 5, 1)  \n"
    "end\n"
    "\n"
-   "redis.call('DEL', key_channel, messages, subscribers)\n"
+   "redis.call('DEL', key_channel, messages, stream, subscribers)\n"
    "\n"
-   "if redis.call('PUBSUB','NUMSUB', pubsub)[2] > 0 then\n"
+   "if sharded_pubsub then\n"
+   "  if redis.call('PUBSUB','SHARDNUMSUB', pubsub)[2] > 0 then\n"
+   "    redis.call('SPUBLISH', pubsub, del_msgpack)\n"
+   "  end\n"
+   "elseif redis.call('PUBSUB','NUMSUB', pubsub)[2] > 0 then\n"
    "  redis.call('PUBLISH', pubsub, del_msgpack)\n"
    "end\n"
    "\n"
@@ -147,7 +221,7 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  return nil\n"
    "end\n"},
 
-  {"find_channel", "d027f1bc80eb1afc33f909759dfb7428cf1f9063",
+  {"find_channel", "f37b31b8e7c4e4b09fefed51ccb2295aa44f6869",
    "--input: keys: [],  values: [ namespace, channel_id ]\n"
    "--output: channel_hash {ttl, time_last_seen, subscribers, last_channel_id, messages} or nil\n"
    "-- finds and return the info hash of a channel, or nil of channel not found\n"
@@ -155,6 +229,7 @@ redis_lua_scripts_t redis_lua_scripts = {
    "local id = ARGV[2]\n"
    "local channel_key = ('%s{channel:%s}'):format(ns, id)\n"
    "local messages_key = channel_key..':messages'\n"
+   "local stream_key = channel_key..':stream'\n"
    "\n"
    "redis.call('echo', ' #######  FIND_CHANNEL ######## ')\n"
    "\n"
@@ -204,6 +279,8 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  if redis.call(\"TYPE\", messages_key)['ok'] == 'list' then\n"
    "    oldestmsg(messages_key, channel_key ..':msg:%s')\n"
    "    msgs_count = tonumber(redis.call('llen', messages_key))\n"
+   "  elseif redis.call(\"TYPE\", stream_key)['ok'] == 'stream' then\n"
+   "    msgs_count = tonumber(redis.call('xlen', stream_key))\n"
    "  else\n"
    "    msgs_count = 0\n"
    "  end\n"
@@ -219,15 +296,39 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  return nil\n"
    "end\n"},
 
-  {"get_message", "fb9c46d33b3798a11d4eca6e0f7a3f92beba8685",
-   "--input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl]\n"
+  {"get_last_message_id_batch", "465650b2f408c0c5677aa0399a61104327de9a38",
+   "--input:  keys: [], values: [namespace, channel_id...]\n"
+   "--output: for each channel, its latest message id as \"time:tag\", \"\" if it has none, or a \"CLUSTER KEYSLOT ERROR\" string\n"
+   "redis.call('ECHO', ' ####### GET LAST MESSAGE ID BATCH ####### ')\n"
+   "local ns=ARGV[1]\n"
+   "\n"
+   "local results = {}\n"
+   "for i = 2, #ARGV do\n"
+   "  local id = ARGV[i]\n"
+   "  -- a pcall, so that a channel that's not on this cluster node doesn't fail the whole batch\n"
+   "  local msgid = redis.pcall('HGET', ('%s{channel:%s}'):format(ns, id), 'current_message')\n"
+   "  if type(msgid) == \"table\" and msgid[\"err\"] then\n"
+   "    table.insert(results, (\"CLUSTER KEYSLOT ERROR. %s\"):format(id))\n"
+   "  else\n"
+   "    table.insert(results, msgid or \"\")\n"
+   "  end\n"
+   "end\n"
+   "return results\n"},
+
+  {"get_message", "9c84c94ae1cf673cf0b38b411ec006eae3bcab7a",
+   "--input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, read_only]\n"
    "--output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count\n"
    "-- no_msgid_order: 'FILO' for oldest message, 'FIFO' for most recent\n"
    "-- create_channel_ttl - make new channel if it's absent, with ttl set to this. 0 to disable.\n"
+   "-- read_only - 1 when running on a slave: don't clean up expired message ids or create channels\n"
    "-- result_code can be: 200 - ok, 404 - not found, 410 - gone, 418 - not yet available\n"
    "local ns, id, time, tag, subscribe_if_current = ARGV[1], ARGV[2], tonumber(ARGV[3]), tonumber(ARGV[4])\n"
    "local no_msgid_order=ARGV[5]\n"
    "local create_channel_ttl=tonumber(ARGV[6]) or 0\n"
+   "local read_only=tonumber(ARGV[7]) == 1\n"
+   "if read_only then\n"
+   "  create_channel_ttl = 0\n"
+   "end\n"
    "local msg_id\n"
    "if time and time ~= 0 and tag then\n"
    "  msg_id=(\"%s:%s\"):format(time, tag)\n"
@@ -261,13 +362,13 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  local n, del=0,0\n"
    "  while true do\n"
    "    n=n+1\n"
-   "    old=redis.call('lindex', list_key, -1)\n"
+   "    old=redis.call('lindex', list_key, read_only and -n or -1)\n"
    "    if old then\n"
    "      oldkey=old_fmt:format(old)\n"
    "      local ex=redis.call('exists', oldkey)\n"
    "      if ex==1 then\n"
    "        return oldkey\n"
-   "      else\n"
+   "      elseif not read_only then\n"
    "        redis.call('rpop', list_key)\n"
    "        del=del+1\n"
    "      end \n"
@@ -376,18 +477,177 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  end\n"
    "end\n"},
 
-  {"get_message_from_key", "304efcd42590f99e0016686572530defd3de1383",
-   "--input:  keys: [message_key], values: []\n"
+  {"get_message_from_key", "a8d4b4468f18baee87934c9d51f325109f74240a",
+   "--input:  keys: [message_key], values: [msg_time, msg_tag]\n"
    "--output: msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression, channel_subscriber_count\n"
+   "-- message_key is either the message's hash, or the channel's message stream (see publish_stream.lua)\n"
    "local key = KEYS[1]\n"
    "\n"
+   "if redis.call('TYPE', key)['ok'] == 'stream' then\n"
+   "  local sid = ('%s-%s'):format(ARGV[1], ARGV[2])\n"
+   "  local entry = redis.call('XRANGE', key, sid, sid)[1]\n"
+   "  if not entry then\n"
+   "    return {}\n"
+   "  end\n"
+   "  local msg = {}\n"
+   "  for i = 1, #entry[2], 2 do\n"
+   "    msg[entry[2][i]] = entry[2][i+1]\n"
+   "  end\n"
+   "  local ttl = tonumber(msg.expires) - tonumber(redis.call('TIME')[1])\n"
+   "  if ttl <= 0 then\n"
+   "    return {}\n"
+   "  end\n"
+   "  return {ttl, tonumber(ARGV[1]), tonumber(ARGV[2]), msg.prev_time or 0, msg.prev_tag or 0, msg.data or \"\", msg.content_type or \"\", msg.eventsource_event or \"\", tonumber(msg.compression or 0)}\n"
+   "end\n"
+   "\n"
    "local ttl = redis.call('TTL', key)\n"
    "local time, tag, prev_time, prev_tag, data, content_type, es_event, compression = unpack(redis.call('HMGET', key, 'time', 'tag', 'prev_time', 'prev_tag', 'data', 'content_type', 'eventsource_event', 'compression'))\n"
    "\n"
    "return {ttl, time, tag, prev_time or 0, prev_tag or 0, data or \"\", content_type or \"\", es_event or \"\", tonumber(compression or 0)}\n"},
 
-  {"publish", "be28281114137d8e85a25a913c50bed2e93d0c7d",
-   "--input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target]\n"
+  {"get_message_stream", "5a2e2e174becbb7f0500c13fd87123f8baa50656",
+   "--input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, read_only]\n"
+   "--output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count\n"
+   "-- same as get_message.lua, for channels whose messages are kept in a Redis stream by publish_stream.lua\n"
+   "-- result_code can be: 200 - ok, 404 - not found, 410 - gone, 418 - not yet available\n"
+   "local ns, id, time, tag = ARGV[1], ARGV[2], tonumber(ARGV[3]), tonumber(ARGV[4])\n"
+   "local no_msgid_order=ARGV[5]\n"
+   "local create_channel_ttl=tonumber(ARGV[6]) or 0\n"
+   "local read_only=tonumber(ARGV[7]) == 1\n"
+   "if read_only then\n"
+   "  create_channel_ttl = 0\n"
+   "end\n"
+   "local msg_id\n"
+   "if time and time ~= 0 and tag then\n"
+   "  msg_id=(\"%s:%s\"):format(time, tag)\n"
+   "end\n"
+   "\n"
+   "if redis.replicate_commands then\n"
+   "  redis.replicate_commands()\n"
+   "end\n"
+   "\n"
+   "local ch=('%s{channel:%s}'):format(ns, id)\n"
+   "local key={\n"
+   "  channel=      ch, --hash\n"
+   "  stream=       ch..':stream', --stream\n"
+   "}\n"
+   "\n"
+   "redis.call('echo', ' #######  GET_MESSAGE STREAM ######## ')\n"
+   "\n"
+   "local tohash=function(arr)\n"
+   "  if type(arr)~=\"table\" then\n"
+   "    return nil\n"
+   "  end\n"
+   "  local h = {}\n"
+   "  local k=nil\n"
+   "  for i, v in ipairs(arr) do\n"
+   "    if k == nil then\n"
+   "      k=v\n"
+   "    else\n"
+   "      h[k]=v; k=nil\n"
+   "    end\n"
+   "  end\n"
+   "  return h\n"
+   "end\n"
+   "\n"
+   "local now = tonumber(redis.call('TIME')[1])\n"
+   "\n"
+   "local expired = function(entry)\n"
+   "  return tonumber(tohash(entry[2]).expires or 0) <= now\n"
+   "end\n"
+   "\n"
+   "local stream_id = function(nchan_msg_id)\n"
+   "  return (nchan_msg_id:gsub(\":\", \"-\"))\n"
+   "end\n"
+   "\n"
+   "--oldest unexpired entry. expired ones are cleaned out on the way, unless this is a slave\n"
+   "local oldest_entry=function()\n"
+   "  local start = '-'\n"
+   "  while true do\n"
+   "    local entries = redis.call('XRANGE', key.stream, start, '+', 'COUNT', 16)\n"
+   "    local found_any = false\n"
+   "    for _, entry in ipairs(entries) do\n"
+   "      if entry[1] ~= start then\n"
+   "        found_any = true\n"
+   "        if not expired(entry) then\n"
+   "          return entry\n"
+   "        elseif not read_only then\n"
+   "          redis.call('XDEL', key.stream, entry[1])\n"
+   "        end\n"
+   "        start = entry[1]\n"
+   "      end\n"
+   "    end\n"
+   "    if not found_any then\n"
+   "      return nil\n"
+   "    end\n"
+   "  end\n"
+   "end\n"
+   "\n"
+   "local entry_reply=function(entry, subs_count)\n"
+   "  local msg = tohash(entry[2])\n"
+   "  local etime, etag = entry[1]:match(\"^(%d+)-(%d+)$\")\n"
+   "  return {200, tonumber(msg.expires) - now, tonumber(etime), tonumber(etag), tonumber(msg.prev_time) or 0, tonumber(msg.prev_tag) or 0, msg.data or \"\", msg.content_type or \"\", msg.eventsource_event or \"\", tonumber(msg.compression) or 0, subs_count}\n"
+   "end\n"
+   "\n"
+   "if no_msgid_order ~= 'FIFO' then\n"
+   "  no_msgid_order = 'FILO'\n"
+   "end\n"
+   "\n"
+   "local channel = tohash(redis.call('HGETALL', key.channel))\n"
+   "local new_channel = false\n"
+   "if next(channel) == nil then\n"
+   "  if create_channel_ttl==0 then\n"
+   "    return {404, nil}\n"
+   "  end\n"
+   "  redis.call('HSET', key.channel, 'time', time)\n"
+   "  redis.call('EXPIRE', key.channel, create_channel_ttl)\n"
+   "  channel = {time=time}\n"
+   "  new_channel = true\n"
+   "end\n"
+   "\n"
+   "local subs_count = tonumber(channel.subscribers)\n"
+   "\n"
+   "if msg_id==nil then\n"
+   "  if new_channel then\n"
+   "    return {418, \"\", \"\", \"\", \"\", subs_count}\n"
+   "  end\n"
+   "  local entry\n"
+   "  if no_msgid_order == 'FIFO' then --most recent message\n"
+   "    if channel.current_message then\n"
+   "      local sid = stream_id(channel.current_message)\n"
+   "      entry = redis.call('XRANGE', key.stream, sid, sid)[1]\n"
+   "      if not entry or expired(entry) then\n"
+   "        return {404, \"\", \"\", \"\", \"\", subs_count}\n"
+   "      end\n"
+   "    end\n"
+   "  else --oldest message\n"
+   "    entry = oldest_entry()\n"
+   "  end\n"
+   "  if entry == nil then\n"
+   "    --we await a message\n"
+   "    return {418, \"\", \"\", \"\", \"\", subs_count}\n"
+   "  end\n"
+   "  return entry_reply(entry, subs_count)\n"
+   "else\n"
+   "  if channel.current_message == msg_id or not channel.current_message then\n"
+   "    return {418, \"\", \"\", \"\", \"\", subs_count}\n"
+   "  end\n"
+   "\n"
+   "  -- the message we're after, and the one after it\n"
+   "  local sid = stream_id(msg_id)\n"
+   "  local entries = redis.call('XRANGE', key.stream, sid, '+', 'COUNT', 2)\n"
+   "  if not entries[1] or entries[1][1] ~= sid or expired(entries[1]) then\n"
+   "    -- no such message. it might've expired, or maybe it was never there\n"
+   "    return {404, nil}\n"
+   "  end\n"
+   "  if not entries[2] or expired(entries[2]) then\n"
+   "    return {404, nil}\n"
+   "  end\n"
+   "  return entry_reply(entries[2], subs_count)\n"
+   "end\n"},
+
+  {"publish", "f0bcc5cd8b80c5ee0ab029f1c11cca83e7a23bf5",
+   "--input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub]\n"
    "--output: channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?\n"
    "\n"
    "local ns, id=ARGV[1], ARGV[2]\n"
@@ -406,6 +666,9 @@ redis_lua_scripts_t redis_lua_scripts = {
    "\n"
    "local optimize_target = tonumber(ARGV[11]) == 2 and \"bandwidth\" or \"cpu\"\n"
    "\n"
+   "--redis 7 sharded pubsub keeps the message on this keyslot's nodes instead of the whole cluster\n"
+   "local publish_command = tonumber(ARGV[12]) == 1 and 'SPUBLISH' or 'PUBLISH'\n"
+   "\n"
    "local time\n"
    "if optimize_target == \"cpu\" and redis.replicate_commands then\n"
    "  -- we're on redis >= 3.2. We can use We can use 'script effects replication' to allow\n"
@@ -660,7 +923,7 @@ redis_lua_scripts_t redis_lua_scripts = {
    "--but now that we're subscribing to slaves this is not possible\n"
    "--so just PUBLISH always.\n"
    "msgpacked = cmsgpack.pack(unpacked)\n"
-   "redis.call('PUBLISH', channel_pubsub, msgpacked)\n"
+   "redis.call(publish_command, channel_pubsub, msgpacked)\n"
    "\n"
    "local num_messages = redis.call('llen', key.messages)\n"
    "\n"
@@ -675,6 +938,278 @@ redis_lua_scripts_t redis_lua_scripts = {
    "\n"
    "return {ch, new_channel}\n"},
 
+  {"publish_batch", "e776af8af9861112b6be1df0232245806b35afd7",
+   "--input:  keys: [], values: [namespace, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub, bodies_count, (message_body)..., (channel_id, time, message_body_index, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size)...]\n"
+   "--output: for each message, either {channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?} or an error string\n"
+   "-- same as publish.lua, for many messages at once. A message published to several channels has its body sent just once.\n"
+   "-- A message whose channel isn't on this cluster node gets a \"CLUSTER KEYSLOT ERROR\" string. Nchan only batches\n"
+   "-- messages like this outside of cluster mode, so that's just for batches queued before the cluster was discovered,\n"
+   "-- which hold one message each.\n"
+   "\n"
+   "local ns = ARGV[1]\n"
+   "local msgpacked_pubsub_cutoff = tonumber(ARGV[2])\n"
+   "local optimize_target = tonumber(ARGV[3]) == 2 and \"bandwidth\" or \"cpu\"\n"
+   "local publish_command = tonumber(ARGV[4]) == 1 and 'SPUBLISH' or 'PUBLISH'\n"
+   "local bodies_count = tonumber(ARGV[5])\n"
+   "local first_msg_arg = 6 + bodies_count\n"
+   "local argc_per_msg = 8\n"
+   "\n"
+   "local effects_replication = false\n"
+   "if optimize_target == \"cpu\" and redis.replicate_commands then\n"
+   "  -- redis >= 3.2, so use Redis' TIME rather than the given time from Nginx. see publish.lua\n"
+   "  redis.replicate_commands()\n"
+   "  effects_replication = true\n"
+   "end\n"
+   "\n"
+   "redis.call('echo', ' #######  PUBLISH BATCH  ######## ')\n"
+   "\n"
+   "-- sets all fields for a hash from a dictionary\n"
+   "local hmset = function (key, dict)\n"
+   "  if next(dict) == nil then return nil end\n"
+   "  local bulk = {}\n"
+   "  for k, v in pairs(dict) do\n"
+   "    table.insert(bulk, k)\n"
+   "    table.insert(bulk, v)\n"
+   "  end\n"
+   "  return redis.call('HMSET', key, unpack(bulk))\n"
+   "end\n"
+   "\n"
+   "local tohash=function(arr)\n"
+   "  if type(arr)~=\"table\" then\n"
+   "    return nil\n"
+   "  end\n"
+   "  local h = {}\n"
+   "  local k=nil\n"
+   "  for i, v in ipairs(arr) do\n"
+   "    if k == nil then\n"
+   "      k=v\n"
+   "    else\n"
+   "      h[k]=v; k=nil\n"
+   "    end\n"
+   "  end\n"
+   "  return h\n"
+   "end\n"
+   "\n"
+   "--check old entries\n"
+   "local oldestmsg=function(list_key, old_fmt)\n"
+   "  local old, oldkey\n"
+   "  while true do\n"
+   "    old=redis.call('lindex', list_key, -1)\n"
+   "    if old then\n"
+   "      oldkey=old_fmt:format(old)\n"
+   "      if redis.call('exists', oldkey)==1 then\n"
+   "        return oldkey\n"
+   "      else\n"
+   "        redis.call('rpop', list_key)\n"
+   "      end\n"
+   "    else\n"
+   "      break\n"
+   "    end\n"
+   "  end\n"
+   "end\n"
+   "\n"
+   "local publish = function(id, msg, store_at_most_n_messages)\n"
+   "  local time = msg.time\n"
+   "\n"
+   "  if store_at_most_n_messages == nil then\n"
+   "    return \"max_msg_buf_size can't be empty\"\n"
+   "  end\n"
+   "  if store_at_most_n_messages == 0 then\n"
+   "    msg.unbuffered = 1\n"
+   "  end\n"
+   "  if msg.ttl == 0 then\n"
+   "    msg.ttl = 126144000 --4 years\n"
+   "  end\n"
+   "  if type(msg.content_type)=='string' and msg.content_type:find(':') then\n"
+   "    return 'Message content-type cannot contain \":\" character.'\n"
+   "  end\n"
+   "\n"
+   "  local ch = ('%s{channel:%s}'):format(ns, id)\n"
+   "  local msg_fmt = ch..':msg:%s'\n"
+   "  local key={\n"
+   "    last_message= msg_fmt, --not finished yet\n"
+   "    message=      msg_fmt, --not finished yet\n"
+   "    channel=      ch,\n"
+   "    messages=     ch..':messages',\n"
+   "    subscribers=  ch..':subscribers'\n"
+   "  }\n"
+   "  local channel_pubsub = ch..':pubsub'\n"
+   "\n"
+   "  -- the first key access for each message is a pcall, so that a channel\n"
+   "  -- that's not on this cluster node doesn't fail the whole batch\n"
+   "  local exists = redis.pcall('EXISTS', key.channel)\n"
+   "  if type(exists) == \"table\" and exists[\"err\"] then\n"
+   "    if tostring(exists[\"err\"]):find(\"non local key\", 1, true) then\n"
+   "      return (\"CLUSTER KEYSLOT ERROR. %s\"):format(id)\n"
+   "    end\n"
+   "    return exists[\"err\"]\n"
+   "  end\n"
+   "\n"
+   "  local new_channel\n"
+   "  local channel\n"
+   "  if exists ~= 0 then\n"
+   "    channel=tohash(redis.call('HGETALL', key.channel))\n"
+   "    channel.max_stored_messages = tonumber(channel.max_stored_messages)\n"
+   "  end\n"
+   "\n"
+   "  if channel~=nil then\n"
+   "    if channel.current_message ~= nil then\n"
+   "      key.last_message=key.last_message:format(channel.current_message, id)\n"
+   "    else\n"
+   "      key.last_message=nil\n"
+   "    end\n"
+   "    new_channel=false\n"
+   "  else\n"
+   "    channel={}\n"
+   "    new_channel=true\n"
+   "    key.last_message=nil\n"
+   "  end\n"
+   "\n"
+   "  --set new message id\n"
+   "  local lastmsg, lasttime, lasttag\n"
+   "  if key.last_message then\n"
+   "    lastmsg = redis.call('HMGET', key.last_message, 'time', 'tag')\n"
+   "    lasttime, lasttag = tonumber(lastmsg[1]), tonumber(lastmsg[2])\n"
+   "    if lasttime and tonumber(lasttime) > tonumber(msg.time) then\n"
+   "      redis.log(redis.LOG_WARNING, \"Nchan: message for \" .. id .. \" arrived a little late and may be delivered out of order. Redis must be very busy, or the Nginx servers do not have their times synchronized.\")\n"
+   "      msg.time = lasttime\n"
+   "      time = lasttime\n"
+   "    end\n"
+   "    if lasttime and lasttime==msg.time then\n"
+   "      msg.tag=lasttag+1\n"
+   "    end\n"
+   "    msg.prev_time = lasttime\n"
+   "    msg.prev_tag = lasttag\n"
+   "  else\n"
+   "    msg.prev_time = 0\n"
+   "    msg.prev_tag = 0\n"
+   "  end\n"
+   "  msg.id=('%i:%i'):format(msg.time, msg.tag)\n"
+   "\n"
+   "  key.message=key.message:format(msg.id)\n"
+   "  if redis.call('EXISTS', key.message) ~= 0 then\n"
+   "    return (\"Message %s for channel %s id %s already exists.\"):format(key.message, id, msg.id)\n"
+   "  end\n"
+   "\n"
+   "  msg.prev=channel.current_message\n"
+   "  if key.last_message and redis.call('exists', key.last_message) == 1 then\n"
+   "    redis.call('HSET', key.last_message, 'next', msg.id)\n"
+   "  end\n"
+   "\n"
+   "  --update channel\n"
+   "  redis.call('HSET', key.channel, 'current_message', msg.id)\n"
+   "  if msg.prev then\n"
+   "    redis.call('HSET', key.channel, 'prev_message', msg.prev)\n"
+   "  end\n"
+   "  if time then\n"
+   "    redis.call('HSET', key.channel, 'time', time)\n"
+   "  end\n"
+   "\n"
+   "  local message_len_changed = false\n"
+   "  if channel.max_stored_messages ~= store_at_most_n_messages then\n"
+   "    channel.max_stored_messages = store_at_most_n_messages\n"
+   "    message_len_changed = true\n"
+   "    redis.call('HSET', key.channel, 'max_stored_messages', store_at_most_n_messages)\n"
+   "  end\n"
+   "\n"
+   "  --write message\n"
+   "  hmset(key.message, msg)\n"
+   "\n"
+   "  local max_stored_msgs = channel.max_stored_messages or -1\n"
+   "\n"
+   "  if max_stored_msgs < 0 then --no limit\n"
+   "    oldestmsg(key.messages, msg_fmt)\n"
+   "    redis.call('LPUSH', key.messages, msg.id)\n"
+   "  elseif max_stored_msgs > 0 then\n"
+   "    local stored_messages = tonumber(redis.call('LLEN', key.messages))\n"
+   "    redis.call('LPUSH', key.messages, msg.id)\n"
+   "    -- Reduce the message length if necessary\n"
+   "    local dump_message_ids = redis.call('LRANGE', key.messages, max_stored_msgs, stored_messages);\n"
+   "    if dump_message_ids then\n"
+   "      for _, msgid in ipairs(dump_message_ids) do\n"
+   "        redis.call('DEL', msg_fmt:format(msgid))\n"
+   "      end\n"
+   "    end\n"
+   "    redis.call('LTRIM', key.messages, 0, max_stored_msgs - 1)\n"
+   "    oldestmsg(key.messages, msg_fmt)\n"
+   "  end\n"
+   "\n"
+   "  --set expiration times for all the things\n"
+   "  local channel_ttl = tonumber(redis.call('TTL',  key.channel))\n"
+   "  redis.call('EXPIRE', key.message, msg.ttl)\n"
+   "  if msg.ttl + 1 > channel_ttl then -- a little extra time for failover weirdness for 1-second TTL messages\n"
+   "    redis.call('EXPIRE', key.channel, msg.ttl + 1)\n"
+   "    redis.call('EXPIRE', key.messages, msg.ttl + 1)\n"
+   "    redis.call('EXPIRE', key.subscribers, msg.ttl + 1)\n"
+   "  end\n"
+   "\n"
+   "  --publish message\n"
+   "  local unpacked\n"
+   "\n"
+   "  if msg.unbuffered or #msg.data < msgpacked_pubsub_cutoff then\n"
+   "    unpacked= {\n"
+   "      \"msg\",\n"
+   "      msg.ttl or 0,\n"
+   "      msg.time,\n"
+   "      tonumber(msg.tag) or 0,\n"
+   "      (msg.unbuffered and 0 or msg.prev_time) or 0,\n"
+   "      (msg.unbuffered and 0 or msg.prev_tag) or 0,\n"
+   "      msg.data or \"\",\n"
+   "      msg.content_type or \"\",\n"
+   "      msg.eventsource_event or \"\",\n"
+   "      msg.compression or 0\n"
+   "    }\n"
+   "  else\n"
+   "    unpacked= {\n"
+   "      \"msgkey\",\n"
+   "      msg.time,\n"
+   "      tonumber(msg.tag) or 0,\n"
+   "      key.message\n"
+   "    }\n"
+   "  end\n"
+   "\n"
+   "  if message_len_changed then\n"
+   "    unpacked[1] = \"max_msgs+\" .. unpacked[1]\n"
+   "    table.insert(unpacked, 2, tonumber(channel.max_stored_messages))\n"
+   "  end\n"
+   "\n"
+   "  redis.call(publish_command, channel_pubsub, cmsgpack.pack(unpacked))\n"
+   "\n"
+   "  local num_messages = redis.call('llen', key.messages)\n"
+   "\n"
+   "  local chan = {\n"
+   "    tonumber(channel.ttl or msg.ttl),\n"
+   "    tonumber(channel.last_seen_fake_subscriber) or 0,\n"
+   "    tonumber(channel.fake_subscribers or channel.subscribers) or 0,\n"
+   "    msg.time and msg.time and (\"%i:%i\"):format(msg.time, msg.tag) or \"\",\n"
+   "    tonumber(num_messages)\n"
+   "  }\n"
+   "\n"
+   "  return {chan, new_channel}\n"
+   "end\n"
+   "\n"
+   "local redis_time\n"
+   "if effects_replication then\n"
+   "  redis_time = tonumber(redis.call('TIME')[1])\n"
+   "end\n"
+   "\n"
+   "local results = {}\n"
+   "for i = first_msg_arg, #ARGV, argc_per_msg do\n"
+   "  local msg = {\n"
+   "    id = nil,\n"
+   "    data = ARGV[5 + tonumber(ARGV[i+2])],\n"
+   "    content_type = ARGV[i+3],\n"
+   "    eventsource_event = ARGV[i+4],\n"
+   "    compression = tonumber(ARGV[i+5]),\n"
+   "    ttl = tonumber(ARGV[i+6]),\n"
+   "    time = redis_time or tonumber(ARGV[i+1]),\n"
+   "    tag = 0\n"
+   "  }\n"
+   "  table.insert(results, publish(ARGV[i], msg, tonumber(ARGV[i+7])))\n"
+   "end\n"
+   "\n"
+   "return results\n"},
+
   {"publish_status", "2f2ce1443b22c8c9cf069d5588bad4bab58d70aa",
    "--input:  keys: [], values: [namespace, channel_id, status_code]\n"
    "--output: current_subscribers\n"
@@ -703,6 +1238,212 @@ redis_lua_scripts_t redis_lua_scripts = {
    "--what?... redis.call('PUBLISH', channel_pubsub, pubmsg)\n"
    "return redis.call('HGET', chan_key, 'subscribers') or 0\n"},
 
+  {"publish_stream", "6b015140ba4c8a30de2d574bc66b414bef44525c",
+   "--input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub]\n"
+   "--output: channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?\n"
+   "-- same as publish.lua, but the channel's messages are entries in a Redis stream (redis >= 5) with ids of the form <time>-<tag>\n"
+   "\n"
+   "local ns, id=ARGV[1], ARGV[2]\n"
+   "\n"
+   "local msg = {}\n"
+   "\n"
+   "local store_at_most_n_messages = tonumber(ARGV[9])\n"
+   "if store_at_most_n_messages == nil or store_at_most_n_messages == \"\" then\n"
+   "  return {err=\"Argument 9, max_msg_buf_size, can't be empty\"}\n"
+   "end\n"
+   "if store_at_most_n_messages == 0 then\n"
+   "  msg.unbuffered = 1\n"
+   "end\n"
+   "\n"
+   "local msgpacked_pubsub_cutoff = tonumber(ARGV[10])\n"
+   "\n"
+   "local optimize_target = tonumber(ARGV[11]) == 2 and \"bandwidth\" or \"cpu\"\n"
+   "\n"
+   "local publish_command = tonumber(ARGV[12]) == 1 and 'SPUBLISH' or 'PUBLISH'\n"
+   "\n"
+   "local time\n"
+   "if optimize_target == \"cpu\" and redis.replicate_commands then\n"
+   "  -- use Redis' TIME rather than the given time from Nginx. see publish.lua\n"
+   "  redis.replicate_commands()\n"
+   "  time = tonumber(redis.call('TIME')[1])\n"
+   "else\n"
+   "  time = tonumber(ARGV[3])\n"
+   "end\n"
+   "\n"
+   "msg.data= ARGV[4]\n"
+   "msg.content_type=ARGV[5]\n"
+   "msg.eventsource_event=ARGV[6]\n"
+   "msg.compression=tonumber(ARGV[7])\n"
+   "msg.ttl= tonumber(ARGV[8])\n"
+   "msg.time= time\n"
+   "msg.tag= 0\n"
+   "\n"
+   "if msg.ttl == 0 then\n"
+   "  msg.ttl = 126144000 --4 years\n"
+   "end\n"
+   "\n"
+   "if type(msg.content_type)=='string' and msg.content_type:find(':') then\n"
+   "  return {err='Message content-type cannot contain \":\" character.'}\n"
+   "end\n"
+   "\n"
+   "redis.call('echo', ' #######  PUBLISH STREAM  ######## ')\n"
+   "\n"
+   "local tohash=function(arr)\n"
+   "  if type(arr)~=\"table\" then\n"
+   "    return nil\n"
+   "  end\n"
+   "  local h = {}\n"
+   "  local k=nil\n"
+   "  for i, v in ipairs(arr) do\n"
+   "    if k == nil then\n"
+   "      k=v\n"
+   "    else\n"
+   "      h[k]=v; k=nil\n"
+   "    end\n"
+   "  end\n"
+   "  return h\n"
+   "end\n"
+   "\n"
+   "local ch = ('%s{channel:%s}'):format(ns, id)\n"
+   "local key={\n"
+   "  channel=      ch,\n"
+   "  stream=       ch..':stream',\n"
+   "  subscribers=  ch..':subscribers'\n"
+   "}\n"
+   "local channel_pubsub = ch..':pubsub'\n"
+   "\n"
+   "local new_channel\n"
+   "local channel\n"
+   "if redis.call('EXISTS', key.channel) ~= 0 then\n"
+   "  channel=tohash(redis.call('HGETALL', key.channel))\n"
+   "  channel.max_stored_messages = tonumber(channel.max_stored_messages)\n"
+   "  new_channel=false\n"
+   "else\n"
+   "  channel={}\n"
+   "  new_channel=true\n"
+   "end\n"
+   "\n"
+   "--set new message id. stream entry ids must keep going up, so the tag does too.\n"
+   "local lasttime, lasttag\n"
+   "if channel.current_message then\n"
+   "  lasttime, lasttag = channel.current_message:match(\"^(%d+):(%d+)$\")\n"
+   "  lasttime, lasttag = tonumber(lasttime), tonumber(lasttag)\n"
+   "end\n"
+   "if lasttime then\n"
+   "  if lasttime > msg.time then\n"
+   "    redis.log(redis.LOG_WARNING, \"Nchan: message for \" .. id .. \" arrived a little late and may be delivered out of order. Redis must be very busy, or the Nginx servers do not have their times synchronized.\")\n"
+   "    msg.time = lasttime\n"
+   "    time = lasttime\n"
+   "  end\n"
+   "  if lasttime == msg.time then\n"
+   "    msg.tag = lasttag + 1\n"
+   "  end\n"
+   "  msg.prev_time = lasttime\n"
+   "  msg.prev_tag = lasttag\n"
+   "else\n"
+   "  msg.prev_time = 0\n"
+   "  msg.prev_tag = 0\n"
+   "end\n"
+   "msg.id=('%i:%i'):format(msg.time, msg.tag)\n"
+   "\n"
+   "--update channel\n"
+   "redis.call('HSET', key.channel, 'current_message', msg.id)\n"
+   "if channel.current_message then\n"
+   "  redis.call('HSET', key.channel, 'prev_message', channel.current_message)\n"
+   "end\n"
+   "if time then\n"
+   "  redis.call('HSET', key.channel, 'time', time)\n"
+   "end\n"
+   "\n"
+   "local message_len_changed = false\n"
+   "if channel.max_stored_messages ~= store_at_most_n_messages then\n"
+   "  channel.max_stored_messages = store_at_most_n_messages\n"
+   "  message_len_changed = true\n"
+   "  redis.call('HSET', key.channel, 'max_stored_messages', store_at_most_n_messages)\n"
+   "end\n"
+   "\n"
+   "--drop expired entries from the front of the stream\n"
+   "local now = msg.time\n"
+   "while true do\n"
+   "  local oldest = redis.call('XRANGE', key.stream, '-', '+', 'COUNT', 1)[1]\n"
+   "  if not oldest or tonumber(tohash(oldest[2]).expires or 0) > now then\n"
+   "    break\n"
+   "  end\n"
+   "  redis.call('XDEL', key.stream, oldest[1])\n"
+   "end\n"
+   "\n"
+   "--write message\n"
+   "local max_stored_msgs = channel.max_stored_messages or -1\n"
+   "local stream_id = ('%i-%i'):format(msg.time, msg.tag)\n"
+   "local entry = {\n"
+   "  'prev_time', msg.prev_time,\n"
+   "  'prev_tag', msg.prev_tag,\n"
+   "  'expires', msg.time + msg.ttl,\n"
+   "  'data', msg.data or \"\",\n"
+   "  'content_type', msg.content_type or \"\",\n"
+   "  'eventsource_event', msg.eventsource_event or \"\",\n"
+   "  'compression', msg.compression or 0\n"
+   "}\n"
+   "if max_stored_msgs < 0 then --no limit\n"
+   "  redis.call('XADD', key.stream, stream_id, unpack(entry))\n"
+   "elseif max_stored_msgs > 0 then\n"
+   "  -- an exact MAXLEN. '~' only trims whole stream nodes, and wouldn't cap short buffers at all\n"
+   "  redis.call('XADD', key.stream, 'MAXLEN', max_stored_msgs, stream_id, unpack(entry))\n"
+   "end\n"
+   "\n"
+   "--set expiration times for all the things\n"
+   "local channel_ttl = tonumber(redis.call('TTL',  key.channel))\n"
+   "if msg.ttl + 1 > channel_ttl then -- a little extra time for failover weirdness for 1-second TTL messages\n"
+   "  redis.call('EXPIRE', key.channel, msg.ttl + 1)\n"
+   "  redis.call('EXPIRE', key.stream, msg.ttl + 1)\n"
+   "  redis.call('EXPIRE', key.subscribers, msg.ttl + 1)\n"
+   "end\n"
+   "\n"
+   "--publish message\n"
+   "local unpacked\n"
+   "\n"
+   "if msg.unbuffered or #msg.data < msgpacked_pubsub_cutoff then\n"
+   "  unpacked= {\n"
+   "    \"msg\",\n"
+   "    msg.ttl or 0,\n"
+   "    msg.time,\n"
+   "    tonumber(msg.tag) or 0,\n"
+   "    (msg.unbuffered and 0 or msg.prev_time) or 0,\n"
+   "    (msg.unbuffered and 0 or msg.prev_tag) or 0,\n"
+   "    msg.data or \"\",\n"
+   "    msg.content_type or \"\",\n"
+   "    msg.eventsource_event or \"\",\n"
+   "    msg.compression or 0\n"
+   "  }\n"
+   "else\n"
+   "  -- get_message_from_key picks the entry out of the stream by the message id\n"
+   "  unpacked= {\n"
+   "    \"msgkey\",\n"
+   "    msg.time,\n"
+   "    tonumber(msg.tag) or 0,\n"
+   "    key.stream\n"
+   "  }\n"
+   "end\n"
+   "\n"
+   "if message_len_changed then\n"
+   "  unpacked[1] = \"max_msgs+\" .. unpacked[1]\n"
+   "  table.insert(unpacked, 2, tonumber(channel.max_stored_messages))\n"
+   "end\n"
+   "\n"
+   "redis.call(publish_command, channel_pubsub, cmsgpack.pack(unpacked))\n"
+   "\n"
+   "local num_messages = redis.call('EXISTS', key.stream) == 1 and redis.call('XLEN', key.stream) or 0\n"
+   "\n"
+   "local chan = {\n"
+   "  tonumber(channel.ttl or msg.ttl),\n"
+   "  tonumber(channel.last_seen_fake_subscriber) or 0,\n"
+   "  tonumber(channel.fake_subscribers or channel.subscribers) or 0,\n"
+   "  msg.time and msg.time and (\"%i:%i\"):format(msg.time, msg.tag) or \"\",\n"
+   "  tonumber(num_messages)\n"
+   "}\n"
+   "\n"
+   "return {chan, new_channel}\n"},
+
   {"rsck", "2fca046fa783d6cc25e493c993c407e59998e6e8",
    "--redis-store consistency check\n"
    "local ns = ARGV[1]\n"
@@ -921,7 +1662,7 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  return concat(#channel_ids, \"channels,\", known_msgs_count, \"messages, all ok\")\n"
    "end\n"},
 
-  {"subscriber_register", "9db24e03e0e7983955946216c560c2e18bae291f",
+  {"subscriber_register", "ccaf66c389e3c63da8c02badc9324bc12431e2cd",
    "--input: keys: [], values: [namespace, channel_id, subscriber_id, active_ttl, time, want_channel_settings]\n"
    "--  'subscriber_id' can be '-' for new id, or an existing id\n"
    "--  'active_ttl' is channel ttl with non-zero subscribers. -1 to persist, >0 ttl in sec\n"
@@ -938,6 +1679,7 @@ redis_lua_scripts_t redis_lua_scripts = {
    "local keys = {\n"
    "  channel =     ch,\n"
    "  messages =    ch..':messages:',\n"
+   "  stream =      ch..':stream',\n"
    "  subscribers = ch..':subscribers'\n"
    "}\n"
    "\n"
@@ -985,7 +1727,7 @@ redis_lua_scripts_t redis_lua_scripts = {
    "\n"
    "return ret\n"},
 
-  {"subscriber_unregister", "a98e07b21485951a7d34cf80736e53db1b6e87a6",
+  {"subscriber_unregister", "e1095517fa3d97f4f0f317124244d27824b008ff",
    "--input: keys: [], values: [namespace, channel_id, subscriber_id, empty_ttl]\n"
    "-- 'subscriber_id' is an existing id\n"
    "-- 'empty_ttl' is channel ttl when without subscribers. 0 to delete immediately, -1 to persist, >0 ttl in sec\n"
@@ -1000,6 +1742,7 @@ redis_lua_scripts_t redis_lua_scripts = {
    "local keys = {\n"
    "  channel =     ch,\n"
    "  messages =    ch..':messages',\n"
+   "  stream =      ch..':stream',\n"
    "  subscribers = ch..':subscribers',\n"
    "}\n"
    "\n"
@@ -1025,7 +1768,8 @@ redis_lua_scripts_t redis_lua_scripts = {
    "if res ~= 0 then\n"
    "   sub_count = redis.call('hincrby', keys.channel, 'subscribers', -1)\n"
    "\n"
-   "  if sub_count == 0 and tonumber(redis.call('LLEN', keys.messages)) == 0 then\n"
+   "  if sub_count == 0 and tonumber(redis.call('LLEN', keys.messages)) == 0\n"
+   "   and (redis.call('EXISTS', keys.stream) == 0 or tonumber(redis.call('XLEN', keys.stream)) == 0) then\n"
    "    setkeyttl(empty_ttl)\n"
    "  elseif sub_count < 0 then\n"
    "    return {err=\"Subscriber count for channel \" .. id .. \" less than zero: \" .. sub_count}\n"
@@ -1036,4 +1780,4 @@ redis_lua_scripts_t redis_lua_scripts = {
    "\n"
    "return {sub_id, sub_count}\n"}
 };
-const int redis_lua_scripts_count=11;
+const int redis_lua_scripts_count=16;
@@ -12,12 +12,17 @@ typedef struct {
   //output: current_fake_subscribers
   redis_lua_script_t add_fakesub;
 
-  //input:  keys: [], values: [namespace, channel_id, ttl]
+  //input:  keys: [], values: [namespace, time, (channel_id, number)...]
+  //output: for each channel, current_fake_subscribers or a "CLUSTER KEYSLOT ERROR" string
+  // same as add_fakesub.lua, for many channels at once
+  redis_lua_script_t add_fakesub_batch;
+
+  //input:  keys: [], values: [namespace, (channel_id, ttl)...]
   // ttl is for when there are no messages but at least 1 subscriber.
-  //output: seconds until next keepalive is expected, or -1 for "let it disappear"
-  redis_lua_script_t channel_keepalive;
+  //output: for each channel, seconds until next keepalive is expected, -1 for "let it disappear", or a "CLUSTER KEYSLOT ERROR" string
+  redis_lua_script_t channel_keepalive_batch;
 
-  //input: keys: [],  values: [ namespace, channel_id ]
+  //input: keys: [],  values: [ namespace, channel_id, sharded_pubsub ]
   //output: channel_hash {ttl, time_last_seen, subscribers, messages} or nil
   // delete this channel and all its messages
   redis_lua_script_t delete;
@@ -27,25 +32,50 @@ typedef struct {
   // finds and return the info hash of a channel, or nil of channel not found
   redis_lua_script_t find_channel;
 
-  //input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl]
+  //input:  keys: [], values: [namespace, channel_id...]
+  //output: for each channel, its latest message id as "time:tag", "" if it has none, or a "CLUSTER KEYSLOT ERROR" string
+  redis_lua_script_t get_last_message_id_batch;
+
+  //input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, read_only]
   //output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count
   // no_msgid_order: 'FILO' for oldest message, 'FIFO' for most recent
   // create_channel_ttl - make new channel if it's absent, with ttl set to this. 0 to disable.
+  // read_only - 1 when running on a slave: don't clean up expired message ids or create channels
   // result_code can be: 200 - ok, 404 - not found, 410 - gone, 418 - not yet available
   redis_lua_script_t get_message;
 
-  //input:  keys: [message_key], values: []
+  //input:  keys: [message_key], values: [msg_time, msg_tag]
   //output: msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression, channel_subscriber_count
+  // message_key is either the message's hash, or the channel's message stream (see publish_stream.lua)
   redis_lua_script_t get_message_from_key;
 
-  //input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target]
+  //input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, read_only]
+  //output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count
+  // same as get_message.lua, for channels whose messages are kept in a Redis stream by publish_stream.lua
+  // result_code can be: 200 - ok, 404 - not found, 410 - gone, 418 - not yet available
+  redis_lua_script_t get_message_stream;
+
+  //input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub]
   //output: channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?
   redis_lua_script_t publish;
 
+  //input:  keys: [], values: [namespace, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub, bodies_count, (message_body)..., (channel_id, time, message_body_index, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size)...]
+  //output: for each message, either {channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?} or an error string
+  // same as publish.lua, for many messages at once. A message published to several channels has its body sent just once.
+  // A message whose channel isn't on this cluster node gets a "CLUSTER KEYSLOT ERROR" string. Nchan only batches
+  // messages like this outside of cluster mode, so that's just for batches queued before the cluster was discovered,
+  // which hold one message each.
+  redis_lua_script_t publish_batch;
+
   //input:  keys: [], values: [namespace, channel_id, status_code]
   //output: current_subscribers
   redis_lua_script_t publish_status;
 
+  //input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, sharded_pubsub]
+  //output: channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?
+  // same as publish.lua, but the channel's messages are entries in a Redis stream (redis >= 5) with ids of the form <time>-<tag>
+  redis_lua_script_t publish_stream;
+
   //redis-store consistency check
   redis_lua_script_t rsck;
 
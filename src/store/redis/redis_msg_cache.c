@@ -0,0 +1,354 @@
+#include <nchan_module.h>
+#include <assert.h>
+#include <store/memory/store.h>
+#include <store/memory/store-private.h>
+#include "redis_nodeset.h"
+#include <util/shmem.h>
+#include <util/nchan_singleflight.h>
+#include "redis_msg_cache.h"
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "REDIS MSGCACHE: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "REDIS MSGCACHE: " fmt, ##args)
+
+// Messages fetched from (or published through) Redis are kept in shared memory, keyed by
+// nodeset, channel id and the id of the message before them -- which is how get_message asks for them.
+// Identical fetches in the same worker are collapsed into one Redis request.
+
+static size_t                max_size = 0;
+static nchan_singleflight_t  inflight = {"redis message fetches in flight", NCHAN_REDIS_MSG_CACHE_INFLIGHT_TIMEOUT, MSG_ERROR};
+
+static redis_msg_cache_shm_t *msg_cache_shm(void) {
+  return max_size > 0 ? nchan_memstore_get_redis_msg_cache() : NULL;
+}
+
+int redis_msg_cache_enabled(void) {
+  return max_size > 0;
+}
+
+void redis_msg_cache_set_size(size_t sz) {
+  max_size = sz;
+}
+
+ngx_int_t redis_msg_cache_stats(size_t *size, ngx_atomic_uint_t *entries, ngx_atomic_uint_t *hits, ngx_atomic_uint_t *misses) {
+  redis_msg_cache_shm_t     *cache = msg_cache_shm();
+  if(!cache) {
+    return NGX_DECLINED;
+  }
+  shmtx_lock(nchan_store_memory_shmem);
+  *size = cache->size;
+  *entries = cache->entries;
+  *hits = cache->hits;
+  *misses = cache->misses;
+  shmtx_unlock(nchan_store_memory_shmem);
+  return NGX_OK;
+}
+
+static uint32_t msg_cache_hash(uint16_t nodeset, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after) {
+  uint32_t   hash;
+  ngx_crc32_init(hash);
+  ngx_crc32_update(&hash, (u_char *)&memstore_worker_generation, sizeof(memstore_worker_generation));
+  ngx_crc32_update(&hash, (u_char *)&nodeset, sizeof(nodeset));
+  ngx_crc32_update(&hash, channel_id->data, channel_id->len);
+  ngx_crc32_update(&hash, (u_char *)&after->time, sizeof(after->time));
+  ngx_crc32_update(&hash, (u_char *)&after->tag, sizeof(after->tag));
+  ngx_crc32_final(hash);
+  return hash;
+}
+
+static void msg_cache_lru_remove_locked(redis_msg_cache_shm_t *cache, redis_msg_cache_entry_t *entry) {
+  if(entry->lru_prev) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  }
+  else {
+    cache->lru_head = entry->lru_next;
+  }
+  if(entry->lru_next) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  }
+  else {
+    cache->lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void msg_cache_lru_push_locked(redis_msg_cache_shm_t *cache, redis_msg_cache_entry_t *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  if(cache->lru_head) {
+    cache->lru_head->lru_prev = entry;
+  }
+  cache->lru_head = entry;
+  if(cache->lru_tail == NULL) {
+    cache->lru_tail = entry;
+  }
+}
+
+static void msg_cache_entry_free_locked(redis_msg_cache_shm_t *cache, redis_msg_cache_entry_t *entry) {
+  redis_msg_cache_entry_t  **prev_next;
+  for(prev_next = &cache->bucket[entry->hash % NCHAN_REDIS_MSG_CACHE_BUCKETS]; *prev_next != NULL; prev_next = &(*prev_next)->next) {
+    if(*prev_next == entry) {
+      *prev_next = entry->next;
+      break;
+    }
+  }
+  msg_cache_lru_remove_locked(cache, entry);
+  cache->size -= entry->size;
+  cache->entries--;
+  shm_locked_free(nchan_store_memory_shmem, entry);
+}
+
+static redis_msg_cache_entry_t *msg_cache_find_locked(redis_msg_cache_shm_t *cache, uint16_t nodeset, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after, uint32_t hash) {
+  redis_msg_cache_entry_t   *cur;
+  for(cur = cache->bucket[hash % NCHAN_REDIS_MSG_CACHE_BUCKETS]; cur != NULL; cur = cur->next) {
+    if(cur->hash == hash && cur->generation == memstore_worker_generation && cur->nodeset == nodeset
+     && cur->after.time == after->time && cur->after.tag == after->tag
+     && cur->channel_id.len == channel_id->len && ngx_memcmp(cur->channel_id.data, channel_id->data, channel_id->len) == 0) {
+      return cur;
+    }
+  }
+  return NULL;
+}
+
+ngx_int_t redis_msg_cache_get(redis_nodeset_t *ns, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after, callback_pt cb, void *pd) {
+  redis_msg_cache_shm_t     *cache = msg_cache_shm();
+  redis_msg_cache_entry_t   *entry;
+  uint32_t                   hash;
+  nchan_msg_t                msg;
+  nchan_compressed_msg_t     cmsg;
+  ngx_str_t                  content_type, eventsource_event;
+  uint16_t                   nodeset = nodeset_index(ns);
+  u_char                    *buf = NULL;
+  size_t                     len;
+
+  if(!cache || after->time <= 0) {
+    //oldest, newest and nth message ids don't always point to the same message
+    return NGX_DECLINED;
+  }
+  hash = msg_cache_hash(nodeset, channel_id, after);
+
+  shmtx_lock(nchan_store_memory_shmem);
+  if((entry = msg_cache_find_locked(cache, nodeset, channel_id, after, hash)) != NULL && entry->expires <= ngx_time()) {
+    msg_cache_entry_free_locked(cache, entry);
+    entry = NULL;
+  }
+  if(entry == NULL) {
+    cache->misses++;
+    shmtx_unlock(nchan_store_memory_shmem);
+    return NGX_DECLINED;
+  }
+
+  //copy it out, the callback can take its time
+  len = entry->content_type.len + entry->eventsource_event.len + entry->data.len;
+  if((buf = ngx_alloc(len > 0 ? len : 1, ngx_cycle->log)) == NULL) {
+    shmtx_unlock(nchan_store_memory_shmem);
+    ERR("couldn't allocate %uz bytes for cached message", len);
+    return NGX_DECLINED;
+  }
+  cache->hits++;
+  msg_cache_lru_remove_locked(cache, entry);
+  msg_cache_lru_push_locked(cache, entry);
+
+  ngx_memzero(&msg, sizeof(msg));
+  msg.storage = NCHAN_MSG_STACK;
+  msg.id.time = entry->id.time;
+  msg.id.tag.fixed[0] = entry->id.tag;
+  msg.id.tagcount = 1;
+  msg.id.tagactive = 0;
+  msg.prev_id.time = entry->prev_id.time;
+  msg.prev_id.tag.fixed[0] = entry->prev_id.tag;
+  msg.prev_id.tagcount = 1;
+  msg.prev_id.tagactive = 0;
+  msg.expires = entry->expires;
+
+  content_type.data = buf;
+  content_type.len = entry->content_type.len;
+  eventsource_event.data = ngx_cpymem(content_type.data, entry->content_type.data, entry->content_type.len);
+  eventsource_event.len = entry->eventsource_event.len;
+  msg.buf.start = ngx_cpymem(eventsource_event.data, entry->eventsource_event.data, entry->eventsource_event.len);
+  ngx_memcpy(msg.buf.start, entry->data.data, entry->data.len);
+  msg.buf.pos = msg.buf.start;
+  msg.buf.end = msg.buf.last = msg.buf.start + entry->data.len;
+  msg.buf.memory = 1;
+  msg.buf.last_buf = 1;
+  msg.buf.last_in_chain = 1;
+
+  msg.content_type = content_type.len > 0 ? &content_type : NULL;
+  msg.eventsource_event = eventsource_event.len > 0 ? &eventsource_event : NULL;
+  if(entry->compression != NCHAN_MSG_NO_COMPRESSION) {
+    ngx_memzero(&cmsg, sizeof(cmsg));
+    cmsg.compression = entry->compression;
+    msg.compressed = &cmsg;
+  }
+  shmtx_unlock(nchan_store_memory_shmem);
+
+  DBG("hit %V after %T:%i", channel_id, after->time, (ngx_int_t )after->tag);
+  cb(MSG_FOUND, &msg, pd);
+  ngx_free(buf);
+  return NGX_OK;
+}
+
+static ngx_int_t msg_cache_store(redis_nodeset_t *ns, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after, nchan_msg_t *msg) {
+  redis_msg_cache_shm_t     *cache = msg_cache_shm();
+  redis_msg_cache_entry_t   *entry;
+  uint16_t                   nodeset = nodeset_index(ns);
+  uint32_t                   hash;
+  size_t                     sz, content_type_len, eventsource_event_len, data_len;
+  u_char                    *cur;
+  ngx_int_t                  rc = NGX_OK;
+
+  if(!cache || after->time <= 0 || msg->id.tagcount != 1 || msg->expires <= ngx_time()) {
+    return NGX_DECLINED;
+  }
+  if(!ngx_buf_in_memory_only((&msg->buf))) {
+    //file-backed, too big to bother with
+    return NGX_DECLINED;
+  }
+  content_type_len = msg->content_type ? msg->content_type->len : 0;
+  eventsource_event_len = msg->eventsource_event ? msg->eventsource_event->len : 0;
+  data_len = ngx_buf_size((&msg->buf));
+  sz = sizeof(*entry) + channel_id->len + content_type_len + eventsource_event_len + data_len;
+  if(sz > max_size / 8) {
+    return NGX_DECLINED;
+  }
+  hash = msg_cache_hash(nodeset, channel_id, after);
+
+  shmtx_lock(nchan_store_memory_shmem);
+  if((entry = msg_cache_find_locked(cache, nodeset, channel_id, after, hash)) != NULL) {
+    //messages don't change once they've been published
+    msg_cache_lru_remove_locked(cache, entry);
+    msg_cache_lru_push_locked(cache, entry);
+  }
+  else {
+    while(cache->lru_tail && cache->size + sz > max_size) {
+      msg_cache_entry_free_locked(cache, cache->lru_tail);
+    }
+    if((entry = shm_locked_alloc(nchan_store_memory_shmem, sz, "redis message cache entry")) == NULL) {
+      rc = NGX_ERROR;
+    }
+    else {
+      entry->hash = hash;
+      entry->size = sz;
+      entry->generation = memstore_worker_generation;
+      entry->nodeset = nodeset;
+      entry->after = *after;
+      entry->id.time = msg->id.time;
+      entry->id.tag = msg->id.tag.fixed[0];
+      entry->prev_id.time = msg->prev_id.time;
+      entry->prev_id.tag = msg->prev_id.tag.fixed[0];
+      entry->expires = msg->expires;
+      entry->compression = msg->compressed ? msg->compressed->compression : NCHAN_MSG_NO_COMPRESSION;
+
+      cur = (u_char *)&entry[1];
+      entry->channel_id.data = cur;
+      entry->channel_id.len = channel_id->len;
+      cur = ngx_cpymem(cur, channel_id->data, channel_id->len);
+      entry->content_type.data = cur;
+      entry->content_type.len = content_type_len;
+      if(content_type_len > 0) {
+        cur = ngx_cpymem(cur, msg->content_type->data, content_type_len);
+      }
+      entry->eventsource_event.data = cur;
+      entry->eventsource_event.len = eventsource_event_len;
+      if(eventsource_event_len > 0) {
+        cur = ngx_cpymem(cur, msg->eventsource_event->data, eventsource_event_len);
+      }
+      entry->data.data = cur;
+      entry->data.len = data_len;
+      ngx_memcpy(cur, msg->buf.pos, data_len);
+
+      entry->next = cache->bucket[hash % NCHAN_REDIS_MSG_CACHE_BUCKETS];
+      cache->bucket[hash % NCHAN_REDIS_MSG_CACHE_BUCKETS] = entry;
+      msg_cache_lru_push_locked(cache, entry);
+      cache->size += sz;
+      cache->entries++;
+    }
+  }
+  shmtx_unlock(nchan_store_memory_shmem);
+
+  if(rc == NGX_ERROR) {
+    nchan_log_ooshm_error("caching Redis message for channel %V", channel_id);
+  }
+  return rc;
+}
+
+ngx_int_t redis_msg_cache_put(redis_nodeset_t *ns, ngx_str_t *channel_id, nchan_msg_t *msg) {
+  nchan_msg_tiny_id_t   after;
+  if(msg->prev_id.tagcount != 1) {
+    return NGX_DECLINED;
+  }
+  after.time = msg->prev_id.time;
+  after.tag = msg->prev_id.tag.fixed[0];
+  return msg_cache_store(ns, channel_id, &after, msg);
+}
+
+ngx_int_t redis_msg_cache_invalidate_channel(redis_nodeset_t *ns, ngx_str_t *channel_id) {
+  redis_msg_cache_shm_t     *cache = msg_cache_shm();
+  redis_msg_cache_entry_t   *cur, *prev;
+  uint16_t                   nodeset = nodeset_index(ns);
+  ngx_uint_t                 n = 0;
+
+  if(!cache) {
+    return NGX_DECLINED;
+  }
+  shmtx_lock(nchan_store_memory_shmem);
+  //this walks the whole cache, but it only happens when a channel is deleted or its message buffer changes
+  for(cur = cache->lru_tail; cur != NULL; cur = prev) {
+    prev = cur->lru_prev;
+    if(cur->nodeset == nodeset && cur->channel_id.len == channel_id->len && ngx_memcmp(cur->channel_id.data, channel_id->data, channel_id->len) == 0) {
+      msg_cache_entry_free_locked(cache, cur);
+      n++;
+    }
+  }
+  shmtx_unlock(nchan_store_memory_shmem);
+  DBG("invalidated %ui messages for %V", n, channel_id);
+  return NGX_OK;
+}
+
+static ngx_int_t msg_cache_inflight_key(redis_nodeset_t *ns, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after, ngx_str_t *key) {
+  if((key->data = ngx_alloc(NGX_INT_T_LEN + NGX_TIME_T_LEN + NGX_INT_T_LEN + 3 + channel_id->len, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate in-flight message key for %V", channel_id);
+    return NGX_ERROR;
+  }
+  key->len = ngx_sprintf(key->data, "%i:%T:%i:%V", nodeset_index(ns), after->time, (ngx_int_t )after->tag, channel_id) - key->data;
+  return NGX_OK;
+}
+
+ngx_int_t redis_msg_cache_wait(redis_nodeset_t *ns, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after, callback_pt cb, void *pd, ngx_uint_t *flight) {
+  ngx_str_t               key;
+  ngx_int_t               rc;
+
+  *flight = 0;
+  if(!redis_msg_cache_enabled()) {
+    return NGX_DECLINED;
+  }
+  if(msg_cache_inflight_key(ns, channel_id, after, &key) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+  rc = nchan_singleflight_wait(&inflight, &key, cb, pd, flight);
+  ngx_free(key.data);
+  return rc;
+}
+
+ngx_int_t redis_msg_cache_resolve(redis_nodeset_t *ns, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after, ngx_uint_t flight, nchan_msg_status_t status, nchan_msg_t *msg) {
+  ngx_str_t               key;
+
+  if(!redis_msg_cache_enabled()) {
+    return NGX_OK;
+  }
+  if(status == MSG_FOUND && msg) {
+    msg_cache_store(ns, channel_id, after, msg);
+  }
+  if(flight == 0 || msg_cache_inflight_key(ns, channel_id, after, &key) != NGX_OK) {
+    return NGX_OK;
+  }
+  nchan_singleflight_resolve(&inflight, &key, flight, status, status == MSG_FOUND ? msg : NULL);
+  ngx_free(key.data);
+  return NGX_OK;
+}
+
+ngx_int_t redis_msg_cache_shutdown(void) {
+  return nchan_singleflight_shutdown(&inflight);
+}
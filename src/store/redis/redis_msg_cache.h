@@ -0,0 +1,66 @@
+#ifndef REDIS_MSG_CACHE_H
+#define REDIS_MSG_CACHE_H
+
+#define NCHAN_REDIS_MSG_CACHE_BUCKETS 8192
+#define NCHAN_REDIS_MSG_CACHE_INFLIGHT_TIMEOUT 30000 //msec
+
+struct redis_nodeset_s;
+
+typedef struct redis_msg_cache_entry_s redis_msg_cache_entry_t;
+struct redis_msg_cache_entry_s {
+  redis_msg_cache_entry_t    *next;     //bucket chain
+  redis_msg_cache_entry_t    *lru_prev;
+  redis_msg_cache_entry_t    *lru_next;
+  uint32_t                    hash;
+  size_t                      size;
+  uint16_t                    generation; //nginx reloads may change what the nodeset index points to
+  uint16_t                    nodeset;
+  ngx_str_t                   channel_id;
+  nchan_msg_tiny_id_t         after;    //the message id this entry's message comes after
+
+  nchan_msg_tiny_id_t         id;
+  nchan_msg_tiny_id_t         prev_id;
+  time_t                      expires;
+  nchan_msg_compression_type_t compression;
+  ngx_str_t                   content_type;
+  ngx_str_t                   eventsource_event;
+  ngx_str_t                   data;
+}; //redis_msg_cache_entry_t
+
+//lives in the memstore's shared memory, guarded by the shm mutex
+typedef struct {
+  size_t                      size;
+  ngx_atomic_uint_t           entries;
+  ngx_atomic_uint_t           hits;
+  ngx_atomic_uint_t           misses;
+  redis_msg_cache_entry_t    *lru_head; //most recently used
+  redis_msg_cache_entry_t    *lru_tail;
+  redis_msg_cache_entry_t    *bucket[NCHAN_REDIS_MSG_CACHE_BUCKETS];
+} redis_msg_cache_shm_t;
+
+// if the message that comes after the given id is cached, calls cb with it (MSG_FOUND) and returns NGX_OK.
+// NGX_DECLINED otherwise.
+ngx_int_t redis_msg_cache_get(struct redis_nodeset_s *ns, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after, callback_pt cb, void *pd);
+
+// NGX_OK if an identical message fetch is already in flight in this worker, and cb will be called with its result.
+// NGX_DECLINED if the caller should fetch the message, and then call redis_msg_cache_resolve with the flight.
+// waiters get MSG_ERROR if the fetch failed, and should fetch the message themselves.
+ngx_int_t redis_msg_cache_wait(struct redis_nodeset_s *ns, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after, callback_pt cb, void *pd, ngx_uint_t *flight);
+
+// cache the fetched message (if found) and wake up anyone waiting on the flight
+ngx_int_t redis_msg_cache_resolve(struct redis_nodeset_s *ns, ngx_str_t *channel_id, nchan_msg_tiny_id_t *after, ngx_uint_t flight, nchan_msg_status_t status, nchan_msg_t *msg);
+
+// cache a message received from Redis PUBSUB, as the one that comes after its prev_id
+ngx_int_t redis_msg_cache_put(struct redis_nodeset_s *ns, ngx_str_t *channel_id, nchan_msg_t *msg);
+
+// forget all the channel's messages. for deleted channels and changed message buffers
+ngx_int_t redis_msg_cache_invalidate_channel(struct redis_nodeset_s *ns, ngx_str_t *channel_id);
+
+// the cache's size (in bytes) and counters. NGX_DECLINED if it's disabled
+ngx_int_t redis_msg_cache_stats(size_t *size, ngx_atomic_uint_t *entries, ngx_atomic_uint_t *hits, ngx_atomic_uint_t *misses);
+
+int redis_msg_cache_enabled(void);
+void redis_msg_cache_set_size(size_t sz);
+ngx_int_t redis_msg_cache_shutdown(void);
+
+#endif //REDIS_MSG_CACHE_H
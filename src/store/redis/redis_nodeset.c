@@ -18,6 +18,7 @@ static redis_nodeset_t  redis_nodeset[NCHAN_MAX_NODESETS];
 static int              redis_nodeset_count = 0;
 static char            *redis_worker_id = NULL;
 static redisCallbackFn *redis_subscribe_callback = NULL;
+static redisReplyObjectFunctions *redis_pubsub_reply_functions = NULL;
 
 typedef struct {
   ngx_event_t      ev;
@@ -172,15 +173,17 @@ int nodeset_ready(redis_nodeset_t *nodeset) {
   return nodeset && nodeset->status == REDIS_NODESET_READY;
 }
 
-ngx_int_t nodeset_initialize(char *worker_id, redisCallbackFn *subscribe_handler) {
+ngx_int_t nodeset_initialize(char *worker_id, redisCallbackFn *subscribe_handler, redisReplyObjectFunctions *pubsub_reply_functions) {
   redis_worker_id = worker_id;
   redis_subscribe_callback = subscribe_handler;
+  redis_pubsub_reply_functions = pubsub_reply_functions;
   return NGX_OK;
 }
 
 redis_nodeset_t *nodeset_create(nchan_loc_conf_t *lcf) {
   nchan_redis_conf_t  *rcf = &lcf->redis;
   redis_nodeset_t     *ns = &redis_nodeset[redis_nodeset_count]; //incremented once everything is ok
+  int                  i;
   assert(rcf->enabled);
   assert(!rcf->nodeset);
   
@@ -210,6 +213,27 @@ redis_nodeset_t *nodeset_create(nchan_loc_conf_t *lcf) {
   
   ns->settings.ping_interval = rcf->ping_interval;
   
+  ns->publish_batch.first = NULL;
+  ns->publish_batch.last = NULL;
+  ns->publish_batch.n = 0;
+  ns->publish_batch.waiting_for_ready = 0;
+  ngx_memzero(&ns->publish_batch.ev, sizeof(ns->publish_batch.ev));
+  
+  for(i = 0; i < REDIS_NODESET_KEEPALIVE_WHEEL_SIZE; i++) {
+    nchan_slist_init(&ns->keepalive.bucket[i], rdstore_channel_head_t, redis.slist.keepalive.prev, redis.slist.keepalive.next);
+  }
+  ns->keepalive.n = 0;
+  ns->keepalive.last_tick = 0;
+  ngx_memzero(&ns->keepalive.ev, sizeof(ns->keepalive.ev));
+  
+  nchan_slist_init(&ns->catch_up.queue, rdstore_channel_head_t, redis.slist.catch_up.prev, redis.slist.catch_up.next);
+  ns->catch_up.in_flight = 0;
+  
+  ns->fakesub_batch.first = NULL;
+  ns->fakesub_batch.last = NULL;
+  ns->fakesub_batch.n = 0;
+  ngx_memzero(&ns->fakesub_batch.ev, sizeof(ns->fakesub_batch.ev));
+  
   ns->status = REDIS_NODESET_DISCONNECTED;
   ngx_memzero(&ns->status_check_ev, sizeof(ns->status_check_ev));
   ns->status_msg = NULL;
@@ -236,6 +260,26 @@ redis_nodeset_t *nodeset_create(nchan_loc_conf_t *lcf) {
     
     ns->settings.optimize_target = scf->redis.optimize_target == NCHAN_REDIS_OPTIMIZE_UNSET ? NCHAN_REDIS_OPTIMIZE_CPU : scf->redis.optimize_target;
     
+    ns->settings.publish_batch = scf->redis.publish_batch == NGX_CONF_UNSET ? 0 : scf->redis.publish_batch;
+    ns->settings.publish_batch_window = scf->redis.publish_batch_window == NGX_CONF_UNSET_MSEC ? 0 : scf->redis.publish_batch_window;
+    
+    ns->settings.sharded_pubsub = scf->redis.sharded_pubsub == NGX_CONF_UNSET ? 0 : scf->redis.sharded_pubsub;
+    
+    ns->settings.command.connections = scf->redis.command_connections == NGX_CONF_UNSET ? 1 : scf->redis.command_connections;
+    ns->settings.command.max_pending = scf->redis.command_max_pending == NGX_CONF_UNSET ? 0 : scf->redis.command_max_pending;
+    ns->settings.command.max_queued = scf->redis.command_max_queued == NGX_CONF_UNSET ? NCHAN_DEFAULT_REDIS_COMMAND_MAX_QUEUED : scf->redis.command_max_queued;
+    
+    ns->settings.latency_routing.enabled = scf->redis.latency_routing == NGX_CONF_UNSET ? 0 : scf->redis.latency_routing;
+    ns->settings.latency_routing.max_lag = scf->redis.replica_max_lag == NGX_CONF_UNSET_SIZE ? NCHAN_DEFAULT_REDIS_REPLICA_MAX_LAG : scf->redis.replica_max_lag;
+    
+    ns->settings.stream_storage = scf->redis.stream_storage == NGX_CONF_UNSET ? 0 : scf->redis.stream_storage;
+    ns->settings.catch_up_concurrency = scf->redis.catch_up_concurrency == NGX_CONF_UNSET ? NCHAN_DEFAULT_REDIS_CATCH_UP_CONCURRENCY : scf->redis.catch_up_concurrency;
+    if(ns->settings.stream_storage && ns->settings.publish_batch) {
+      //the batch script only knows the hash-and-list layout
+      nchan_log_warning("nchan_redis_publish_batch is ignored with nchan_redis_stream_storage enabled");
+      ns->settings.publish_batch = 0;
+    }
+    
     for(i=0; i < servers->nelts; i++) {
 #if nginx_version >= 1007002
       upstream_url = &usrv[i].name;
@@ -251,6 +295,16 @@ redis_nodeset_t *nodeset_create(nchan_loc_conf_t *lcf) {
     ns->settings.connect_timeout = NCHAN_DEFAULT_REDIS_NODE_CONNECT_TIMEOUT_MSEC;
     ns->settings.node_weight.master = 1;
     ns->settings.node_weight.slave = 1;
+    ns->settings.publish_batch = 0;
+    ns->settings.publish_batch_window = 0;
+    ns->settings.sharded_pubsub = 0;
+    ns->settings.command.connections = 1;
+    ns->settings.command.max_pending = 0;
+    ns->settings.command.max_queued = NCHAN_DEFAULT_REDIS_COMMAND_MAX_QUEUED;
+    ns->settings.latency_routing.enabled = 0;
+    ns->settings.latency_routing.max_lag = NCHAN_DEFAULT_REDIS_REPLICA_MAX_LAG;
+    ns->settings.stream_storage = 0;
+    ns->settings.catch_up_concurrency = NCHAN_DEFAULT_REDIS_CATCH_UP_CONCURRENCY;
     ngx_str_t **urlref = nchan_list_append(&ns->urls);
     *urlref = rcf->url.len > 0 ? &rcf->url : &default_redis_url;
   }
@@ -260,6 +314,10 @@ redis_nodeset_t *nodeset_create(nchan_loc_conf_t *lcf) {
   return ns;
 }
 
+ngx_int_t nodeset_index(redis_nodeset_t *ns) {
+  return ns - redis_nodeset;
+}
+
 redis_nodeset_t *nodeset_find(nchan_redis_conf_t *rcf) {
   if(rcf->nodeset) {
     return rcf->nodeset;
@@ -520,6 +578,80 @@ static void node_ping_event(ngx_event_t *ev) {
   }
 }
 
+static void node_latency_probe_callback(redisAsyncContext *ac, void *rep, void *privdata) {
+  redisReply                 *reply = rep;
+  redis_node_t               *node = privdata;
+  struct timeval              tv;
+  ngx_int_t                   sample;
+  ngx_str_t                   offset;
+  
+  node->latency.probe_pending = 0;
+  if(!reply || reply->type != REDIS_REPLY_STRING) {
+    if(reply) {
+      node_log_error(node, "latency probe failed");
+    }
+    return;
+  }
+  
+  ngx_gettimeofday(&tv);
+  sample = (tv.tv_sec - node->latency.probe_sent.tv_sec) * 1000000 + (tv.tv_usec - node->latency.probe_sent.tv_usec);
+  if(sample <= 0) {
+    sample = 1;
+  }
+  //same smoothing as TCP's SRTT
+  node->latency.rtt = node->latency.rtt == 0 ? (ngx_uint_t )sample : (node->latency.rtt * 7 + sample) / 8;
+  
+  if(node->role == REDIS_NODE_ROLE_MASTER) {
+    if(nchan_get_rest_of_line_in_cstr(reply->str, "master_repl_offset:", &offset)) {
+      node->latency.repl_offset = ngx_atoof(offset.data, offset.len);
+    }
+  }
+  else if(node->role == REDIS_NODE_ROLE_SLAVE) {
+    redis_node_t *master = node->peers.master;
+    node->latency.master_link_up = nchan_cstr_match_line(reply->str, "master_link_status:up") ? 1 : 0;
+    node->latency.repl_lag = -1;
+    if(master && master->latency.repl_offset >= 0 && nchan_get_rest_of_line_in_cstr(reply->str, "slave_repl_offset:", &offset)) {
+      node->latency.repl_offset = ngx_atoof(offset.data, offset.len);
+      if(node->latency.repl_offset >= 0) {
+        //the master's offset is from its last probe, so this can come out a little negative
+        node->latency.repl_lag = ngx_max(master->latency.repl_offset - node->latency.repl_offset, 0);
+      }
+    }
+  }
+}
+
+static void node_latency_probe_event(ngx_event_t *ev) {
+  redis_node_t       *node = ev->data;
+  if(!ev->timedout || ngx_exiting || ngx_quit)
+    return;
+  
+  ev->timedout = 0;
+  if(node->state == REDIS_NODE_READY) {
+    assert(node->ctx.cmd);
+    //one probe at a time. a slow reply gets counted when it finally arrives
+    if(!node->latency.probe_pending) {
+      node->latency.probe_pending = 1;
+      ngx_gettimeofday(&node->latency.probe_sent);
+      redisAsyncCommand(node->ctx.cmd, node_latency_probe_callback, node, "INFO replication");
+    }
+    ngx_add_timer(ev, NCHAN_REDIS_LATENCY_PROBE_INTERVAL_MSEC);
+  }
+}
+
+static int node_needs_readonly(redis_node_t *node) {
+  return node->cluster.enabled && node->role == REDIS_NODE_ROLE_SLAVE && node->nodeset->settings.latency_routing.enabled;
+}
+
+static void node_cmd_pool_init(redis_node_t *node);
+
+static void node_latency_reset(redis_node_t *node) {
+  node->latency.rtt = 0;
+  node->latency.repl_offset = -1;
+  node->latency.repl_lag = -1;
+  node->latency.master_link_up = 0;
+  node->latency.probe_pending = 0;
+}
+
 redis_node_t *nodeset_node_create_with_space(redis_nodeset_t *ns, redis_connect_params_t *rcp, size_t extra_space, void **extraspace_ptr) {
   assert(!nodeset_node_find_by_connect_params(ns, rcp));
   node_blob_t      *node_blob;
@@ -555,6 +687,8 @@ redis_node_t *nodeset_node_create_with_space(redis_nodeset_t *ns, redis_connect_
   node->pending_commands = 0;
   node->run_id.len = 0;
   node->run_id.data = node_blob->run_id;
+  node->version.len = 0;
+  node->version.data = node_blob->version;
   node->nodeset = ns;
   node->generation = 0;
   
@@ -567,10 +701,16 @@ redis_node_t *nodeset_node_create_with_space(redis_nodeset_t *ns, redis_connect_
   ngx_memzero(&node->ping_timer, sizeof(node->ping_timer));
   nchan_init_timer(&node->ping_timer, node_ping_event, node);
   
+  ngx_memzero(&node->latency, sizeof(node->latency));
+  nchan_init_timer(&node->latency.probe_timer, node_latency_probe_event, node);
+  node_latency_reset(node);
+  
   node->ctx.cmd = NULL;
   node->ctx.pubsub = NULL;
   node->ctx.sync = NULL;
   
+  node_cmd_pool_init(node);
+  
   assert(nodeset_node_find_by_connect_params(ns, rcp));
   return node;
 }
@@ -607,14 +747,21 @@ static void node_remove_peer(redis_node_t *node, redis_node_t *peer) {
   }
 }
 
+static void node_cmd_pool_disconnect(redis_node_t *node);
+static void node_cmd_pool_run_rejected(redis_node_t *node);
+static void node_cmd_pool_free_recycled(redis_node_t *node);
+
 ngx_int_t nodeset_node_destroy(redis_node_t *node) {
   node_set_role(node, REDIS_NODE_ROLE_UNKNOWN); //removes from all peer lists, and clears own slave list
+  node_cmd_pool_disconnect(node);
   if(node->ctx.cmd)
     redisAsyncFree(node->ctx.cmd);
   if(node->ctx.pubsub)
     redisAsyncFree(node->ctx.pubsub);
   if(node->ctx.sync)
     redisFree(node->ctx.sync);
+  node_cmd_pool_run_rejected(node);
+  node_cmd_pool_free_recycled(node);
   if(node->connect_timeout) {
     nchan_abort_oneshot_timer(node->connect_timeout);
     node->connect_timeout = NULL;
@@ -737,6 +884,7 @@ int node_connect(redis_node_t *node) {
 int node_disconnect(redis_node_t *node, int disconnected_state) {
   ngx_int_t prev_state = node->state;
   node_log_debug(node, "disconnect");
+  node_cmd_pool_disconnect(node);
   if(node->ctx.cmd) {
     node->ctx.cmd->onDisconnect = NULL;
     //redisAsyncSetDisconnectCallback(node->ctx.cmd, NULL); //this only sets the callback if it's currently null...
@@ -774,6 +922,10 @@ int node_disconnect(redis_node_t *node, int disconnected_state) {
   if(node->ping_timer.timer_set) {
     ngx_del_timer(&node->ping_timer);
   }
+  if(node->latency.probe_timer.timer_set) {
+    ngx_del_timer(&node->latency.probe_timer);
+  }
+  node_latency_reset(node);
   
   rdstore_channel_head_t *cur;
   nchan_slist_t *cmd = &node->channels.cmd;
@@ -903,6 +1055,19 @@ static int node_parseinfo_set_run_id(redis_node_t *node, const char *info) {
   return node_parseinfo_set_preallocd_str(node, &node->run_id, info, "run_id:", MAX_RUN_ID_LENGTH);
 }
 
+static int node_parseinfo_set_version(redis_node_t *node, const char *info) {
+  return node_parseinfo_set_preallocd_str(node, &node->version, info, "redis_version:", MAX_VERSION_LENGTH);
+}
+
+static ngx_int_t node_major_version(redis_node_t *node) {
+  ngx_str_t   major = node->version;
+  u_char     *dot;
+  if((dot = ngx_strlchr(major.data, major.data + major.len, '.')) != NULL) {
+    major.len = dot - major.data;
+  }
+  return major.len > 0 ? ngx_atoi(major.data, major.len) : NGX_ERROR;
+}
+
 static int node_connector_loadscript_reply_ok(redis_node_t *node, redis_lua_script_t *script, redisReply *reply) {
   if (reply == NULL) {
     node_log_error(node, "missing reply after loading Redis Lua script %s", script->name);
@@ -929,8 +1094,11 @@ static int node_connector_loadscript_reply_ok(redis_node_t *node, redis_lua_scri
   }
 }
 
+static int node_cmd_pool_conn_index(redis_node_t *node, const redisAsyncContext *ac);
+
 static void redis_nginx_unexpected_disconnect_event_handler(const redisAsyncContext *ac, int status) {
   redis_node_t    *node = ac->data;
+  int              i;
   //char            *which_ctx;
   //DBG("unexpected disconnect event handler ac %p", ac);
   if(node) {
@@ -942,6 +1110,11 @@ static void redis_nginx_unexpected_disconnect_event_handler(const redisAsyncCont
       node->ctx.pubsub = NULL;
       //which_ctx = "pubsub";
     }
+    else if((i = node_cmd_pool_conn_index(node, ac)) > 0) {
+      //which_ctx = "extra cmd";
+      node->cmd_pool.conn[i].ctx = NULL;
+      node->cmd_pool.conn[i].ready = 0;
+    }
     else {
       node_log_error(node, "unknown redisAsyncContext disconnected");
       //which_ctx = "unknown";
@@ -973,6 +1146,488 @@ static redisAsyncContext *node_connect_context(redis_node_t *node, ngx_str_t *ho
   return ctx;
 }
 
+// Command connection pool.
+// conn[0] is the node's main cmd connection, used for setup, pings and cluster discovery.
+// Extra connections are opened once the node is ready. Commands go to the ready connection with
+// the fewest replies outstanding. With settings.command.max_pending, commands that would go over
+// that limit on every connection are queued, and once settings.command.max_queued commands are
+// waiting, new ones fail with a NULL reply. Failed commands get their callbacks run from a posted
+// event, never from inside the call that issued them, same as when a reply comes back.
+
+static int node_cmd_pool_enabled(redis_node_t *node) {
+  return node->nodeset->settings.command.connections > 1 || node->nodeset->settings.command.max_pending > 0;
+}
+
+static int node_cmd_pool_conn_index(redis_node_t *node, const redisAsyncContext *ac) {
+  int i;
+  for(i = 0; i < NCHAN_REDIS_MAX_COMMAND_CONNECTIONS; i++) {
+    if(node->cmd_pool.conn[i].ctx == ac) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static redis_node_command_t *node_cmd_pool_alloc(redis_node_t *node) {
+  redis_node_command_t *cmd;
+  if((cmd = node->cmd_pool.free) != NULL) {
+    node->cmd_pool.free = cmd->next;
+  }
+  else if((cmd = ngx_alloc(sizeof(*cmd), ngx_cycle->log)) == NULL) {
+    return NULL;
+  }
+  cmd->node = node;
+  cmd->conn = -1;
+  cmd->cmd = NULL;
+  cmd->len = 0;
+  cmd->next = NULL;
+  return cmd;
+}
+
+static void node_cmd_pool_recycle(redis_node_t *node, redis_node_command_t *cmd) {
+  if(cmd->cmd) {
+    redisFreeCommand(cmd->cmd);
+    cmd->cmd = NULL;
+  }
+  cmd->next = node->cmd_pool.free;
+  node->cmd_pool.free = cmd;
+}
+
+static void node_cmd_pool_free_recycled(redis_node_t *node) {
+  redis_node_command_t *cur, *next;
+  for(cur = node->cmd_pool.free; cur != NULL; cur = next) {
+    next = cur->next;
+    ngx_free(cur);
+  }
+  node->cmd_pool.free = NULL;
+}
+
+static int node_cmd_pool_least_loaded(redis_node_t *node) {
+  int   i, best = -1;
+  for(i = 0; i < node->cmd_pool.n; i++) {
+    if(node->cmd_pool.conn[i].ready && (best == -1 || node->cmd_pool.conn[i].pending < node->cmd_pool.conn[best].pending)) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+static void node_cmd_pool_run_rejected(redis_node_t *node) {
+  redis_node_command_t *cur, *next;
+  redisCallbackFn      *cb;
+  void                 *pd;
+  
+  if(node->cmd_pool.rejected.ev.posted) {
+    ngx_delete_posted_event(&node->cmd_pool.rejected.ev);
+  }
+  cur = node->cmd_pool.rejected.first;
+  node->cmd_pool.rejected.first = NULL;
+  node->cmd_pool.rejected.last = NULL;
+  for(; cur != NULL; cur = next) {
+    next = cur->next;
+    cb = cur->cb;
+    pd = cur->pd;
+    node_cmd_pool_recycle(node, cur);
+    if(cb) {
+      //same as what the callback gets when the connection drops with the command pending.
+      //it's also what takes care of node->pending_commands, just like for a real reply
+      cb(&node->cmd_pool.rejected.ctx, NULL, pd);
+    }
+  }
+}
+
+static void node_cmd_pool_rejected_event_handler(ngx_event_t *ev) {
+  node_cmd_pool_run_rejected((redis_node_t *)ev->data);
+}
+
+static void node_cmd_pool_reject(redis_node_t *node, redis_node_command_t *cmd) {
+  if(cmd->cmd) {
+    redisFreeCommand(cmd->cmd);
+    cmd->cmd = NULL;
+  }
+  cmd->next = NULL;
+  if(node->cmd_pool.rejected.last) {
+    node->cmd_pool.rejected.last->next = cmd;
+  }
+  else {
+    node->cmd_pool.rejected.first = cmd;
+  }
+  node->cmd_pool.rejected.last = cmd;
+  if(!node->cmd_pool.rejected.ev.posted) {
+    ngx_post_event(&node->cmd_pool.rejected.ev, &ngx_posted_events);
+  }
+}
+
+static void node_cmd_pool_init(redis_node_t *node) {
+  redisAsyncContext *ac = &node->cmd_pool.rejected.ctx;
+  ngx_memzero(&node->cmd_pool, sizeof(node->cmd_pool));
+  nchan_init_timer(&node->cmd_pool.rejected.ev, node_cmd_pool_rejected_event_handler, node);
+  ac->c.err = REDIS_ERR_OTHER;
+  ngx_cpystrn((u_char *)ac->c.errstr, (u_char *)"command not sent", sizeof(ac->c.errstr));
+  ac->err = ac->c.err;
+  ac->errstr = ac->c.errstr;
+  ac->data = node;
+}
+
+static void node_cmd_pool_drain(redis_node_t *node);
+
+static void node_cmd_pool_reply_callback(redisAsyncContext *ac, void *reply, void *privdata) {
+  redis_node_command_t *cmd = privdata;
+  redis_node_t         *node = cmd->node;
+  redisCallbackFn      *cb = cmd->cb;
+  void                 *pd = cmd->pd;
+  
+  if(node->cmd_pool.conn[cmd->conn].pending > 0) {
+    node->cmd_pool.conn[cmd->conn].pending--;
+  }
+  node_cmd_pool_recycle(node, cmd);
+  if(cb) {
+    cb(ac, reply, pd);
+  }
+  node_cmd_pool_drain(node);
+}
+
+static int node_cmd_pool_send(redis_node_t *node, int i, redis_node_command_t *cmd) {
+  cmd->conn = i;
+  node->cmd_pool.conn[i].pending++;
+  if(redisAsyncFormattedCommand(node->cmd_pool.conn[i].ctx, node_cmd_pool_reply_callback, cmd, cmd->cmd, cmd->len) != REDIS_OK) {
+    node->cmd_pool.conn[i].pending--;
+    return REDIS_ERR;
+  }
+  redisFreeCommand(cmd->cmd);
+  cmd->cmd = NULL;
+  return REDIS_OK;
+}
+
+static int node_cmd_pool_dispatch(redis_node_t *node, redisCallbackFn *cb, void *pd, char *formatted, int len) {
+  redis_node_command_t *cmd;
+  ngx_int_t             max_pending = node->nodeset->settings.command.max_pending;
+  int                   i;
+  
+  if((cmd = node_cmd_pool_alloc(node)) == NULL) {
+    node_log_error(node, "couldn't allocate command");
+    redisFreeCommand(formatted);
+    //no callback is ever going to run for this one
+    node->pending_commands--;
+    nchan_update_stub_status(redis_pending_commands, -1);
+    return REDIS_ERR;
+  }
+  cmd->cb = cb;
+  cmd->pd = pd;
+  cmd->cmd = formatted;
+  cmd->len = len;
+  
+  i = node_cmd_pool_least_loaded(node);
+  if(i == -1) {
+    node_log_error(node, "Can't run redis command: no connection to redis server.");
+    node_cmd_pool_reject(node, cmd);
+    return REDIS_ERR;
+  }
+  
+  if(node->cmd_pool.queue.n == 0 && (max_pending == 0 || node->cmd_pool.conn[i].pending < max_pending)) {
+    if(node_cmd_pool_send(node, i, cmd) != REDIS_OK) {
+      node_cmd_pool_reject(node, cmd);
+      return REDIS_ERR;
+    }
+    return REDIS_OK;
+  }
+  
+  if(node->cmd_pool.queue.n >= node->nodeset->settings.command.max_queued) {
+    if(!node->cmd_pool.queue.full) {
+      node_log_warning(node, "command queue is full (%i commands), new commands will fail until it drains", node->cmd_pool.queue.n);
+      node->cmd_pool.queue.full = 1;
+    }
+    node_cmd_pool_reject(node, cmd);
+    return REDIS_ERR;
+  }
+  
+  if(node->cmd_pool.queue.last) {
+    node->cmd_pool.queue.last->next = cmd;
+  }
+  else {
+    node->cmd_pool.queue.first = cmd;
+  }
+  node->cmd_pool.queue.last = cmd;
+  node->cmd_pool.queue.n++;
+  return REDIS_OK;
+}
+
+static void node_cmd_pool_drain(redis_node_t *node) {
+  redis_node_command_t *cmd;
+  ngx_int_t             max_pending = node->nodeset->settings.command.max_pending;
+  int                   i;
+  
+  while((cmd = node->cmd_pool.queue.first) != NULL) {
+    i = node_cmd_pool_least_loaded(node);
+    if(i == -1 || (max_pending > 0 && node->cmd_pool.conn[i].pending >= max_pending)) {
+      break;
+    }
+    node->cmd_pool.queue.first = cmd->next;
+    if(node->cmd_pool.queue.first == NULL) {
+      node->cmd_pool.queue.last = NULL;
+    }
+    node->cmd_pool.queue.n--;
+    cmd->next = NULL;
+    if(node_cmd_pool_send(node, i, cmd) != REDIS_OK) {
+      node_cmd_pool_reject(node, cmd);
+    }
+  }
+  if(node->cmd_pool.queue.n < node->nodeset->settings.command.max_queued) {
+    node->cmd_pool.queue.full = 0;
+  }
+}
+
+int nodeset_node_command(redis_node_t *node, redisCallbackFn *cb, void *pd, const char *fmt, ...) {
+  va_list   ap;
+  char     *formatted;
+  int       len, rc;
+  
+  va_start(ap, fmt);
+  if(!node_cmd_pool_enabled(node)) {
+    rc = redisvAsyncCommand(node->ctx.cmd, cb, pd, fmt, ap);
+    va_end(ap);
+    return rc;
+  }
+  len = redisvFormatCommand(&formatted, fmt, ap);
+  va_end(ap);
+  if(len < 0) {
+    node_log_error(node, "couldn't format command");
+    return REDIS_ERR;
+  }
+  return node_cmd_pool_dispatch(node, cb, pd, formatted, len);
+}
+
+int nodeset_node_command_argv(redis_node_t *node, redisCallbackFn *cb, void *pd, int argc, const char **argv, const size_t *argvlen) {
+  char     *formatted;
+  int       len;
+  
+  if(!node_cmd_pool_enabled(node)) {
+    return redisAsyncCommandArgv(node->ctx.cmd, cb, pd, argc, argv, argvlen);
+  }
+  if((len = redisFormatCommandArgv(&formatted, argc, argv, argvlen)) < 0) {
+    node_log_error(node, "couldn't format command");
+    return REDIS_ERR;
+  }
+  return node_cmd_pool_dispatch(node, cb, pd, formatted, len);
+}
+
+static void node_cmd_pool_conn_fail(redis_node_t *node, int i, const char *err) {
+  redisAsyncContext *ac = node->cmd_pool.conn[i].ctx;
+  node_log_error(node, "extra command connection %i failed: %s", i, err);
+  node->cmd_pool.conn[i].ctx = NULL;
+  node->cmd_pool.conn[i].ready = 0;
+  if(ac) {
+    ac->onDisconnect = NULL;
+    redisAsyncFree(ac);
+  }
+}
+
+static void node_cmd_pool_conn_ready(redis_node_t *node, int i) {
+  if(node_needs_readonly(node)) {
+    redisAsyncCommand(node->cmd_pool.conn[i].ctx, NULL, NULL, "READONLY");
+  }
+  node->cmd_pool.conn[i].ready = 1;
+  node_log_debug(node, "extra command connection %i ready", i);
+  node_cmd_pool_drain(node);
+}
+
+static void node_cmd_pool_select_callback(redisAsyncContext *ac, void *rep, void *privdata) {
+  redisReply             *reply = rep;
+  redis_node_t           *node = privdata;
+  int                     i = node_cmd_pool_conn_index(node, ac);
+  if(i <= 0) {
+    return;
+  }
+  if(reply == NULL || reply->type == REDIS_REPLY_ERROR) {
+    return node_cmd_pool_conn_fail(node, i, "SELECT command failed");
+  }
+  node_cmd_pool_conn_ready(node, i);
+}
+
+static void node_cmd_pool_select_db(redis_node_t *node, int i) {
+  if(node->connect_params.db > 0) {
+    redisAsyncCommand(node->cmd_pool.conn[i].ctx, node_cmd_pool_select_callback, node, "SELECT %d", node->connect_params.db);
+  }
+  else {
+    node_cmd_pool_conn_ready(node, i);
+  }
+}
+
+static void node_cmd_pool_auth_callback(redisAsyncContext *ac, void *rep, void *privdata) {
+  redis_node_t           *node = privdata;
+  int                     i = node_cmd_pool_conn_index(node, ac);
+  if(i <= 0) {
+    return;
+  }
+  if(!node_connector_reply_status_ok(rep)) {
+    return node_cmd_pool_conn_fail(node, i, "AUTH command failed");
+  }
+  node_cmd_pool_select_db(node, i);
+}
+
+static void node_cmd_pool_connect_event_handler(const redisAsyncContext *cac, int status) {
+  redisAsyncContext      *ac = (redisAsyncContext *)cac;
+  redis_node_t           *node = ac->data;
+  redis_connect_params_t *cp = &node->connect_params;
+  int                     i = node_cmd_pool_conn_index(node, ac);
+  if(i <= 0) {
+    return;
+  }
+  if(status != REDIS_OK || ac->err) {
+    //hiredis frees the context once we return
+    node->cmd_pool.conn[i].ctx = NULL;
+    node_log_error(node, "extra command connection %i failed: %s", i, ac->errstr);
+    return;
+  }
+  if(cp->password.len > 0) {
+    redisAsyncCommand(ac, node_cmd_pool_auth_callback, node, "AUTH %b", STR(&cp->password));
+  }
+  else {
+    node_cmd_pool_select_db(node, i);
+  }
+}
+
+static void node_cmd_pool_connect(redis_node_t *node) {
+  redis_connect_params_t *cp = &node->connect_params;
+  redisAsyncContext      *ac;
+  int                     i, n = node->nodeset->settings.command.connections;
+  
+  node->cmd_pool.n = n;
+  node->cmd_pool.conn[0].ctx = node->ctx.cmd;
+  node->cmd_pool.conn[0].pending = 0;
+  node->cmd_pool.conn[0].ready = 1;
+  
+  for(i = 1; i < n; i++) {
+    if(node->cmd_pool.conn[i].ctx) {
+      continue;
+    }
+    node->cmd_pool.conn[i].pending = 0;
+    node->cmd_pool.conn[i].ready = 0;
+    if((ac = redis_nginx_open_context(cp->peername.len > 0 ? &cp->peername : &cp->hostname, cp->port, node)) == NULL) {
+      node_log_error(node, "failed to open extra command connection %i", i);
+      continue;
+    }
+    redisAsyncSetConnectCallback(ac, node_cmd_pool_connect_event_handler);
+    redisAsyncSetDisconnectCallback(ac, redis_nginx_unexpected_disconnect_event_handler);
+    node->cmd_pool.conn[i].ctx = ac;
+  }
+  node_cmd_pool_drain(node);
+}
+
+static void node_cmd_pool_disconnect(redis_node_t *node) {
+  redis_node_command_t *cur, *next;
+  redisAsyncContext    *ac;
+  int                   i;
+  
+  for(i = 0; i < NCHAN_REDIS_MAX_COMMAND_CONNECTIONS; i++) {
+    node->cmd_pool.conn[i].ready = 0;
+  }
+  
+  //fail the queued commands
+  cur = node->cmd_pool.queue.first;
+  node->cmd_pool.queue.first = NULL;
+  node->cmd_pool.queue.last = NULL;
+  node->cmd_pool.queue.n = 0;
+  node->cmd_pool.queue.full = 0;
+  for(; cur != NULL; cur = next) {
+    next = cur->next;
+    node_cmd_pool_reject(node, cur);
+  }
+  
+  for(i = 1; i < NCHAN_REDIS_MAX_COMMAND_CONNECTIONS; i++) {
+    if((ac = node->cmd_pool.conn[i].ctx) != NULL) {
+      node->cmd_pool.conn[i].ctx = NULL;
+      ac->onDisconnect = NULL;
+      redisAsyncFree(ac);
+    }
+    node->cmd_pool.conn[i].pending = 0;
+  }
+  node->cmd_pool.conn[0].ctx = NULL; //that's ctx.cmd, node_disconnect takes care of it
+  node->cmd_pool.conn[0].pending = 0;
+  node->cmd_pool.n = 0;
+}
+
+static ngx_uint_t node_latency_pubsub_weight(redis_node_t *node, redis_node_t *master);
+
+//percent chance of this node getting picked for a new channel's PUBSUB subscription
+static ngx_uint_t node_latency_pubsub_share(redis_node_t *node) {
+  redis_node_t   *master = node->role == REDIS_NODE_ROLE_SLAVE ? node->peers.master : node;
+  redis_node_t  **nodeptr;
+  ngx_uint_t      total;
+  
+  if(master == NULL || master->role != REDIS_NODE_ROLE_MASTER) {
+    return 0;
+  }
+  total = node_latency_pubsub_weight(master, master);
+  for(nodeptr = nchan_list_first(&master->peers.slaves); nodeptr != NULL; nodeptr = nchan_list_next(nodeptr)) {
+    total += node_latency_pubsub_weight(*nodeptr, master);
+  }
+  if(total == 0) {
+    return node == master ? 100 : 0;
+  }
+  return node_latency_pubsub_weight(node, master) * 100 / total;
+}
+
+size_t nodeset_node_stats_size(void) {
+  size_t   sz = 0;
+  int      i;
+  for(i = 0; i < redis_nodeset_count; i++) {
+    sz += redis_nodeset[i].nodes.n * 600;
+  }
+  return sz;
+}
+
+u_char *nodeset_node_stats_write(u_char *cur, u_char *end) {
+  redis_node_t   *node;
+  int             i;
+  for(i = 0; i < redis_nodeset_count; i++) {
+    for(node = nchan_list_first(&redis_nodeset[i].nodes); node != NULL; node = nchan_list_next(node)) {
+      cur = ngx_snprintf(cur, (size_t )(end - cur), "redis node %s pending commands: %i\n", node_cstr(node), node->pending_commands);
+      if(redis_nodeset[i].settings.latency_routing.enabled) {
+        cur = ngx_snprintf(cur, (size_t )(end - cur), "redis node %s latency: %uius, replication lag: %O, subscribe weight: %ui%%\n", node_cstr(node), node->latency.rtt, node->latency.repl_lag, node_latency_pubsub_share(node));
+      }
+    }
+  }
+  return cur;
+}
+
+void nodeset_node_stats_each(void (*cb)(redis_node_stats_t *, void *), void *pd) {
+  redis_node_t        *node;
+  redis_node_stats_t   stats;
+  int                  i;
+  for(i = 0; i < redis_nodeset_count; i++) {
+    for(node = nchan_list_first(&redis_nodeset[i].nodes); node != NULL; node = nchan_list_next(node)) {
+      stats.address = node_cstr(node);
+      switch(node->role) {
+        case REDIS_NODE_ROLE_MASTER:
+          stats.role = "master";
+          break;
+        case REDIS_NODE_ROLE_SLAVE:
+          stats.role = "slave";
+          break;
+        default:
+          stats.role = "unknown";
+      }
+      if(node->state >= REDIS_NODE_READY) {
+        stats.state = "ready";
+      }
+      else if(node->state > REDIS_NODE_DISCONNECTED) {
+        stats.state = "connecting";
+      }
+      else if(node->state == REDIS_NODE_DISCONNECTED) {
+        stats.state = "disconnected";
+      }
+      else {
+        stats.state = "failed";
+      }
+      stats.pending_commands = node->pending_commands;
+      stats.latency = node->latency.rtt;
+      stats.replication_lag = redis_nodeset[i].settings.latency_routing.enabled ? node->latency.repl_lag : -1;
+      cb(&stats, pd);
+    }
+  }
+}
+
 static int node_discover_slaves_from_info_reply(redis_node_t *node, redisReply *reply) {
   redis_connect_params_t   *rcp;
   size_t                    i, n;
@@ -1089,6 +1744,11 @@ static void node_connector_callback(redisAsyncContext *ac, void *rep, void *priv
       if((node->ctx.pubsub = node_connect_context(node, &cp->peername, cp->port)) == NULL) {
         return node_connector_fail(node, "failed to open redis async context for pubsub");
       }
+      if(redis_pubsub_reply_functions) {
+        //before anything's been read, so that every reply is built with these
+        node->ctx.pubsub->c.reader->fn = redis_pubsub_reply_functions;
+        node->ctx.pubsub->c.reader->privdata = node;
+      }
       node->state++;
       break; //wait until the onConnect callback brings us back
     
@@ -1224,6 +1884,13 @@ static void node_connector_callback(redisAsyncContext *ac, void *rep, void *priv
         return;
       }
       
+      if(!node_parseinfo_set_version(node, reply->str)) {
+        node_log_notice(node, "couldn't find redis_version in INFO");
+      }
+      if(node->nodeset->settings.sharded_pubsub && node_major_version(node) < 7) {
+        return node_connector_fail(node, "sharded PUBSUB needs Redis 7 or newer");
+      }
+      
       if(nchan_cstr_match_line(reply->str, "loading:1")) {
         return node_connector_fail(node, "is busy loading data...");
       }
@@ -1342,9 +2009,17 @@ static void node_connector_callback(redisAsyncContext *ac, void *rep, void *priv
         nchan_abort_oneshot_timer(node->connect_timeout);
         node->connect_timeout = NULL;
       }
+      if(node_needs_readonly(node)) {
+        //let cluster slaves answer reads for their master's keyslots instead of redirecting them
+        redisAsyncCommand(node->ctx.cmd, NULL, NULL, "READONLY");
+      }
+      node_cmd_pool_connect(node);
       if(!node->ping_timer.timer_set && nodeset->settings.ping_interval > 0) {
         ngx_add_timer(&node->ping_timer, nodeset->settings.ping_interval * 1000);
       }
+      if(!node->latency.probe_timer.timer_set && nodeset->settings.latency_routing.enabled) {
+        ngx_add_timer(&node->latency.probe_timer, 0);
+      }
       node_log_notice(node, "%s", node->generation == 0 ? "connected" : "reconnected");
       node->generation++;
       nodeset_examine(nodeset);
@@ -1460,6 +2135,8 @@ static ngx_int_t update_chanhead_status_on_reconnect(rdstore_channel_head_t *ch)
 
 ngx_int_t nodeset_reconnect_disconnected_channels(redis_nodeset_t *ns) {
   rdstore_channel_head_t *cur;
+  rdstore_channel_head_t **heads;
+  ngx_uint_t              i, n;
   nchan_slist_t *disconnected_cmd = &ns->channels.disconnected_cmd;
   nchan_slist_t *disconnected_pubsub = &ns->channels.disconnected_pubsub;
   assert(nodeset_ready(ns));
@@ -1471,14 +2148,38 @@ ngx_int_t nodeset_reconnect_disconnected_channels(redis_nodeset_t *ns) {
     update_chanhead_status_on_reconnect(cur);
   }
   
+  if(nchan_slist_is_empty(disconnected_pubsub)) {
+    return NGX_OK;
+  }
+  
+  if((heads = ngx_alloc(sizeof(*heads) * disconnected_pubsub->n, ngx_cycle->log)) == NULL) {
+    nodeset_log_error(ns, "can't allocate memory to reconnect channels in bulk. doing it one at a time.");
+    while((cur = nchan_slist_pop(disconnected_pubsub)) != NULL) {
+      assert(cur->redis.node.pubsub == NULL);
+      cur->redis.slist.in_disconnected_pubsub_list = 0;
+      assert(nodeset_node_pubsub_find_by_chanhead(cur)); // this reuses the linked-list fields
+      redis_chanhead_catch_up_after_reconnect(cur);
+      ensure_chanhead_pubsub_subscribed_if_needed(cur);
+      update_chanhead_status_on_reconnect(cur);
+    }
+    return NGX_OK;
+  }
+  
+  n = 0;
   while((cur = nchan_slist_pop(disconnected_pubsub)) != NULL) {
     assert(cur->redis.node.pubsub == NULL);
     cur->redis.slist.in_disconnected_pubsub_list = 0;
     assert(nodeset_node_pubsub_find_by_chanhead(cur)); // this reuses the linked-list fields
-    redis_chanhead_catch_up_after_reconnect(cur);
-    ensure_chanhead_pubsub_subscribed_if_needed(cur);
-    update_chanhead_status_on_reconnect(cur);
+    heads[n++] = cur;
+  }
+  
+  //multi-channel SUBSCRIBEs, and batched checks for missed messages
+  redis_chanheads_catch_up_after_reconnect(ns, heads, n);
+  redis_chanheads_resubscribe(ns, heads, n);
+  for(i = 0; i < n; i++) {
+    update_chanhead_status_on_reconnect(heads[i]);
   }
+  ngx_free(heads);
   
   return NGX_OK;
 }
@@ -1953,6 +2654,88 @@ static redis_node_t *nodeset_node_random_master_or_slave(redis_node_t *master) {
   }
 }
 
+static int node_latency_caught_up(redis_node_t *node) {
+  if(node->role != REDIS_NODE_ROLE_SLAVE) {
+    return 1;
+  }
+  return node->latency.rtt > 0 && node->latency.master_link_up && node->latency.repl_lag >= 0
+    && (size_t )node->latency.repl_lag <= node->nodeset->settings.latency_routing.max_lag;
+}
+
+static ngx_uint_t node_latency_pubsub_weight(redis_node_t *node, redis_node_t *master) {
+  redis_nodeset_t *ns = node->nodeset;
+  ngx_int_t        weight = node->role == REDIS_NODE_ROLE_SLAVE ? ns->settings.node_weight.slave : ns->settings.node_weight.master;
+  ngx_uint_t       rtt;
+  
+  if(weight <= 0 || node->state < REDIS_NODE_READY) {
+    return 0;
+  }
+  if(node->latency.rtt == 0) {
+    //not probed yet. weigh it as if it were as fast as the master
+    rtt = master->latency.rtt > 0 ? master->latency.rtt : 1000;
+  }
+  else if(!node_latency_caught_up(node)) {
+    return 0;
+  }
+  else {
+    rtt = node->latency.rtt;
+  }
+  return ngx_max((ngx_uint_t )weight * 1000000 / rtt, 1);
+}
+
+static redis_node_t *nodeset_node_latency_weighted_master_or_slave(redis_node_t *master) {
+  ngx_uint_t       total, n, w;
+  redis_node_t   **nodeptr;
+  
+  assert(master->role == REDIS_NODE_ROLE_MASTER);
+  
+  total = node_latency_pubsub_weight(master, master);
+  for(nodeptr = nchan_list_first(&master->peers.slaves); nodeptr != NULL; nodeptr = nchan_list_next(nodeptr)) {
+    total += node_latency_pubsub_weight(*nodeptr, master);
+  }
+  if(total == 0) {
+    return master;
+  }
+  
+  n = ngx_random() % total;
+  w = node_latency_pubsub_weight(master, master);
+  if(n < w) {
+    return master;
+  }
+  n -= w;
+  for(nodeptr = nchan_list_first(&master->peers.slaves); nodeptr != NULL; nodeptr = nchan_list_next(nodeptr)) {
+    w = node_latency_pubsub_weight(*nodeptr, master);
+    if(n < w) {
+      return *nodeptr;
+    }
+    n -= w;
+  }
+  return master;
+}
+
+static redis_node_t *nodeset_node_fastest_master_or_slave(redis_node_t *master) {
+  redis_node_t   *best = master, **nodeptr, *cur;
+  
+  if(master->role != REDIS_NODE_ROLE_MASTER || !master->nodeset->settings.latency_routing.enabled || master->latency.rtt == 0) {
+    return master;
+  }
+  for(nodeptr = nchan_list_first(&master->peers.slaves); nodeptr != NULL; nodeptr = nchan_list_next(nodeptr)) {
+    cur = *nodeptr;
+    if(cur->state >= REDIS_NODE_READY && node_latency_caught_up(cur) && cur->latency.rtt < best->latency.rtt) {
+      best = cur;
+    }
+  }
+  return best;
+}
+
+redis_node_t *nodeset_node_read_find_by_channel_id(redis_nodeset_t *ns, ngx_str_t *channel_id) {
+  return nodeset_node_fastest_master_or_slave(nodeset_node_find_by_channel_id(ns, channel_id));
+}
+
+redis_node_t *nodeset_node_read_find_by_key(redis_nodeset_t *ns, ngx_str_t *key) {
+  return nodeset_node_fastest_master_or_slave(nodeset_node_find_by_key(ns, key));
+}
+
 redis_node_t *nodeset_node_find_by_chanhead(void *chan) {
   rdstore_channel_head_t *ch = chan;
   redis_node_t           *node;
@@ -1970,7 +2753,12 @@ redis_node_t *nodeset_node_pubsub_find_by_chanhead(void *chan) {
     return ch->redis.node.pubsub;
   }
   node = nodeset_node_find_by_channel_id(ch->redis.nodeset, &ch->id);
-  node = nodeset_node_random_master_or_slave(node);
+  if(node->nodeset->settings.latency_routing.enabled) {
+    node = nodeset_node_latency_weighted_master_or_slave(node);
+  }
+  else {
+    node = nodeset_node_random_master_or_slave(node);
+  }
   nodeset_node_associate_pubsub_chanhead(node, ch);
   return ch->redis.node.pubsub;
 }
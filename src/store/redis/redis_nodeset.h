@@ -8,6 +8,7 @@
 #include <util/nchan_rbtree.h>
 #include <util/nchan_list.h>
 #include <util/nchan_slist.h>
+#include "store.h"
 
 //#include "store-private.h"
 
@@ -34,6 +35,8 @@
 #define REDIS_NODESET_MAX_CONNECTING_TIME_SEC 5
 #define REDIS_NODESET_RECONNECT_WAIT_TIME_SEC 5
 #define REDIS_NODESET_MAX_FAILING_TIME_SEC 2
+#define REDIS_NODESET_KEEPALIVE_WHEEL_SIZE 64 //buckets
+#define REDIS_NODESET_KEEPALIVE_WHEEL_TICK_SEC 10
 
 #define REDIS_NODE_DEDUPLICATED         -100
 #define REDIS_NODE_CONNECTION_TIMED_OUT   -2
@@ -61,6 +64,7 @@
   
 typedef struct redis_nodeset_s redis_nodeset_t;
 typedef struct redis_node_s redis_node_t;
+typedef struct redis_node_command_s redis_node_command_t;
 
 typedef struct { //redis_nodeset_cluster_t
   unsigned                    enabled:1;
@@ -131,8 +135,49 @@ struct redis_nodeset_s {
     ngx_str_t                  *namespace;
     nchan_redis_optimize_t      optimize_target;
     ngx_msec_t                  connect_timeout;
+    ngx_flag_t                  publish_batch;
+    ngx_msec_t                  publish_batch_window;
+    ngx_flag_t                  sharded_pubsub;
+    struct {                    //command
+      ngx_int_t                   connections;
+      ngx_int_t                   max_pending; //per connection, 0 for no limit
+      ngx_int_t                   max_queued;
+    }                           command;
+    struct {                    //latency_routing
+      ngx_flag_t                  enabled;
+      size_t                      max_lag; //replication offset bytes
+    }                           latency_routing;
+    ngx_flag_t                  stream_storage; //messages in a Redis stream instead of hashes and a list
+    ngx_int_t                   catch_up_concurrency; //catch-up batches in flight after a reconnect
   }                           settings;
   
+  struct {                    //publish_batch
+    struct redis_publish_batch_entry_s *first; //messages waiting to be published together
+    struct redis_publish_batch_entry_s *last;
+    ngx_uint_t                  n;
+    unsigned                    waiting_for_ready:1;
+    ngx_event_t                 ev;
+  }                           publish_batch;
+  
+  struct {                    //keepalive
+    nchan_slist_t               bucket[REDIS_NODESET_KEEPALIVE_WHEEL_SIZE]; //chanheads, by the time their keepalive is due
+    ngx_uint_t                  n;
+    time_t                      last_tick;
+    ngx_event_t                 ev;
+  }                           keepalive;
+  
+  struct {                    //catch_up
+    nchan_slist_t               queue; //reconnected chanheads that may have missed some messages
+    ngx_int_t                   in_flight;
+  }                           catch_up;
+  
+  struct {                    //fakesub_batch
+    struct redis_fakesub_batch_entry_s *first; //fake subscriber count changes waiting to be sent together
+    struct redis_fakesub_batch_entry_s *last;
+    ngx_uint_t                  n;
+    ngx_event_t                 ev;
+  }                           fakesub_batch;
+  
   struct {
     nchan_slist_t               all;
     nchan_slist_t               disconnected_cmd;
@@ -164,6 +209,15 @@ struct redis_node_s {
   int                       scripts_loaded;
   int                       generation;
   ngx_event_t               ping_timer;
+  struct {                  //latency
+    ngx_event_t               probe_timer;
+    struct timeval            probe_sent;
+    ngx_uint_t                rtt; //moving average, in microseconds. 0 if not yet measured
+    off_t                     repl_offset;
+    off_t                     repl_lag; //bytes behind master, -1 if unknown
+    unsigned                  master_link_up:1;
+    unsigned                  probe_pending:1;
+  }                         latency;
   struct {
     unsigned                  enabled:1;
     unsigned                  ok:1;
@@ -185,6 +239,27 @@ struct redis_node_s {
     redisContext              *sync;
   }                         ctx;
   int                       pending_commands;
+  struct {                  //cmd_pool
+    struct {
+      redisAsyncContext         *ctx; //conn[0].ctx is ctx.cmd
+      int                        pending;
+      unsigned                   ready:1;
+    }                         conn[NCHAN_REDIS_MAX_COMMAND_CONNECTIONS];
+    int                       n;
+    struct {
+      redis_node_command_t      *first;
+      redis_node_command_t      *last;
+      int                        n;
+      unsigned                   full:1;
+    }                         queue;
+    struct {
+      redis_node_command_t      *first; //failed commands waiting for their callbacks to be run
+      redis_node_command_t      *last;
+      ngx_event_t                ev;
+      redisAsyncContext          ctx;   //what those callbacks get, since the connection may be gone by then
+    }                         rejected;
+    redis_node_command_t     *free; //recycled command wrappers
+  }                         cmd_pool;
   struct {
   nchan_slist_t               cmd;
   nchan_slist_t               pubsub;
@@ -196,11 +271,22 @@ typedef struct {
   redis_node_t           *node;
 } redis_nodeset_slot_range_node_t;
 
+struct redis_node_command_s {
+  redisCallbackFn          *cb;
+  void                     *pd;
+  redis_node_t             *node;
+  int                       conn;  //index into node->cmd_pool.conn
+  char                     *cmd;   //formatted command, only while queued
+  size_t                    len;
+  redis_node_command_t     *next;
+};
+
 
 
 redis_nodeset_t *nodeset_create(nchan_loc_conf_t *lcf);
-ngx_int_t nodeset_initialize(char *worker_id, redisCallbackFn *subscribe_handler);
+ngx_int_t nodeset_initialize(char *worker_id, redisCallbackFn *subscribe_handler, redisReplyObjectFunctions *pubsub_reply_functions);
 redis_nodeset_t *nodeset_find(nchan_redis_conf_t *rcf);
+ngx_int_t nodeset_index(redis_nodeset_t *ns); //same in all workers
 ngx_int_t nodeset_examine(redis_nodeset_t *nodeset);
 
 ngx_int_t nodeset_node_destroy(redis_node_t *node);
@@ -240,6 +326,12 @@ redis_node_t *nodeset_node_find_by_channel_id(redis_nodeset_t *ns, ngx_str_t *ch
 redis_node_t *nodeset_node_find_by_key(redis_nodeset_t *ns, ngx_str_t *key);
 redis_node_t *nodeset_node_find_any_ready_master(redis_nodeset_t *ns);
 int nodeset_node_reply_keyslot_ok(redis_node_t *node, redisReply *r);
+
+int nodeset_node_command(redis_node_t *node, redisCallbackFn *cb, void *pd, const char *fmt, ...);
+int nodeset_node_command_argv(redis_node_t *node, redisCallbackFn *cb, void *pd, int argc, const char **argv, const size_t *argvlen);
+size_t nodeset_node_stats_size(void);
+u_char *nodeset_node_stats_write(u_char *cur, u_char *end);
+void nodeset_node_stats_each(void (*cb)(redis_node_stats_t *, void *), void *pd);
 int nodeset_ready(redis_nodeset_t *nodeset);
 
 //chanheads are (void *) here to avoid circular typedef dependency with store-private.h
@@ -254,6 +346,8 @@ ngx_int_t nodeset_node_dissociate_pubsub_chanhead(void *chanhead);
 
 redis_node_t *nodeset_node_find_by_chanhead(void *chanhead);
 redis_node_t *nodeset_node_pubsub_find_by_chanhead(void *chanhead);
+redis_node_t *nodeset_node_read_find_by_channel_id(redis_nodeset_t *ns, ngx_str_t *channel_id); //latency-aware, may be a slave
+redis_node_t *nodeset_node_read_find_by_key(redis_nodeset_t *ns, ngx_str_t *key);
 
 
 
@@ -4,6 +4,8 @@
 #define NCHAN_CHANHEAD_EXPIRE_SEC 1
 #define NCHAN_CHANHEAD_CLUSTER_ORPHAN_EXPIRE_SEC 15
 #define NCHAN_NOTICE_REDIS_CHANNEL_MESSAGE_BUFFER_SIZE_CHANGE 0xB00F
+#define NCHAN_REDIS_PUBSUB_SHM_DECODE_MIN_SIZE 1024 //PUBSUB messages at least this big are decoded straight into shm
+#define REDIS_REPLY_NCHAN_SHM_MSG 100 //not a hiredis reply type. reply->str is the shm message body
 
 #include <nchan_module.h>
 #include "uthash.h"
@@ -37,7 +39,7 @@ struct rdstore_channel_head_s {
   ngx_uint_t                   sub_count;
   ngx_int_t                    fetching_message_count;
   ngx_uint_t                   internal_sub_count;
-  ngx_event_t                  keepalive_timer;
+  time_t                       keepalive_time; //when the next keepalive is due
   ngx_uint_t                   keepalive_times_sent;
   nchan_msg_id_t               last_msgid;
   
@@ -67,8 +69,18 @@ struct rdstore_channel_head_s {
         rdstore_channel_head_t      *prev;
         rdstore_channel_head_t      *next;
       }                            node_pubsub;
+      struct {
+        rdstore_channel_head_t      *prev;
+        rdstore_channel_head_t      *next;
+      }                            keepalive;
+      struct {
+        rdstore_channel_head_t      *prev;
+        rdstore_channel_head_t      *next;
+      }                            catch_up;
       unsigned                     in_disconnected_cmd_list:1;
       unsigned                     in_disconnected_pubsub_list:1;
+      unsigned                     in_keepalive_wheel:1;
+      unsigned                     in_catch_up_queue:1;
     }                            slist;
     
   }                            redis;
@@ -97,6 +109,8 @@ ngx_int_t rdstore_initialize_chanhead_reaper(nchan_reaper_t *reaper, char *name)
 ngx_int_t redis_chanhead_gc_add(rdstore_channel_head_t *head, ngx_int_t expire, const char *reason);
 ngx_int_t redis_chanhead_gc_withdraw(rdstore_channel_head_t *head);
 ngx_int_t redis_chanhead_catch_up_after_reconnect(rdstore_channel_head_t *ch);
+ngx_int_t redis_chanheads_catch_up_after_reconnect(redis_nodeset_t *ns, rdstore_channel_head_t **heads, ngx_uint_t n);
+ngx_int_t redis_chanheads_resubscribe(redis_nodeset_t *ns, rdstore_channel_head_t **heads, ngx_uint_t n);
 
 ngx_int_t ensure_chanhead_pubsub_subscribed_if_needed(rdstore_channel_head_t *ch);
 
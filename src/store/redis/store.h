@@ -18,4 +18,19 @@ int nchan_store_redis_validate_url(ngx_str_t *url);
 
 
 ngx_int_t redis_store_callback_on_connected(nchan_loc_conf_t *cf, ngx_msec_t max_wait, callback_pt cb, void *privdata);
+
+//per-node stats for this worker, for nchan_stub_status
+size_t redis_store_node_stats_size(void);
+u_char *redis_store_node_stats_write(u_char *cur, u_char *end);
+
+typedef struct {
+  const char     *address;
+  const char     *role;
+  const char     *state;
+  ngx_int_t       pending_commands;
+  ngx_uint_t      latency; //round-trip time in microseconds, 0 if not measured
+  off_t           replication_lag; //bytes behind master, -1 if unknown
+} redis_node_stats_t;
+
+void redis_store_node_stats_each(void (*cb)(redis_node_stats_t *, void *), void *pd);
 #endif // NCHAN_REDIS_STORE_H
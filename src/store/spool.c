@@ -1,5 +1,7 @@
 #include <nchan_module.h>
 #include "spool.h"
+#include <util/nchan_latency.h>
+#include <util/nchan_stall.h>
 #include <assert.h>
 
 #define DEBUG_LEVEL NGX_LOG_DEBUG
@@ -24,6 +26,15 @@ static ngx_int_t spool_fetch_msg(subscriber_pool_t *spool);
 static nchan_msg_id_t     latest_msg_id = NCHAN_NEWEST_MSGID;
 static nchan_msg_id_t     oldest_msg_id = NCHAN_OLDEST_MSGID;
 
+//sampled start time of the message being spooled out, until its first subscriber gets it
+static uint64_t           latency_first_delivery_start = 0;
+
+static ngx_uint_t         total_spools = 0;
+
+ngx_uint_t spooler_total_spools(void) {
+  return total_spools;
+}
+
 static subscriber_pool_t *find_spool(channel_spooler_t *spl, nchan_msg_id_t *id) {
   rbtree_seed_t      *seed = &spl->spoolseed;
   ngx_rbtree_node_t  *node;
@@ -205,6 +216,7 @@ static subscriber_pool_t *get_spool(channel_spooler_t *spl, nchan_msg_id_t *id)
       rbtree_destroy_node(seed, node);
       return NULL;
     }
+    total_spools++;
   }
   else {
     spool = (subscriber_pool_t *)rbtree_data_from_node(node);
@@ -575,6 +587,9 @@ static ngx_int_t spool_respond_general(subscriber_pool_t *self, nchan_msg_t *msg
   ngx_uint_t                  numsubs[SUBSCRIBER_TYPES];
   spooled_subscriber_t       *nsub, *nnext;
   subscriber_t               *sub;
+  uint64_t                    stall_start = nchan_stall_start();
+  ngx_int_t                   stall_subs = self->sub_count;
+  ngx_str_t                  *stall_chid = self->spooler ? self->spooler->chid : NULL;
   
   //channel_spooler_t          *spl = self->spooler;
   //validate_spooler(spl, "before respond_general");
@@ -613,6 +628,10 @@ static ngx_int_t spool_respond_general(subscriber_pool_t *self, nchan_msg_t *msg
     if(msg) {
       //self->responded_count++;
       sub->fn->respond_message(sub, msg);
+      if(latency_first_delivery_start) {
+        nchan_latency_record(NCHAN_LATENCY_DELIVERY_FIRST, latency_first_delivery_start);
+        latency_first_delivery_start = 0;
+      }
     }
     else if(!notice) {
       //self->responded_count++;
@@ -625,6 +644,7 @@ static ngx_int_t spool_respond_general(subscriber_pool_t *self, nchan_msg_t *msg
   
   //if(!notice && code != NGX_HTTP_NO_CONTENT) self->responded_count++;
   //assert(validate_spooler(spl, "after respond_general"));
+  nchan_stall_end(NCHAN_STALL_SPOOL_RESPOND, stall_start, NULL, stall_chid, stall_subs);
   return NGX_OK;
 }
 
@@ -929,6 +949,8 @@ static ngx_int_t spooler_respond_message(channel_spooler_t *self, nchan_msg_t *m
   srdata.msg = msg;
   srdata.n = 0;
   
+  latency_first_delivery_start = msg->latency_start;
+  
   //spooler_print_contents(self);
   
   //find all spools between msg->prev_id and msg->id
@@ -953,18 +975,17 @@ static ngx_int_t spooler_respond_message(channel_spooler_t *self, nchan_msg_t *m
   
   spool = get_spool(self, &latest_msg_id);
   if(spool->sub_count > 0 && *self->channel_buffer_complete) {
-#if NCHAN_BENCHMARK
     responded_subs += spool->sub_count;
-#endif
     spool_respond_general(spool, msg, 0, NULL, 0);
     spool_nextmsg(spool, &msg->id);
   }
 
   nchan_copy_msg_id(&self->prev_msg_id, &msg->id, NULL);
   
-#if NCHAN_BENCHMARK
-  self->last_responded_subscriber_count = responded_subs;
-#endif
+  latency_first_delivery_start = 0;
+  if(responded_subs > 0) {
+    nchan_latency_record(NCHAN_LATENCY_DELIVERY_LAST, msg->latency_start);
+  }
   return NGX_OK;
 }
 
@@ -1199,6 +1220,7 @@ static ngx_int_t remove_spool(subscriber_pool_t *spool) {
   
   nchan_free_msg_id(&spool->id);
   rbtree_remove_node(&spl->spoolseed, rbtree_node_from_data(spool));
+  total_spools--;
   
   //assert((node = rbtree_find_node(&spl->spoolseed, &spool->id)) == NULL);
   //double-check that it's gone 
@@ -88,9 +88,6 @@ struct channel_spooler_s {
   void                       *handlers_privdata;
   fetchmsg_data_t            *fetchmsg_cb_data_list;
   spooler_event_ll_t         *spooler_dependent_events;
-#if NCHAN_BENCHMARK
-  ngx_int_t                   last_responded_subscriber_count;
-#endif  
   spooler_fetching_strategy_t fetching_strategy;
   unsigned                    publish_events:1;
   unsigned                    running:1;
@@ -114,6 +111,9 @@ ngx_int_t spooler_catch_up(channel_spooler_t *spl);
 
 ngx_int_t spooler_print_contents(channel_spooler_t *spl);
 
+//spools in all of this worker's spoolers
+ngx_uint_t spooler_total_spools(void);
+
 ngx_event_t *spooler_add_timer(channel_spooler_t *spl, ngx_msec_t timeout, void (*cb)(void *), void (*cancel)(void *), void *pd);
 
 
@@ -2,7 +2,10 @@
 #include <assert.h>
 #include "common.h"
 //#include <util/nchan_fake_request.h>
+#include <util/nchan_auth_cache.h>
 #include <util/nchan_subrequest.h>
+#include <util/nchan_presence_batch.h>
+#include <util/nchan_trace.h>
 
 #include <util/nchan_fake_request.h>
 
@@ -18,13 +21,57 @@
 typedef struct {
   subscriber_t       *sub;
   ngx_str_t          *ch_id;
+  nchan_loc_conf_t   *cf;
+  ngx_str_t           cache_key;
+  ngx_uint_t          cache_flight;
   nchan_fakereq_subrequest_data_t *subrequest;
 } nchan_subscribe_auth_request_data_t;
 
+typedef struct {
+  subscriber_t       *sub;
+  ngx_str_t          *ch_id;
+} nchan_subscribe_auth_wait_data_t;
+
+static ngx_int_t subscriber_authorize_request(subscriber_t *sub, ngx_str_t *ch_id, ngx_str_t *cache_key, ngx_uint_t cache_flight);
+
+static ngx_int_t subscriber_authorize_wait_callback(ngx_int_t code, void *unused, void *data) {
+  nchan_subscribe_auth_wait_data_t    *d = data;
+  subscriber_t                        *sub = d->sub;
+  ngx_str_t                           *ch_id = d->ch_id;
+  
+  ngx_free(d);
+  if(sub->status == DEAD) {
+    sub->fn->release(sub, 0);
+  }
+  else {
+    sub->fn->release(sub, 1);
+    if(code >= 200 && code <299) {
+      nchan_subscriber_subscribe(sub, ch_id);
+    }
+    else if(code >= 500 && code < 600) {
+      sub->fn->respond_status(sub, code, NULL, NULL); //auto-closes subscriber
+    }
+    //forbidden. denials aren't shared, so ask for ourselves and forward the response to the subscriber
+    else if(subscriber_authorize_request(sub, ch_id, NULL, 0) != NGX_OK) {
+      sub->fn->respond_status(sub, NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, NULL);
+    }
+  }
+  return NGX_OK;
+}
+
 static ngx_int_t subscriber_authorize_callback(ngx_int_t rc, ngx_http_request_t *sr, void *data) {
   nchan_subscribe_auth_request_data_t *d = data;
   subscriber_t                        *sub = d->sub;
   
+  if(d->cache_key.len > 0) {
+    if(rc == NGX_OK) {
+      nchan_auth_cache_set(d->cf, &d->cache_key, d->cache_flight, sr->headers_out.status, sr);
+    }
+    else {
+      nchan_auth_cache_resolve(&d->cache_key, d->cache_flight, (rc >= 500 && rc < 600) ? rc : NGX_HTTP_INTERNAL_SERVER_ERROR);
+    }
+  }
+  
   if(sub->status == DEAD) {
     nchan_requestmachine_request_cleanup_manual(d->subrequest);
     sub->fn->release(d->sub, 0);
@@ -102,34 +149,78 @@ ngx_int_t nchan_subscriber_authorize_subscribe_request(subscriber_t *sub, ngx_st
     return nchan_subscriber_subscribe(sub, ch_id);
   }
   else {
-    nchan_requestmachine_request_params_t param;
-    param.url.cv = authorize_request_url_ccv;
-    param.url_complex = 1;
-    param.pool = ngx_create_pool(1024, ngx_cycle->log);
-    param.body = NULL;
-    param.response_headers_only = 0;
-    param.manual_cleanup = 1;
+    ngx_str_t                             cache_key = {0, NULL};
+    ngx_uint_t                            cache_flight = 0;
+    nchan_subscribe_auth_wait_data_t     *wd;
     
-    nchan_subscribe_auth_request_data_t  *d = ngx_palloc(param.pool, sizeof(*d));
-    if(!d) {
-      ngx_destroy_pool(param.pool);
-      return NGX_ERROR;
+    if(sub->cf->authorize_cache.key && nchan_auth_cache_key(sub->request, sub->cf, SUB, sub->request->pool, &cache_key) == NGX_OK) {
+      if(nchan_auth_cache_get(&cache_key) != NGX_DECLINED) {
+        //only successful responses are cached
+        return nchan_subscriber_subscribe(sub, ch_id);
+      }
+      if((wd = ngx_alloc(sizeof(*wd), ngx_cycle->log)) == NULL) {
+        cache_key.len = 0; //just make the request uncached then
+      }
+      else {
+        wd->sub = sub;
+        wd->ch_id = ch_id;
+        if(nchan_auth_cache_wait(&cache_key, (callback_pt )subscriber_authorize_wait_callback, wd, &cache_flight) == NGX_OK) {
+          //an identical request is already underway
+          sub->fn->reserve(sub);
+          return NGX_OK;
+        }
+        ngx_free(wd);
+      }
     }
-    param.cb = (callback_pt )subscriber_authorize_callback;
-    param.pd = d;
     
-    d->sub = sub;
-    d->ch_id = ch_id;
-    d->subrequest = nchan_subscriber_subrequest(sub, &param);
-    if(d->subrequest != NULL) {
-      sub->fn->reserve(sub);
-      return NGX_OK;
-    }
-    else {
+    return subscriber_authorize_request(sub, ch_id, &cache_key, cache_flight);
+  }
+}
+
+//cache_key is NULL (or zero-length) when the response isn't to be cached
+static ngx_int_t subscriber_authorize_request(subscriber_t *sub, ngx_str_t *ch_id, ngx_str_t *cache_key, ngx_uint_t cache_flight) {
+  nchan_requestmachine_request_params_t param;
+  nchan_subscribe_auth_request_data_t  *d;
+  size_t                                keylen = cache_key ? cache_key->len : 0;
+  
+  param.url.cv = sub->cf->authorize_request_url;
+  param.url_complex = 1;
+  param.pool = ngx_create_pool(1024, ngx_cycle->log);
+  param.body = NULL;
+  param.response_headers_only = 0;
+  param.manual_cleanup = 1;
+  
+  if(!param.pool || (d = ngx_palloc(param.pool, sizeof(*d) + keylen)) == NULL) {
+    if(param.pool) {
       ngx_destroy_pool(param.pool);
-      return NGX_ERROR;
     }
+    if(keylen > 0) {
+      nchan_auth_cache_resolve(cache_key, cache_flight, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    }
+    return NGX_ERROR;
+  }
+  param.cb = (callback_pt )subscriber_authorize_callback;
+  param.pd = d;
+  
+  d->sub = sub;
+  d->ch_id = ch_id;
+  d->cf = sub->cf;
+  d->cache_key.len = keylen;
+  d->cache_key.data = (u_char *)&d[1];
+  d->cache_flight = cache_flight;
+  if(keylen > 0) {
+    ngx_memcpy(d->cache_key.data, cache_key->data, keylen);
+  }
+  d->subrequest = nchan_subscriber_subrequest(sub, &param);
+  if(d->subrequest == NULL) {
+    ngx_destroy_pool(param.pool);
+    if(keylen > 0) {
+      nchan_auth_cache_resolve(cache_key, cache_flight, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    }
+    return NGX_ERROR;
   }
+  sub->fn->reserve(sub);
+  return NGX_OK;
 }
 
 static ngx_int_t nchan_subscriber_subrequest_fire_and_forget(subscriber_t *sub, ngx_http_complex_value_t *url_cv) {
@@ -162,6 +253,9 @@ ngx_int_t nchan_subscriber_unsubscribe_request(subscriber_t *sub) {
   }
   
   ctx->sent_unsubscribe_request = 1;
+  if(sub->cf->subscriber_presence_batch.interval > 0) {
+    return nchan_presence_batch_add(sub, sub->cf->unsubscribe_request_url, 0);
+  }
   return nchan_subscriber_subrequest_fire_and_forget(sub, sub->cf->unsubscribe_request_url);
 }
 
@@ -169,6 +263,9 @@ ngx_int_t nchan_subscriber_subscribe_request(subscriber_t *sub) {
   if(!sub->enable_sub_unsub_callbacks) {
     return NGX_OK;
   }
+  if(sub->cf->subscriber_presence_batch.interval > 0) {
+    return nchan_presence_batch_add(sub, sub->cf->subscribe_request_url, 1);
+  }
   return nchan_subscriber_subrequest_fire_and_forget(sub, sub->cf->subscribe_request_url);
 }
 
@@ -182,6 +279,7 @@ ngx_int_t nchan_subscriber_subscribe(subscriber_t *sub, ngx_str_t *ch_id) {
   
   //DBG("%p (req %p) nchan_subscriber_subscribe", sub, sub->request);
   
+  nchan_trace_subscribe(sub, ch_id);
   ret = sub->cf->storage_engine->subscribe(ch_id, sub);
   //don't access sub directly, it might have already been freed
   if(ret == NGX_OK && enable_sub_unsub_callbacks && cf->subscribe_request_url && ctx->sub == sub) {
@@ -276,7 +374,7 @@ ngx_int_t nchan_request_set_content_type_multipart_boundary_header(ngx_http_requ
   return NGX_OK;
 }
 
-void nchan_subscriber_timeout_ev_handler(ngx_event_t *ev) {
+void nchan_subscriber_timeout_ev_handler(nchan_wheel_timer_t *ev) {
   subscriber_t *sub = (subscriber_t *)ev->data;
 #if FAKESHARD
   memstore_fakeprocess_push(sub->owner);
@@ -289,9 +387,8 @@ void nchan_subscriber_timeout_ev_handler(ngx_event_t *ev) {
 }
 
 
-void nchan_subscriber_init_timeout_timer(subscriber_t *sub, ngx_event_t *ev) {
-  ngx_memzero(ev, sizeof(*ev));
-  nchan_init_timer(ev, nchan_subscriber_timeout_ev_handler, sub);
+void nchan_subscriber_init_timeout_timer(subscriber_t *sub, nchan_wheel_timer_t *ev) {
+  nchan_wheel_timer_init(ev, nchan_subscriber_timeout_ev_handler, sub);
 }
 
 nchan_fakereq_subrequest_data_t *nchan_subscriber_subrequest(subscriber_t *sub, nchan_requestmachine_request_params_t *params) {
@@ -17,9 +17,9 @@ ngx_int_t nchan_subscriber_empty_notify(subscriber_t *, ngx_int_t code, void *da
 nchan_fakereq_subrequest_data_t *nchan_subscriber_subrequest(subscriber_t *sub, nchan_requestmachine_request_params_t *params);
 
 
-void nchan_subscriber_timeout_ev_handler(ngx_event_t *ev);
+void nchan_subscriber_timeout_ev_handler(nchan_wheel_timer_t *ev);
 void nchan_subscriber_init(subscriber_t *sub, const subscriber_t *tmpl, ngx_http_request_t *r, nchan_msg_id_t *msgid);
-void nchan_subscriber_init_timeout_timer(subscriber_t *sub, ngx_event_t *ev);
+void nchan_subscriber_init_timeout_timer(subscriber_t *sub, nchan_wheel_timer_t *ev);
 void nchan_subscriber_common_setup(subscriber_t *sub, subscriber_type_t type, ngx_str_t *name, subscriber_fn_t *fn, ngx_int_t enable_sub_unsub_callbacks, ngx_int_t dequeue_after_response);
 ngx_int_t nchan_subscriber_init_msgid_reusepool(nchan_request_ctx_t *ctx, ngx_pool_t *request_pool);
 ngx_str_t nchan_subscriber_set_recyclable_msgid_str(nchan_request_ctx_t *ctx, nchan_msg_id_t *msgid);
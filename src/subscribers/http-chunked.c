@@ -53,8 +53,7 @@ static ngx_int_t chunked_respond_message(subscriber_t *sub,  nchan_msg_t *msg) {
   ngx_int_t               rc;
   
   if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
-    ngx_add_timer(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
   }
   
   ctx->prev_msg_id = fsub->sub.last_msgid;
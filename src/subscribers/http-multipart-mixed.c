@@ -86,8 +86,7 @@ static ngx_int_t multipart_respond_message(subscriber_t *sub,  nchan_msg_t *msg)
   u_char                 *cur = headerbuf->charbuf;
   
   if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
-    ngx_add_timer(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
   }
   
   //generate the headers
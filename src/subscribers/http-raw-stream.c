@@ -37,8 +37,7 @@ static ngx_int_t rawstream_respond_message(subscriber_t *sub,  nchan_msg_t *msg)
   
   
   if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
-    ngx_add_timer(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
   }
   
   if(msg_len + separator_len == 0) {
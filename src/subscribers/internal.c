@@ -151,10 +151,7 @@ void *internal_subscriber_get_privdata(subscriber_t *sub) {
 
 static void reset_timer(internal_subscriber_t *f) {
   if(f->sub.cf && f->sub.cf->subscriber_timeout > 0) {
-    if(f->timeout_ev.timer_set) {
-      ngx_del_timer(&f->timeout_ev);
-    }
-    ngx_add_timer(&f->timeout_ev, f->sub.cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&f->timeout_ev, f->sub.cf->subscriber_timeout * 1000);
   }
 }
 
@@ -180,8 +177,8 @@ static ngx_int_t internal_dequeue(subscriber_t *self) {
   DBG("%p (%V) dequeue sub", self, f->sub.name);
   f->dequeue(NGX_OK, NULL, f->privdata);
   f->dequeue_handler(self, f->dequeue_handler_data);
-  if(self->cf && self->cf->subscriber_timeout > 0 && f->timeout_ev.timer_set) {
-    ngx_del_timer(&f->timeout_ev);
+  if(self->cf && self->cf->subscriber_timeout > 0) {
+    nchan_wheel_timer_del(&f->timeout_ev);
   }
   self->enqueued = 0;
   if(self->destroy_after_dequeue) {
@@ -8,7 +8,7 @@ typedef struct {
   ngx_http_cleanup_t      *cln;
   subscriber_callback_pt  dequeue_handler;
   void                   *dequeue_handler_data;
-  ngx_event_t             timeout_ev;
+  nchan_wheel_timer_t     timeout_ev;
   
   nchan_longpoll_multimsg_t *multimsg_first;
   nchan_longpoll_multimsg_t *multimsg_last;
@@ -1,5 +1,6 @@
 #include <nchan_module.h>
 #include <subscribers/common.h>
+#include <util/nchan_trace.h>
 //#define DEBUG_LEVEL NGX_LOG_WARN
 #define DEBUG_LEVEL NGX_LOG_DEBUG
 #define DBG(fmt, arg...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "SUB:LONGPOLL:" fmt, ##arg)
@@ -152,7 +153,7 @@ ngx_int_t longpoll_enqueue(subscriber_t *self) {
   ensure_request_hold(fsub);
   if(self->cf->subscriber_timeout > 0) {
     //add timeout timer
-    ngx_add_timer(&fsub->data.timeout_ev, self->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->data.timeout_ev, self->cf->subscriber_timeout * 1000);
   }
 
   return NGX_OK;
@@ -163,12 +164,15 @@ static ngx_int_t longpoll_dequeue(subscriber_t *self) {
   ngx_http_request_t   *r = fsub->sub.request;
   nchan_request_ctx_t  *ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
   int                   finalize_now = fsub->data.finalize_request;
-  if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
-  }
+  nchan_wheel_timer_del(&fsub->data.timeout_ev);
   DBG("%p dequeue", self);
   fsub->data.dequeue_handler(self, fsub->data.dequeue_handler_data);
   
+  if(self->enqueued) {
+    nchan_trace_unsubscribe(self);
+    nchan_footprint_record(self, sizeof(*fsub));
+  }
+  
   if(self->enqueued && self->enable_sub_unsub_callbacks && self->cf->unsubscribe_request_url) {
     nchan_subscriber_unsubscribe_request(self);
   }
@@ -253,9 +257,7 @@ static ngx_int_t longpoll_respond_message(subscriber_t *self, nchan_msg_t *msg)
   ctx->msg_id = self->last_msgid;
 
   //verify_unique_response(&fsub->data.request->uri, &self->last_msgid, msg, self);
-  if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
-  }
+  nchan_wheel_timer_del(&fsub->data.timeout_ev);
   if(!cf->longpoll_multimsg) {
     //disable abort handler
     fsub->data.cln->handler = empty_handler;
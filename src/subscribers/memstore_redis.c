@@ -60,6 +60,7 @@ static ngx_int_t sub_dequeue(ngx_int_t status, void *ptr, sub_data_t* d) {
 
 static ngx_int_t sub_respond_message(ngx_int_t status, void *ptr, sub_data_t* d) {
   nchan_msg_t       *msg = (nchan_msg_t *) ptr;
+  nchan_msg_t       *shm_msg;
   nchan_loc_conf_t   cf;
   nchan_msg_id_t    *lastid;
   ngx_pool_t        *deflate_pool = NULL;
@@ -90,7 +91,17 @@ static ngx_int_t sub_respond_message(ngx_int_t status, void *ptr, sub_data_t* d)
   if(lastid->time < msg->id.time || 
     (lastid->time == msg->id.time && lastid->tag.fixed[0] < msg->id.tag.fixed[0])) {
     memstore_ensure_chanhead_is_ready(d->chanhead, 1);
-    nchan_store_chanhead_publish_message_generic(d->chanhead, msg, 0, &cf, NULL, NULL);
+    if(msg->shared_body && cf.message_compression == NCHAN_MSG_NO_COMPRESSION
+     && (shm_msg = memstore_shared_msg_header_create(msg->shared_body)) != NULL) {
+      //decoded straight into shm off the PUBSUB connection. no need to copy it again.
+      if(nchan_store_chanhead_publish_message_generic(d->chanhead, shm_msg, 1, &cf, NULL, NULL) == NGX_ERROR) {
+        //the header's been discarded, and its hold on the body released, by the failed publish
+        ERR("couldn't publish Redis PUBSUB message to channel %V", &d->chanhead->id);
+      }
+    }
+    else {
+      nchan_store_chanhead_publish_message_generic(d->chanhead, msg, 0, &cf, NULL, NULL);
+    }
   }
   else {
     //meh, this message has already been delivered probably hopefully
@@ -2,6 +2,9 @@
 #include <subscribers/common.h>
 #include <util/nchan_subrequest.h>
 #include <util/nchan_fake_request.h>
+#include <util/nchan_latency.h>
+#include <util/nchan_trace.h>
+#include <util/nchan_footprint.h>
 #if nginx_version >= 1000003
 #include <ngx_crypt.h>
 #endif
@@ -185,11 +188,11 @@ struct full_subscriber_s {
   nchan_request_ctx_t    *ctx;
   subscriber_callback_pt  dequeue_handler;
   void                   *dequeue_handler_data;
-  ngx_event_t             timeout_ev;
+  nchan_wheel_timer_t     timeout_ev;
   ngx_event_t             closing_ev;
   ws_frame_t              frame;
   
-  ngx_event_t             ping_ev;
+  nchan_wheel_timer_t     ping_ev;
   
   permessage_deflate_t    deflate;
   
@@ -451,6 +454,7 @@ static ngx_int_t websocket_publish_callback(ngx_int_t status, nchan_channel_t *c
   ngx_str_t             *accept_header = NULL;
   ngx_buf_t             *tmp_buf;
   nchan_buf_and_chain_t *bc;
+  uint64_t               latency_start = d->msg.latency_start;
   if(ch) {
     subscribers = ch->subscribers;
     last_seen = ch->last_seen;
@@ -474,6 +478,7 @@ static ngx_int_t websocket_publish_callback(ngx_int_t status, nchan_channel_t *c
   switch(status) {
     case NCHAN_MESSAGE_QUEUED:
     case NCHAN_MESSAGE_RECEIVED:
+      nchan_latency_record(NCHAN_LATENCY_PUBLISH_STORED, latency_start);
       if(fsub->sub.cf->sub.websocket) {
         //don't reply with status info, this websocket is used for subscribing too,
         //so it should only be receiving messages
@@ -522,12 +527,14 @@ static void websocket_publish_continue(ws_publish_data_t *d) {
   }
   //ERR("%p pool sz %d", fsub, r->pool->total_allocd);
   msg->storage = NCHAN_MSG_POOL;
+  msg->latency_start = nchan_latency_sample_start();
   
   if(nchan_need_to_deflate_message(fsub->sub.cf)) {
     nchan_deflate_message_if_needed(msg, fsub->sub.cf, r, d->pool);
   }
   
   websocket_reserve(&fsub->sub);
+  nchan_trace_publish(fsub->publisher.channel_id, msg);
   fsub->sub.cf->storage_engine->publish(fsub->publisher.channel_id, msg, fsub->sub.cf, (callback_pt )websocket_publish_callback, d); 
   nchan_update_stub_status(total_published_messages, 1);
   
@@ -692,6 +699,8 @@ static void *framebuf_alloc(void *pd) {
   return ngx_palloc((ngx_pool_t *)pd, sizeof(framebuf_t));
 }
 
+static void ping_ev_handler(nchan_wheel_timer_t *ev);
+
 static void closing_ev_handler(ngx_event_t *ev) {
   full_subscriber_t *fsub = (full_subscriber_t *)ev->data;
   DBG("closing_ev timer handler for %p, delayed", fsub);
@@ -720,7 +729,7 @@ subscriber_t *websocket_subscriber_create(ngx_http_request_t *r, nchan_msg_id_t
   fsub->awaiting_pong = 0;
   fsub->sent_close_frame = 0;
   fsub->received_close_frame = 0;
-  ngx_memzero(&fsub->ping_ev, sizeof(fsub->ping_ev));
+  nchan_wheel_timer_init(&fsub->ping_ev, ping_ev_handler, fsub);
   
   nchan_subscriber_init_timeout_timer(&fsub->sub, &fsub->timeout_ev);
   
@@ -1148,20 +1157,17 @@ static ngx_int_t websocket_release(subscriber_t *self, uint8_t nodestroy) {
   }
 }
 
-static void ping_ev_handler(ngx_event_t *ev) {
+static void ping_ev_handler(nchan_wheel_timer_t *ev) {
   full_subscriber_t *fsub = (full_subscriber_t *)ev->data;
-  if(ev->timedout) {
-    ev->timedout=0;
-    if(fsub->awaiting_pong) {
-      //never got a PONG back
-      //NGX_HTTP_CLIENT_CLOSED_REQUEST?
-      websocket_finalize_request(fsub);
-    }
-    else {
-      fsub->awaiting_pong = 1;
-      websocket_send_frame(fsub, WEBSOCKET_PING_LAST_FRAME_BYTE, 0, NULL); 
-      ngx_add_timer(&fsub->ping_ev, fsub->sub.cf->websocket_ping_interval * 1000);
-    }
+  if(fsub->awaiting_pong) {
+    //never got a PONG back
+    //NGX_HTTP_CLIENT_CLOSED_REQUEST?
+    websocket_finalize_request(fsub);
+  }
+  else {
+    fsub->awaiting_pong = 1;
+    websocket_send_frame(fsub, WEBSOCKET_PING_LAST_FRAME_BYTE, 0, NULL); 
+    nchan_wheel_timer_add(&fsub->ping_ev, fsub->sub.cf->websocket_ping_interval * 1000);
   }
 }
 
@@ -1174,32 +1180,40 @@ static ngx_int_t websocket_enqueue(subscriber_t *self) {
   self->enqueued = 1;
   
   if(self->cf->websocket_ping_interval > 0) {
-    //add timeout timer
-    //nextsub->ev should be zeroed;
-    nchan_init_timer(&fsub->ping_ev, ping_ev_handler, fsub);
-    ngx_add_timer(&fsub->ping_ev, self->cf->websocket_ping_interval * 1000);
+    //add ping timer
+    nchan_wheel_timer_add(&fsub->ping_ev, self->cf->websocket_ping_interval * 1000);
   }
   
   if(self->cf->subscriber_timeout > 0) {
     //add timeout timer
-    ngx_add_timer(&fsub->timeout_ev, self->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->timeout_ev, self->cf->subscriber_timeout * 1000);
   }
   
   return NGX_OK;
 }
 
 static void websocket_delete_timers(full_subscriber_t *fsub) {
-  if(fsub->ping_ev.timer_set) {
-    ngx_del_timer(&fsub->ping_ev);
-  }
+  nchan_wheel_timer_del(&fsub->ping_ev);
   
   if(fsub->closing_ev.timer_set) {
     ngx_del_timer(&fsub->closing_ev);
   }
   
-  if(fsub->timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->timeout_ev);
+  nchan_wheel_timer_del(&fsub->timeout_ev);
+}
+
+//what the subscriber has allocated outside of the request and connection pools
+static size_t websocket_footprint(full_subscriber_t *fsub) {
+  size_t    sz = sizeof(*fsub);
+  if(fsub->publisher.msg_pool) {
+    sz += nchan_pool_footprint(fsub->publisher.msg_pool);
   }
+#if (NGX_ZLIB)
+  if(fsub->deflate.zstream_in) {
+    sz += sizeof(*fsub->deflate.zstream_in) + NCHAN_FOOTPRINT_INFLATE_STATE + (1 << fsub->deflate.client_max_window_bits);
+  }
+#endif
+  return sz;
 }
 
 static ngx_int_t websocket_dequeue(subscriber_t *self) {
@@ -1207,6 +1221,10 @@ static ngx_int_t websocket_dequeue(subscriber_t *self) {
   DBG("%p dequeue", self);
   fsub->dequeue_handler(&fsub->sub, fsub->dequeue_handler_data);
   
+  if(self->enqueued) {
+    nchan_trace_unsubscribe(self);
+    nchan_footprint_record(self, websocket_footprint(fsub));
+  }
   self->enqueued = 0;
   
   if(!fsub->sent_close_frame && fsub->shook_hands) {
@@ -1902,8 +1920,7 @@ static ngx_int_t websocket_respond_message(subscriber_t *self, nchan_msg_t *msg)
   }
   
   if(fsub->timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->timeout_ev);
-    ngx_add_timer(&fsub->timeout_ev, fsub->sub.cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->timeout_ev, fsub->sub.cf->subscriber_timeout * 1000);
   }
   
   fsub->ctx->prev_msg_id = self->last_msgid;
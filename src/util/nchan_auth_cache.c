@@ -0,0 +1,241 @@
+#include <nchan_module.h>
+#include <assert.h>
+#include <store/memory/store.h>
+#include <util/shmem.h>
+#include <util/nchan_singleflight.h>
+#include "nchan_auth_cache.h"
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "AUTHCACHE: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "AUTHCACHE: " fmt, ##args)
+
+//worker-local in-flight authorization requests, for collapsing identical lookups into one
+static nchan_singleflight_t  inflight = {"authorization requests in flight", NCHAN_AUTH_CACHE_INFLIGHT_TIMEOUT, NGX_HTTP_GATEWAY_TIME_OUT};
+
+static nchan_auth_cache_shm_t *auth_cache_shm(void) {
+  return nchan_memstore_get_auth_cache();
+}
+
+ngx_int_t nchan_auth_cache_key(ngx_http_request_t *r, nchan_loc_conf_t *cf, pub_or_sub_t type, ngx_pool_t *pool, ngx_str_t *key) {
+  ngx_str_t    val, url;
+  size_t       maxlen;
+  if(!cf->authorize_cache.key || !cf->authorize_request_url) {
+    return NGX_DECLINED;
+  }
+  if(ngx_http_complex_value(r, cf->authorize_cache.key, &val) != NGX_OK
+   || ngx_http_complex_value(r, cf->authorize_request_url, &url) != NGX_OK) {
+    return NGX_ERROR;
+  }
+  //publishers and subscribers are authorized separately, and so is every authorization URL,
+  //or locations with the same key but different authorizers would get each other's decisions.
+  maxlen = 2 + NGX_SIZE_T_LEN + 1 + url.len + val.len;
+  if(val.len == 0 || maxlen > NCHAN_AUTH_CACHE_MAX_KEY_LENGTH) {
+    //nothing to key on, or too big to bother with
+    return NGX_DECLINED;
+  }
+  if((key->data = ngx_palloc(pool, maxlen)) == NULL) {
+    return NGX_ERROR;
+  }
+  key->len = ngx_sprintf(key->data, "%c:%uz:%V%V", type == PUB ? 'p' : 's', url.len, &url, &val) - key->data;
+  return NGX_OK;
+}
+
+static void auth_cache_entry_free_locked(nchan_auth_cache_shm_t *cache, nchan_auth_cache_entry_t *entry) {
+  shm_locked_free(nchan_store_memory_shmem, entry);
+  cache->entries--;
+}
+
+static void auth_cache_sweep_locked(nchan_auth_cache_shm_t *cache) {
+  nchan_auth_cache_entry_t   *cur, **prev_next;
+  time_t                      now = ngx_time();
+  int                         i;
+
+  if(cache->last_sweep == now) {
+    return;
+  }
+  cache->last_sweep = now;
+  for(i=0; i<NCHAN_AUTH_CACHE_BUCKETS; i++) {
+    prev_next = &cache->bucket[i];
+    while((cur = *prev_next) != NULL) {
+      if(cur->expires <= now) {
+        *prev_next = cur->next;
+        auth_cache_entry_free_locked(cache, cur);
+      }
+      else {
+        prev_next = &cur->next;
+      }
+    }
+  }
+}
+
+//finds the entry, and gets rid of any expired ones it runs into
+static nchan_auth_cache_entry_t **auth_cache_find_locked(nchan_auth_cache_shm_t *cache, ngx_str_t *key, uint32_t hash) {
+  nchan_auth_cache_entry_t   *cur, **prev_next;
+  time_t                      now = ngx_time();
+
+  prev_next = &cache->bucket[hash % NCHAN_AUTH_CACHE_BUCKETS];
+  while((cur = *prev_next) != NULL) {
+    if(cur->expires <= now) {
+      *prev_next = cur->next;
+      auth_cache_entry_free_locked(cache, cur);
+      continue;
+    }
+    if(cur->hash == hash && cur->key.len == key->len && ngx_memcmp(cur->key.data, key->data, key->len) == 0) {
+      return prev_next;
+    }
+    prev_next = &cur->next;
+  }
+  return NULL;
+}
+
+ngx_int_t nchan_auth_cache_get(ngx_str_t *key) {
+  nchan_auth_cache_shm_t     *cache = auth_cache_shm();
+  nchan_auth_cache_entry_t  **found;
+  uint32_t                    hash = ngx_crc32_short(key->data, key->len);
+  ngx_int_t                   code = NGX_DECLINED;
+
+  if(!cache) {
+    return NGX_DECLINED;
+  }
+
+  shmtx_lock(nchan_store_memory_shmem);
+  if((found = auth_cache_find_locked(cache, key, hash)) != NULL) {
+    code = (*found)->code;
+  }
+  shmtx_unlock(nchan_store_memory_shmem);
+
+  DBG("get %V: %i", key, code);
+  return code;
+}
+
+static time_t auth_cache_response_ttl(nchan_loc_conf_t *cf, ngx_int_t code, ngx_http_request_t *sr) {
+  ngx_uint_t                       i;
+  ngx_list_part_t                 *part;
+  ngx_table_elt_t                 *header;
+  u_char                          *start, *last, *cur;
+  time_t                           ttl;
+  ngx_int_t                        maxage;
+
+  if(code >= 200 && code < 300) {
+    ttl = cf->authorize_cache.ttl;
+  }
+  else {
+    //denials aren't cached: the uncached response's body and headers go to the client, and we don't keep those.
+    //neither are errors and such.
+    return 0;
+  }
+
+  if(!sr) {
+    return ttl;
+  }
+
+  part = &sr->headers_out.headers.part;
+  header = part->elts;
+  for (i = 0; /* void */ ; i++) {
+    if (i >= part->nelts) {
+      if (part->next == NULL) {
+        break;
+      }
+      part = part->next;
+      header = part->elts;
+      i = 0;
+    }
+    if(!nchan_strmatch(&header[i].key, 1, "Cache-Control")) {
+      continue;
+    }
+    start = header[i].value.data;
+    last = start + header[i].value.len;
+
+    if(ngx_strlcasestrn(start, last, (u_char *)"no-store", 8 - 1)
+     || ngx_strlcasestrn(start, last, (u_char *)"no-cache", 8 - 1)
+     || ngx_strlcasestrn(start, last, (u_char *)"private", 7 - 1)) {
+      return 0;
+    }
+
+    //s-maxage is meant for shared caches, so it wins over max-age
+    if((cur = ngx_strlcasestrn(start, last, (u_char *)"s-maxage=", 9 - 1)) != NULL) {
+      cur += 9;
+    }
+    else if((cur = ngx_strlcasestrn(start, last, (u_char *)"max-age=", 8 - 1)) != NULL) {
+      cur += 8;
+    }
+    if(cur) {
+      for(start = cur; cur < last && *cur >= '0' && *cur <= '9'; cur++) { /* void */ }
+      if((maxage = ngx_atoi(start, cur - start)) != NGX_ERROR) {
+        ttl = maxage;
+      }
+    }
+  }
+
+  return ttl;
+}
+
+static ngx_int_t auth_cache_store(ngx_str_t *key, ngx_int_t code, time_t ttl) {
+  nchan_auth_cache_shm_t     *cache = auth_cache_shm();
+  nchan_auth_cache_entry_t  **found, *entry;
+  uint32_t                    hash = ngx_crc32_short(key->data, key->len);
+  ngx_int_t                   rc = NGX_OK;
+
+  if(!cache) {
+    return NGX_DECLINED;
+  }
+
+  shmtx_lock(nchan_store_memory_shmem);
+  if((found = auth_cache_find_locked(cache, key, hash)) != NULL) {
+    (*found)->code = code;
+    (*found)->expires = ngx_time() + ttl;
+  }
+  else {
+    if(cache->entries >= NCHAN_AUTH_CACHE_MAX_ENTRIES) {
+      auth_cache_sweep_locked(cache);
+    }
+    if(cache->entries >= NCHAN_AUTH_CACHE_MAX_ENTRIES) {
+      rc = NGX_DECLINED;
+    }
+    else if((entry = shm_locked_alloc(nchan_store_memory_shmem, sizeof(*entry) + key->len, "auth cache entry")) == NULL) {
+      rc = NGX_ERROR;
+    }
+    else {
+      entry->hash = hash;
+      entry->code = code;
+      entry->expires = ngx_time() + ttl;
+      entry->key.len = key->len;
+      entry->key.data = (u_char *)&entry[1];
+      ngx_memcpy(entry->key.data, key->data, key->len);
+
+      entry->next = cache->bucket[hash % NCHAN_AUTH_CACHE_BUCKETS];
+      cache->bucket[hash % NCHAN_AUTH_CACHE_BUCKETS] = entry;
+      cache->entries++;
+    }
+  }
+  shmtx_unlock(nchan_store_memory_shmem);
+
+  if(rc == NGX_ERROR) {
+    nchan_log_ooshm_error("caching authorization response for %V", key);
+  }
+  else if(rc == NGX_DECLINED) {
+    nchan_log_warning("Authorization cache is full, not caching response for %V", key);
+  }
+  return rc;
+}
+
+ngx_int_t nchan_auth_cache_wait(ngx_str_t *key, callback_pt cb, void *pd, ngx_uint_t *flight) {
+  return nchan_singleflight_wait(&inflight, key, cb, pd, flight);
+}
+
+ngx_int_t nchan_auth_cache_resolve(ngx_str_t *key, ngx_uint_t flight, ngx_int_t code) {
+  return nchan_singleflight_resolve(&inflight, key, flight, code, NULL);
+}
+
+ngx_int_t nchan_auth_cache_set(nchan_loc_conf_t *cf, ngx_str_t *key, ngx_uint_t flight, ngx_int_t code, ngx_http_request_t *sr) {
+  time_t ttl = auth_cache_response_ttl(cf, code, sr);
+  if(ttl > 0) {
+    auth_cache_store(key, code, ttl);
+  }
+  return nchan_auth_cache_resolve(key, flight, code);
+}
+
+ngx_int_t nchan_auth_cache_shutdown(void) {
+  return nchan_singleflight_shutdown(&inflight);
+}
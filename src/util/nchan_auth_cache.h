@@ -0,0 +1,43 @@
+#ifndef NCHAN_AUTH_CACHE_H
+#define NCHAN_AUTH_CACHE_H
+
+#define NCHAN_AUTH_CACHE_BUCKETS 4096
+#define NCHAN_AUTH_CACHE_MAX_ENTRIES 65536
+#define NCHAN_AUTH_CACHE_MAX_KEY_LENGTH 1024
+#define NCHAN_AUTH_CACHE_INFLIGHT_TIMEOUT 30000 //msec
+
+typedef struct nchan_auth_cache_entry_s nchan_auth_cache_entry_t;
+struct nchan_auth_cache_entry_s {
+  nchan_auth_cache_entry_t   *next;
+  uint32_t                    hash;
+  time_t                      expires;
+  ngx_int_t                   code;
+  ngx_str_t                   key;
+}; //nchan_auth_cache_entry_t
+
+//lives in the memstore's shared memory, guarded by the shm mutex
+typedef struct {
+  ngx_atomic_uint_t           entries;
+  time_t                      last_sweep;
+  nchan_auth_cache_entry_t   *bucket[NCHAN_AUTH_CACHE_BUCKETS];
+} nchan_auth_cache_shm_t;
+
+ngx_int_t nchan_auth_cache_key(ngx_http_request_t *r, nchan_loc_conf_t *cf, pub_or_sub_t type, ngx_pool_t *pool, ngx_str_t *key);
+
+// returns the cached authorization response code, or NGX_DECLINED if there's nothing cached.
+// only successful responses are cached.
+ngx_int_t nchan_auth_cache_get(ngx_str_t *key);
+
+// NGX_OK if an identical authorization request is already in flight, and cb will be called with its response code.
+// NGX_DECLINED if the caller should make the request, and then call nchan_auth_cache_set or nchan_auth_cache_resolve with the flight.
+ngx_int_t nchan_auth_cache_wait(ngx_str_t *key, callback_pt cb, void *pd, ngx_uint_t *flight);
+
+// cache the authorization response (if it's cacheable) and wake up anyone waiting for it
+ngx_int_t nchan_auth_cache_set(nchan_loc_conf_t *cf, ngx_str_t *key, ngx_uint_t flight, ngx_int_t code, ngx_http_request_t *sr);
+
+// wake up anyone waiting without caching anything
+ngx_int_t nchan_auth_cache_resolve(ngx_str_t *key, ngx_uint_t flight, ngx_int_t code);
+
+ngx_int_t nchan_auth_cache_shutdown(void);
+
+#endif //NCHAN_AUTH_CACHE_H
@@ -0,0 +1,501 @@
+#include <nchan_module.h>
+#include <assert.h>
+#include <subscribers/internal.h>
+#include <util/nchan_slist.h>
+#include <util/nchan_histogram.h>
+#include "nchan_benchmark.h"
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "BENCHMARK: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "BENCHMARK: " fmt, ##args)
+
+// The benchmark runs in the worker that gets the request. Its subscribers are internal subscribers,
+// and its messages are published straight to the location's storage engine, so the results measure
+// Nchan and not the client. With the memory store, the channels are owned by all the workers and the
+// messages go through interprocess messaging as usual. With Redis, they go through Redis.
+//
+// Each message starts with the microsecond timestamp of when it was published. The response is a
+// stream of JSON objects, one per line: a "start" object once the subscribers are ready, a "progress"
+// object every second, and finally the "results".
+
+#define BENCHMARK_TIMESTAMP_LEN 20
+
+typedef struct nchan_benchmark_s nchan_benchmark_t;
+
+typedef struct {
+  nchan_benchmark_t        *bench;
+  ngx_str_t                 id;
+  ngx_event_t               publish_timer;
+} benchmark_channel_t;
+
+typedef struct benchmark_sub_s benchmark_sub_t;
+struct benchmark_sub_s {
+  nchan_benchmark_t        *bench;
+  subscriber_t             *sub;
+  benchmark_sub_t          *prev;
+  benchmark_sub_t          *next;
+  unsigned                  enqueued:1;
+};
+
+typedef struct {
+  ngx_uint_t                published;
+  ngx_uint_t                publish_failures;
+  ngx_uint_t                received;
+} benchmark_counts_t;
+
+typedef enum {BENCHMARK_WARMUP, BENCHMARK_RUNNING, BENCHMARK_COOLDOWN, BENCHMARK_FINISHED} benchmark_state_t;
+
+struct nchan_benchmark_s {
+  ngx_http_request_t       *r; //NULL once the client is gone
+  ngx_http_cleanup_t       *cln;
+  nchan_loc_conf_t         *cf;
+  benchmark_state_t         state;
+  ngx_uint_t                refcount; //the benchmark itself, its subscribers, and its unfinished publishes
+
+  benchmark_channel_t      *channel;
+  ngx_uint_t                channels;
+  nchan_slist_t             subs;
+  ngx_uint_t                subs_per_channel;
+  ngx_uint_t                subs_enqueued;
+
+  ngx_msec_t                publish_interval;
+  u_char                   *msgbuf;
+  size_t                    msgbuf_len;
+
+  ngx_event_t               timer;
+  ngx_msec_t                started;
+  ngx_msec_t                stopped;
+  ngx_uint_t                ticks;
+
+  benchmark_counts_t        total;
+  benchmark_counts_t        interval;
+  nchan_histogram_t         latency;
+  nchan_histogram_t         interval_latency;
+};
+
+static ngx_uint_t       benchmark_serial = 0;
+static ngx_str_t        benchmark_sub_name = ngx_string("benchmark");
+static ngx_str_t        benchmark_content_type = ngx_string("application/json");
+
+static void benchmark_teardown(nchan_benchmark_t *bench);
+
+static uint64_t benchmark_now_usec(void) {
+  struct timeval    tv;
+  ngx_gettimeofday(&tv);
+  return (uint64_t )tv.tv_sec * 1000000 + (uint64_t )tv.tv_usec;
+}
+
+static void benchmark_release(nchan_benchmark_t *bench) {
+  assert(bench->refcount > 0);
+  if(--bench->refcount > 0) {
+    return;
+  }
+  DBG("%p free", bench);
+  if(bench->timer.timer_set) {
+    ngx_del_timer(&bench->timer);
+  }
+  ngx_free(bench->channel);
+  ngx_free(bench->msgbuf);
+  ngx_free(bench);
+}
+
+static ngx_int_t benchmark_write(nchan_benchmark_t *bench, u_char *data, size_t len, int last) {
+  ngx_http_request_t   *r = bench->r;
+  ngx_buf_t            *b;
+  ngx_chain_t           chain;
+
+  if(r == NULL) {
+    return NGX_ERROR;
+  }
+  if((b = ngx_calloc_buf(r->pool)) == NULL || (b->start = ngx_palloc(r->pool, len)) == NULL) {
+    ERR("can't allocate output buffer");
+    return NGX_ERROR;
+  }
+  ngx_memcpy(b->start, data, len);
+  b->pos = b->start;
+  b->last = b->start + len;
+  b->end = b->last;
+  b->memory = 1;
+  b->flush = 1;
+  b->last_buf = last;
+
+  chain.buf = b;
+  chain.next = NULL;
+  return ngx_http_output_filter(r, &chain);
+}
+
+static u_char *benchmark_write_latency(u_char *cur, nchan_histogram_t *h) {
+  return ngx_sprintf(cur, "{\"min\":%uL,\"avg\":%uL,\"p50\":%uL,\"p90\":%uL,\"p99\":%uL,\"p999\":%uL,\"max\":%uL}",
+                     h->min, nchan_histogram_mean(h),
+                     nchan_histogram_percentile(h, 50), nchan_histogram_percentile(h, 90),
+                     nchan_histogram_percentile(h, 99), nchan_histogram_percentile(h, 99.9),
+                     h->max);
+}
+
+/* subscribers */
+
+static ngx_int_t benchmark_sub_enqueue(ngx_int_t code, void *ptr, benchmark_sub_t *d) {
+  nchan_benchmark_t    *bench = d->bench;
+  d->enqueued = 1;
+  bench->subs_enqueued++;
+  if(bench->state == BENCHMARK_FINISHED && !bench->timer.timer_set) {
+    //too late. can't dequeue while enqueueing, so that happens on the next timer tick
+    ngx_add_timer(&bench->timer, 0);
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t benchmark_sub_dequeue(ngx_int_t code, void *ptr, benchmark_sub_t *d) {
+  if(d->enqueued) {
+    d->enqueued = 0;
+    d->bench->subs_enqueued--;
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t benchmark_sub_respond_message(ngx_int_t code, nchan_msg_t *msg, benchmark_sub_t *d) {
+  nchan_benchmark_t    *bench = d->bench;
+  uint64_t              sent = 0, now;
+  u_char               *cur, *end;
+
+  if(bench->state != BENCHMARK_RUNNING && bench->state != BENCHMARK_COOLDOWN) {
+    return NGX_OK;
+  }
+  bench->total.received++;
+  bench->interval.received++;
+
+  if(msg->buf.in_file) {
+    //nothing to read the timestamp from
+    return NGX_OK;
+  }
+  cur = msg->buf.pos;
+  end = msg->buf.last;
+  if(end - cur > BENCHMARK_TIMESTAMP_LEN) {
+    end = cur + BENCHMARK_TIMESTAMP_LEN;
+  }
+  for(; cur < end && *cur >= '0' && *cur <= '9'; cur++) {
+    sent = sent * 10 + (*cur - '0');
+  }
+  now = benchmark_now_usec();
+  if(sent > 0 && now >= sent) {
+    nchan_histogram_record(&bench->latency, now - sent);
+    nchan_histogram_record(&bench->interval_latency, now - sent);
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t benchmark_sub_respond_status(ngx_int_t status, void *ptr, benchmark_sub_t *d) {
+  DBG("subscriber %p got status %i", d->sub, status);
+  return NGX_OK;
+}
+
+static ngx_int_t benchmark_sub_destroy(ngx_int_t code, void *ptr, benchmark_sub_t *d) {
+  nchan_benchmark_t    *bench = d->bench;
+  benchmark_sub_dequeue(code, ptr, d);
+  nchan_slist_remove(&bench->subs, d);
+  benchmark_release(bench);
+  return NGX_OK;
+}
+
+static void benchmark_dequeue_subscribers(nchan_benchmark_t *bench) {
+  benchmark_sub_t      *cur, *next;
+  for(cur = nchan_slist_first(&bench->subs); cur != NULL; cur = next) {
+    next = nchan_slist_next(&bench->subs, cur);
+    if(cur->enqueued) {
+      //destroys the subscriber, and removes it from the list
+      cur->sub->fn->dequeue(cur->sub);
+    }
+  }
+}
+
+static ngx_int_t benchmark_subscribe(nchan_benchmark_t *bench, benchmark_channel_t *ch) {
+  static nchan_msg_id_t newest_msgid = NCHAN_NEWEST_MSGID;
+  subscriber_t         *sub;
+  benchmark_sub_t      *d;
+
+  sub = internal_subscriber_create_init(&benchmark_sub_name, bench->cf, sizeof(*d), (void **)&d, (callback_pt )benchmark_sub_enqueue, (callback_pt )benchmark_sub_dequeue, (callback_pt )benchmark_sub_respond_message, (callback_pt )benchmark_sub_respond_status, NULL, (callback_pt )benchmark_sub_destroy);
+  if(sub == NULL) {
+    return NGX_ERROR;
+  }
+  d->bench = bench;
+  d->sub = sub;
+  d->enqueued = 0;
+  nchan_slist_append(&bench->subs, d);
+  bench->refcount++;
+
+  sub->last_msgid = newest_msgid;
+  return bench->cf->storage_engine->subscribe(&ch->id, sub);
+}
+
+/* publishing */
+
+static ngx_int_t benchmark_publish_callback(ngx_int_t status, void *data, nchan_benchmark_t *bench) {
+  if(status != NCHAN_MESSAGE_QUEUED && status != NCHAN_MESSAGE_RECEIVED) {
+    bench->total.publish_failures++;
+    bench->interval.publish_failures++;
+  }
+  benchmark_release(bench);
+  return NGX_OK;
+}
+
+static void benchmark_publish_timer_handler(ngx_event_t *ev) {
+  benchmark_channel_t  *ch = ev->data;
+  nchan_benchmark_t    *bench = ch->bench;
+  nchan_msg_t           msg;
+
+  if(bench->state != BENCHMARK_RUNNING) {
+    return;
+  }
+
+  //fixed-width, so that the message size stays the same
+  ngx_sprintf(bench->msgbuf, "%020uL", benchmark_now_usec());
+
+  ngx_memzero(&msg, sizeof(msg));
+  msg.buf.temporary = 1;
+  msg.buf.memory = 1;
+  msg.buf.last_buf = 1;
+  msg.buf.start = bench->msgbuf;
+  msg.buf.pos = bench->msgbuf;
+  msg.buf.end = bench->msgbuf + bench->msgbuf_len;
+  msg.buf.last = msg.buf.end;
+  msg.id.time = 0;
+  msg.id.tag.fixed[0] = 0;
+  msg.id.tagactive = 0;
+  msg.id.tagcount = 1;
+
+  bench->total.published++;
+  bench->interval.published++;
+  bench->refcount++;
+  bench->cf->storage_engine->publish(&ch->id, &msg, bench->cf, (callback_pt )benchmark_publish_callback, bench);
+
+  if(bench->state == BENCHMARK_RUNNING) {
+    ngx_add_timer(ev, bench->publish_interval);
+  }
+}
+
+static void benchmark_stop_publishing(nchan_benchmark_t *bench) {
+  ngx_uint_t     i;
+  for(i = 0; i < bench->channels; i++) {
+    if(bench->channel[i].publish_timer.timer_set) {
+      ngx_del_timer(&bench->channel[i].publish_timer);
+    }
+  }
+}
+
+/* the run */
+
+static void benchmark_start(nchan_benchmark_t *bench) {
+  u_char         buf[512], *end;
+  ngx_uint_t     i;
+
+  bench->state = BENCHMARK_RUNNING;
+  bench->started = ngx_current_msec;
+
+  end = ngx_snprintf(buf, sizeof(buf), "{\"type\":\"start\",\"channels\":%ui,\"subscribers\":%ui,\"subscribers_ready\":%ui,\"message_size\":%uz,\"messages_per_channel_per_minute\":%i,\"time\":%T}\n",
+                     bench->channels, bench->channels * bench->subs_per_channel, bench->subs_enqueued, bench->msgbuf_len, bench->cf->benchmark.messages_per_channel_per_minute, bench->cf->benchmark.time);
+  benchmark_write(bench, buf, end - buf, 0);
+
+  //spread the channels' publishing out over the interval
+  for(i = 0; i < bench->channels; i++) {
+    ngx_add_timer(&bench->channel[i].publish_timer, (ngx_msec_t )ngx_random() % bench->publish_interval);
+  }
+  ngx_add_timer(&bench->timer, NCHAN_BENCHMARK_PROGRESS_INTERVAL);
+}
+
+static void benchmark_progress(nchan_benchmark_t *bench) {
+  u_char         buf[512], *end;
+
+  bench->ticks++;
+  end = ngx_snprintf(buf, sizeof(buf) - 2, "{\"type\":\"progress\",\"time\":%ui,\"published\":%ui,\"publish_failures\":%ui,\"received\":%ui,\"latency_usec\":",
+                     bench->ticks * NCHAN_BENCHMARK_PROGRESS_INTERVAL / 1000, bench->interval.published, bench->interval.publish_failures, bench->interval.received);
+  end = benchmark_write_latency(end, &bench->interval_latency);
+  end = ngx_sprintf(end, "}\n");
+  benchmark_write(bench, buf, end - buf, 0);
+
+  ngx_memzero(&bench->interval, sizeof(bench->interval));
+  nchan_histogram_init(&bench->interval_latency);
+}
+
+static void benchmark_finish(nchan_benchmark_t *bench) {
+  u_char               buf[1024], *end;
+  ngx_msec_t           elapsed = bench->stopped - bench->started;
+  ngx_http_request_t  *r = bench->r;
+  ngx_int_t            rc;
+
+  if(elapsed == 0) {
+    elapsed = 1;
+  }
+  end = ngx_snprintf(buf, sizeof(buf) - 2, "{\"type\":\"results\",\"time\":%M,\"channels\":%ui,\"subscribers\":%ui,\"published\":%ui,\"publish_failures\":%ui,\"received\":%ui,\"expected\":%ui,\"publish_rate\":%ui,\"receive_rate\":%ui,\"latency_usec\":",
+                     elapsed, bench->channels, bench->channels * bench->subs_per_channel,
+                     bench->total.published, bench->total.publish_failures, bench->total.received,
+                     (bench->total.published - bench->total.publish_failures) * bench->subs_per_channel,
+                     bench->total.published * 1000 / elapsed, bench->total.received * 1000 / elapsed);
+  end = benchmark_write_latency(end, &bench->latency);
+  end = ngx_sprintf(end, "}\n");
+  rc = benchmark_write(bench, buf, end - buf, 1);
+
+  if(r) {
+    //we're done with the request. don't let its cleanup touch the benchmark.
+    bench->cln->data = NULL;
+    bench->r = NULL;
+    ngx_http_finalize_request(r, rc);
+  }
+  benchmark_teardown(bench);
+}
+
+static void benchmark_timer_handler(ngx_event_t *ev) {
+  nchan_benchmark_t    *bench = ev->data;
+
+  switch(bench->state) {
+    case BENCHMARK_WARMUP:
+      if(bench->subs_enqueued < bench->channels * bench->subs_per_channel && ngx_current_msec - bench->started < NCHAN_BENCHMARK_WARMUP_TIMEOUT) {
+        ngx_add_timer(ev, 100);
+      }
+      else {
+        benchmark_start(bench);
+      }
+      break;
+
+    case BENCHMARK_RUNNING:
+      benchmark_progress(bench);
+      if(bench->ticks * NCHAN_BENCHMARK_PROGRESS_INTERVAL >= (ngx_uint_t )bench->cf->benchmark.time * 1000) {
+        bench->state = BENCHMARK_COOLDOWN;
+        bench->stopped = ngx_current_msec;
+        benchmark_stop_publishing(bench);
+        ngx_add_timer(ev, NCHAN_BENCHMARK_COOLDOWN);
+      }
+      else {
+        ngx_add_timer(ev, NCHAN_BENCHMARK_PROGRESS_INTERVAL);
+      }
+      break;
+
+    case BENCHMARK_COOLDOWN:
+      benchmark_finish(bench);
+      break;
+
+    case BENCHMARK_FINISHED:
+      //latecomer subscribers
+      benchmark_dequeue_subscribers(bench);
+      break;
+  }
+}
+
+static void benchmark_teardown(nchan_benchmark_t *bench) {
+  if(bench->state == BENCHMARK_FINISHED) {
+    return;
+  }
+  bench->state = BENCHMARK_FINISHED;
+  benchmark_stop_publishing(bench);
+  if(bench->timer.timer_set) {
+    ngx_del_timer(&bench->timer);
+  }
+  benchmark_dequeue_subscribers(bench);
+  benchmark_release(bench);
+}
+
+static void benchmark_request_cleanup(nchan_benchmark_t *bench) {
+  if(bench == NULL) {
+    return;
+  }
+  DBG("%p client went away", bench);
+  bench->r = NULL;
+  benchmark_teardown(bench);
+}
+
+ngx_int_t nchan_benchmark_handler(ngx_http_request_t *r) {
+  nchan_loc_conf_t     *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  nchan_benchmark_t    *bench;
+  u_char               *idbuf, *cur;
+  size_t                idlen;
+  ngx_uint_t            i, j, serial;
+  ngx_int_t             rc;
+
+  if(r->method != NGX_HTTP_GET) {
+    return NGX_HTTP_NOT_ALLOWED;
+  }
+  if(ngx_http_discard_request_body(r) != NGX_OK) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  serial = benchmark_serial++;
+  idlen = sizeof("/nchan_benchmark...") - 1 + NGX_INT_T_LEN * 3;
+
+  if((bench = ngx_calloc(sizeof(*bench) + idlen * cf->benchmark.channels, ngx_cycle->log)) == NULL
+   || (bench->channel = ngx_calloc(sizeof(*bench->channel) * cf->benchmark.channels, ngx_cycle->log)) == NULL) {
+    nchan_log_request_error(r, "couldn't allocate benchmark");
+    if(bench) ngx_free(bench);
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  bench->msgbuf_len = ngx_max(cf->benchmark.message_size, BENCHMARK_TIMESTAMP_LEN);
+  if((bench->msgbuf = ngx_alloc(bench->msgbuf_len, ngx_cycle->log)) == NULL) {
+    nchan_log_request_error(r, "couldn't allocate benchmark message");
+    ngx_free(bench->channel);
+    ngx_free(bench);
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  ngx_memset(bench->msgbuf, 'x', bench->msgbuf_len);
+
+  if((bench->cln = ngx_http_cleanup_add(r, 0)) == NULL) {
+    nchan_log_request_error(r, "couldn't allocate benchmark request cleanup");
+    ngx_free(bench->msgbuf);
+    ngx_free(bench->channel);
+    ngx_free(bench);
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  bench->cln->data = bench;
+  bench->cln->handler = (ngx_http_cleanup_pt )benchmark_request_cleanup;
+
+  bench->r = r;
+  bench->cf = cf;
+  bench->refcount = 1;
+  bench->state = BENCHMARK_WARMUP;
+  bench->channels = cf->benchmark.channels;
+  bench->subs_per_channel = cf->benchmark.subscribers_per_channel;
+  bench->publish_interval = 60000 / cf->benchmark.messages_per_channel_per_minute;
+  if(bench->publish_interval == 0) {
+    bench->publish_interval = 1;
+  }
+  nchan_slist_init(&bench->subs, benchmark_sub_t, prev, next);
+  nchan_histogram_init(&bench->latency);
+  nchan_histogram_init(&bench->interval_latency);
+  nchan_init_timer(&bench->timer, benchmark_timer_handler, bench);
+
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_type = benchmark_content_type;
+  r->headers_out.content_length_n = -1;
+  rc = ngx_http_send_header(r);
+  if(rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    bench->cln->data = NULL;
+    ngx_free(bench->msgbuf);
+    ngx_free(bench->channel);
+    ngx_free(bench);
+    return rc;
+  }
+  r->main->count++;
+  r->read_event_handler = ngx_http_test_reading;
+
+  idbuf = (u_char *)&bench[1];
+  for(i = 0; i < bench->channels; i++) {
+    benchmark_channel_t  *ch = &bench->channel[i];
+    ch->bench = bench;
+    ch->id.data = idbuf;
+    cur = ngx_sprintf(idbuf, "/nchan_benchmark.%P.%ui.%ui", ngx_pid, serial, i);
+    ch->id.len = cur - idbuf;
+    idbuf += idlen;
+    nchan_init_timer(&ch->publish_timer, benchmark_publish_timer_handler, ch);
+  }
+
+  DBG("%p starting with %ui channels, %ui subscribers each", bench, bench->channels, bench->subs_per_channel);
+  bench->started = ngx_current_msec;
+  for(i = 0; i < bench->channels; i++) {
+    for(j = 0; j < bench->subs_per_channel; j++) {
+      if(benchmark_subscribe(bench, &bench->channel[i]) != NGX_OK) {
+        ERR("%p couldn't subscribe to %V", bench, &bench->channel[i].id);
+      }
+    }
+  }
+  ngx_add_timer(&bench->timer, 100);
+
+  return NGX_DONE;
+}
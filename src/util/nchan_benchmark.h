@@ -0,0 +1,10 @@
+#ifndef NCHAN_BENCHMARK_H
+#define NCHAN_BENCHMARK_H
+
+#define NCHAN_BENCHMARK_WARMUP_TIMEOUT 5000 //msec to wait for all the subscribers to be ready
+#define NCHAN_BENCHMARK_COOLDOWN 2000 //msec to wait for messages still in flight once publishing stops
+#define NCHAN_BENCHMARK_PROGRESS_INTERVAL 1000 //msec
+
+ngx_int_t nchan_benchmark_handler(ngx_http_request_t *r);
+
+#endif //NCHAN_BENCHMARK_H
@@ -209,6 +209,94 @@ ngx_http_request_t *nchan_create_derivative_fake_request(ngx_connection_t *c, ng
   return fr;
 }
 
+static ngx_int_t detach_str(ngx_pool_t *pool, ngx_str_t *str) {
+  u_char *data;
+  if(str->len == 0) {
+    return NGX_OK;
+  }
+  if((data = ngx_pnalloc(pool, str->len)) == NULL) {
+    return NGX_ERROR;
+  }
+  ngx_memcpy(data, str->data, str->len);
+  str->data = data;
+  return NGX_OK;
+}
+
+//a template request that doesn't depend on rsrc (or its connection) staying alive. 
+//client request headers, body, variables and module contexts are not carried over.
+ngx_http_request_t *nchan_create_detached_fake_request(ngx_http_request_t *rsrc, ngx_pool_t *pool) {
+  ngx_http_request_t         *fr;
+  ngx_http_core_main_conf_t  *cmcf;
+  
+  if((fr = ngx_palloc(pool, sizeof(*fr))) == NULL) {
+    return NULL;
+  }
+  *fr = *rsrc;
+  
+  fr->pool = pool;
+  fr->connection = NULL;
+  fr->main = fr;
+  fr->parent = NULL;
+  fr->cleanup = NULL;
+  fr->posted_requests = NULL;
+  fr->postponed = NULL;
+  fr->out = NULL;
+  fr->upstream = NULL;
+  fr->request_body = NULL;
+  fr->header_in = NULL;
+#if (NGX_HTTP_CACHE)
+  fr->cache = NULL;
+#endif
+#if (NGX_HTTP_V2)
+  fr->stream = NULL;
+#endif
+  fr->read_event_handler = empty_handler;
+  fr->write_event_handler = empty_handler;
+  fr->http_state = NGX_HTTP_PROCESS_REQUEST_STATE;
+  fr->signature = NGX_HTTP_MODULE;
+  fr->count = 1;
+  fr->subrequests = NGX_HTTP_MAX_SUBREQUESTS + 1;
+  fr->uri_changes = NGX_HTTP_MAX_URI_CHANGES + 1;
+  
+  if(rsrc->http_connection) {
+    if((fr->http_connection = ngx_palloc(pool, sizeof(*fr->http_connection))) == NULL) {
+      return NULL;
+    }
+    *fr->http_connection = *rsrc->http_connection;
+  }
+  
+  ngx_memzero(&fr->headers_in, sizeof(fr->headers_in));
+  fr->headers_in.content_length_n = 0;
+  fr->headers_in.keep_alive_n = -1;
+  ngx_memzero(&fr->headers_out, sizeof(fr->headers_out));
+  fr->headers_out.content_length_n = -1;
+  fr->headers_out.last_modified_time = -1;
+  if(ngx_list_init(&fr->headers_in.headers, pool, 1, sizeof(ngx_table_elt_t)) != NGX_OK
+   || ngx_list_init(&fr->headers_out.headers, pool, 1, sizeof(ngx_table_elt_t)) != NGX_OK) {
+    return NULL;
+  }
+  
+  if((fr->ctx = ngx_pcalloc(pool, sizeof(void *) * ngx_http_max_module)) == NULL) {
+    return NULL;
+  }
+  cmcf = ngx_http_get_module_main_conf(fr, ngx_http_core_module);
+  if((fr->variables = ngx_pcalloc(pool, cmcf->variables.nelts * sizeof(ngx_http_variable_value_t))) == NULL) {
+    return NULL;
+  }
+  
+  if(detach_str(pool, &fr->request_line) != NGX_OK
+   || detach_str(pool, &fr->uri) != NGX_OK
+   || detach_str(pool, &fr->args) != NGX_OK
+   || detach_str(pool, &fr->exten) != NGX_OK
+   || detach_str(pool, &fr->unparsed_uri) != NGX_OK
+   || detach_str(pool, &fr->method_name) != NGX_OK
+   || detach_str(pool, &fr->http_protocol) != NGX_OK) {
+    return NULL;
+  }
+  
+  return fr;
+}
+
 void nchan_finalize_fake_request(ngx_http_request_t *r, ngx_int_t rc) {
   ngx_connection_t          *c;
 #if (NGX_HTTP_SSL)
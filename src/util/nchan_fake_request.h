@@ -5,6 +5,7 @@
 #include <util/nchan_slist.h>
 
 ngx_http_request_t *nchan_create_derivative_fake_request(ngx_connection_t *c, ngx_http_request_t *rsrc);
+ngx_http_request_t *nchan_create_detached_fake_request(ngx_http_request_t *rsrc, ngx_pool_t *pool);
 void nchan_finalize_fake_request(ngx_http_request_t *r, ngx_int_t rc);
 void nchan_free_fake_request(ngx_http_request_t *r);
 
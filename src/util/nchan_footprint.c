@@ -0,0 +1,94 @@
+#include <nchan_module.h>
+#include <store/memory/store.h>
+#include "nchan_footprint.h"
+#if (NGX_LINUX)
+#include <malloc.h>
+#endif
+
+static nchan_footprint_stats_t  *worker_stats = NULL;
+
+static const char *type_name[] = {
+  [LONGPOLL] =        "longpoll",
+  [HTTP_CHUNKED] =    "chunked",
+  [HTTP_MULTIPART] =  "multipart-mixed",
+  [HTTP_RAW_STREAM] = "http-raw-stream",
+  [INTERVALPOLL] =    "intervalpoll",
+  [EVENTSOURCE] =     "eventsource",
+  [WEBSOCKET] =       "websocket"
+};
+
+size_t nchan_pool_footprint(ngx_pool_t *pool) {
+  ngx_pool_t         *p;
+  ngx_pool_large_t   *l;
+  size_t              sz = 0;
+
+  for(p = pool; p != NULL; p = p->d.next) {
+    sz += p->d.end - (u_char *)p;
+  }
+  for(l = pool->large; l != NULL; l = l->next) {
+    if(l->alloc) {
+#if (NGX_LINUX)
+      sz += malloc_usable_size(l->alloc);
+#else
+      //the pool doesn't keep their sizes, but they're all bigger than this
+      sz += pool->max;
+#endif
+    }
+  }
+  return sz;
+}
+
+void nchan_footprint_record(subscriber_t *sub, size_t extra) {
+  ngx_http_request_t   *r = sub->request;
+  size_t                sz = extra;
+
+  if(r == NULL || sub->type >= NCHAN_FOOTPRINT_TYPES) {
+    return;
+  }
+  if(worker_stats == NULL && (worker_stats = memstore_worker_footprint_stats(-1)) == NULL) {
+    return;
+  }
+  sz += nchan_pool_footprint(r->pool);
+  if(r->connection->pool && r->connection->pool != r->pool) {
+    sz += nchan_pool_footprint(r->connection->pool);
+  }
+  nchan_histogram_record(&worker_stats->type[sub->type], sz);
+}
+
+nchan_footprint_stats_t *nchan_footprint_stats_merged(void) {
+  static nchan_footprint_stats_t  merged;
+  nchan_footprint_stats_t        *stats;
+  ngx_int_t                       i, workers = memstore_worker_count();
+  int                             t;
+
+  for(t = 0; t < NCHAN_FOOTPRINT_TYPES; t++) {
+    nchan_histogram_init(&merged.type[t]);
+  }
+  for(i = 0; i < workers; i++) {
+    if((stats = memstore_worker_footprint_stats(i)) != NULL) {
+      for(t = 0; t < NCHAN_FOOTPRINT_TYPES; t++) {
+        nchan_histogram_merge(&merged.type[t], &stats->type[t]);
+      }
+    }
+  }
+  return &merged;
+}
+
+#define FOOTPRINT_STUB_STATUS_FMT "subscriber footprint %s bytes: avg %uL p50 %uL p99 %uL max %uL samples %uL\n"
+
+size_t nchan_footprint_stub_status_size(void) {
+  return NCHAN_FOOTPRINT_TYPES * (sizeof(FOOTPRINT_STUB_STATUS_FMT) + sizeof("multipart-mixed") + NGX_INT64_LEN * 5);
+}
+
+u_char *nchan_footprint_stub_status_write(u_char *cur, u_char *last) {
+  nchan_footprint_stats_t  *stats = nchan_footprint_stats_merged();
+  nchan_histogram_t        *h;
+  int                       t;
+
+  for(t = 0; t < NCHAN_FOOTPRINT_TYPES; t++) {
+    h = &stats->type[t];
+    cur = ngx_snprintf(cur, last - cur, FOOTPRINT_STUB_STATUS_FMT, type_name[t],
+                       nchan_histogram_mean(h), nchan_histogram_percentile(h, 50), nchan_histogram_percentile(h, 99), h->max, h->count);
+  }
+  return cur;
+}
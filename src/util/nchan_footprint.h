@@ -0,0 +1,27 @@
+#ifndef NCHAN_FOOTPRINT_H
+#define NCHAN_FOOTPRINT_H
+
+#include <util/nchan_histogram.h>
+
+// how much memory subscribers' connections hold on to, measured as each one goes away
+#define NCHAN_FOOTPRINT_TYPES INTERNAL //internal subscribers have no connection of their own to measure
+#define NCHAN_FOOTPRINT_INFLATE_STATE 7168 //zlib's inflate state, without its window. "about 7 KB", says zconf.h
+
+// one per worker, in shared memory
+typedef struct {
+  nchan_histogram_t           type[NCHAN_FOOTPRINT_TYPES]; //bytes, by subscriber_type_t
+} nchan_footprint_stats_t;
+
+// all the memory in a pool's blocks and large allocations
+size_t nchan_pool_footprint(ngx_pool_t *pool);
+
+// record a subscriber's footprint: its request and connection pools, plus extra for whatever it allocated outside of them
+void nchan_footprint_record(subscriber_t *sub, size_t extra);
+
+// all the workers' footprints, added up
+nchan_footprint_stats_t *nchan_footprint_stats_merged(void);
+
+size_t nchan_footprint_stub_status_size(void);
+u_char *nchan_footprint_stub_status_write(u_char *cur, u_char *last);
+
+#endif //NCHAN_FOOTPRINT_H
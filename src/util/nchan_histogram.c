@@ -0,0 +1,96 @@
+#include <nchan_module.h>
+#include "nchan_histogram.h"
+
+#define HISTOGRAM_MAX_VALUE ((((uint64_t )1) << NCHAN_HISTOGRAM_MAX_BITS) - 1)
+
+static ngx_uint_t histogram_bucket_index(uint64_t val) {
+  ngx_uint_t    msb = NCHAN_HISTOGRAM_SUB_BUCKET_BITS;
+  
+  if(val < 2 * NCHAN_HISTOGRAM_SUB_BUCKETS) {
+    return (ngx_uint_t )val;
+  }
+  if(val > HISTOGRAM_MAX_VALUE) {
+    val = HISTOGRAM_MAX_VALUE;
+  }
+  while(val >> (msb + 1)) {
+    msb++;
+  }
+  //the top SUB_BUCKET_BITS bits under the most significant one pick the sub-bucket
+  return (msb - NCHAN_HISTOGRAM_SUB_BUCKET_BITS + 1) * NCHAN_HISTOGRAM_SUB_BUCKETS + ((val >> (msb - NCHAN_HISTOGRAM_SUB_BUCKET_BITS)) & (NCHAN_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+//the middle of the range of values that land in the bucket
+static uint64_t histogram_bucket_value(ngx_uint_t idx) {
+  ngx_uint_t    shift;
+  uint64_t      lowest;
+  
+  if(idx < 2 * NCHAN_HISTOGRAM_SUB_BUCKETS) {
+    return idx;
+  }
+  shift = idx / NCHAN_HISTOGRAM_SUB_BUCKETS - 1;
+  lowest = ((uint64_t )(NCHAN_HISTOGRAM_SUB_BUCKETS + idx % NCHAN_HISTOGRAM_SUB_BUCKETS)) << shift;
+  return lowest + ((((uint64_t )1) << shift) >> 1);
+}
+
+void nchan_histogram_init(nchan_histogram_t *h) {
+  ngx_memzero(h, sizeof(*h));
+}
+
+void nchan_histogram_record(nchan_histogram_t *h, uint64_t val) {
+  if(h->count == 0 || val < h->min) {
+    h->min = val;
+  }
+  if(val > h->max) {
+    h->max = val;
+  }
+  h->count++;
+  h->sum += val;
+  h->bucket[histogram_bucket_index(val)]++;
+}
+
+void nchan_histogram_merge(nchan_histogram_t *dst, nchan_histogram_t *src) {
+  ngx_uint_t    i;
+  if(src->count == 0) {
+    return;
+  }
+  if(dst->count == 0 || src->min < dst->min) {
+    dst->min = src->min;
+  }
+  if(src->max > dst->max) {
+    dst->max = src->max;
+  }
+  dst->count += src->count;
+  dst->sum += src->sum;
+  for(i = 0; i < NCHAN_HISTOGRAM_BUCKETS; i++) {
+    dst->bucket[i] += src->bucket[i];
+  }
+}
+
+uint64_t nchan_histogram_percentile(nchan_histogram_t *h, double percentile) {
+  uint64_t      want, seen = 0, val;
+  ngx_uint_t    i;
+  
+  if(h->count == 0) {
+    return 0;
+  }
+  if(percentile >= 100) {
+    return h->max;
+  }
+  want = (uint64_t )((percentile / 100.0) * (double )h->count + 0.5);
+  if(want == 0) {
+    want = 1;
+  }
+  for(i = 0; i < NCHAN_HISTOGRAM_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if(seen >= want) {
+      val = histogram_bucket_value(i);
+      //the exact extremes are known, no need to be approximate about them
+      return val < h->min ? h->min : (val > h->max ? h->max : val);
+    }
+  }
+  return h->max;
+}
+
+uint64_t nchan_histogram_mean(nchan_histogram_t *h) {
+  return h->count == 0 ? 0 : h->sum / h->count;
+}
@@ -0,0 +1,28 @@
+#ifndef NCHAN_HISTOGRAM_H
+#define NCHAN_HISTOGRAM_H
+
+// log-linear histogram: values below 2^NCHAN_HISTOGRAM_SUB_BUCKET_BITS+1 get a bucket each, and every
+// power of 2 above that is split into 2^NCHAN_HISTOGRAM_SUB_BUCKET_BITS buckets. That's about 3% precision.
+#define NCHAN_HISTOGRAM_SUB_BUCKET_BITS 5
+#define NCHAN_HISTOGRAM_SUB_BUCKETS (1 << NCHAN_HISTOGRAM_SUB_BUCKET_BITS)
+#define NCHAN_HISTOGRAM_MAX_BITS 36 //values (usually usec) up to about 19 hours. larger ones count as the max.
+#define NCHAN_HISTOGRAM_BUCKETS (NCHAN_HISTOGRAM_SUB_BUCKETS * (NCHAN_HISTOGRAM_MAX_BITS - NCHAN_HISTOGRAM_SUB_BUCKET_BITS + 1))
+
+//plain data, no pointers. can live in shared memory.
+typedef struct {
+  uint64_t                    count;
+  uint64_t                    sum;
+  uint64_t                    min;
+  uint64_t                    max;
+  uint64_t                    bucket[NCHAN_HISTOGRAM_BUCKETS];
+} nchan_histogram_t;
+
+void nchan_histogram_init(nchan_histogram_t *h);
+void nchan_histogram_record(nchan_histogram_t *h, uint64_t val);
+void nchan_histogram_merge(nchan_histogram_t *dst, nchan_histogram_t *src);
+
+// percentile between 0 and 100. 0 if the histogram is empty
+uint64_t nchan_histogram_percentile(nchan_histogram_t *h, double percentile);
+uint64_t nchan_histogram_mean(nchan_histogram_t *h);
+
+#endif //NCHAN_HISTOGRAM_H
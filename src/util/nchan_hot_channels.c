@@ -0,0 +1,326 @@
+#include <nchan_module.h>
+#include <store/memory/store.h>
+#include "nchan_hot_channels.h"
+
+// Each worker counts what it sees in a count-min sketch, and keeps the channels with the highest
+// estimates in a small min-heap. The sketch and heaps are cleared every window, and the last window's
+// heaps are kept to estimate a rate over a sliding window. Readers in other workers copy the heaps
+// without locking, and retry if the worker was writing at the time.
+
+static time_t                  window = NCHAN_DEFAULT_HOT_CHANNELS_WINDOW;
+static nchan_hot_channels_t   *worker_hot = NULL;
+
+static const char *metric_name[] = {
+  [NCHAN_HOT_PUBLISHES] =  "publishes",
+  [NCHAN_HOT_BYTES] =      "bytes",
+  [NCHAN_HOT_SUBSCRIBES] = "subscribes",
+  [NCHAN_HOT_FANOUT] =     "fanout"
+};
+
+typedef struct {
+  uint32_t                h1;
+  uint32_t                h2;
+  uint64_t                hash;
+} hot_hash_t;
+
+typedef struct {
+  uint64_t                hash;
+  double                  count;
+  nchan_hot_channel_t    *chan;
+} hot_merge_t;
+
+void nchan_hot_channels_set_window(time_t w) {
+  window = w;
+}
+
+time_t nchan_hot_channels_window(void) {
+  return window;
+}
+
+const char *nchan_hot_channels_metric_name(nchan_hot_metric_t metric) {
+  return metric_name[metric];
+}
+
+static nchan_hot_channels_t *my_hot_channels(void) {
+  if(worker_hot == NULL) {
+    worker_hot = memstore_worker_hot_channels(-1);
+  }
+  return worker_hot;
+}
+
+static void hot_hash(ngx_str_t *id, hot_hash_t *h) {
+  h->h1 = ngx_crc32_long(id->data, id->len);
+  h->h2 = ngx_murmur_hash2(id->data, id->len) | 1; //odd, so the rows never all land in the same column
+  h->hash = ((uint64_t )h->h1 << 32) | h->h2;
+}
+
+static void hot_rotate(nchan_hot_channels_t *hc, time_t now) {
+  time_t    elapsed = now - hc->window_start;
+  if(elapsed >= 0 && elapsed < window) {
+    return;
+  }
+  if(elapsed >= window && elapsed < window * 2) {
+    ngx_memcpy(hc->previous, hc->current, sizeof(hc->current));
+    hc->window_start += window;
+  }
+  else {
+    //nothing happened for a whole window (or the clock jumped)
+    ngx_memzero(hc->previous, sizeof(hc->previous));
+    hc->window_start = now;
+  }
+  ngx_memzero(hc->current, sizeof(hc->current));
+  ngx_memzero(hc->sketch, sizeof(hc->sketch));
+}
+
+static void heap_sift_down(nchan_hot_top_t *top, ngx_uint_t i) {
+  nchan_hot_channel_t   tmp;
+  ngx_uint_t            l, r, min;
+  while(1) {
+    l = i * 2 + 1;
+    r = l + 1;
+    min = i;
+    if(l < top->n && top->heap[l].count < top->heap[min].count) {
+      min = l;
+    }
+    if(r < top->n && top->heap[r].count < top->heap[min].count) {
+      min = r;
+    }
+    if(min == i) {
+      return;
+    }
+    tmp = top->heap[i];
+    top->heap[i] = top->heap[min];
+    top->heap[min] = tmp;
+    i = min;
+  }
+}
+
+static void heap_sift_up(nchan_hot_top_t *top, ngx_uint_t i) {
+  nchan_hot_channel_t   tmp;
+  ngx_uint_t            parent;
+  while(i > 0) {
+    parent = (i - 1) / 2;
+    if(top->heap[parent].count <= top->heap[i].count) {
+      return;
+    }
+    tmp = top->heap[i];
+    top->heap[i] = top->heap[parent];
+    top->heap[parent] = tmp;
+    i = parent;
+  }
+}
+
+static void heap_entry_set(nchan_hot_channel_t *chan, hot_hash_t *h, ngx_str_t *id, uint64_t count) {
+  chan->hash = h->hash;
+  chan->count = count;
+  chan->truncated = id->len > NCHAN_HOT_CHANNELS_ID_MAX;
+  chan->id_len = chan->truncated ? NCHAN_HOT_CHANNELS_ID_MAX : id->len;
+  ngx_memcpy(chan->id, id->data, chan->id_len);
+}
+
+static void hot_record(nchan_hot_channels_t *hc, nchan_hot_metric_t metric, hot_hash_t *h, ngx_str_t *id, uint64_t n) {
+  uint64_t            (*rows)[NCHAN_HOT_CHANNELS_SKETCH_WIDTH] = hc->sketch[metric];
+  nchan_hot_top_t      *top = &hc->current[metric];
+  uint64_t             *cell[NCHAN_HOT_CHANNELS_SKETCH_DEPTH];
+  uint64_t              estimate = UINT64_MAX;
+  ngx_uint_t            i;
+
+  for(i = 0; i < NCHAN_HOT_CHANNELS_SKETCH_DEPTH; i++) {
+    cell[i] = &rows[i][(h->h1 + i * h->h2) % NCHAN_HOT_CHANNELS_SKETCH_WIDTH];
+    if(*cell[i] < estimate) {
+      estimate = *cell[i];
+    }
+  }
+  estimate += n;
+  //conservative update: only raise the counters that are below the new estimate
+  for(i = 0; i < NCHAN_HOT_CHANNELS_SKETCH_DEPTH; i++) {
+    if(*cell[i] < estimate) {
+      *cell[i] = estimate;
+    }
+  }
+
+  for(i = 0; i < top->n; i++) {
+    if(top->heap[i].hash == h->hash) {
+      //estimates only go up within a window
+      top->heap[i].count = estimate;
+      heap_sift_down(top, i);
+      return;
+    }
+  }
+  if(top->n < NCHAN_HOT_CHANNELS_TOP) {
+    heap_entry_set(&top->heap[top->n], h, id, estimate);
+    heap_sift_up(top, top->n++);
+  }
+  else if(estimate > top->heap[0].count) {
+    heap_entry_set(&top->heap[0], h, id, estimate);
+    heap_sift_down(top, 0);
+  }
+}
+
+static nchan_hot_channels_t *hot_write_start(void) {
+  nchan_hot_channels_t  *hc;
+  if(window <= 0 || (hc = my_hot_channels()) == NULL) {
+    return NULL;
+  }
+  hc->version++;
+  ngx_memory_barrier();
+  hot_rotate(hc, ngx_time());
+  return hc;
+}
+
+static void hot_write_finish(nchan_hot_channels_t *hc) {
+  ngx_memory_barrier();
+  hc->version++;
+}
+
+void nchan_hot_channels_record(ngx_str_t *channel_id, nchan_hot_metric_t metric, uint64_t n) {
+  nchan_hot_channels_t  *hc;
+  hot_hash_t             h;
+  if(n == 0 || (hc = hot_write_start()) == NULL) {
+    return;
+  }
+  hot_hash(channel_id, &h);
+  hot_record(hc, metric, &h, channel_id, n);
+  hot_write_finish(hc);
+}
+
+void nchan_hot_channels_record_publish(ngx_str_t *channel_id, size_t bytes) {
+  nchan_hot_channels_t  *hc;
+  hot_hash_t             h;
+  if((hc = hot_write_start()) == NULL) {
+    return;
+  }
+  hot_hash(channel_id, &h);
+  hot_record(hc, NCHAN_HOT_PUBLISHES, &h, channel_id, 1);
+  if(bytes > 0) {
+    hot_record(hc, NCHAN_HOT_BYTES, &h, channel_id, bytes);
+  }
+  hot_write_finish(hc);
+}
+
+#define HOT_SNAPSHOT_TRIES 1000
+
+static ngx_int_t hot_snapshot(nchan_hot_channels_t *hc, nchan_hot_metric_t metric, nchan_hot_top_t *cur, nchan_hot_top_t *prev, time_t *start) {
+  ngx_atomic_uint_t   version;
+  ngx_uint_t          i;
+  for(i = 0; i < HOT_SNAPSHOT_TRIES; i++) {
+    version = hc->version;
+    if(version & 1) {
+      ngx_cpu_pause();
+      continue;
+    }
+    ngx_memory_barrier();
+    *cur = hc->current[metric];
+    *prev = hc->previous[metric];
+    *start = hc->window_start;
+    ngx_memory_barrier();
+    if(hc->version == version) {
+      return NGX_OK;
+    }
+  }
+  return NGX_ERROR;
+}
+
+static ngx_int_t hot_merge_add(ngx_array_t *merged, nchan_hot_top_t *top, double weight) {
+  hot_merge_t    *m;
+  ngx_uint_t      i;
+  if(weight <= 0) {
+    return NGX_OK;
+  }
+  for(i = 0; i < top->n; i++) {
+    if((m = ngx_array_push(merged)) == NULL) {
+      return NGX_ERROR;
+    }
+    m->hash = top->heap[i].hash;
+    m->count = top->heap[i].count * weight;
+    m->chan = &top->heap[i];
+  }
+  return NGX_OK;
+}
+
+static int hot_merge_hash_cmp(const void *a, const void *b) {
+  const hot_merge_t *ma = a, *mb = b;
+  return ma->hash < mb->hash ? -1 : ma->hash > mb->hash ? 1 : 0;
+}
+
+static int hot_merge_count_cmp(const void *a, const void *b) {
+  const hot_merge_t *ma = a, *mb = b;
+  return ma->count > mb->count ? -1 : ma->count < mb->count ? 1 : 0;
+}
+
+ngx_uint_t nchan_hot_channels_top(nchan_hot_metric_t metric, nchan_hot_channel_rate_t *out, ngx_uint_t max, ngx_pool_t *pool) {
+  ngx_int_t              i, workers = memstore_worker_count();
+  ngx_array_t           *merged;
+  nchan_hot_channels_t  *hc;
+  nchan_hot_top_t       *tops;
+  hot_merge_t           *m;
+  time_t                 start, elapsed, now = ngx_time();
+  ngx_uint_t             j, n;
+
+  if(window <= 0 || workers == 0) {
+    return 0;
+  }
+  if((merged = ngx_array_create(pool, 2 * NCHAN_HOT_CHANNELS_TOP, sizeof(hot_merge_t))) == NULL) {
+    return 0;
+  }
+
+  for(i = 0; i < workers; i++) {
+    if((hc = memstore_worker_hot_channels(i)) == NULL) {
+      continue;
+    }
+    if((tops = ngx_palloc(pool, sizeof(*tops) * 2)) == NULL) {
+      return 0;
+    }
+    if(hot_snapshot(hc, metric, &tops[0], &tops[1], &start) != NGX_OK) {
+      continue;
+    }
+    elapsed = now - start;
+    if(elapsed < 0 || elapsed >= window * 2) {
+      continue;
+    }
+    if(elapsed < window) {
+      //the current window, and the part of the previous one still inside the sliding window
+      if(hot_merge_add(merged, &tops[0], 1) != NGX_OK
+       || hot_merge_add(merged, &tops[1], 1 - (double )elapsed / window) != NGX_OK) {
+        return 0;
+      }
+    }
+    else {
+      //the worker hasn't rotated since, so its current window is really the previous one
+      if(hot_merge_add(merged, &tops[0], 1 - (double )(elapsed - window) / window) != NGX_OK) {
+        return 0;
+      }
+    }
+  }
+  if(merged->nelts == 0) {
+    return 0;
+  }
+
+  //add up the same channel's counts from all the workers and windows
+  m = merged->elts;
+  ngx_qsort(m, merged->nelts, sizeof(*m), hot_merge_hash_cmp);
+  for(j = 1, n = 0; j < merged->nelts; j++) {
+    if(m[j].hash == m[n].hash) {
+      m[n].count += m[j].count;
+    }
+    else {
+      m[++n] = m[j];
+    }
+  }
+  n++;
+  ngx_qsort(m, n, sizeof(*m), hot_merge_count_cmp);
+
+  if(n > max) {
+    n = max;
+  }
+  for(j = 0; j < n; j++) {
+    out[j].id.len = m[j].chan->id_len;
+    if((out[j].id.data = ngx_pnalloc(pool, out[j].id.len)) == NULL) {
+      return j;
+    }
+    ngx_memcpy(out[j].id.data, m[j].chan->id, out[j].id.len);
+    out[j].truncated = m[j].chan->truncated;
+    out[j].rate = m[j].count / window;
+  }
+  return n;
+}
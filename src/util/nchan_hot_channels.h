@@ -0,0 +1,59 @@
+#ifndef NCHAN_HOT_CHANNELS_H
+#define NCHAN_HOT_CHANNELS_H
+
+// the busiest channels, found with a count-min sketch and a top-k heap per worker in shared memory
+
+#define NCHAN_HOT_CHANNELS_TOP 16
+#define NCHAN_HOT_CHANNELS_SKETCH_DEPTH 4
+#define NCHAN_HOT_CHANNELS_SKETCH_WIDTH 512
+#define NCHAN_HOT_CHANNELS_ID_MAX 128 //longer channel ids are truncated
+
+typedef enum {
+  NCHAN_HOT_PUBLISHES,    //messages published
+  NCHAN_HOT_BYTES,        //message bytes published
+  NCHAN_HOT_SUBSCRIBES,   //subscribers added
+  NCHAN_HOT_FANOUT,       //messages times the subscribers they were sent to
+  NCHAN_HOT_METRICS
+} nchan_hot_metric_t;
+
+typedef struct {
+  uint64_t                hash;
+  uint64_t                count;
+  uint16_t                id_len;
+  unsigned                truncated:1;
+  u_char                  id[NCHAN_HOT_CHANNELS_ID_MAX];
+} nchan_hot_channel_t;
+
+typedef struct {
+  nchan_hot_channel_t     heap[NCHAN_HOT_CHANNELS_TOP]; //min-heap by count
+  ngx_uint_t              n;
+} nchan_hot_top_t;
+
+// one per worker, in shared memory. Only its own worker writes to it.
+typedef struct {
+  ngx_atomic_t            version; //odd while it's being written
+  time_t                  window_start;
+  nchan_hot_top_t         current[NCHAN_HOT_METRICS];
+  nchan_hot_top_t         previous[NCHAN_HOT_METRICS];
+  uint64_t                sketch[NCHAN_HOT_METRICS][NCHAN_HOT_CHANNELS_SKETCH_DEPTH][NCHAN_HOT_CHANNELS_SKETCH_WIDTH];
+} nchan_hot_channels_t;
+
+typedef struct {
+  ngx_str_t               id;
+  unsigned                truncated:1;
+  double                  rate; //per second, over the sliding window
+} nchan_hot_channel_rate_t;
+
+// sliding window length. 0 to stop tracking
+void nchan_hot_channels_set_window(time_t window);
+time_t nchan_hot_channels_window(void);
+
+void nchan_hot_channels_record(ngx_str_t *channel_id, nchan_hot_metric_t metric, uint64_t n);
+void nchan_hot_channels_record_publish(ngx_str_t *channel_id, size_t bytes);
+
+// the hottest channels across all workers, hottest first. ids are allocated from the pool.
+// returns the number of channels written to out
+ngx_uint_t nchan_hot_channels_top(nchan_hot_metric_t metric, nchan_hot_channel_rate_t *out, ngx_uint_t max, ngx_pool_t *pool);
+const char *nchan_hot_channels_metric_name(nchan_hot_metric_t metric);
+
+#endif //NCHAN_HOT_CHANNELS_H
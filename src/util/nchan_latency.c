@@ -0,0 +1,108 @@
+#include <nchan_module.h>
+#include <store/memory/store.h>
+#include "nchan_latency.h"
+
+static ngx_int_t               sampling = NCHAN_DEFAULT_LATENCY_SAMPLING;
+static ngx_uint_t              sample_counter = 0;
+static nchan_latency_stats_t  *worker_stats = NULL;
+
+static ngx_str_t stage_name[] = {
+  [NCHAN_LATENCY_PUBLISH_STORED] = ngx_string("publish_stored"),
+  [NCHAN_LATENCY_PUBLISH_IPC] =    ngx_string("publish_ipc"),
+  [NCHAN_LATENCY_DELIVERY_FIRST] = ngx_string("delivery_first"),
+  [NCHAN_LATENCY_DELIVERY_LAST] =  ngx_string("delivery_last")
+};
+
+void nchan_latency_set_sampling(ngx_int_t n) {
+  sampling = n;
+}
+
+static uint64_t latency_now_usec(void) {
+  struct timeval    tv;
+  ngx_gettimeofday(&tv);
+  return (uint64_t )tv.tv_sec * 1000000 + (uint64_t )tv.tv_usec;
+}
+
+uint64_t nchan_latency_sample_start(void) {
+  if(sampling <= 0) {
+    return 0;
+  }
+  if(sampling > 1 && (sample_counter++ % sampling) != 0) {
+    return 0;
+  }
+  return latency_now_usec();
+}
+
+void nchan_latency_record(nchan_latency_stage_t stage, uint64_t start) {
+  uint64_t     now;
+  if(start == 0) {
+    return;
+  }
+  if(worker_stats == NULL && (worker_stats = memstore_worker_latency_stats(-1)) == NULL) {
+    return;
+  }
+  now = latency_now_usec();
+  //clocks can go backwards
+  nchan_histogram_record(&worker_stats->stage[stage], now > start ? now - start : 0);
+}
+
+nchan_latency_stats_t *nchan_latency_stats_merged(void) {
+  static nchan_latency_stats_t  merged;
+  nchan_latency_stats_t        *stats;
+  ngx_int_t                     i, workers = memstore_worker_count();
+  int                           s;
+  
+  for(s = 0; s < NCHAN_LATENCY_STAGES; s++) {
+    nchan_histogram_init(&merged.stage[s]);
+  }
+  for(i = 0; i < workers; i++) {
+    if((stats = memstore_worker_latency_stats(i)) != NULL) {
+      for(s = 0; s < NCHAN_LATENCY_STAGES; s++) {
+        nchan_histogram_merge(&merged.stage[s], &stats->stage[s]);
+      }
+    }
+  }
+  return &merged;
+}
+
+uint64_t nchan_latency_stat(nchan_histogram_t *h, nchan_latency_stat_t stat) {
+  switch(stat) {
+    case NCHAN_LATENCY_AVG:
+      return nchan_histogram_mean(h);
+    case NCHAN_LATENCY_P50:
+      return nchan_histogram_percentile(h, 50);
+    case NCHAN_LATENCY_P90:
+      return nchan_histogram_percentile(h, 90);
+    case NCHAN_LATENCY_P99:
+      return nchan_histogram_percentile(h, 99);
+    case NCHAN_LATENCY_MAX:
+      return h->max;
+    case NCHAN_LATENCY_SAMPLES:
+      return h->count;
+  }
+  return 0;
+}
+
+ngx_str_t *nchan_latency_stage_name(nchan_latency_stage_t stage) {
+  return &stage_name[stage];
+}
+
+#define LATENCY_STUB_STATUS_FMT "latency %V usec: avg %uL p50 %uL p90 %uL p99 %uL max %uL samples %uL\n"
+
+size_t nchan_latency_stub_status_size(void) {
+  return NCHAN_LATENCY_STAGES * (sizeof(LATENCY_STUB_STATUS_FMT) + sizeof("delivery_first") + NGX_INT64_LEN * 6);
+}
+
+u_char *nchan_latency_stub_status_write(u_char *cur, u_char *last) {
+  nchan_latency_stats_t  *stats = nchan_latency_stats_merged();
+  nchan_histogram_t      *h;
+  int                     s;
+  
+  for(s = 0; s < NCHAN_LATENCY_STAGES; s++) {
+    h = &stats->stage[s];
+    cur = ngx_snprintf(cur, last - cur, LATENCY_STUB_STATUS_FMT, &stage_name[s],
+                       nchan_histogram_mean(h), nchan_histogram_percentile(h, 50), nchan_histogram_percentile(h, 90),
+                       nchan_histogram_percentile(h, 99), h->max, h->count);
+  }
+  return cur;
+}
@@ -0,0 +1,41 @@
+#ifndef NCHAN_LATENCY_H
+#define NCHAN_LATENCY_H
+
+#include <util/nchan_histogram.h>
+
+// publish-to-delivery latency, measured from when a published message is accepted
+typedef enum {
+  NCHAN_LATENCY_PUBLISH_STORED,   //the store is done with it, and the publisher can get a response
+  NCHAN_LATENCY_PUBLISH_IPC,      //it has reached the channel owner's worker, when that's another worker
+  NCHAN_LATENCY_DELIVERY_FIRST,   //the first subscriber in a worker has been sent the message
+  NCHAN_LATENCY_DELIVERY_LAST,    //all the subscribers in a worker have been sent the message
+  NCHAN_LATENCY_STAGES
+} nchan_latency_stage_t;
+
+typedef enum {
+  NCHAN_LATENCY_AVG, NCHAN_LATENCY_P50, NCHAN_LATENCY_P90, NCHAN_LATENCY_P99, NCHAN_LATENCY_MAX, NCHAN_LATENCY_SAMPLES
+} nchan_latency_stat_t;
+
+// one per worker, in shared memory
+typedef struct {
+  nchan_histogram_t           stage[NCHAN_LATENCY_STAGES];
+} nchan_latency_stats_t;
+
+// sample 1 in every n published messages. 0 for none
+void nchan_latency_set_sampling(ngx_int_t n);
+
+// the start time (usec) to stamp on a published message, or 0 if it's not sampled
+uint64_t nchan_latency_sample_start(void);
+
+// record the latency since start for this worker. does nothing if start is 0
+void nchan_latency_record(nchan_latency_stage_t stage, uint64_t start);
+
+// all the workers' latencies, added up
+nchan_latency_stats_t *nchan_latency_stats_merged(void);
+uint64_t nchan_latency_stat(nchan_histogram_t *h, nchan_latency_stat_t stat);
+ngx_str_t *nchan_latency_stage_name(nchan_latency_stage_t stage);
+
+size_t nchan_latency_stub_status_size(void);
+u_char *nchan_latency_stub_status_write(u_char *cur, u_char *last);
+
+#endif //NCHAN_LATENCY_H
@@ -0,0 +1,643 @@
+#include <nchan_module.h>
+#include <store/memory/store.h>
+#include <util/shmem.h>
+#include <store/redis/store.h>
+#include <store/redis/redis_msg_cache.h>
+#include <util/nchan_latency.h>
+#include <util/nchan_hot_channels.h>
+#include <util/nchan_stall.h>
+#include <util/nchan_footprint.h>
+#include "nchan_metrics.h"
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "METRICS: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "METRICS: " fmt, ##args)
+
+// The global counters are the same ones nchan_stub_status shows as text. Per-worker counters come from
+// each worker's own slot in shared memory, and the groups from the memory store's list of all groups.
+// Redis node state is, like in the text output, as seen by the worker that got the request.
+
+#define METRICS_BUF_SIZE 16384
+#define METRICS_LINE_MAX 1024 //longest line written with out_printf
+#define METRICS_SLAB_SLOTS_MAX 32
+
+static ngx_str_t  json_content_type = ngx_string("application/json");
+static ngx_str_t  openmetrics_content_type = ngx_string("application/openmetrics-text; version=1.0.0; charset=utf-8");
+
+static const char *subscriber_type_name[] = {
+  [LONGPOLL] =        "longpoll",
+  [HTTP_CHUNKED] =    "chunked",
+  [HTTP_MULTIPART] =  "multipart-mixed",
+  [HTTP_RAW_STREAM] = "http-raw-stream",
+  [INTERVALPOLL] =    "intervalpoll",
+  [EVENTSOURCE] =     "eventsource",
+  [WEBSOCKET] =       "websocket",
+  [INTERNAL] =        "internal"
+};
+
+typedef struct {
+  ngx_http_request_t     *r;
+  ngx_chain_t            *first;
+  ngx_chain_t            *last;
+  ngx_buf_t              *buf;
+  unsigned                nomem:1;
+} metrics_out_t;
+
+typedef struct {
+  nchan_main_conf_t      *mcf;
+  nchan_stub_status_t    *stats;
+  ngx_array_t            *groups; //nchan_group_t copies, names in the request pool
+  ngx_array_t            *nodes; //redis_node_stats_t copies
+#if nginx_version > 1011006
+  shm_slab_slot_stats_t   slab[METRICS_SLAB_SLOTS_MAX];
+  shm_page_stats_t        pages;
+#endif
+  ngx_uint_t              slab_slots;
+  struct {
+    ngx_atomic_uint_t       sweeps;
+    ngx_atomic_uint_t       moved;
+    ngx_atomic_uint_t       bytes;
+  }                       compaction; //all workers' memstore_worker_stats_t compaction counters
+  struct {
+    unsigned                enabled:1;
+    size_t                  size;
+    ngx_atomic_uint_t       entries;
+    ngx_atomic_uint_t       hits;
+    ngx_atomic_uint_t       misses;
+  }                       msg_cache; //nchan_redis_message_cache_size
+  nchan_hot_channel_rate_t hot[NCHAN_HOT_METRICS][NCHAN_HOT_CHANNELS_TOP];
+  ngx_uint_t              hot_n[NCHAN_HOT_METRICS];
+} metrics_data_t;
+
+static ngx_int_t out_reserve(metrics_out_t *out, size_t sz) {
+  ngx_chain_t   *cl;
+  ngx_buf_t     *b;
+
+  if(out->nomem) {
+    return NGX_ERROR;
+  }
+  if(out->buf && (size_t )(out->buf->end - out->buf->last) >= sz) {
+    return NGX_OK;
+  }
+  if(sz < METRICS_BUF_SIZE) {
+    sz = METRICS_BUF_SIZE;
+  }
+  if((cl = ngx_alloc_chain_link(out->r->pool)) == NULL || (b = ngx_create_temp_buf(out->r->pool, sz)) == NULL) {
+    out->nomem = 1;
+    return NGX_ERROR;
+  }
+  cl->buf = b;
+  cl->next = NULL;
+  if(out->last) {
+    out->last->next = cl;
+  }
+  else {
+    out->first = cl;
+  }
+  out->last = cl;
+  out->buf = b;
+  return NGX_OK;
+}
+
+static void out_printf(metrics_out_t *out, const char *fmt, ...) {
+  va_list   args;
+  if(out_reserve(out, METRICS_LINE_MAX) != NGX_OK) {
+    return;
+  }
+  va_start(args, fmt);
+  out->buf->last = ngx_vslprintf(out->buf->last, out->buf->end, fmt, args);
+  va_end(args);
+}
+
+//a quoted string, escaped for json or for openmetrics label values
+static void out_quoted(metrics_out_t *out, ngx_str_t *str, int json) {
+  u_char     *dst, c;
+  size_t      i;
+  if(out_reserve(out, str->len * 6 + 2) != NGX_OK) {
+    return;
+  }
+  dst = out->buf->last;
+  *dst++ = '"';
+  for(i = 0; i < str->len; i++) {
+    c = str->data[i];
+    switch(c) {
+      case '"':
+      case '\\':
+        *dst++ = '\\';
+        *dst++ = c;
+        break;
+      case '\n':
+        *dst++ = '\\';
+        *dst++ = 'n';
+        break;
+      default:
+        if(json && c < 0x20) {
+          dst = ngx_sprintf(dst, "\\u%04xd", (int )c);
+        }
+        else {
+          *dst++ = c;
+        }
+    }
+  }
+  *dst++ = '"';
+  out->buf->last = dst;
+}
+
+static void collect_group(nchan_group_t *group, void *pd) {
+  ngx_array_t    *groups = pd;
+  nchan_group_t  *cpy;
+  if((cpy = ngx_array_push(groups)) == NULL) {
+    return;
+  }
+  *cpy = *group;
+  cpy->prev = cpy->next = NULL;
+  if((cpy->name.data = ngx_pnalloc(groups->pool, group->name.len)) == NULL) {
+    cpy->name.len = 0;
+    return;
+  }
+  ngx_memcpy(cpy->name.data, group->name.data, group->name.len);
+}
+
+static void collect_redis_node(redis_node_stats_t *node, void *pd) {
+  ngx_array_t         *nodes = pd;
+  redis_node_stats_t  *cpy;
+  size_t               len = ngx_strlen(node->address);
+  if((cpy = ngx_array_push(nodes)) == NULL) {
+    return;
+  }
+  *cpy = *node;
+  //the address is in a static buffer
+  if((cpy->address = ngx_pnalloc(nodes->pool, len + 1)) == NULL) {
+    cpy->address = "";
+    return;
+  }
+  ngx_memcpy((u_char *)cpy->address, node->address, len + 1);
+}
+
+static ngx_int_t metrics_collect(ngx_http_request_t *r, metrics_data_t *d) {
+  int                       m;
+  ngx_int_t                 i, workers = memstore_worker_count();
+  memstore_worker_stats_t  *ws;
+  d->mcf = ngx_http_get_module_main_conf(r, ngx_nchan_module);
+  d->stats = nchan_get_stub_status_stats();
+  if((d->groups = ngx_array_create(r->pool, 8, sizeof(nchan_group_t))) == NULL) {
+    return NGX_ERROR;
+  }
+  if((d->nodes = ngx_array_create(r->pool, 4, sizeof(redis_node_stats_t))) == NULL) {
+    return NGX_ERROR;
+  }
+  memstore_groups_each(collect_group, d->groups);
+  redis_store_node_stats_each(collect_redis_node, d->nodes);
+#if nginx_version > 1011006
+  d->slab_slots = shm_slab_stats(nchan_store_memory_shmem, d->slab, METRICS_SLAB_SLOTS_MAX, &d->pages);
+#else
+  d->slab_slots = 0;
+#endif
+  ngx_memzero(&d->compaction, sizeof(d->compaction));
+  for(i = 0; i < workers; i++) {
+    if((ws = memstore_worker_stats(i)) != NULL) {
+      d->compaction.sweeps += ws->compaction.sweeps;
+      d->compaction.moved += ws->compaction.messages;
+      d->compaction.bytes += ws->compaction.bytes;
+    }
+  }
+  d->msg_cache.enabled = redis_msg_cache_stats(&d->msg_cache.size, &d->msg_cache.entries, &d->msg_cache.hits, &d->msg_cache.misses) == NGX_OK;
+  for(m = 0; m < NCHAN_HOT_METRICS; m++) {
+    d->hot_n[m] = nchan_hot_channels_top(m, d->hot[m], NCHAN_HOT_CHANNELS_TOP, r->pool);
+  }
+  return NGX_OK;
+}
+
+static const char *reaper_name[] = {"msg", "nobuffer_msg", "chanhead", "chanhead_churner"};
+
+static ngx_atomic_uint_t worker_reaper_count(memstore_worker_stats_t *ws, int i) {
+  switch(i) {
+    case 0:
+      return ws->reaper.msg;
+    case 1:
+      return ws->reaper.nobuffer_msg;
+    case 2:
+      return ws->reaper.chanhead;
+    default:
+      return ws->reaper.chanhead_churner;
+  }
+}
+
+#define REAPERS (sizeof(reaper_name)/sizeof(*reaper_name))
+
+static const char *latency_stat_name[] = {
+  [NCHAN_LATENCY_AVG] = "avg",
+  [NCHAN_LATENCY_P50] = "p50",
+  [NCHAN_LATENCY_P90] = "p90",
+  [NCHAN_LATENCY_P99] = "p99",
+  [NCHAN_LATENCY_MAX] = "max",
+  [NCHAN_LATENCY_SAMPLES] = "samples"
+};
+
+//////// JSON ////////
+
+static void json_write(metrics_out_t *out, metrics_data_t *d) {
+  nchan_stub_status_t      *st = d->stats;
+  nchan_latency_stats_t    *latency = nchan_latency_stats_merged();
+  nchan_stall_stats_t      *stalls = nchan_stall_stats_merged();
+  nchan_footprint_stats_t  *footprint = nchan_footprint_stats_merged();
+  memstore_worker_stats_t  *ws;
+  nchan_group_t            *group;
+  redis_node_stats_t       *node;
+  ngx_int_t                 i, workers = memstore_worker_count();
+  ngx_uint_t                n, codes = memstore_ipc_command_count();
+  int                       s, t, first;
+
+  out_printf(out, "{\n"
+                  "  \"nchan_version\": \"%s\",\n"
+                  "  \"published_messages\": %uA,\n"
+                  "  \"stored_messages\": %uA,\n"
+                  "  \"shared_memory_used\": %uz,\n"
+                  "  \"shared_memory_limit\": %uz,\n"
+                  "  \"channels\": %uA,\n"
+                  "  \"subscribers\": %uA,\n"
+                  "  \"redis_pending_commands\": %uA,\n"
+                  "  \"redis_connected_servers\": %uA,\n"
+                  "  \"ipc_alerts_received\": %uA,\n"
+                  "  \"ipc_alerts_in_transit\": %uA,\n"
+                  "  \"ipc_queued_alerts\": %uA,\n"
+                  "  \"ipc_send_delay\": %uA,\n"
+                  "  \"ipc_receive_delay\": %uA,\n",
+             NCHAN_VERSION, st->total_published_messages, st->messages, nchan_get_used_shmem(), d->mcf->shm_size,
+             st->channels, st->subscribers, st->redis_pending_commands, st->redis_connected_servers,
+             st->ipc_total_alerts_received, st->ipc_total_alerts_sent - st->ipc_total_alerts_received,
+             st->ipc_queue_size, st->ipc_total_send_delay, st->ipc_total_receive_delay);
+
+  out_printf(out, "  \"latency\": {");
+  for(s = 0; s < NCHAN_LATENCY_STAGES; s++) {
+    out_printf(out, "%s\n    \"%V\": {", s == 0 ? "" : ",", nchan_latency_stage_name(s));
+    for(t = 0; t <= NCHAN_LATENCY_SAMPLES; t++) {
+      out_printf(out, "%s\"%s\": %uL", t == 0 ? "" : ", ", latency_stat_name[t], nchan_latency_stat(&latency->stage[s], t));
+    }
+    out_printf(out, "}");
+  }
+  out_printf(out, "\n  },\n");
+
+  out_printf(out, "  \"stalls\": {\n    \"threshold_msec\": %M", nchan_stall_threshold());
+  for(s = 0; s < NCHAN_STALL_SITES; s++) {
+    out_printf(out, ",\n    \"%s\": {", nchan_stall_site_name(s));
+    for(t = 0; t <= NCHAN_LATENCY_SAMPLES; t++) {
+      out_printf(out, "%s\"%s\": %uL", t == 0 ? "" : ", ", latency_stat_name[t], nchan_latency_stat(&stalls->site[s], t));
+    }
+    out_printf(out, ", \"over_threshold\": %uA}", stalls->stalls[s]);
+  }
+  out_printf(out, "\n  },\n");
+
+  out_printf(out, "  \"subscriber_footprint_bytes\": {");
+  for(s = 0; s < NCHAN_FOOTPRINT_TYPES; s++) {
+    out_printf(out, "%s\n    \"%s\": {", s == 0 ? "" : ",", subscriber_type_name[s]);
+    for(t = 0; t <= NCHAN_LATENCY_SAMPLES; t++) {
+      out_printf(out, "%s\"%s\": %uL", t == 0 ? "" : ", ", latency_stat_name[t], nchan_latency_stat(&footprint->type[s], t));
+    }
+    out_printf(out, "}");
+  }
+  out_printf(out, "\n  },\n");
+
+  out_printf(out, "  \"hot_channels\": {\n    \"window\": %T", nchan_hot_channels_window());
+  for(s = 0; s < NCHAN_HOT_METRICS; s++) {
+    out_printf(out, ",\n    \"%s\": [", nchan_hot_channels_metric_name(s));
+    for(n = 0; n < d->hot_n[s]; n++) {
+      out_printf(out, "%s\n      {\"channel\": ", n == 0 ? "" : ",");
+      out_quoted(out, &d->hot[s][n].id, 1);
+      out_printf(out, ", \"truncated\": %s, \"per_second\": %.2f}", d->hot[s][n].truncated ? "true" : "false", d->hot[s][n].rate);
+    }
+    out_printf(out, "%s]", d->hot_n[s] > 0 ? "\n    " : "");
+  }
+  out_printf(out, "\n  },\n");
+
+  out_printf(out, "  \"workers\": [");
+  first = 1;
+  for(i = 0; i < workers; i++) {
+    if((ws = memstore_worker_stats(i)) == NULL) {
+      continue;
+    }
+    out_printf(out, "%s\n    {\"worker\": %i, \"pid\": %P, \"channels\": %uA, \"spools\": %uA,\n     \"subscribers\": {", first ? "" : ",", i, ws->pid, ws->channels, ws->spools);
+    first = 0;
+    for(t = 0; t < SUBSCRIBER_TYPES; t++) {
+      out_printf(out, "%s\"%s\": %uA", t == 0 ? "" : ", ", subscriber_type_name[t], ws->subscribers[t]);
+    }
+    out_printf(out, "},\n     \"reapers\": {");
+    for(n = 0; n < REAPERS; n++) {
+      out_printf(out, "%s\"%s\": %uA", n == 0 ? "" : ", ", reaper_name[n], worker_reaper_count(ws, n));
+    }
+    out_printf(out, "},\n     \"ipc_alerts_sent\": {");
+    for(n = 0; n < codes; n++) {
+      out_printf(out, "%s\"%s\": %uA", n == 0 ? "" : ", ", memstore_ipc_command_name(n), ws->ipc_alerts_sent[n]);
+    }
+    out_printf(out, "},\n     \"ipc_alerts_received\": {");
+    for(n = 0; n < codes; n++) {
+      out_printf(out, "%s\"%s\": %uA", n == 0 ? "" : ", ", memstore_ipc_command_name(n), ws->ipc_alerts_received[n]);
+    }
+    out_printf(out, "}}");
+  }
+  out_printf(out, "\n  ],\n");
+
+  out_printf(out, "  \"groups\": [");
+  group = d->groups->elts;
+  for(n = 0; n < d->groups->nelts; n++) {
+    out_printf(out, "%s\n    {\"name\": ", n == 0 ? "" : ",");
+    out_quoted(out, &group[n].name, 1);
+    out_printf(out, ", \"channels\": %A, \"multiplexed_channels\": %A, \"subscribers\": %A, \"messages\": %A, \"messages_shmem_bytes\": %A, \"messages_file_bytes\": %A}",
+               group[n].channels, group[n].multiplexed_channels, group[n].subscribers, group[n].messages, group[n].messages_shmem_bytes, group[n].messages_file_bytes);
+  }
+  out_printf(out, "\n  ],\n");
+
+  out_printf(out, "  \"shared_memory_slabs\": [");
+#if nginx_version > 1011006
+  for(n = 0; n < d->slab_slots; n++) {
+    out_printf(out, "%s\n    {\"size\": %uz, \"slots\": %ui, \"used\": %ui, \"requests\": %ui, \"failures\": %ui, \"pages\": %ui, \"partial_pages\": %ui}", n == 0 ? "" : ",",
+               d->slab[n].size, d->slab[n].total, d->slab[n].used, d->slab[n].reqs, d->slab[n].fails, d->slab[n].pages, d->slab[n].partial_pages);
+  }
+#endif
+  out_printf(out, "\n  ],\n");
+
+#if nginx_version > 1011006
+  out_printf(out, "  \"shared_memory_pages\": {\"size\": %ui, \"total\": %ui, \"free\": %ui, \"largest_free_run\": %ui, \"whole_page_allocations\": %ui},\n",
+             ngx_pagesize, d->pages.total, d->pages.free, d->pages.largest_free_run, d->pages.whole);
+#endif
+  out_printf(out, "  \"shared_memory_compaction\": {\"sweeps\": %uA, \"messages_moved\": %uA, \"bytes_moved\": %uA},\n",
+             d->compaction.sweeps, d->compaction.moved, d->compaction.bytes);
+
+  if(d->msg_cache.enabled) {
+    out_printf(out, "  \"redis_message_cache\": {\"size\": %uz, \"entries\": %uA, \"hits\": %uA, \"misses\": %uA},\n",
+               d->msg_cache.size, d->msg_cache.entries, d->msg_cache.hits, d->msg_cache.misses);
+  }
+
+  out_printf(out, "  \"redis_nodes\": [");
+  node = d->nodes->elts;
+  for(n = 0; n < d->nodes->nelts; n++) {
+    out_printf(out, "%s\n    {\"address\": \"%s\", \"role\": \"%s\", \"state\": \"%s\", \"pending_commands\": %i, \"latency\": %ui, \"replication_lag\": %O}", n == 0 ? "" : ",",
+               node[n].address, node[n].role, node[n].state, node[n].pending_commands, node[n].latency, node[n].replication_lag);
+  }
+  out_printf(out, "\n  ]\n}\n");
+}
+
+//////// OPENMETRICS ////////
+
+static void om_family(metrics_out_t *out, const char *name, const char *type, const char *help) {
+  out_printf(out, "# TYPE nchan_%s %s\n# HELP nchan_%s %s\n", name, type, name, help);
+}
+
+static void om_global_counter(metrics_out_t *out, const char *name, const char *help, ngx_atomic_uint_t val) {
+  om_family(out, name, "counter", help);
+  out_printf(out, "nchan_%s_total %uA\n", name, val);
+}
+
+static void om_global_gauge(metrics_out_t *out, const char *name, const char *help, ngx_atomic_uint_t val) {
+  om_family(out, name, "gauge", help);
+  out_printf(out, "nchan_%s %uA\n", name, val);
+}
+
+#define OM_GROUP_GAUGE(field, help) \
+  om_family(out, "group_" #field, "gauge", help); \
+  for(n = 0; n < d->groups->nelts; n++) { \
+    out_printf(out, "nchan_group_" #field "{group="); \
+    out_quoted(out, &group[n].name, 0); \
+    out_printf(out, "} %A\n", group[n].field); \
+  }
+
+static void openmetrics_write(metrics_out_t *out, metrics_data_t *d) {
+  nchan_stub_status_t      *st = d->stats;
+  nchan_latency_stats_t    *latency = nchan_latency_stats_merged();
+  nchan_stall_stats_t      *stalls = nchan_stall_stats_merged();
+  nchan_footprint_stats_t  *footprint = nchan_footprint_stats_merged();
+  nchan_histogram_t        *h;
+  memstore_worker_stats_t  *ws;
+  nchan_group_t            *group = d->groups->elts;
+  redis_node_stats_t       *node = d->nodes->elts;
+  ngx_int_t                 i, workers = memstore_worker_count();
+  ngx_uint_t                n, codes = memstore_ipc_command_count();
+  int                       s, t;
+
+  //info samples are named after their family, with an _info suffix
+  om_family(out, "build", "info", "Nchan version");
+  out_printf(out, "nchan_build_info{version=\"%s\"} 1\n", NCHAN_VERSION);
+
+  om_global_counter(out, "published_messages", "Messages published to all channels through this server", st->total_published_messages);
+  om_global_gauge(out, "stored_messages", "Messages buffered in memory", st->messages);
+  om_global_gauge(out, "shared_memory_used_bytes", "Shared memory used", nchan_get_used_shmem());
+  om_global_gauge(out, "shared_memory_limit_bytes", "nchan_shared_memory_size", d->mcf->shm_size);
+  om_global_gauge(out, "channels", "Channels on this server", st->channels);
+  om_global_gauge(out, "subscribers", "Subscribers to all channels on this server", st->subscribers);
+  om_global_gauge(out, "redis_pending_commands", "Commands sent to Redis awaiting a reply", st->redis_pending_commands);
+  om_global_gauge(out, "redis_connected_servers", "Redis servers connected to", st->redis_connected_servers);
+  om_global_counter(out, "ipc_alerts_received", "Interprocess alerts received", st->ipc_total_alerts_received);
+  om_global_gauge(out, "ipc_alerts_in_transit", "Interprocess alerts in transit", st->ipc_total_alerts_sent - st->ipc_total_alerts_received);
+  om_global_gauge(out, "ipc_queued_alerts", "Interprocess alerts waiting to be sent", st->ipc_queue_size);
+  om_global_counter(out, "ipc_send_delay_seconds", "Time interprocess alerts spent queued when delayed", st->ipc_total_send_delay);
+  om_global_counter(out, "ipc_receive_delay_seconds", "Time interprocess alerts spent in transit when delayed", st->ipc_total_receive_delay);
+
+  om_family(out, "latency_microseconds", "summary", "Time from a message being published to it reaching each stage");
+  for(s = 0; s < NCHAN_LATENCY_STAGES; s++) {
+    h = &latency->stage[s];
+    for(t = NCHAN_LATENCY_P50; t <= NCHAN_LATENCY_P99; t++) {
+      out_printf(out, "nchan_latency_microseconds{stage=\"%V\",quantile=\"%s\"} %uL\n", nchan_latency_stage_name(s),
+                 t == NCHAN_LATENCY_P50 ? "0.5" : t == NCHAN_LATENCY_P90 ? "0.9" : "0.99", nchan_latency_stat(h, t));
+    }
+    out_printf(out, "nchan_latency_microseconds_sum{stage=\"%V\"} %uL\n", nchan_latency_stage_name(s), h->sum);
+    out_printf(out, "nchan_latency_microseconds_count{stage=\"%V\"} %uL\n", nchan_latency_stage_name(s), h->count);
+  }
+
+  om_family(out, "stall_microseconds", "summary", "Time spent in each kind of potentially slow event loop work");
+  for(s = 0; s < NCHAN_STALL_SITES; s++) {
+    h = &stalls->site[s];
+    for(t = NCHAN_LATENCY_P50; t <= NCHAN_LATENCY_P99; t++) {
+      out_printf(out, "nchan_stall_microseconds{site=\"%s\",quantile=\"%s\"} %uL\n", nchan_stall_site_name(s),
+                 t == NCHAN_LATENCY_P50 ? "0.5" : t == NCHAN_LATENCY_P90 ? "0.9" : "0.99", nchan_latency_stat(h, t));
+    }
+    out_printf(out, "nchan_stall_microseconds_sum{site=\"%s\"} %uL\n", nchan_stall_site_name(s), h->sum);
+    out_printf(out, "nchan_stall_microseconds_count{site=\"%s\"} %uL\n", nchan_stall_site_name(s), h->count);
+  }
+  om_family(out, "stalls", "counter", "Event loop work that took longer than nchan_stall_threshold");
+  for(s = 0; s < NCHAN_STALL_SITES; s++) {
+    out_printf(out, "nchan_stalls_total{site=\"%s\"} %uA\n", nchan_stall_site_name(s), stalls->stalls[s]);
+  }
+
+  om_family(out, "subscriber_footprint_bytes", "summary", "Memory held by each subscriber's connection when it went away, by type");
+  for(s = 0; s < NCHAN_FOOTPRINT_TYPES; s++) {
+    h = &footprint->type[s];
+    for(t = NCHAN_LATENCY_P50; t <= NCHAN_LATENCY_P99; t++) {
+      out_printf(out, "nchan_subscriber_footprint_bytes{type=\"%s\",quantile=\"%s\"} %uL\n", subscriber_type_name[s],
+                 t == NCHAN_LATENCY_P50 ? "0.5" : t == NCHAN_LATENCY_P90 ? "0.9" : "0.99", nchan_latency_stat(h, t));
+    }
+    out_printf(out, "nchan_subscriber_footprint_bytes_sum{type=\"%s\"} %uL\n", subscriber_type_name[s], h->sum);
+    out_printf(out, "nchan_subscriber_footprint_bytes_count{type=\"%s\"} %uL\n", subscriber_type_name[s], h->count);
+  }
+
+  for(s = 0; s < NCHAN_HOT_METRICS; s++) {
+    out_printf(out, "# TYPE nchan_hot_channel_%s_per_second gauge\n"
+                    "# HELP nchan_hot_channel_%s_per_second The busiest channels' %s rate over the last %T seconds\n",
+               nchan_hot_channels_metric_name(s), nchan_hot_channels_metric_name(s), nchan_hot_channels_metric_name(s), nchan_hot_channels_window());
+    for(n = 0; n < d->hot_n[s]; n++) {
+      out_printf(out, "nchan_hot_channel_%s_per_second{channel=", nchan_hot_channels_metric_name(s));
+      out_quoted(out, &d->hot[s][n].id, 0);
+      out_printf(out, "} %.2f\n", d->hot[s][n].rate);
+    }
+  }
+
+  om_family(out, "worker_channels", "gauge", "Channels owned by the worker");
+  for(i = 0; i < workers; i++) {
+    if((ws = memstore_worker_stats(i)) != NULL) {
+      out_printf(out, "nchan_worker_channels{worker=\"%i\"} %uA\n", i, ws->channels);
+    }
+  }
+  om_family(out, "worker_subscribers", "gauge", "Subscribers in the worker, by type");
+  for(i = 0; i < workers; i++) {
+    if((ws = memstore_worker_stats(i)) != NULL) {
+      for(t = 0; t < SUBSCRIBER_TYPES; t++) {
+        out_printf(out, "nchan_worker_subscribers{worker=\"%i\",type=\"%s\"} %uA\n", i, subscriber_type_name[t], ws->subscribers[t]);
+      }
+    }
+  }
+  om_family(out, "worker_spools", "gauge", "Subscriber pools in the worker");
+  for(i = 0; i < workers; i++) {
+    if((ws = memstore_worker_stats(i)) != NULL) {
+      out_printf(out, "nchan_worker_spools{worker=\"%i\"} %uA\n", i, ws->spools);
+    }
+  }
+  om_family(out, "worker_reaper_queue", "gauge", "Items waiting to be garbage-collected in the worker");
+  for(i = 0; i < workers; i++) {
+    if((ws = memstore_worker_stats(i)) != NULL) {
+      for(n = 0; n < REAPERS; n++) {
+        out_printf(out, "nchan_worker_reaper_queue{worker=\"%i\",reaper=\"%s\"} %uA\n", i, reaper_name[n], worker_reaper_count(ws, n));
+      }
+    }
+  }
+  om_family(out, "worker_ipc_alerts_sent", "counter", "Interprocess alerts sent by the worker");
+  for(i = 0; i < workers; i++) {
+    if((ws = memstore_worker_stats(i)) != NULL) {
+      for(n = 0; n < codes; n++) {
+        out_printf(out, "nchan_worker_ipc_alerts_sent_total{worker=\"%i\",code=\"%s\"} %uA\n", i, memstore_ipc_command_name(n), ws->ipc_alerts_sent[n]);
+      }
+    }
+  }
+  om_family(out, "worker_ipc_alerts_received", "counter", "Interprocess alerts received by the worker");
+  for(i = 0; i < workers; i++) {
+    if((ws = memstore_worker_stats(i)) != NULL) {
+      for(n = 0; n < codes; n++) {
+        out_printf(out, "nchan_worker_ipc_alerts_received_total{worker=\"%i\",code=\"%s\"} %uA\n", i, memstore_ipc_command_name(n), ws->ipc_alerts_received[n]);
+      }
+    }
+  }
+
+  OM_GROUP_GAUGE(channels, "Channels in the group");
+  OM_GROUP_GAUGE(multiplexed_channels, "Multiplexed channels in the group");
+  OM_GROUP_GAUGE(subscribers, "Subscribers in the group");
+  OM_GROUP_GAUGE(messages, "Messages in the group");
+  OM_GROUP_GAUGE(messages_shmem_bytes, "Shared memory used by the group's messages");
+  OM_GROUP_GAUGE(messages_file_bytes, "File storage used by the group's messages");
+
+#if nginx_version > 1011006
+  om_family(out, "shm_slab_slots", "gauge", "Shared memory slab slots, by slot size");
+  for(n = 0; n < d->slab_slots; n++) {
+    out_printf(out, "nchan_shm_slab_slots{size=\"%uz\"} %ui\n", d->slab[n].size, d->slab[n].total);
+  }
+  om_family(out, "shm_slab_slots_used", "gauge", "Shared memory slab slots in use, by slot size");
+  for(n = 0; n < d->slab_slots; n++) {
+    out_printf(out, "nchan_shm_slab_slots_used{size=\"%uz\"} %ui\n", d->slab[n].size, d->slab[n].used);
+  }
+  om_family(out, "shm_slab_requests", "counter", "Shared memory allocations, by slot size");
+  for(n = 0; n < d->slab_slots; n++) {
+    out_printf(out, "nchan_shm_slab_requests_total{size=\"%uz\"} %ui\n", d->slab[n].size, d->slab[n].reqs);
+  }
+  om_family(out, "shm_slab_failures", "counter", "Failed shared memory allocations, by slot size");
+  for(n = 0; n < d->slab_slots; n++) {
+    out_printf(out, "nchan_shm_slab_failures_total{size=\"%uz\"} %ui\n", d->slab[n].size, d->slab[n].fails);
+  }
+  om_family(out, "shm_slab_pages", "gauge", "Shared memory pages split into slab slots, by slot size");
+  for(n = 0; n < d->slab_slots; n++) {
+    out_printf(out, "nchan_shm_slab_pages{size=\"%uz\"} %ui\n", d->slab[n].size, d->slab[n].pages);
+  }
+  om_family(out, "shm_slab_partial_pages", "gauge", "Shared memory slab pages with some free slots, by slot size");
+  for(n = 0; n < d->slab_slots; n++) {
+    out_printf(out, "nchan_shm_slab_partial_pages{size=\"%uz\"} %ui\n", d->slab[n].size, d->slab[n].partial_pages);
+  }
+  om_global_gauge(out, "shm_pages", "Shared memory pages", d->pages.total);
+  om_global_gauge(out, "shm_free_pages", "Free shared memory pages", d->pages.free);
+  om_global_gauge(out, "shm_largest_free_run_pages", "The most contiguous free shared memory pages", d->pages.largest_free_run);
+  om_global_gauge(out, "shm_whole_page_allocation_pages", "Shared memory pages used by allocations bigger than half a page", d->pages.whole);
+#endif
+  om_global_counter(out, "shm_compaction_sweeps", "Shared memory compaction sweeps", d->compaction.sweeps);
+  om_global_counter(out, "shm_compaction_messages_moved", "Messages moved to fuller shared memory pages", d->compaction.moved);
+  om_global_counter(out, "shm_compaction_bytes_moved", "Bytes of messages moved to fuller shared memory pages", d->compaction.bytes);
+
+  if(d->msg_cache.enabled) {
+    om_global_gauge(out, "redis_message_cache_bytes", "Shared memory used by cached Redis messages", d->msg_cache.size);
+    om_global_gauge(out, "redis_message_cache_entries", "Redis messages cached in shared memory", d->msg_cache.entries);
+    om_global_counter(out, "redis_message_cache_hits", "Redis message fetches served from the cache", d->msg_cache.hits);
+    om_global_counter(out, "redis_message_cache_misses", "Redis message fetches not found in the cache", d->msg_cache.misses);
+  }
+
+  om_family(out, "redis_node_up", "gauge", "Whether the Redis server is connected and ready");
+  for(n = 0; n < d->nodes->nelts; n++) {
+    out_printf(out, "nchan_redis_node_up{node=\"%s\",role=\"%s\"} %d\n", node[n].address, node[n].role, ngx_strcmp(node[n].state, "ready") == 0 ? 1 : 0);
+  }
+  om_family(out, "redis_node_pending_commands", "gauge", "Commands sent to the Redis server awaiting a reply");
+  for(n = 0; n < d->nodes->nelts; n++) {
+    out_printf(out, "nchan_redis_node_pending_commands{node=\"%s\",role=\"%s\"} %i\n", node[n].address, node[n].role, node[n].pending_commands);
+  }
+  om_family(out, "redis_node_latency_microseconds", "gauge", "Smoothed round-trip time to the Redis server");
+  for(n = 0; n < d->nodes->nelts; n++) {
+    if(node[n].latency > 0) {
+      out_printf(out, "nchan_redis_node_latency_microseconds{node=\"%s\",role=\"%s\"} %ui\n", node[n].address, node[n].role, node[n].latency);
+    }
+  }
+  om_family(out, "redis_node_replication_lag_bytes", "gauge", "How far the Redis slave is behind its master");
+  for(n = 0; n < d->nodes->nelts; n++) {
+    if(node[n].replication_lag >= 0) {
+      out_printf(out, "nchan_redis_node_replication_lag_bytes{node=\"%s\",role=\"%s\"} %O\n", node[n].address, node[n].role, node[n].replication_lag);
+    }
+  }
+
+  out_printf(out, "# EOF\n");
+}
+
+ngx_int_t nchan_metrics_handler(ngx_http_request_t *r) {
+  nchan_loc_conf_t   *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  metrics_data_t      data;
+  metrics_out_t       out;
+  ngx_chain_t        *cl;
+  off_t               len = 0;
+  ngx_int_t           rc;
+  int                 json = cf->stub_status_format == NCHAN_STUB_STATUS_JSON;
+
+  ngx_memzero(&out, sizeof(out));
+  out.r = r;
+
+  if(metrics_collect(r, &data) != NGX_OK) {
+    nchan_log_request_error(r, "Failed to allocate nchan_stub_status data.");
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  if(json) {
+    json_write(&out, &data);
+  }
+  else {
+    openmetrics_write(&out, &data);
+  }
+  if(out.nomem || out.first == NULL) {
+    nchan_log_request_error(r, "Failed to allocate response buffer for nchan_stub_status.");
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  for(cl = out.first; cl != NULL; cl = cl->next) {
+    len += ngx_buf_size(cl->buf);
+  }
+  out.last->buf->last_buf = 1;
+
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_type = json ? json_content_type : openmetrics_content_type;
+  r->headers_out.content_length_n = len;
+  rc = ngx_http_send_header(r);
+  if(rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
+
+  return ngx_http_output_filter(r, out.first);
+}
@@ -0,0 +1,7 @@
+#ifndef NCHAN_METRICS_H
+#define NCHAN_METRICS_H
+
+// nchan_stub_status in the json or prometheus format
+ngx_int_t nchan_metrics_handler(ngx_http_request_t *r);
+
+#endif //NCHAN_METRICS_H
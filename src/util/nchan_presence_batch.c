@@ -0,0 +1,305 @@
+#include <nchan_module.h>
+#include <assert.h>
+#include <util/nchan_rbtree.h>
+#include <util/nchan_fake_request.h>
+#include "nchan_presence_batch.h"
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "PRESENCE BATCH: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "PRESENCE BATCH: " fmt, ##args)
+
+// Subscribe and unsubscribe events headed for the same callback location are collected
+// per worker, and sent as a single POST with a JSON array body once there are enough
+// of them or enough time has passed:
+//  [{"type":"subscribe","channel":"foo","subscriber_type":"websocket","args":"user=bar"}, ...]
+// Each subscriber location gets its own batches, since the batch size and interval are set per location.
+// A gracefully exiting worker waits for its batches to be sent, and sends new events right away.
+
+typedef struct {
+  ngx_str_t                key; // 's' or 'u', the subscriber location's nchan_loc_conf_t pointer, and the url path
+  ngx_str_t                url;
+  ngx_pool_t              *pool;
+  nchan_requestmachine_t   rm;
+
+  u_char                  *buf;
+  size_t                   len;
+  size_t                   size;
+  ngx_uint_t               n;
+
+  ngx_uint_t               max_n;
+  ngx_msec_t               interval;
+  ngx_event_t              timer;
+} presence_batch_t;
+
+static rbtree_seed_t      batch_tree;
+static int                batch_tree_initialized = 0;
+
+static ngx_str_t          json_content_type = ngx_string("application/json");
+static ngx_str_t          content_type_header = ngx_string("Content-Type");
+
+static void *batch_id(void *d) {
+  return &((presence_batch_t *)d)->key;
+}
+
+static size_t json_escaped_len(ngx_str_t *str) {
+  size_t   i, len = 0;
+  u_char   c;
+  for(i=0; i < str->len; i++) {
+    c = str->data[i];
+    if(c == '"' || c == '\\') {
+      len += 2;
+    }
+    else if(c < 0x20) {
+      len += 6;
+    }
+    else {
+      len++;
+    }
+  }
+  return len;
+}
+
+static u_char *json_escape_copy(u_char *cur, ngx_str_t *str) {
+  static u_char  hex[] = "0123456789abcdef";
+  size_t         i;
+  u_char         c;
+  for(i=0; i < str->len; i++) {
+    c = str->data[i];
+    if(c == '"' || c == '\\') {
+      *cur++ = '\\';
+      *cur++ = c;
+    }
+    else if(c < 0x20) {
+      cur = ngx_cpymem(cur, "\\u00", 4);
+      *cur++ = hex[c >> 4];
+      *cur++ = hex[c & 0xf];
+    }
+    else {
+      *cur++ = c;
+    }
+  }
+  return cur;
+}
+
+static ngx_int_t batch_flush(presence_batch_t *batch) {
+  nchan_requestmachine_request_params_t  param;
+  ngx_pool_t                            *pool;
+  ngx_buf_t                             *body;
+
+  if(batch->timer.timer_set) {
+    ngx_del_timer(&batch->timer);
+  }
+  if(batch->n == 0) {
+    return NGX_OK;
+  }
+
+  DBG("flush %ui events to %V", batch->n, &batch->url);
+
+  if((pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log)) == NULL
+   || (body = ngx_create_temp_buf(pool, batch->len + 2)) == NULL) {
+    ERR("couldn't allocate %ui-event batch for %V", batch->n, &batch->url);
+    if(pool) {
+      ngx_destroy_pool(pool);
+    }
+    batch->len = 0;
+    batch->n = 0;
+    return NGX_ERROR;
+  }
+
+  *body->last++ = '[';
+  body->last = ngx_cpymem(body->last, batch->buf, batch->len);
+  *body->last++ = ']';
+
+  batch->len = 0;
+  batch->n = 0;
+
+  param.url.str = &batch->url;
+  param.url_complex = 0;
+  param.cb = NULL;
+  param.pd = NULL;
+  param.pool = pool;
+  param.body = body;
+  param.response_headers_only = 1;
+  param.manual_cleanup = 0;
+
+  if(nchan_requestmachine_request(&batch->rm, &param) == NULL) {
+    ERR("couldn't send batch to %V", &batch->url);
+    ngx_destroy_pool(pool);
+    return NGX_ERROR;
+  }
+  return NGX_OK;
+}
+
+static void batch_timer_handler(ngx_event_t *ev) {
+  batch_flush((presence_batch_t *)ev->data);
+}
+
+static presence_batch_t *batch_create(ngx_str_t *key, ngx_http_request_t *r, nchan_loc_conf_t *cf) {
+  ngx_rbtree_node_t   *node;
+  presence_batch_t    *batch;
+  ngx_pool_t          *pool;
+  ngx_http_request_t  *template_request;
+  ngx_table_elt_t     *h;
+
+  if((pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log)) == NULL) {
+    return NULL;
+  }
+
+  //the batch outlives the request that started it, so it needs a request of its own to make subrequests from
+  if((template_request = nchan_create_detached_fake_request(r, pool)) == NULL) {
+    ngx_destroy_pool(pool);
+    return NULL;
+  }
+  if((h = ngx_list_push(&template_request->headers_in.headers)) == NULL) {
+    ngx_destroy_pool(pool);
+    return NULL;
+  }
+  h->hash = 1;
+  h->key = content_type_header;
+  h->value = json_content_type;
+  h->lowcase_key = (u_char *)"content-type";
+  template_request->headers_in.content_type = h;
+
+  if((node = rbtree_create_node(&batch_tree, sizeof(*batch) + key->len)) == NULL) {
+    ngx_destroy_pool(pool);
+    return NULL;
+  }
+  batch = rbtree_data_from_node(node);
+  ngx_memzero(batch, sizeof(*batch));
+
+  batch->key.len = key->len;
+  batch->key.data = (u_char *)&batch[1];
+  ngx_memcpy(batch->key.data, key->data, key->len);
+  batch->url.len = key->len - 1 - sizeof(cf);
+  batch->url.data = &batch->key.data[1 + sizeof(cf)];
+
+  batch->pool = pool;
+  nchan_requestmachine_initialize(&batch->rm, template_request);
+
+  batch->max_n = cf->subscriber_presence_batch.size;
+  batch->interval = cf->subscriber_presence_batch.interval;
+  nchan_init_timer(&batch->timer, batch_timer_handler, batch);
+#if nginx_version >= 1008000
+  batch->timer.cancelable = 0;
+#endif
+
+  rbtree_insert_node(&batch_tree, node);
+  return batch;
+}
+
+ngx_int_t nchan_presence_batch_add(subscriber_t *sub, ngx_http_complex_value_t *url_cv, int subscribed) {
+  ngx_http_request_t    *r = sub->request;
+  nchan_request_ctx_t   *ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
+  ngx_str_t              url, path, args, key, *chid, *subtype;
+  ngx_str_t              empty = ngx_null_string;
+  ngx_rbtree_node_t     *node;
+  presence_batch_t      *batch;
+  u_char                *qs, *cur;
+  size_t                 sz;
+
+  if(ngx_http_complex_value(r, url_cv, &url) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  path = url;
+  args.len = 0;
+  args.data = NULL;
+  if((qs = ngx_strlchr(url.data, url.data + url.len, '?')) != NULL) {
+    path.len = qs - url.data;
+    args.data = qs + 1;
+    args.len = url.len - path.len - 1;
+  }
+
+  if((key.data = ngx_pnalloc(r->pool, 1 + sizeof(sub->cf) + path.len)) == NULL) {
+    return NGX_ERROR;
+  }
+  key.data[0] = subscribed ? 's' : 'u';
+  ngx_memcpy(&key.data[1], &sub->cf, sizeof(sub->cf));
+  ngx_memcpy(&key.data[1 + sizeof(sub->cf)], path.data, path.len);
+  key.len = 1 + sizeof(sub->cf) + path.len;
+
+  if(!batch_tree_initialized) {
+    rbtree_init(&batch_tree, "subscriber presence batches", batch_id, NULL, NULL);
+    batch_tree_initialized = 1;
+  }
+
+  if((node = rbtree_find_node(&batch_tree, &key)) != NULL) {
+    batch = rbtree_data_from_node(node);
+  }
+  else if((batch = batch_create(&key, r, sub->cf)) == NULL) {
+    ERR("couldn't create batch for %V", &path);
+    return NGX_ERROR;
+  }
+
+  chid = ctx && ctx->channel_id_count > 0 ? &ctx->channel_id[0] : &empty;
+  subtype = ctx && ctx->subscriber_type ? ctx->subscriber_type : &empty;
+
+  sz = sizeof(",{\"type\":\"unsubscribe\",\"channel\":\"\",\"subscriber_type\":\"\",\"args\":\"\"}")
+     + json_escaped_len(chid) + json_escaped_len(subtype) + json_escaped_len(&args);
+
+  if(batch->len + sz > batch->size) {
+    size_t   newsize = batch->size == 0 ? 1024 : batch->size * 2;
+    u_char  *newbuf;
+    while(newsize < batch->len + sz) {
+      newsize *= 2;
+    }
+    if((newbuf = ngx_alloc(newsize, ngx_cycle->log)) == NULL) {
+      ERR("couldn't grow batch for %V", &batch->url);
+      return NGX_ERROR;
+    }
+    if(batch->buf) {
+      ngx_memcpy(newbuf, batch->buf, batch->len);
+      ngx_free(batch->buf);
+    }
+    batch->buf = newbuf;
+    batch->size = newsize;
+  }
+
+  cur = batch->buf + batch->len;
+  if(batch->n > 0) {
+    *cur++ = ',';
+  }
+  cur = ngx_sprintf(cur, "{\"type\":\"%s\",\"channel\":\"", subscribed ? "subscribe" : "unsubscribe");
+  cur = json_escape_copy(cur, chid);
+  cur = ngx_cpymem(cur, "\",\"subscriber_type\":\"", sizeof("\",\"subscriber_type\":\"") - 1);
+  cur = json_escape_copy(cur, subtype);
+  cur = ngx_cpymem(cur, "\",\"args\":\"", sizeof("\",\"args\":\"") - 1);
+  cur = json_escape_copy(cur, &args);
+  cur = ngx_cpymem(cur, "\"}", 2);
+  batch->len = cur - batch->buf;
+  batch->n++;
+
+  if(batch->n >= batch->max_n || ngx_exiting || ngx_quit) {
+    return batch_flush(batch);
+  }
+  if(!batch->timer.timer_set) {
+    ngx_add_timer(&batch->timer, batch->interval);
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t batch_shutdown_walker(rbtree_seed_t *seed, void *node_data, void *privdata) {
+  presence_batch_t   *batch = node_data;
+  if(batch->timer.timer_set) {
+    ngx_del_timer(&batch->timer);
+  }
+  if(batch->n > 0) {
+    //only when the worker didn't get to exit gracefully
+    nchan_log_warning("dropping %ui unsent subscriber presence events for %V", batch->n, &batch->url);
+  }
+  nchan_requestmachine_shutdown(&batch->rm);
+  if(batch->buf) {
+    ngx_free(batch->buf);
+  }
+  //the pool is left alone: requests still in flight point into its template request.
+  return NGX_OK;
+}
+
+ngx_int_t nchan_presence_batch_shutdown(void) {
+  if(batch_tree_initialized) {
+    rbtree_empty(&batch_tree, batch_shutdown_walker, NULL);
+    batch_tree_initialized = 0;
+  }
+  return NGX_OK;
+}
@@ -0,0 +1,8 @@
+#ifndef NCHAN_PRESENCE_BATCH_H
+#define NCHAN_PRESENCE_BATCH_H
+
+//queue a subscribe or unsubscribe event to be POSTed along with others to the callback url's location
+ngx_int_t nchan_presence_batch_add(subscriber_t *sub, ngx_http_complex_value_t *url_cv, int subscribed);
+ngx_int_t nchan_presence_batch_shutdown(void);
+
+#endif //NCHAN_PRESENCE_BATCH_H
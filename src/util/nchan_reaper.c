@@ -1,5 +1,6 @@
 #include <nchan_module.h>
 #include "nchan_reaper.h"
+#include <util/nchan_stall.h>
 #include <assert.h>
 
 //#define DEBUG_LEVEL NGX_LOG_WARN
@@ -303,18 +304,18 @@ static void its_reaping_rotating_time(nchan_reaper_t *rp, uint8_t force) {
 
 static void reaper_timer_handler(ngx_event_t *ev) {
   nchan_reaper_t      *rp = ev->data;
+  uint64_t             stall_start = nchan_stall_start();
   switch (rp->strategy) {
     case RESCAN:
       its_reaping_time(rp, 0);
-      reaper_reset_timer(rp);
-      return;
+      break;
     case ROTATE:
       its_reaping_rotating_time(rp, 0);
-      reaper_reset_timer(rp);
-      return;
+      break;
     case KEEP_PLACE:
       its_reaping_time_keep_place(rp, 0);
-      reaper_reset_timer(rp);
-      return;
+      break;
   }
+  nchan_stall_end(NCHAN_STALL_REAPER, stall_start, rp->name, NULL, -1);
+  reaper_reset_timer(rp);
 }
@@ -0,0 +1,862 @@
+#include <nchan_module.h>
+#include "nchan_simulation.h"
+
+#if FAKESHARD
+
+#include <assert.h>
+#include <subscribers/internal.h>
+#include <store/memory/store-private.h>
+#include <util/nchan_slist.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "SIMULATION: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "SIMULATION: " fmt, ##args)
+
+// A scripted load simulation for FAKESHARD builds, where all MAX_FAKE_WORKERS memstore workers live in
+// one process and interprocess alerts are plain function calls. A GET request to an nchan_simulation
+// location runs the location's script to completion before responding, on a simulated clock: the
+// worker's cached time is moved from one scripted step or due timer to the next, and the timers are
+// run as they come due. The same script and seed always produce the same run.
+//
+// The script is a text file, one step per line, with # for comments:
+//
+//   seed <n>                 seed the random number generators. defaults to 1
+//   end <time>               stop the run here. defaults to 1s after the last step
+//   <time> <worker> subscribe <channel> [subscribers=<n>] [channels=<n>]
+//   <time> <worker> unsubscribe <channel> [channels=<n>]
+//   <time> <worker> publish <channel> [size=<bytes>] [count=<n>] [every=<time>] [channels=<n>]
+//
+// <time> is from the start of the run, in msec unless given in other units. <worker> is a fake worker
+// slot, or * to spread the step's subscribers or messages across all the workers in turn (and, for
+// unsubscribe, to unsubscribe everyone). With channels=<n>, the step applies to n channels, and "{n}"
+// in the channel id is replaced with the channel number. Publishing steps send one message to each
+// channel, count times, every so often. A trace is just a script with a line for every event.
+//
+// The response is a JSON object with the thread CPU time taken by each kind of operation (including
+// everything it set off in the other workers), what each worker published, subscribed and received,
+// the interprocess alerts sent, and the high-water marks for shared memory, channels, subscribers and
+// messages.
+//
+// Only the timers set during the run are run on the simulated clock. The ones that were already set are
+// left alone until the run is over, and whatever's left of the run's own timers is then moved back onto
+// the real clock. Everything else in the worker still sees the simulated time while the run lasts, so
+// this is meant for a nginx that does little but run simulations.
+
+typedef enum {SIM_SUBSCRIBE, SIM_UNSUBSCRIBE, SIM_PUBLISH, SIM_TIMERS, SIM_OPS} sim_op_t;
+
+typedef struct {
+  ngx_uint_t                line;
+  sim_op_t                  op;
+  ngx_int_t                 worker; //-1 to take turns
+  ngx_uint_t                turn;
+  ngx_str_t                *id;
+  ngx_uint_t                channels;
+  ngx_uint_t                subscribers;
+  size_t                    size;
+  ngx_uint_t                remaining;
+  ngx_msec_t                every;
+  ngx_msec_t                at;
+} sim_step_t;
+
+typedef struct {
+  ngx_uint_t                count;
+  uint64_t                  cpu_nsec;
+} sim_op_stats_t;
+
+typedef struct {
+  ngx_uint_t                published;
+  ngx_uint_t                subscribed;
+  ngx_uint_t                received;
+  uint64_t                  cpu_nsec;
+} sim_worker_stats_t;
+
+typedef struct nchan_simulation_s nchan_simulation_t;
+
+typedef struct sim_sub_s sim_sub_t;
+struct sim_sub_s {
+  nchan_simulation_t       *sim;
+  subscriber_t             *sub;
+  ngx_str_t                *id;
+  ngx_int_t                 worker;
+  sim_sub_t                *prev;
+  sim_sub_t                *next;
+  unsigned                  enqueued:1;
+};
+
+struct nchan_simulation_s {
+  ngx_pool_t               *pool;
+  nchan_loc_conf_t         *cf;
+  ngx_uint_t                refcount; //the simulation itself, its subscribers, and its unfinished publishes
+  unsigned                  finished:1;
+  unsigned                  end_set:1;
+
+  ngx_array_t               steps;
+  ngx_msec_t                end;
+  unsigned long             seed;
+  u_char                   *msgbuf;
+  size_t                    msgbuf_len;
+  nchan_slist_t             subs;
+
+  ngx_msec_t                now;
+  ngx_msec_t                start_msec;
+  ngx_rbtree_node_t       **real_timers; //set before the run, sorted by address
+  ngx_uint_t                real_timers_n;
+  ngx_time_t                start_time;
+  volatile ngx_time_t      *real_cached_time;
+
+  sim_op_stats_t            op[SIM_OPS];
+  sim_worker_stats_t        worker[MAX_FAKE_WORKERS];
+  ngx_uint_t                published;
+  ngx_uint_t                publish_failures;
+  ngx_uint_t                received;
+  ngx_atomic_uint_t         ipc_alerts;
+  ngx_atomic_uint_t         ipc_alerts_by_cmd[MEMSTORE_WORKER_STATS_IPC_CODES];
+  struct {
+    size_t                    shm;
+    ngx_atomic_uint_t         channels;
+    ngx_atomic_uint_t         subscribers;
+    ngx_atomic_uint_t         messages;
+  }                         high_water;
+};
+
+static ngx_time_t       sim_time;
+static ngx_str_t        sim_sub_name = ngx_string("simulation");
+static ngx_str_t        sim_content_type = ngx_string("application/json");
+static const char      *sim_op_name[] = {
+  [SIM_SUBSCRIBE] =   "subscribe",
+  [SIM_UNSUBSCRIBE] = "unsubscribe",
+  [SIM_PUBLISH] =     "publish",
+  [SIM_TIMERS] =      "timers"
+};
+
+static void sim_release(nchan_simulation_t *sim) {
+  assert(sim->refcount > 0);
+  if(--sim->refcount > 0) {
+    return;
+  }
+  DBG("%p free", sim);
+  ngx_destroy_pool(sim->pool);
+}
+
+/* the clock */
+
+static uint64_t sim_cpu_nsec(void) {
+  struct timespec   ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t )ts.tv_sec * 1000000000 + (uint64_t )ts.tv_nsec;
+}
+
+static void sim_clock_set(nchan_simulation_t *sim, ngx_msec_t at) {
+  ngx_msec_t   msec = sim->start_time.msec + at;
+  sim->now = at;
+  sim_time.sec = sim->start_time.sec + msec / 1000;
+  sim_time.msec = msec % 1000;
+  sim_time.gmtoff = sim->start_time.gmtoff;
+  ngx_cached_time = &sim_time;
+  ngx_current_msec = sim->start_msec + at;
+}
+
+/* the timers. the simulation's own are the ones that weren't there before the run */
+
+static ngx_uint_t sim_timers_collect(ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t **out) {
+  ngx_uint_t    n;
+  if(node == sentinel) {
+    return 0;
+  }
+  if(out) {
+    out[0] = node;
+  }
+  n = 1;
+  n += sim_timers_collect(node->left, sentinel, out ? &out[n] : NULL);
+  n += sim_timers_collect(node->right, sentinel, out ? &out[n] : NULL);
+  return n;
+}
+
+static int sim_timer_cmp(const void *a, const void *b) {
+  uintptr_t  l = (uintptr_t )*(ngx_rbtree_node_t **)a, r = (uintptr_t )*(ngx_rbtree_node_t **)b;
+  return l < r ? -1 : (l > r ? 1 : 0);
+}
+
+static ngx_int_t sim_timers_record(nchan_simulation_t *sim) {
+  ngx_uint_t    n = sim_timers_collect(ngx_event_timer_rbtree.root, ngx_event_timer_rbtree.sentinel, NULL);
+  sim->real_timers_n = n;
+  if(n == 0) {
+    return NGX_OK;
+  }
+  if((sim->real_timers = ngx_palloc(sim->pool, n * sizeof(*sim->real_timers))) == NULL) {
+    return NGX_ERROR;
+  }
+  sim_timers_collect(ngx_event_timer_rbtree.root, ngx_event_timer_rbtree.sentinel, sim->real_timers);
+  qsort(sim->real_timers, n, sizeof(*sim->real_timers), sim_timer_cmp);
+  return NGX_OK;
+}
+
+static int sim_timer_is_real(nchan_simulation_t *sim, ngx_rbtree_node_t *node) {
+  return sim->real_timers_n > 0 && bsearch(&node, sim->real_timers, sim->real_timers_n, sizeof(*sim->real_timers), sim_timer_cmp) != NULL;
+}
+
+static ngx_rbtree_node_t *sim_timer_first(nchan_simulation_t *sim, ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel) {
+  //the earliest of the simulation's timers
+  ngx_rbtree_node_t  *found;
+  if(node == sentinel) {
+    return NULL;
+  }
+  if((found = sim_timer_first(sim, node->left, sentinel)) != NULL) {
+    return found;
+  }
+  if(!sim_timer_is_real(sim, node)) {
+    return node;
+  }
+  return sim_timer_first(sim, node->right, sentinel);
+}
+
+static ngx_msec_t sim_timer_find(nchan_simulation_t *sim) {
+  ngx_rbtree_node_t  *node = sim_timer_first(sim, ngx_event_timer_rbtree.root, ngx_event_timer_rbtree.sentinel);
+  ngx_msec_int_t      timer;
+  if(node == NULL) {
+    return NGX_TIMER_INFINITE;
+  }
+  timer = (ngx_msec_int_t )(node->key - ngx_current_msec);
+  return (ngx_msec_t )(timer > 0 ? timer : 0);
+}
+
+static void sim_timers_expire(nchan_simulation_t *sim) {
+  //like ngx_event_expire_timers(), for the simulation's timers only
+  ngx_rbtree_node_t  *node;
+  ngx_event_t        *ev;
+  while((node = sim_timer_first(sim, ngx_event_timer_rbtree.root, ngx_event_timer_rbtree.sentinel)) != NULL
+   && (ngx_msec_int_t )(node->key - ngx_current_msec) <= 0) {
+    ev = (ngx_event_t *)((char *)node - offsetof(ngx_event_t, timer));
+    ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+#if (NGX_DEBUG)
+    ev->timer.left = NULL;
+    ev->timer.right = NULL;
+    ev->timer.parent = NULL;
+#endif
+    ev->timer_set = 0;
+    ev->timedout = 1;
+    ev->handler(ev);
+  }
+}
+
+static void sim_clock_restore(nchan_simulation_t *sim) {
+  //the simulation's leftover timers were set on the simulated clock. move them back onto the real one
+  ngx_rbtree_node_t  *node = NULL;
+  ngx_array_t        *left;
+  ngx_rbtree_node_t **moved;
+  ngx_uint_t          i;
+  
+  left = ngx_array_create(sim->pool, 8, sizeof(ngx_rbtree_node_t *));
+  while(left && (node = sim_timer_first(sim, ngx_event_timer_rbtree.root, ngx_event_timer_rbtree.sentinel)) != NULL) {
+    if((moved = ngx_array_push(left)) == NULL) {
+      break;
+    }
+    ngx_rbtree_delete(&ngx_event_timer_rbtree, node);
+    node->key -= sim->now;
+    *moved = node;
+  }
+  if(left == NULL || node != NULL) {
+    ERR("%p couldn't allocate space to move leftover timers back to the real clock", sim);
+  }
+  if(left) {
+    moved = left->elts;
+    for(i = 0; i < left->nelts; i++) {
+      ngx_rbtree_insert(&ngx_event_timer_rbtree, moved[i]);
+    }
+  }
+  ngx_cached_time = sim->real_cached_time;
+  ngx_current_msec = sim->start_msec;
+  ngx_time_update();
+}
+
+static void sim_op_done(nchan_simulation_t *sim, sim_op_t op, ngx_int_t worker, uint64_t cpu_start) {
+  uint64_t     cpu = sim_cpu_nsec() - cpu_start;
+  sim->op[op].count++;
+  sim->op[op].cpu_nsec += cpu;
+  if(worker >= 0) {
+    sim->worker[worker].cpu_nsec += cpu;
+  }
+}
+
+static void sim_sample(nchan_simulation_t *sim) {
+  nchan_stub_status_t  *st = nchan_get_stub_status_stats();
+  size_t                shm = nchan_get_used_shmem();
+
+  sim->high_water.shm = ngx_max(sim->high_water.shm, shm);
+  sim->high_water.channels = ngx_max(sim->high_water.channels, st->channels);
+  sim->high_water.subscribers = ngx_max(sim->high_water.subscribers, st->subscribers);
+  sim->high_water.messages = ngx_max(sim->high_water.messages, st->messages);
+}
+
+/* subscribers */
+
+static ngx_int_t sim_sub_enqueue(ngx_int_t code, void *ptr, sim_sub_t *d) {
+  d->enqueued = 1;
+  return NGX_OK;
+}
+
+static ngx_int_t sim_sub_dequeue(ngx_int_t code, void *ptr, sim_sub_t *d) {
+  d->enqueued = 0;
+  return NGX_OK;
+}
+
+static ngx_int_t sim_sub_respond_message(ngx_int_t code, nchan_msg_t *msg, sim_sub_t *d) {
+  nchan_simulation_t   *sim = d->sim;
+  if(!sim->finished) {
+    sim->received++;
+    sim->worker[d->worker].received++;
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t sim_sub_respond_status(ngx_int_t status, void *ptr, sim_sub_t *d) {
+  DBG("subscriber %p got status %i", d->sub, status);
+  return NGX_OK;
+}
+
+static ngx_int_t sim_sub_destroy(ngx_int_t code, void *ptr, sim_sub_t *d) {
+  nchan_simulation_t   *sim = d->sim;
+  d->enqueued = 0;
+  nchan_slist_remove(&sim->subs, d);
+  sim_release(sim);
+  return NGX_OK;
+}
+
+static void sim_subscribe(nchan_simulation_t *sim, sim_step_t *step) {
+  static nchan_msg_id_t newest_msgid = NCHAN_NEWEST_MSGID;
+  subscriber_t         *sub;
+  sim_sub_t            *d;
+  ngx_uint_t            i, j;
+  ngx_int_t             worker;
+  uint64_t              cpu;
+
+  for(i = 0; i < step->channels; i++) {
+    for(j = 0; j < step->subscribers; j++) {
+      worker = step->worker >= 0 ? step->worker : (ngx_int_t )(step->turn++ % MAX_FAKE_WORKERS);
+      cpu = sim_cpu_nsec();
+      memstore_fakeprocess_push(worker);
+      sub = internal_subscriber_create_init(&sim_sub_name, sim->cf, sizeof(*d), (void **)&d, (callback_pt )sim_sub_enqueue, (callback_pt )sim_sub_dequeue, (callback_pt )sim_sub_respond_message, (callback_pt )sim_sub_respond_status, NULL, (callback_pt )sim_sub_destroy);
+      if(sub == NULL) {
+        ERR("%p couldn't create subscriber for %V", sim, &step->id[i]);
+        memstore_fakeprocess_pop();
+        continue;
+      }
+      d->sim = sim;
+      d->sub = sub;
+      d->id = &step->id[i];
+      d->worker = worker;
+      d->enqueued = 0;
+      nchan_slist_append(&sim->subs, d);
+      sim->refcount++;
+      sim->worker[worker].subscribed++;
+
+      sub->last_msgid = newest_msgid;
+      sim->cf->storage_engine->subscribe(&step->id[i], sub);
+      memstore_fakeprocess_pop();
+      sim_op_done(sim, SIM_SUBSCRIBE, worker, cpu);
+    }
+  }
+}
+
+static void sim_unsubscribe(nchan_simulation_t *sim, sim_step_t *step) {
+  sim_sub_t            *cur, *next;
+  ngx_uint_t            i;
+  uint64_t              cpu;
+
+  for(i = 0; i < step->channels; i++) {
+    for(cur = nchan_slist_first(&sim->subs); cur != NULL; cur = next) {
+      next = nchan_slist_next(&sim->subs, cur);
+      if(!cur->enqueued || (step->worker >= 0 && cur->worker != step->worker) || !nchan_ngx_str_match(cur->id, &step->id[i])) {
+        continue;
+      }
+      cpu = sim_cpu_nsec();
+      memstore_fakeprocess_push(cur->worker);
+      //destroys the subscriber, and removes it from the list
+      cur->sub->fn->dequeue(cur->sub);
+      memstore_fakeprocess_pop();
+      sim_op_done(sim, SIM_UNSUBSCRIBE, cur->worker, cpu);
+    }
+  }
+}
+
+static void sim_dequeue_subscribers(nchan_simulation_t *sim) {
+  sim_sub_t            *cur, *next;
+  for(cur = nchan_slist_first(&sim->subs); cur != NULL; cur = next) {
+    next = nchan_slist_next(&sim->subs, cur);
+    if(cur->enqueued) {
+      memstore_fakeprocess_push(cur->worker);
+      cur->sub->fn->dequeue(cur->sub);
+      memstore_fakeprocess_pop();
+    }
+  }
+}
+
+/* publishing */
+
+static ngx_int_t sim_publish_callback(ngx_int_t status, void *data, nchan_simulation_t *sim) {
+  if(status != NCHAN_MESSAGE_QUEUED && status != NCHAN_MESSAGE_RECEIVED && !sim->finished) {
+    sim->publish_failures++;
+  }
+  sim_release(sim);
+  return NGX_OK;
+}
+
+static void sim_publish(nchan_simulation_t *sim, sim_step_t *step) {
+  nchan_msg_t           msg;
+  ngx_uint_t            i;
+  ngx_int_t             worker;
+  uint64_t              cpu;
+
+  for(i = 0; i < step->channels; i++) {
+    worker = step->worker >= 0 ? step->worker : (ngx_int_t )(step->turn++ % MAX_FAKE_WORKERS);
+
+    ngx_memzero(&msg, sizeof(msg));
+    msg.storage = NCHAN_MSG_STACK;
+    msg.buf.temporary = 1;
+    msg.buf.memory = 1;
+    msg.buf.last_buf = 1;
+    msg.buf.start = sim->msgbuf;
+    msg.buf.pos = sim->msgbuf;
+    msg.buf.end = sim->msgbuf + step->size;
+    msg.buf.last = msg.buf.end;
+    msg.id.time = 0;
+    msg.id.tag.fixed[0] = 0;
+    msg.id.tagactive = 0;
+    msg.id.tagcount = 1;
+
+    cpu = sim_cpu_nsec();
+    memstore_fakeprocess_push(worker);
+    sim->published++;
+    sim->worker[worker].published++;
+    sim->refcount++;
+    sim->cf->storage_engine->publish(&step->id[i], &msg, sim->cf, (callback_pt )sim_publish_callback, sim);
+    memstore_fakeprocess_pop();
+    sim_op_done(sim, SIM_PUBLISH, worker, cpu);
+  }
+}
+
+/* the script */
+
+static ngx_int_t sim_parse_channels(nchan_simulation_t *sim, sim_step_t *step, ngx_str_t *channel) {
+  u_char         *cur, *end, *pattern;
+  size_t          len;
+  ngx_uint_t      i;
+
+  if((step->id = ngx_palloc(sim->pool, sizeof(*step->id) * step->channels)) == NULL) {
+    return NGX_ERROR;
+  }
+  pattern = ngx_strlchr(channel->data, channel->data + channel->len, '{');
+  if(pattern && (channel->data + channel->len - pattern < 3 || ngx_strncmp(pattern, "{n}", 3) != 0)) {
+    pattern = NULL;
+  }
+  for(i = 0; i < step->channels; i++) {
+    len = 1 + channel->len + NGX_INT_T_LEN;
+    if((cur = ngx_palloc(sim->pool, len)) == NULL) {
+      return NGX_ERROR;
+    }
+    step->id[i].data = cur;
+    end = cur + len;
+    if(channel->data[0] != '/') {
+      *cur++ = '/';
+    }
+    if(pattern) {
+      cur = ngx_slprintf(cur, end, "%*s%ui%*s", (size_t )(pattern - channel->data), channel->data, i, (size_t )(channel->data + channel->len - pattern - 3), pattern + 3);
+    }
+    else {
+      cur = ngx_cpymem(cur, channel->data, channel->len);
+    }
+    step->id[i].len = cur - step->id[i].data;
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t sim_parse_option(sim_step_t *step, ngx_str_t *opt) {
+  u_char         *eq = ngx_strlchr(opt->data, opt->data + opt->len, '=');
+  ngx_str_t       key, val;
+  ngx_int_t       n;
+
+  if(eq == NULL) {
+    return NGX_ERROR;
+  }
+  key.data = opt->data;
+  key.len = eq - opt->data;
+  val.data = eq + 1;
+  val.len = opt->data + opt->len - val.data;
+
+  if(nchan_strmatch(&key, 1, "size")) {
+    if(step->op != SIM_PUBLISH || (n = ngx_parse_size(&val)) == NGX_ERROR) {
+      return NGX_ERROR;
+    }
+    step->size = n;
+  }
+  else if(nchan_strmatch(&key, 1, "every")) {
+    if(step->op != SIM_PUBLISH || (n = ngx_parse_time(&val, 0)) == NGX_ERROR) {
+      return NGX_ERROR;
+    }
+    step->every = n;
+  }
+  else if(nchan_strmatch(&key, 1, "count")) {
+    if(step->op != SIM_PUBLISH || (n = ngx_atoi(val.data, val.len)) == NGX_ERROR) {
+      return NGX_ERROR;
+    }
+    step->remaining = n;
+  }
+  else if(nchan_strmatch(&key, 1, "subscribers")) {
+    if(step->op != SIM_SUBSCRIBE || (n = ngx_atoi(val.data, val.len)) == NGX_ERROR) {
+      return NGX_ERROR;
+    }
+    step->subscribers = n;
+  }
+  else if(nchan_strmatch(&key, 1, "channels")) {
+    if((n = ngx_atoi(val.data, val.len)) == NGX_ERROR || n < 1) {
+      return NGX_ERROR;
+    }
+    step->channels = n;
+  }
+  else {
+    return NGX_ERROR;
+  }
+  return NGX_OK;
+}
+
+#define SIM_MAX_TOKENS 16
+
+static ngx_int_t sim_parse_line(nchan_simulation_t *sim, ngx_uint_t line, ngx_str_t *tok, ngx_uint_t n, u_char **err) {
+  static u_char  *bad_line = (u_char *)"expected <time> <worker> <subscribe|unsubscribe|publish> <channel> [<option>=<value> ...]";
+  sim_step_t     *step;
+  ngx_int_t       val;
+  ngx_uint_t      i;
+  ngx_msec_t      last;
+
+  if(nchan_strmatch(&tok[0], 1, "seed")) {
+    if(n != 2 || (val = ngx_atoi(tok[1].data, tok[1].len)) == NGX_ERROR) {
+      *err = (u_char *)"expected seed <n>";
+      return NGX_ERROR;
+    }
+    sim->seed = val;
+    return NGX_OK;
+  }
+  if(nchan_strmatch(&tok[0], 1, "end")) {
+    if(n != 2 || (val = ngx_parse_time(&tok[1], 0)) == NGX_ERROR) {
+      *err = (u_char *)"expected end <time>";
+      return NGX_ERROR;
+    }
+    sim->end = val;
+    sim->end_set = 1;
+    return NGX_OK;
+  }
+
+  if(n < 4) {
+    *err = bad_line;
+    return NGX_ERROR;
+  }
+  if((step = ngx_array_push(&sim->steps)) == NULL) {
+    *err = (u_char *)"out of memory";
+    return NGX_ERROR;
+  }
+  ngx_memzero(step, sizeof(*step));
+  step->line = line;
+  step->channels = 1;
+  step->subscribers = 1;
+  step->remaining = 1;
+  step->size = NCHAN_SIMULATION_DEFAULT_MESSAGE_SIZE;
+
+  if((val = ngx_parse_time(&tok[0], 0)) == NGX_ERROR) {
+    *err = (u_char *)"invalid time";
+    return NGX_ERROR;
+  }
+  step->at = val;
+
+  if(tok[1].len == 1 && tok[1].data[0] == '*') {
+    step->worker = -1;
+  }
+  else if((step->worker = ngx_atoi(tok[1].data, tok[1].len)) == NGX_ERROR || step->worker >= MAX_FAKE_WORKERS) {
+    *err = (u_char *)"invalid worker. must be * or less than MAX_FAKE_WORKERS";
+    return NGX_ERROR;
+  }
+
+  if(nchan_strmatch(&tok[2], 1, "subscribe")) {
+    step->op = SIM_SUBSCRIBE;
+  }
+  else if(nchan_strmatch(&tok[2], 1, "unsubscribe")) {
+    step->op = SIM_UNSUBSCRIBE;
+  }
+  else if(nchan_strmatch(&tok[2], 1, "publish")) {
+    step->op = SIM_PUBLISH;
+  }
+  else {
+    *err = bad_line;
+    return NGX_ERROR;
+  }
+
+  for(i = 4; i < n; i++) {
+    if(sim_parse_option(step, &tok[i]) != NGX_OK) {
+      *err = (u_char *)"invalid option for this step";
+      return NGX_ERROR;
+    }
+  }
+  if(sim_parse_channels(sim, step, &tok[3]) != NGX_OK) {
+    *err = (u_char *)"out of memory";
+    return NGX_ERROR;
+  }
+  if(step->op == SIM_PUBLISH && step->size > sim->msgbuf_len) {
+    sim->msgbuf_len = step->size;
+  }
+
+  last = step->at + (step->remaining > 0 ? step->every * (step->remaining - 1) : 0);
+  if(!sim->end_set && last + NCHAN_SIMULATION_COOLDOWN > sim->end) {
+    sim->end = last + NCHAN_SIMULATION_COOLDOWN;
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t sim_load_script(nchan_simulation_t *sim, ngx_str_t *path, u_char *errbuf, size_t errlen) {
+  ngx_fd_t          fd;
+  ngx_file_info_t   fi;
+  u_char           *buf, *cur, *end, *eol, *err = NULL;
+  ssize_t           n;
+  size_t            size, got = 0;
+  ngx_str_t         tok[SIM_MAX_TOKENS];
+  ngx_uint_t        ntok, line = 0;
+
+  fd = ngx_open_file(path->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+  if(fd == NGX_INVALID_FILE) {
+    ngx_snprintf(errbuf, errlen, "can't open %V%Z", path);
+    return NGX_ERROR;
+  }
+  if(ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+    ngx_close_file(fd);
+    ngx_snprintf(errbuf, errlen, "can't stat %V%Z", path);
+    return NGX_ERROR;
+  }
+  size = ngx_file_size(&fi);
+  if((buf = ngx_palloc(sim->pool, size + 1)) == NULL) {
+    ngx_close_file(fd);
+    ngx_snprintf(errbuf, errlen, "out of memory%Z");
+    return NGX_ERROR;
+  }
+  while(got < size) {
+    n = ngx_read_fd(fd, buf + got, size - got);
+    if(n <= 0) {
+      break;
+    }
+    got += n;
+  }
+  ngx_close_file(fd);
+  if(got < size) {
+    ngx_snprintf(errbuf, errlen, "can't read %V%Z", path);
+    return NGX_ERROR;
+  }
+
+  for(cur = buf, end = buf + size; cur < end; cur = eol + 1) {
+    line++;
+    if((eol = ngx_strlchr(cur, end, '\n')) == NULL) {
+      eol = end;
+    }
+    ntok = 0;
+    while(cur < eol && *cur != '#') {
+      if(*cur == ' ' || *cur == '\t' || *cur == '\r') {
+        cur++;
+        continue;
+      }
+      if(ntok == SIM_MAX_TOKENS) {
+        err = (u_char *)"too many options";
+        break;
+      }
+      tok[ntok].data = cur;
+      while(cur < eol && *cur != ' ' && *cur != '\t' && *cur != '\r' && *cur != '#') {
+        cur++;
+      }
+      tok[ntok].len = cur - tok[ntok].data;
+      ntok++;
+    }
+    if(err == NULL && ntok > 0) {
+      sim_parse_line(sim, line, tok, ntok, &err);
+    }
+    if(err) {
+      ngx_snprintf(errbuf, errlen, "%V line %ui: %s%Z", path, line, err);
+      return NGX_ERROR;
+    }
+  }
+  return NGX_OK;
+}
+
+/* the run */
+
+static void sim_run(nchan_simulation_t *sim) {
+  sim_step_t     *step, *steps = sim->steps.elts;
+  ngx_uint_t      i, nsteps = sim->steps.nelts;
+  ngx_msec_t      next, timer;
+  uint64_t        cpu;
+
+  srandom(sim->seed);
+  srand(sim->seed);
+  sim_clock_set(sim, 0);
+
+  for(;;) {
+    next = sim->end;
+    for(i = 0; i < nsteps; i++) {
+      if(steps[i].remaining > 0 && steps[i].at < next) {
+        next = steps[i].at;
+      }
+    }
+    timer = sim_timer_find(sim);
+    if(timer != NGX_TIMER_INFINITE && sim->now + timer < next) {
+      next = sim->now + timer;
+    }
+    sim_clock_set(sim, next);
+
+    cpu = sim_cpu_nsec();
+    sim_timers_expire(sim);
+    sim_op_done(sim, SIM_TIMERS, -1, cpu);
+
+    for(i = 0; i < nsteps; i++) {
+      step = &steps[i];
+      while(step->remaining > 0 && step->at <= sim->now) {
+        switch(step->op) {
+          case SIM_SUBSCRIBE:
+            sim_subscribe(sim, step);
+            break;
+          case SIM_UNSUBSCRIBE:
+            sim_unsubscribe(sim, step);
+            break;
+          case SIM_PUBLISH:
+            sim_publish(sim, step);
+            break;
+          default:
+            break;
+        }
+        step->remaining--;
+        step->at += step->every;
+      }
+    }
+    sim_sample(sim);
+
+    if(sim->now >= sim->end) {
+      break;
+    }
+  }
+}
+
+static u_char *sim_write_results(nchan_simulation_t *sim, u_char *cur, u_char *last) {
+  memstore_worker_stats_t  *ws = memstore_worker_stats(-1);
+  nchan_stub_status_t      *st = nchan_get_stub_status_stats();
+  ngx_uint_t                i, n;
+  sim_op_stats_t           *op;
+  sim_worker_stats_t       *w;
+
+  cur = ngx_slprintf(cur, last, "{\"workers\": %i, \"simulated_msec\": %M, \"seed\": %ul, \"published\": %ui, \"publish_failures\": %ui, \"received\": %ui,\n \"operations\": {",
+                     (ngx_int_t )MAX_FAKE_WORKERS, sim->now, sim->seed, sim->published, sim->publish_failures, sim->received);
+  for(i = 0; i < SIM_OPS; i++) {
+    op = &sim->op[i];
+    cur = ngx_slprintf(cur, last, "%s\n  \"%s\": {\"count\": %ui, \"cpu_usec\": %uL, \"cpu_nsec_per_op\": %uL}", i == 0 ? "" : ",",
+                       sim_op_name[i], op->count, op->cpu_nsec / 1000, op->count > 0 ? op->cpu_nsec / op->count : 0);
+  }
+  cur = ngx_slprintf(cur, last, "},\n \"per_worker\": [");
+  for(i = 0; i < MAX_FAKE_WORKERS; i++) {
+    w = &sim->worker[i];
+    cur = ngx_slprintf(cur, last, "%s\n  {\"published\": %ui, \"subscribed\": %ui, \"received\": %ui, \"cpu_usec\": %uL}", i == 0 ? "" : ",",
+                       w->published, w->subscribed, w->received, w->cpu_nsec / 1000);
+  }
+  cur = ngx_slprintf(cur, last, "],\n \"ipc_alerts\": %uA", st->ipc_total_alerts_sent - sim->ipc_alerts);
+  if(ws) {
+    //only counted with an nchan_stub_status location
+    cur = ngx_slprintf(cur, last, ",\n \"ipc_alerts_by_command\": {");
+    for(i = 0, n = 0; i < memstore_ipc_command_count(); i++) {
+      if(ws->ipc_alerts_sent[i] > sim->ipc_alerts_by_cmd[i]) {
+        cur = ngx_slprintf(cur, last, "%s\"%s\": %uA", n++ == 0 ? "" : ", ", memstore_ipc_command_name(i), ws->ipc_alerts_sent[i] - sim->ipc_alerts_by_cmd[i]);
+      }
+    }
+    cur = ngx_slprintf(cur, last, "}");
+  }
+  cur = ngx_slprintf(cur, last, ",\n \"high_water\": {\"shm_bytes\": %uz, \"channels\": %uA, \"subscribers\": %uA, \"messages\": %uA}}\n",
+                     sim->high_water.shm, sim->high_water.channels, sim->high_water.subscribers, sim->high_water.messages);
+  return cur;
+}
+
+ngx_int_t nchan_simulation_handler(ngx_http_request_t *r) {
+  nchan_loc_conf_t         *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  memstore_worker_stats_t  *ws;
+  nchan_simulation_t       *sim;
+  ngx_pool_t               *pool;
+  ngx_buf_t                *b;
+  ngx_chain_t              *cl;
+  u_char                    err[512];
+  ngx_uint_t                i;
+  ngx_int_t                 rc;
+
+  if(r->method != NGX_HTTP_GET) {
+    return NGX_HTTP_NOT_ALLOWED;
+  }
+  if(ngx_http_discard_request_body(r) != NGX_OK) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  if((pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log)) == NULL
+   || (sim = ngx_pcalloc(pool, sizeof(*sim))) == NULL
+   || ngx_array_init(&sim->steps, pool, 16, sizeof(sim_step_t)) != NGX_OK) {
+    nchan_log_request_error(r, "couldn't allocate simulation");
+    if(pool) ngx_destroy_pool(pool);
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  sim->pool = pool;
+  sim->cf = cf;
+  sim->refcount = 1;
+  sim->seed = NCHAN_SIMULATION_DEFAULT_SEED;
+  nchan_slist_init(&sim->subs, sim_sub_t, prev, next);
+
+  if(sim_load_script(sim, &cf->simulation_script, err, sizeof(err)) != NGX_OK) {
+    nchan_log_request_error(r, "simulation script error: %s", err);
+    sim_release(sim);
+    return nchan_respond_cstring(r, NGX_HTTP_INTERNAL_SERVER_ERROR, &NCHAN_CONTENT_TYPE_TEXT_PLAIN, (char *)err, 0);
+  }
+  if((sim->msgbuf = ngx_palloc(pool, sim->msgbuf_len + 1)) == NULL
+   || (b = ngx_create_temp_buf(r->pool, NCHAN_SIMULATION_RESPONSE_SIZE)) == NULL
+   || (cl = ngx_alloc_chain_link(r->pool)) == NULL) {
+    nchan_log_request_error(r, "couldn't allocate simulation buffers");
+    sim_release(sim);
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  ngx_memset(sim->msgbuf, 'x', sim->msgbuf_len);
+
+  sim->ipc_alerts = nchan_get_stub_status_stats()->ipc_total_alerts_sent;
+  if((ws = memstore_worker_stats(-1)) != NULL) {
+    for(i = 0; i < MEMSTORE_WORKER_STATS_IPC_CODES; i++) {
+      sim->ipc_alerts_by_cmd[i] = ws->ipc_alerts_sent[i];
+    }
+  }
+
+  DBG("%p running %ui steps until %M msec", sim, sim->steps.nelts, sim->end);
+  if(sim_timers_record(sim) != NGX_OK) {
+    nchan_log_request_error(r, "couldn't allocate simulation timer records");
+    sim_release(sim);
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  sim->real_cached_time = ngx_cached_time;
+  sim->start_time = *ngx_cached_time;
+  sim->start_msec = ngx_current_msec;
+  sim_run(sim);
+  b->last = sim_write_results(sim, b->last, b->end);
+
+  //leave nothing behind, and let whatever that sets off finish on the simulated clock
+  sim->finished = 1;
+  sim_dequeue_subscribers(sim);
+  sim_timers_expire(sim);
+  sim_clock_restore(sim);
+  sim_release(sim);
+
+  b->last_buf = 1;
+  cl->buf = b;
+  cl->next = NULL;
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_type = sim_content_type;
+  r->headers_out.content_length_n = ngx_buf_size(b);
+  rc = ngx_http_send_header(r);
+  if(rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
+  return ngx_http_output_filter(r, cl);
+}
+
+#endif //FAKESHARD
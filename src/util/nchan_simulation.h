@@ -0,0 +1,13 @@
+#ifndef NCHAN_SIMULATION_H
+#define NCHAN_SIMULATION_H
+
+#define NCHAN_SIMULATION_COOLDOWN 1000 //simulated msec to keep running after the script's last step, unless it says when to end
+#define NCHAN_SIMULATION_DEFAULT_MESSAGE_SIZE 100
+#define NCHAN_SIMULATION_DEFAULT_SEED 1
+#define NCHAN_SIMULATION_RESPONSE_SIZE 8192
+
+#if FAKESHARD
+ngx_int_t nchan_simulation_handler(ngx_http_request_t *r);
+#endif
+
+#endif //NCHAN_SIMULATION_H
@@ -0,0 +1,138 @@
+#include <nchan_module.h>
+#include "nchan_singleflight.h"
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "SINGLEFLIGHT: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "SINGLEFLIGHT: " fmt, ##args)
+
+typedef struct singleflight_waiter_s singleflight_waiter_t;
+struct singleflight_waiter_s {
+  callback_pt              cb;
+  void                    *pd;
+  singleflight_waiter_t   *next;
+}; //singleflight_waiter_t
+
+typedef struct {
+  ngx_str_t                key;
+  ngx_uint_t               flight; //so that a late response can't resolve a newer request for the same key
+  nchan_singleflight_t    *sf;
+  singleflight_waiter_t   *waiters;
+  ngx_event_t              timeout_ev;
+} singleflight_inflight_t;
+
+static void *inflight_id(void *d) {
+  return &((singleflight_inflight_t *)d)->key;
+}
+
+static void inflight_finish(nchan_singleflight_t *sf, ngx_rbtree_node_t *node, ngx_int_t status, void *data) {
+  singleflight_inflight_t  *inflight = rbtree_data_from_node(node);
+  singleflight_waiter_t    *cur, *next;
+
+  //take it out of the tree first, the callbacks may start new requests for this key
+  cur = inflight->waiters;
+  if(inflight->timeout_ev.timer_set) {
+    ngx_del_timer(&inflight->timeout_ev);
+  }
+  rbtree_remove_node(&sf->tree, node);
+  rbtree_destroy_node(&sf->tree, node);
+
+  for(/* void */; cur != NULL; cur = next) {
+    next = cur->next;
+    cur->cb(status, data, cur->pd);
+    ngx_free(cur);
+  }
+}
+
+static void inflight_timeout_handler(ngx_event_t *ev) {
+  singleflight_inflight_t  *inflight = ev->data;
+  nchan_singleflight_t     *sf = inflight->sf;
+  ERR("gave up waiting on %s for %V", sf->name, &inflight->key);
+  inflight_finish(sf, rbtree_node_from_data(inflight), sf->timeout_status, NULL);
+}
+
+ngx_int_t nchan_singleflight_wait(nchan_singleflight_t *sf, ngx_str_t *key, callback_pt cb, void *pd, ngx_uint_t *flight) {
+  ngx_rbtree_node_t        *node;
+  singleflight_inflight_t  *inflight;
+  singleflight_waiter_t    *waiter;
+
+  *flight = 0;
+  if(!sf->initialized) {
+    rbtree_init(&sf->tree, sf->name, inflight_id, NULL, NULL);
+    sf->initialized = 1;
+  }
+
+  if((node = rbtree_find_node(&sf->tree, key)) != NULL) {
+    inflight = rbtree_data_from_node(node);
+    if((waiter = ngx_alloc(sizeof(*waiter), ngx_cycle->log)) == NULL) {
+      ERR("couldn't allocate waiter on %s for %V", sf->name, key);
+      return NGX_DECLINED; //just make the request then
+    }
+    waiter->cb = cb;
+    waiter->pd = pd;
+    waiter->next = inflight->waiters;
+    inflight->waiters = waiter;
+    DBG("wait on %s for %V", sf->name, key);
+    return NGX_OK;
+  }
+
+  //nothing in flight. the caller's going to make the request
+  if((node = rbtree_create_node(&sf->tree, sizeof(*inflight) + key->len)) == NULL) {
+    ERR("couldn't allocate %s entry for %V", sf->name, key);
+    return NGX_DECLINED;
+  }
+  inflight = rbtree_data_from_node(node);
+  inflight->key.len = key->len;
+  inflight->key.data = (u_char *)&inflight[1];
+  ngx_memcpy(inflight->key.data, key->data, key->len);
+  if(++sf->last_flight == 0) {
+    sf->last_flight = 1;
+  }
+  inflight->flight = sf->last_flight;
+  inflight->sf = sf;
+  inflight->waiters = NULL;
+  ngx_memzero(&inflight->timeout_ev, sizeof(inflight->timeout_ev));
+  nchan_init_timer(&inflight->timeout_ev, inflight_timeout_handler, inflight);
+  ngx_add_timer(&inflight->timeout_ev, sf->timeout);
+  rbtree_insert_node(&sf->tree, node);
+
+  *flight = inflight->flight;
+  return NGX_DECLINED;
+}
+
+ngx_int_t nchan_singleflight_resolve(nchan_singleflight_t *sf, ngx_str_t *key, ngx_uint_t flight, ngx_int_t status, void *data) {
+  ngx_rbtree_node_t        *node;
+  singleflight_inflight_t  *inflight;
+
+  if(flight == 0 || !sf->initialized || (node = rbtree_find_node(&sf->tree, key)) == NULL) {
+    return NGX_OK;
+  }
+  inflight = rbtree_data_from_node(node);
+  if(inflight->flight != flight) {
+    DBG("late response on %s for %V, a newer request is in flight", sf->name, key);
+    return NGX_OK;
+  }
+  inflight_finish(sf, node, status, data);
+  return NGX_OK;
+}
+
+static ngx_int_t inflight_shutdown_walker(rbtree_seed_t *seed, void *node_data, void *privdata) {
+  singleflight_inflight_t  *inflight = node_data;
+  singleflight_waiter_t    *cur, *next;
+  if(inflight->timeout_ev.timer_set) {
+    ngx_del_timer(&inflight->timeout_ev);
+  }
+  for(cur = inflight->waiters; cur != NULL; cur = next) {
+    next = cur->next;
+    ngx_free(cur);
+  }
+  return NGX_OK;
+}
+
+ngx_int_t nchan_singleflight_shutdown(nchan_singleflight_t *sf) {
+  if(sf->initialized) {
+    rbtree_empty(&sf->tree, inflight_shutdown_walker, NULL);
+    sf->initialized = 0;
+  }
+  return NGX_OK;
+}
@@ -0,0 +1,29 @@
+#ifndef NCHAN_SINGLEFLIGHT_H
+#define NCHAN_SINGLEFLIGHT_H
+
+#include <util/nchan_rbtree.h>
+
+// worker-local collapsing of identical requests: the first caller for a key makes the request,
+// and everyone else asking for the same key while it's in flight waits for its result.
+// set up statically with the first three fields, the rest is managed here.
+typedef struct {
+  char                      *name;
+  ngx_msec_t                 timeout;
+  ngx_int_t                  timeout_status; //what the waiters get when the request takes too long
+  rbtree_seed_t              tree;
+  ngx_uint_t                 last_flight;
+  unsigned                   initialized:1;
+} nchan_singleflight_t;
+
+// NGX_OK if an identical request is already in flight, and cb will be called with its result.
+// NGX_DECLINED if the caller should make the request, and then call nchan_singleflight_resolve with the flight id.
+// *flight is set to 0 if the request isn't being tracked, in which case resolving it does nothing.
+ngx_int_t nchan_singleflight_wait(nchan_singleflight_t *sf, ngx_str_t *key, callback_pt cb, void *pd, ngx_uint_t *flight);
+
+// wake up everyone waiting on this flight. a flight that has already timed out (or been resolved) is left alone,
+// as is any newer flight for the same key.
+ngx_int_t nchan_singleflight_resolve(nchan_singleflight_t *sf, ngx_str_t *key, ngx_uint_t flight, ngx_int_t status, void *data);
+
+ngx_int_t nchan_singleflight_shutdown(nchan_singleflight_t *sf);
+
+#endif //NCHAN_SINGLEFLIGHT_H
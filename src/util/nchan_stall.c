@@ -0,0 +1,111 @@
+#include <nchan_module.h>
+#include <store/memory/store.h>
+#include "nchan_stall.h"
+#if (NCHAN_HAVE_SDT)
+#include <sys/sdt.h>
+#endif
+
+#define STALL_LOG_CHANNEL_ID_MAX 255
+
+static ngx_msec_t            threshold = NCHAN_DEFAULT_STALL_THRESHOLD;
+static nchan_stall_stats_t  *worker_stats = NULL;
+
+static const char *site_name[] = {
+  [NCHAN_STALL_SPOOL_RESPOND] = "spool_respond",
+  [NCHAN_STALL_MESSAGES_GC] =   "messages_gc",
+  [NCHAN_STALL_REAPER] =        "reaper",
+  [NCHAN_STALL_DEFLATE] =       "deflate",
+  [NCHAN_STALL_REDIS_REPLY] =   "redis_reply",
+  [NCHAN_STALL_IPC] =           "ipc"
+};
+
+void nchan_stall_set_threshold(ngx_msec_t msec) {
+  threshold = msec;
+}
+
+ngx_msec_t nchan_stall_threshold(void) {
+  return threshold;
+}
+
+static uint64_t stall_now_usec(void) {
+  //not the cached ngx_current_msec, which doesn't move until the event loop comes back around
+#if defined(CLOCK_MONOTONIC)
+  struct timespec   ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t )ts.tv_sec * 1000000 + (uint64_t )ts.tv_nsec / 1000;
+#else
+  struct timeval    tv;
+  ngx_gettimeofday(&tv);
+  return (uint64_t )tv.tv_sec * 1000000 + (uint64_t )tv.tv_usec;
+#endif
+}
+
+uint64_t nchan_stall_start(void) {
+  if(threshold == 0) {
+    return 0;
+  }
+  return stall_now_usec();
+}
+
+void nchan_stall_end(nchan_stall_site_t site, uint64_t start, const char *detail, ngx_str_t *channel_id, ngx_int_t subscribers) {
+  uint64_t     now, usec;
+  u_char       buf[STALL_LOG_CHANNEL_ID_MAX + 128], *cur = buf, *last = buf + sizeof(buf);
+  ngx_str_t    chid;
+
+  if(start == 0) {
+    return;
+  }
+  now = stall_now_usec();
+  usec = now > start ? now - start : 0;
+
+#if (NCHAN_HAVE_SDT)
+  DTRACE_PROBE3(nchan, stall_probe, site, usec, subscribers);
+#endif
+
+  if(worker_stats == NULL && (worker_stats = memstore_worker_stall_stats(-1)) == NULL) {
+    return;
+  }
+  nchan_histogram_record(&worker_stats->site[site], usec);
+  if(usec < (uint64_t )threshold * 1000) {
+    return;
+  }
+  worker_stats->stalls[site]++;
+
+  if(detail) {
+    cur = ngx_snprintf(cur, last - cur, " (%s)", detail);
+  }
+  if(channel_id) {
+    chid.data = channel_id->data;
+    chid.len = ngx_min(channel_id->len, STALL_LOG_CHANNEL_ID_MAX);
+    cur = ngx_snprintf(cur, last - cur, ", channel %V%s", &chid, chid.len < channel_id->len ? "..." : "");
+  }
+  if(subscribers >= 0) {
+    cur = ngx_snprintf(cur, last - cur, ", %i subscribers", subscribers);
+  }
+  ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0, "nchan: %s took %uL.%03uL msec%*s", site_name[site], usec / 1000, usec % 1000, (size_t )(cur - buf), buf);
+}
+
+nchan_stall_stats_t *nchan_stall_stats_merged(void) {
+  static nchan_stall_stats_t  merged;
+  nchan_stall_stats_t        *stats;
+  ngx_int_t                   i, workers = memstore_worker_count();
+  int                         s;
+
+  for(s = 0; s < NCHAN_STALL_SITES; s++) {
+    nchan_histogram_init(&merged.site[s]);
+    merged.stalls[s] = 0;
+  }
+  for(i = 0; i < workers; i++) {
+    if((stats = memstore_worker_stall_stats(i)) != NULL) {
+      for(s = 0; s < NCHAN_STALL_SITES; s++) {
+        nchan_histogram_merge(&merged.site[s], &stats->site[s]);
+        merged.stalls[s] += stats->stalls[s];
+      }
+    }
+  }
+  return &merged;
+}
+
+const char *nchan_stall_site_name(nchan_stall_site_t site) {
+  return site_name[site];
+}
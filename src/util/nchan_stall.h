@@ -0,0 +1,37 @@
+#ifndef NCHAN_STALL_H
+#define NCHAN_STALL_H
+
+#include <util/nchan_histogram.h>
+
+// timing probes around the things that can hold up a worker's event loop
+typedef enum {
+  NCHAN_STALL_SPOOL_RESPOND,    //responding to a spool's subscribers
+  NCHAN_STALL_MESSAGES_GC,      //removing a channel's expired messages
+  NCHAN_STALL_REAPER,           //a reaper's sweep
+  NCHAN_STALL_DEFLATE,          //compressing a message
+  NCHAN_STALL_REDIS_REPLY,      //handling a Redis PUBSUB reply
+  NCHAN_STALL_IPC,              //handling an interprocess alert
+  NCHAN_STALL_SITES
+} nchan_stall_site_t;
+
+// one per worker, in shared memory
+typedef struct {
+  nchan_histogram_t           site[NCHAN_STALL_SITES]; //usec
+  ngx_atomic_uint_t           stalls[NCHAN_STALL_SITES]; //over the threshold
+} nchan_stall_stats_t;
+
+// log and count calls that take at least this long. 0 to stop timing them
+void nchan_stall_set_threshold(ngx_msec_t msec);
+ngx_msec_t nchan_stall_threshold(void);
+
+// the start time to pass to nchan_stall_end(), or 0 if probes are off
+uint64_t nchan_stall_start(void);
+
+// detail, channel_id and subscribers are only for the log, and can be NULL, NULL and -1
+void nchan_stall_end(nchan_stall_site_t site, uint64_t start, const char *detail, ngx_str_t *channel_id, ngx_int_t subscribers);
+
+// all the workers' timings, added up
+nchan_stall_stats_t *nchan_stall_stats_merged(void);
+const char *nchan_stall_site_name(nchan_stall_site_t site);
+
+#endif //NCHAN_STALL_H
@@ -0,0 +1,130 @@
+#include <nchan_module.h>
+#include "nchan_timer_wheel.h"
+
+static struct {
+  nchan_wheel_timer_t      *slot[NCHAN_TIMER_WHEEL_SLOTS];
+  ngx_msec_t                tick; //the last second whose slot was run
+  ngx_uint_t                count;
+  ngx_event_t               ev;
+} wheel;
+
+static void wheel_ev_handler(ngx_event_t *ev);
+
+static void wheel_list_insert(nchan_wheel_timer_t *t, nchan_wheel_timer_t **head) {
+  t->head = head;
+  t->prev = NULL;
+  t->next = *head;
+  if(*head) {
+    (*head)->prev = t;
+  }
+  *head = t;
+}
+
+static void wheel_list_remove(nchan_wheel_timer_t *t) {
+  if(t->prev) {
+    t->prev->next = t->next;
+  }
+  else {
+    *t->head = t->next;
+  }
+  if(t->next) {
+    t->next->prev = t->prev;
+  }
+  t->prev = NULL;
+  t->next = NULL;
+  t->head = NULL;
+}
+
+static void wheel_ev_add(void) {
+  //wake up at the start of the next second
+  if(wheel.ev.handler == NULL) {
+    nchan_init_timer(&wheel.ev, wheel_ev_handler, NULL);
+  }
+  ngx_add_timer(&wheel.ev, 1000 - ngx_current_msec % 1000);
+}
+
+void nchan_wheel_timer_init(nchan_wheel_timer_t *t, void (*handler)(nchan_wheel_timer_t *), void *data) {
+  ngx_memzero(t, sizeof(*t));
+  t->handler = handler;
+  t->data = data;
+}
+
+void nchan_wheel_timer_add(nchan_wheel_timer_t *t, ngx_msec_t msec) {
+  ngx_msec_t    expire;
+  
+  if(wheel.count == 0) {
+    //nothing to miss by starting over from now
+    wheel.tick = ngx_current_msec / 1000;
+  }
+  expire = (ngx_current_msec + msec + 999) / 1000;
+  if(expire <= wheel.tick) {
+    expire = wheel.tick + 1;
+  }
+  
+  if(t->timer_set) {
+    wheel_list_remove(t);
+  }
+  else {
+    t->timer_set = 1;
+    wheel.count++;
+  }
+  t->expire = expire;
+  wheel_list_insert(t, &wheel.slot[expire % NCHAN_TIMER_WHEEL_SLOTS]);
+  
+  if(!wheel.ev.timer_set) {
+    wheel_ev_add();
+  }
+}
+
+void nchan_wheel_timer_del(nchan_wheel_timer_t *t) {
+  if(!t->timer_set) {
+    return;
+  }
+  wheel_list_remove(t);
+  t->timer_set = 0;
+  wheel.count--;
+}
+
+static void wheel_run_slot(ngx_msec_t tick) {
+  nchan_wheel_timer_t    **slot = &wheel.slot[tick % NCHAN_TIMER_WHEEL_SLOTS];
+  nchan_wheel_timer_t     *firing = *slot, *t;
+  
+  //handlers may add or delete any timer, including ones in this slot, so take them all out first
+  *slot = NULL;
+  for(t = firing; t != NULL; t = t->next) {
+    t->head = &firing;
+  }
+  
+  while((t = firing) != NULL) {
+    wheel_list_remove(t);
+    if(t->expire > tick) {
+      //not this time around
+      wheel_list_insert(t, slot);
+      continue;
+    }
+    t->timer_set = 0;
+    wheel.count--;
+    t->handler(t);
+  }
+}
+
+static void wheel_ev_handler(ngx_event_t *ev) {
+  ngx_msec_t    now = ngx_current_msec / 1000;
+  
+  if(now < wheel.tick) {
+    //the clock's been set back, which only an nchan_simulation run does
+    wheel.tick = now;
+  }
+  if(now - wheel.tick > NCHAN_TIMER_WHEEL_SLOTS) {
+    //way behind. every slot gets run once, and that's enough
+    wheel.tick = now - NCHAN_TIMER_WHEEL_SLOTS;
+  }
+  while(wheel.tick < now) {
+    wheel.tick++;
+    wheel_run_slot(wheel.tick);
+  }
+  
+  if(wheel.count > 0 && !wheel.ev.timer_set) {
+    wheel_ev_add();
+  }
+}
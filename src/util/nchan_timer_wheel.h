@@ -0,0 +1,25 @@
+#ifndef NCHAN_TIMER_WHEEL_H
+#define NCHAN_TIMER_WHEEL_H
+
+// coarse per-worker timers for subscriber timeouts and pings, rounded up to the next whole second.
+// they all share one nginx timer, so adding, re-arming and deleting them never touches nginx's timer tree.
+#define NCHAN_TIMER_WHEEL_SLOTS 256 //one per second. longer timers go around more than once
+
+typedef struct nchan_wheel_timer_s nchan_wheel_timer_t;
+struct nchan_wheel_timer_s {
+  void                     (*handler)(nchan_wheel_timer_t *);
+  void                      *data;
+  nchan_wheel_timer_t       *prev;
+  nchan_wheel_timer_t       *next;
+  nchan_wheel_timer_t      **head; //the slot it's in
+  ngx_msec_t                 expire; //in seconds
+  unsigned                   timer_set:1;
+};
+
+void nchan_wheel_timer_init(nchan_wheel_timer_t *t, void (*handler)(nchan_wheel_timer_t *), void *data);
+
+// (re)arm the timer. same as deleting it and adding it again, but cheaper
+void nchan_wheel_timer_add(nchan_wheel_timer_t *t, ngx_msec_t msec);
+void nchan_wheel_timer_del(nchan_wheel_timer_t *t);
+
+#endif //NCHAN_TIMER_WHEEL_H
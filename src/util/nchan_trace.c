@@ -0,0 +1,142 @@
+#include <nchan_module.h>
+#include <sys/mman.h>
+#include "nchan_trace.h"
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "TRACE: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "TRACE: " fmt, ##args)
+
+// Each record is a fixed-size write into a MAP_SHARED mapping of the worker's file, so tracing costs a
+// crc32 of the channel id and a 64-byte copy. The kernel writes the pages back whenever it likes, and
+// the file is always readable, even while the worker is running. When it fills up, the oldest records
+// are overwritten.
+
+static ngx_str_t                trace_path = ngx_null_string;
+static size_t                   trace_size = 0;
+
+static nchan_trace_header_t    *trace = NULL;
+static nchan_trace_record_t    *trace_records;
+static size_t                   trace_mapped_size;
+
+void nchan_trace_set_file(ngx_str_t *path, size_t size) {
+  trace_path = *path;
+  trace_size = size;
+}
+
+static uint64_t trace_now_usec(void) {
+  //the cached time is plenty for traffic shapes, and costs nothing
+  ngx_time_t   *tp = ngx_timeofday();
+  return (uint64_t )tp->sec * 1000000 + (uint64_t )tp->msec * 1000;
+}
+
+ngx_int_t nchan_trace_init_worker(ngx_cycle_t *cycle) {
+  u_char           path[NGX_MAX_PATH], old_path[NGX_MAX_PATH];
+  ngx_fd_t         fd;
+  uint64_t         capacity;
+  void            *map;
+
+  if(trace_path.len == 0) {
+    return NGX_OK;
+  }
+  capacity = (trace_size - sizeof(*trace)) / sizeof(*trace_records);
+  trace_mapped_size = sizeof(*trace) + capacity * sizeof(*trace_records);
+
+  if(ngx_snprintf(path, sizeof(path) - 1, "%V.%ui%Z", &trace_path, ngx_worker) == path + sizeof(path) - 1
+   || ngx_snprintf(old_path, sizeof(old_path) - 1, "%s.old%Z", path) == old_path + sizeof(old_path) - 1) {
+    ERR("trace file path %V is too long", &trace_path);
+    return NGX_ERROR;
+  }
+  //after a reload, the old worker with this number may still be writing to the file through its mapping.
+  //move the file aside rather than truncating it out from under that worker.
+  if(ngx_rename_file(path, old_path) == NGX_FILE_ERROR && ngx_errno != NGX_ENOENT) {
+    ngx_log_error(NGX_LOG_WARN, cycle->log, ngx_errno, "nchan: can't move old trace file %s to %s", path, old_path);
+  }
+  fd = ngx_open_file(path, NGX_FILE_RDWR, NGX_FILE_TRUNCATE, NGX_FILE_DEFAULT_ACCESS);
+  if(fd == NGX_INVALID_FILE) {
+    ngx_log_error(NGX_LOG_ERR, cycle->log, ngx_errno, "nchan: can't open trace file %s", path);
+    return NGX_ERROR;
+  }
+  if(ftruncate(fd, trace_mapped_size) == -1) {
+    ngx_log_error(NGX_LOG_ERR, cycle->log, ngx_errno, "nchan: can't size trace file %s", path);
+    ngx_close_file(fd);
+    return NGX_ERROR;
+  }
+  map = mmap(NULL, trace_mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ngx_close_file(fd);
+  if(map == MAP_FAILED) {
+    ngx_log_error(NGX_LOG_ERR, cycle->log, ngx_errno, "nchan: can't map trace file %s", path);
+    return NGX_ERROR;
+  }
+
+  trace = map;
+  trace_records = (nchan_trace_record_t *)&trace[1];
+  ngx_memcpy(trace->magic, NCHAN_TRACE_MAGIC, sizeof(trace->magic));
+  trace->version = NCHAN_TRACE_VERSION;
+  trace->record_size = sizeof(*trace_records);
+  trace->capacity = capacity;
+  trace->written = 0;
+  trace->start_usec = trace_now_usec();
+  trace->pid = ngx_pid;
+  trace->worker = ngx_worker;
+  DBG("tracing to %s, %uL records", path, capacity);
+  return NGX_OK;
+}
+
+void nchan_trace_exit_worker(void) {
+  if(trace) {
+    munmap(trace, trace_mapped_size);
+    trace = NULL;
+  }
+}
+
+static nchan_trace_record_t *trace_record(nchan_trace_event_t event, uint32_t channel_hash, size_t channel_id_len) {
+  nchan_trace_record_t  *rec = &trace_records[trace->written % trace->capacity];
+  ngx_memzero(rec, sizeof(*rec));
+  rec->time_usec = trace_now_usec();
+  rec->event = event;
+  rec->channel_hash = channel_hash;
+  rec->channel_id_len = ngx_min(channel_id_len, 0xFFFF);
+  trace->written++;
+  return rec;
+}
+
+void nchan_trace_publish(ngx_str_t *channel_id, nchan_msg_t *msg) {
+  nchan_trace_record_t  *rec;
+  if(trace == NULL) {
+    return;
+  }
+  rec = trace_record(NCHAN_TRACE_PUBLISH, ngx_crc32_short(channel_id->data, channel_id->len), channel_id->len);
+  rec->size = ngx_buf_size((&msg->buf));
+  if(msg->content_type) {
+    ngx_memcpy(rec->content_type, msg->content_type->data, ngx_min(msg->content_type->len, sizeof(rec->content_type)));
+  }
+}
+
+void nchan_trace_subscribe(subscriber_t *sub, ngx_str_t *channel_id) {
+  nchan_request_ctx_t   *ctx;
+  nchan_trace_record_t  *rec;
+  uint32_t               hash;
+  if(trace == NULL || sub->request == NULL) {
+    return;
+  }
+  hash = ngx_crc32_short(channel_id->data, channel_id->len);
+  if((ctx = ngx_http_get_module_ctx(sub->request, ngx_nchan_module)) != NULL) {
+    ctx->trace_channel_hash = hash;
+    ctx->trace_channel_id_len = ngx_min(channel_id->len, 0xFFFF);
+  }
+  rec = trace_record(sub->last_msgid.time > 0 ? NCHAN_TRACE_RECONNECT : NCHAN_TRACE_SUBSCRIBE, hash, channel_id->len);
+  rec->subscriber_type = sub->type;
+  rec->msgid_time = sub->last_msgid.time;
+  rec->msgid_tag = sub->last_msgid.tag.fixed[0];
+}
+
+void nchan_trace_unsubscribe(subscriber_t *sub) {
+  nchan_request_ctx_t   *ctx;
+  nchan_trace_record_t  *rec;
+  if(trace == NULL || sub->request == NULL || (ctx = ngx_http_get_module_ctx(sub->request, ngx_nchan_module)) == NULL) {
+    return;
+  }
+  rec = trace_record(NCHAN_TRACE_UNSUBSCRIBE, ctx->trace_channel_hash, ctx->trace_channel_id_len);
+  rec->subscriber_type = sub->type;
+}
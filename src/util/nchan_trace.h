@@ -0,0 +1,54 @@
+#ifndef NCHAN_TRACE_H
+#define NCHAN_TRACE_H
+
+// a binary log of publishes and subscriber comings and goings, in a fixed-size ring file per worker.
+// dev/replay.rb reads these to summarize or replay the traffic.
+
+#define NCHAN_TRACE_MAGIC "NCHANTRC"
+#define NCHAN_TRACE_VERSION 1
+#define NCHAN_TRACE_CONTENT_TYPE_MAX 32 //longer content types are truncated
+
+typedef enum {
+  NCHAN_TRACE_PUBLISH = 1,
+  NCHAN_TRACE_SUBSCRIBE,       //a subscriber starting at the newest or oldest message, or the nth
+  NCHAN_TRACE_RECONNECT,       //a subscriber resuming from a message id it was given
+  NCHAN_TRACE_UNSUBSCRIBE
+} nchan_trace_event_t;
+
+// all little-endian on the platforms we build on, and the same size everywhere
+typedef struct {
+  u_char                  magic[8];
+  uint32_t                version;
+  uint32_t                record_size;
+  uint64_t                capacity;   //records
+  uint64_t                written;    //records ever written. the next one goes in slot written % capacity
+  uint64_t                start_usec;
+  int32_t                 pid;
+  uint32_t                worker;
+  u_char                  reserved[16];
+} nchan_trace_header_t;
+
+typedef struct {
+  uint64_t                time_usec;
+  uint32_t                channel_hash;    //crc32 of the channel id
+  uint32_t                size;            //message size, for publishes
+  int64_t                 msgid_time;      //where a subscriber started
+  int16_t                 msgid_tag;
+  uint8_t                 event;           //nchan_trace_event_t
+  uint8_t                 subscriber_type; //subscriber_type_t
+  uint16_t                channel_id_len;
+  uint16_t                reserved;
+  u_char                  content_type[NCHAN_TRACE_CONTENT_TYPE_MAX]; //for publishes. NUL-padded
+} nchan_trace_record_t;
+
+// path prefix ("" for no tracing) and file size. each worker writes to <path>.<worker number>
+void nchan_trace_set_file(ngx_str_t *path, size_t size);
+
+ngx_int_t nchan_trace_init_worker(ngx_cycle_t *cycle);
+void nchan_trace_exit_worker(void);
+
+void nchan_trace_publish(ngx_str_t *channel_id, nchan_msg_t *msg);
+void nchan_trace_subscribe(subscriber_t *sub, ngx_str_t *channel_id);
+void nchan_trace_unsubscribe(subscriber_t *sub);
+
+#endif //NCHAN_TRACE_H
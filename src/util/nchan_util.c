@@ -1,4 +1,5 @@
 #include <nchan_module.h>
+#include <util/nchan_stall.h>
 #include <assert.h>
 
 #if (NGX_ZLIB)
@@ -1091,7 +1092,9 @@ ngx_int_t nchan_deflate_message_if_needed(nchan_msg_t *msg, nchan_loc_conf_t *cf
       }
     }
     else {
+      uint64_t    stall_start = nchan_stall_start();
       ngx_buf_t  *compressed_buf = nchan_common_deflate(&msg->buf, r, pool);
+      nchan_stall_end(NCHAN_STALL_DEFLATE, stall_start, NULL, NULL, -1);
       if(!compressed_buf) {
         if(r) {
           nchan_log_request_error(r, "failed to compress message");
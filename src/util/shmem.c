@@ -62,6 +62,151 @@ size_t shm_used_pages(shmem_t *shm) {
   ngx_uint_t          max = (ngx_uint_t) (size / (ngx_pagesize + sizeof(ngx_slab_page_t)));
   return max - shpool->pfree;
 }
+
+//ngx_slab.c keeps its page bookkeeping to itself
+#define SHM_SLAB_PAGE_MASK   3
+#define SHM_SLAB_PAGE        0
+#define SHM_SLAB_BIG         1
+#define SHM_SLAB_EXACT       2
+#define SHM_SLAB_SMALL       3
+
+#if (NGX_PTR_SIZE == 4)
+#define SHM_SLAB_PAGE_START  0x80000000
+#define SHM_SLAB_SHIFT_MASK  0x0000000f
+#define SHM_SLAB_MAP_MASK    0xffff0000
+#define SHM_SLAB_MAP_SHIFT   16
+#else
+#define SHM_SLAB_PAGE_START  0x8000000000000000
+#define SHM_SLAB_SHIFT_MASK  0x000000000000000f
+#define SHM_SLAB_MAP_MASK    0xffffffff00000000
+#define SHM_SLAB_MAP_SHIFT   32
+#endif
+
+static ngx_uint_t bits_set(uintptr_t v) {
+  ngx_uint_t   n = 0;
+  for(; v; v &= v - 1) {
+    n++;
+  }
+  return n;
+}
+
+static ngx_uint_t slab_exact_shift(void) {
+  //slots this size are tracked in the page's slab field
+  ngx_uint_t   n, shift = 0;
+  for(n = ngx_pagesize / (8 * sizeof(uintptr_t)); n >>= 1; shift++) { /*void*/ }
+  return shift;
+}
+
+//the slot size and usage of a page carved into slots. NGX_DECLINED for free pages and whole-page allocations
+static ngx_int_t slab_page_slots(ngx_slab_pool_t *shpool, ngx_slab_page_t *page, ngx_uint_t *shift, ngx_uint_t *used, ngx_uint_t *total) {
+  uintptr_t    *bitmap;
+  ngx_uint_t    i, n, map;
+  
+  switch(page->prev & SHM_SLAB_PAGE_MASK) {
+    case SHM_SLAB_SMALL:
+      *shift = page->slab & SHM_SLAB_SHIFT_MASK;
+      bitmap = (uintptr_t *)(shpool->start + ((page - shpool->pages) << ngx_pagesize_shift));
+      map = (ngx_pagesize >> *shift) / (8 * sizeof(uintptr_t));
+      //the bitmap itself takes up the first few slots, which are marked as used
+      n = (ngx_pagesize >> *shift) / ((1 << *shift) * 8);
+      if(n == 0) {
+        n = 1;
+      }
+      *used = 0;
+      for(i = 0; i < map; i++) {
+        *used += bits_set(bitmap[i]);
+      }
+      *used -= n;
+      *total = (ngx_pagesize >> *shift) - n;
+      return NGX_OK;
+    
+    case SHM_SLAB_EXACT:
+      *shift = slab_exact_shift();
+      *used = bits_set(page->slab);
+      *total = 8 * sizeof(uintptr_t);
+      return NGX_OK;
+    
+    case SHM_SLAB_BIG:
+      *shift = page->slab & SHM_SLAB_SHIFT_MASK;
+      *used = bits_set((page->slab & SHM_SLAB_MAP_MASK) >> SHM_SLAB_MAP_SHIFT);
+      *total = ngx_pagesize >> *shift;
+      return NGX_OK;
+    
+    default:
+      return NGX_DECLINED;
+  }
+}
+
+ngx_uint_t shm_slab_stats(shmem_t *shm, shm_slab_slot_stats_t *stats, ngx_uint_t max, shm_page_stats_t *pages) {
+  ngx_slab_pool_t    *shpool = SHPOOL(shm);
+  ngx_slab_page_t    *page;
+  ngx_uint_t          i, n = ngx_pagesize_shift - shpool->min_shift, run, shift, used, total;
+  
+  if(n > max) {
+    n = max;
+  }
+  ngx_memzero(pages, sizeof(*pages));
+  ngx_shmtx_lock(&shpool->mutex);
+  for(i = 0; i < n; i++) {
+    stats[i].size = (size_t )1 << (i + shpool->min_shift);
+    stats[i].total = shpool->stats[i].total;
+    stats[i].used = shpool->stats[i].used;
+    stats[i].reqs = shpool->stats[i].reqs;
+    stats[i].fails = shpool->stats[i].fails;
+    stats[i].pages = 0;
+    stats[i].partial_pages = 0;
+  }
+  
+  pages->total = shpool->last - shpool->pages;
+  for(page = shpool->pages; page < shpool->last; page += run) {
+    run = 1;
+    if(slab_page_slots(shpool, page, &shift, &used, &total) == NGX_OK) {
+      i = shift - shpool->min_shift;
+      if(i < n) {
+        stats[i].pages++;
+        //full pages are taken out of their slot size's list
+        if(page->next != NULL) {
+          stats[i].partial_pages++;
+        }
+      }
+    }
+    else if(page->slab & SHM_SLAB_PAGE_START) {
+      run = page->slab & ~SHM_SLAB_PAGE_START;
+      pages->whole += run;
+    }
+    else if(page->next != NULL && page->slab > 0) {
+      //the first page of a free run knows how long it is
+      run = page->slab;
+      pages->free += run;
+      if(run > pages->largest_free_run) {
+        pages->largest_free_run = run;
+      }
+    }
+  }
+  ngx_shmtx_unlock(&shpool->mutex);
+  return n;
+}
+
+ngx_int_t shm_page_fill(shmem_t *shm, void *p, shm_page_fill_t *fill) {
+  ngx_slab_pool_t    *shpool = SHPOOL(shm);
+  ngx_slab_page_t    *page;
+  ngx_uint_t          shift;
+  ngx_int_t           rc;
+  
+  if((u_char *)p < shpool->start || (u_char *)p >= shpool->end) {
+    return NGX_DECLINED;
+  }
+  page = &shpool->pages[((u_char *)p - shpool->start) >> ngx_pagesize_shift];
+  ngx_shmtx_lock(&shpool->mutex);
+  rc = slab_page_slots(shpool, page, &shift, &fill->used, &fill->total);
+  ngx_shmtx_unlock(&shpool->mutex);
+  if(rc != NGX_OK) {
+    return rc;
+  }
+  fill->page = shpool->start + ((page - shpool->pages) << ngx_pagesize_shift);
+  fill->size = (size_t )1 << shift;
+  return NGX_OK;
+}
 #endif
 
 ngx_int_t shm_init(shmem_t *shm) {
@@ -27,6 +27,36 @@ void              shm_verify_immutable_string(shmem_t *shm, ngx_str_t *str);
 void shm_set_allocd_pages_tracker(shmem_t *shm, ngx_atomic_uint_t *ptr);
 #else
 ngx_uint_t shm_used_pages(shmem_t *shm);
+
+typedef struct {
+  size_t                  size;
+  ngx_uint_t              total;
+  ngx_uint_t              used;
+  ngx_uint_t              reqs;
+  ngx_uint_t              fails;
+  ngx_uint_t              pages;          //pages split into slots of this size
+  ngx_uint_t              partial_pages;  //...that have some free slots
+} shm_slab_slot_stats_t;
+
+typedef struct {
+  ngx_uint_t              total;
+  ngx_uint_t              free;
+  ngx_uint_t              largest_free_run; //the most contiguous free pages, and so the largest allocation that can succeed
+  ngx_uint_t              whole;            //pages used by allocations bigger than half a page
+} shm_page_stats_t;
+
+//usage of each slab slot size, smallest first, and of the pages they're carved out of. returns how many slot sizes were written
+ngx_uint_t shm_slab_stats(shmem_t *shm, shm_slab_slot_stats_t *stats, ngx_uint_t max, shm_page_stats_t *pages);
+
+typedef struct {
+  void                   *page;           //the page's address
+  size_t                  size;           //slot size
+  ngx_uint_t              used;
+  ngx_uint_t              total;
+} shm_page_fill_t;
+
+//how full the page holding an allocation is. NGX_DECLINED if it's not in a slot page
+ngx_int_t shm_page_fill(shmem_t *shm, void *p, shm_page_fill_t *fill);
 #endif
 
 